@@ -63,7 +63,9 @@ struct {
     {"ab-eip", NULL, NULL, NULL, ab_tag_create},
     {"ab_eip", NULL, NULL, NULL, ab_tag_create},
     {"modbus-tcp", NULL, NULL, NULL, mb_tag_create},
-    {"modbus_tcp", NULL, NULL, NULL, mb_tag_create}
+    {"modbus_tcp", NULL, NULL, NULL, mb_tag_create},
+    {"modbus-rtu", NULL, NULL, NULL, mb_tag_create},
+    {"modbus_rtu", NULL, NULL, NULL, mb_tag_create}
 };
 
 static lock_t library_initialization_lock = LOCK_INIT;
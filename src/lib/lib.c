@@ -77,6 +77,7 @@ static int set_tag_byte_order(plc_tag_p tag, attr attribs);
 static int check_byte_order_str(const char* byte_order, int length);
 // static int get_string_count_size_unsafe(plc_tag_p tag, int offset);
 static int get_string_length_unsafe(plc_tag_p tag, int offset);
+static int get_member_info(int32_t id, const char *member_path, int *bit_num);
 // static int get_string_capacity_unsafe(plc_tag_p tag, int offset);
 // static int get_string_padding_unsafe(plc_tag_p tag, int offset);
 // static int get_string_total_length_unsafe(plc_tag_p tag, int offset);
@@ -860,6 +861,77 @@ LIB_EXPORT int plc_tag_unregister_callback(int32_t tag_id)
     return rc;
 }
 
+/*
+ * plc_tag_register_list_callback
+ *
+ * Hand tag listing entries to the callback as they arrive.  See the header
+ * for the details.
+ */
+
+LIB_EXPORT int plc_tag_register_list_callback(int32_t tag_id, void (*list_callback_func)(int32_t tag_id, uint32_t instance_id, uint16_t symbol_type, uint16_t element_length, const uint32_t *array_dims, const char *name))
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(tag_id);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if (!tag) {
+        pdebug(DEBUG_WARN, "Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex)
+    {
+        if (tag->list_callback) {
+            rc = PLCTAG_ERR_DUPLICATE;
+        } else {
+            rc = PLCTAG_STATUS_OK;
+            tag->list_callback = list_callback_func;
+        }
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+/*
+ * plc_tag_unregister_list_callback
+ *
+ * This function removes the list callback already registered on the tag.
+ */
+
+LIB_EXPORT int plc_tag_unregister_list_callback(int32_t tag_id)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(tag_id);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if (!tag) {
+        pdebug(DEBUG_WARN, "Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex)
+    {
+        if (tag->list_callback) {
+            rc = PLCTAG_STATUS_OK;
+            tag->list_callback = NULL;
+        } else {
+            rc = PLCTAG_ERR_NOT_FOUND;
+        }
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
 /*
  * plc_tag_register_logger
  *
@@ -1607,6 +1679,93 @@ LIB_EXPORT int plc_tag_set_int_attribute(int32_t id, const char* attrib_name, in
     return res;
 }
 
+int get_member_info(int32_t id, const char *member_path, int *bit_num)
+{
+    int res = PLCTAG_ERR_UNSUPPORTED;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if (!tag) {
+        pdebug(DEBUG_WARN, "Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if (!member_path || str_length(member_path) == 0) {
+        pdebug(DEBUG_WARN, "Member path must not be null or zero-length!");
+        rc_dec(tag);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    /* only AB tags have UDTs, the AB code checks the tag type. */
+    critical_block(tag->api_mutex)
+    {
+        res = ab_tag_get_member_offset(tag, member_path, bit_num);
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return res;
+}
+
+
+LIB_EXPORT int plc_tag_get_member_offset(int32_t id, const char *member_path)
+{
+    int bit_num = -1;
+
+    return get_member_info(id, member_path, &bit_num);
+}
+
+
+LIB_EXPORT int plc_tag_get_member_bit(int32_t id, const char *member_path)
+{
+    int bit_num = -1;
+    int rc = get_member_info(id, member_path, &bit_num);
+
+    if(rc < 0) {
+        return rc;
+    }
+
+    return (bit_num >= 0 ? bit_num : PLCTAG_ERR_UNSUPPORTED);
+}
+
+
+
+LIB_EXPORT int plc_tag_find_list_entry(int32_t id, const char *name, int symbol_type, int start_offset)
+{
+    int res = PLCTAG_ERR_UNSUPPORTED;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if (!tag) {
+        pdebug(DEBUG_WARN, "Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if (start_offset < 0) {
+        pdebug(DEBUG_WARN, "Start offset must not be negative!");
+        rc_dec(tag);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    /* only AB tags have tag listings, the AB code checks the tag type. */
+    critical_block(tag->api_mutex)
+    {
+        res = ab_tag_find_list_entry(tag, name, symbol_type, start_offset);
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return res;
+}
+
+
+
 LIB_EXPORT int plc_tag_get_size(int32_t id)
 {
     int result = 0;
@@ -1716,6 +1875,8 @@ LIB_EXPORT int plc_tag_set_bit(int32_t id, int offset_bit, int val)
                 tag->tag_is_dirty = 1;
             }
 
+            tag_mark_dirty(tag, real_offset / 8, 1);
+
             if (val) {
                 tag->data[real_offset / 8] |= (uint8_t)(1 << (real_offset % 8));
             } else {
@@ -1809,6 +1970,8 @@ LIB_EXPORT int plc_tag_set_uint64(int32_t id, int offset, uint64_t val)
                     tag->tag_is_dirty = 1;
                 }
 
+                tag_mark_dirty(tag, offset, (int)sizeof(uint64_t));
+
                 tag->data[offset + tag->byte_order->int64_order[0]] = (uint8_t)((val >> 0) & 0xFF);
                 tag->data[offset + tag->byte_order->int64_order[1]] = (uint8_t)((val >> 8) & 0xFF);
                 tag->data[offset + tag->byte_order->int64_order[2]] = (uint8_t)((val >> 16) & 0xFF);
@@ -1913,6 +2076,8 @@ LIB_EXPORT int plc_tag_set_int64(int32_t id, int offset, int64_t ival)
                     tag->tag_is_dirty = 1;
                 }
 
+                tag_mark_dirty(tag, offset, (int)sizeof(int64_t));
+
                 tag->data[offset + tag->byte_order->int64_order[0]] = (uint8_t)((val >> 0) & 0xFF);
                 tag->data[offset + tag->byte_order->int64_order[1]] = (uint8_t)((val >> 8) & 0xFF);
                 tag->data[offset + tag->byte_order->int64_order[2]] = (uint8_t)((val >> 16) & 0xFF);
@@ -2016,6 +2181,8 @@ LIB_EXPORT int plc_tag_set_uint32(int32_t id, int offset, uint32_t val)
                     tag->tag_is_dirty = 1;
                 }
 
+                tag_mark_dirty(tag, offset, (int)sizeof(uint32_t));
+
                 tag->data[offset + tag->byte_order->int32_order[0]] = (uint8_t)((val >> 0) & 0xFF);
                 tag->data[offset + tag->byte_order->int32_order[1]] = (uint8_t)((val >> 8) & 0xFF);
                 tag->data[offset + tag->byte_order->int32_order[2]] = (uint8_t)((val >> 16) & 0xFF);
@@ -2116,6 +2283,8 @@ LIB_EXPORT int plc_tag_set_int32(int32_t id, int offset, int32_t ival)
                     tag->tag_is_dirty = 1;
                 }
 
+                tag_mark_dirty(tag, offset, (int)sizeof(int32_t));
+
                 tag->data[offset + tag->byte_order->int32_order[0]] = (uint8_t)((val >> 0) & 0xFF);
                 tag->data[offset + tag->byte_order->int32_order[1]] = (uint8_t)((val >> 8) & 0xFF);
                 tag->data[offset + tag->byte_order->int32_order[2]] = (uint8_t)((val >> 16) & 0xFF);
@@ -2215,6 +2384,8 @@ LIB_EXPORT int plc_tag_set_uint16(int32_t id, int offset, uint16_t val)
                     tag->tag_is_dirty = 1;
                 }
 
+                tag_mark_dirty(tag, offset, (int)sizeof(uint16_t));
+
                 tag->data[offset + tag->byte_order->int16_order[0]] = (uint8_t)((val >> 0) & 0xFF);
                 tag->data[offset + tag->byte_order->int16_order[1]] = (uint8_t)((val >> 8) & 0xFF);
 
@@ -2312,6 +2483,8 @@ LIB_EXPORT int plc_tag_set_int16(int32_t id, int offset, int16_t ival)
                     tag->tag_is_dirty = 1;
                 }
 
+                tag_mark_dirty(tag, offset, (int)sizeof(int16_t));
+
                 tag->data[offset + tag->byte_order->int16_order[0]] = (uint8_t)((val >> 0) & 0xFF);
                 tag->data[offset + tag->byte_order->int16_order[1]] = (uint8_t)((val >> 8) & 0xFF);
 
@@ -2408,6 +2581,8 @@ LIB_EXPORT int plc_tag_set_uint8(int32_t id, int offset, uint8_t val)
                     tag->tag_is_dirty = 1;
                 }
 
+                tag_mark_dirty(tag, offset, (int)sizeof(uint8_t));
+
                 tag->data[offset] = val;
 
                 tag->status = PLCTAG_STATUS_OK;
@@ -2504,6 +2679,8 @@ LIB_EXPORT int plc_tag_set_int8(int32_t id, int offset, int8_t ival)
                     tag->tag_is_dirty = 1;
                 }
 
+                tag_mark_dirty(tag, offset, (int)sizeof(int8_t));
+
                 tag->data[offset] = val;
 
                 tag->status = PLCTAG_STATUS_OK;
@@ -2617,6 +2794,8 @@ LIB_EXPORT int plc_tag_set_float64(int32_t id, int offset, double fval)
                 tag->tag_is_dirty = 1;
             }
 
+            tag_mark_dirty(tag, offset, (int)sizeof(uint64_t));
+
             tag->data[offset + tag->byte_order->float64_order[0]] = (uint8_t)((val >> 0) & 0xFF);
             tag->data[offset + tag->byte_order->float64_order[1]] = (uint8_t)((val >> 8) & 0xFF);
             tag->data[offset + tag->byte_order->float64_order[2]] = (uint8_t)((val >> 16) & 0xFF);
@@ -2730,6 +2909,8 @@ LIB_EXPORT int plc_tag_set_float32(int32_t id, int offset, float fval)
                 tag->tag_is_dirty = 1;
             }
 
+            tag_mark_dirty(tag, offset, (int)sizeof(uint32_t));
+
             tag->data[offset + tag->byte_order->float32_order[0]] = (uint8_t)((val >> 0) & 0xFF);
             tag->data[offset + tag->byte_order->float32_order[1]] = (uint8_t)((val >> 8) & 0xFF);
             tag->data[offset + tag->byte_order->float32_order[2]] = (uint8_t)((val >> 16) & 0xFF);
@@ -2928,6 +3109,10 @@ LIB_EXPORT int plc_tag_set_string(int32_t tag_id, int string_start_offset, const
                 if (rc == PLCTAG_STATUS_OK && tag->auto_sync_write_ms > 0) {
                     tag->tag_is_dirty = 1;
                 }
+
+                if (rc == PLCTAG_STATUS_OK) {
+                    tag_mark_dirty(tag, string_start_offset, (int)(tag->byte_order->str_count_word_bytes) + string_capacity + 1);
+                }
             } else {
                 pdebug(DEBUG_WARN, "Writing the full string would go out of bounds in the tag buffer!");
                 rc = PLCTAG_ERR_OUT_OF_BOUNDS;
@@ -3129,6 +3314,8 @@ LIB_EXPORT int plc_tag_set_raw_bytes(int32_t id, int offset, uint8_t* buffer, in
                     tag->tag_is_dirty = 1;
                 }
 
+                tag_mark_dirty(tag, offset, buffer_size);
+
                 int i;
                 for (i = 0; i < buffer_size; i++) {
                     tag->data[offset + i] = buffer[i];
@@ -3764,6 +3951,80 @@ int get_string_length_unsafe(plc_tag_p tag, int offset)
     return string_length;
 }
 
+
+
+/*
+ * tag_mark_dirty
+ *
+ * Record that the setters changed some bytes of the tag data so that
+ * protocols can write only the changed parts.  Ranges that overlap or are
+ * close together are merged since sending the few bytes between them is
+ * cheaper than another request.  If there are too many ranges, the two
+ * closest are merged.
+ *
+ * This must be called with the tag API mutex held!
+ */
+
+void tag_mark_dirty(plc_tag_p tag, int offset, int length)
+{
+    int start = offset;
+    int end = offset + length;
+    int index = 0;
+
+    if (start < 0) {
+        start = 0;
+    }
+
+    if (end > tag->size) {
+        end = tag->size;
+    }
+
+    if (start >= end) {
+        return;
+    }
+
+    /* absorb every range that overlaps or is close to the new one. */
+    while (index < tag->dirty_count) {
+        struct tag_dirty_range_t *range = &tag->dirty_ranges[index];
+
+        if (range->start <= end + DIRTY_RANGE_MERGE_GAP && start <= range->end + DIRTY_RANGE_MERGE_GAP) {
+            start = (range->start < start ? range->start : start);
+            end = (range->end > end ? range->end : end);
+
+            tag->dirty_count--;
+            mem_move(range, range + 1, (tag->dirty_count - index) * (int)sizeof(*range));
+        } else {
+            index++;
+        }
+    }
+
+    /* make room by merging the two closest ranges. */
+    if (tag->dirty_count == MAX_DIRTY_RANGES) {
+        int closest = 0;
+
+        for (int i = 1; i < tag->dirty_count - 1; i++) {
+            if (tag->dirty_ranges[i + 1].start - tag->dirty_ranges[i].end < tag->dirty_ranges[closest + 1].start - tag->dirty_ranges[closest].end) {
+                closest = i;
+            }
+        }
+
+        tag->dirty_ranges[closest].end = tag->dirty_ranges[closest + 1].end;
+        tag->dirty_count--;
+        mem_move(&tag->dirty_ranges[closest + 1], &tag->dirty_ranges[closest + 2], (tag->dirty_count - closest - 1) * (int)sizeof(struct tag_dirty_range_t));
+    }
+
+    /* keep the ranges in order. */
+    index = 0;
+    while (index < tag->dirty_count && tag->dirty_ranges[index].start < start) {
+        index++;
+    }
+
+    mem_move(&tag->dirty_ranges[index + 1], &tag->dirty_ranges[index], (tag->dirty_count - index) * (int)sizeof(struct tag_dirty_range_t));
+    tag->dirty_ranges[index].start = start;
+    tag->dirty_ranges[index].end = end;
+    tag->dirty_count++;
+}
+
 /*
  * get the string capacity depending on the PLC string type.
  *
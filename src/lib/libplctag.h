@@ -281,6 +281,47 @@ LIB_EXPORT int plc_tag_unregister_callback(int32_t tag_id);
 
 
 
+
+
+
+/*
+ * plc_tag_register_list_callback
+ *
+ * Stream the entries of a tag listing ("@tags" or "Program:<name>.@tags")
+ * to a callback as each response from the PLC arrives, instead of collecting
+ * the whole listing in the tag buffer.  The callback gets the symbol instance
+ * ID, the symbol type, the element size in bytes, the three array dimensions
+ * and the zero terminated name of each entry.  The tag buffer is not filled
+ * while a list callback is registered, so memory use does not grow with the
+ * size of the listing.
+ *
+ * The callback is called while the internal tag mutex is held.  Do not call
+ * any tag functions from it, copy out what is needed and return quickly.
+ * The name and dimension pointers are only valid during the call.
+ *
+ * Return values:
+ *
+ * PLCTAG_ERR_DUPLICATE if there is already a list callback on the tag,
+ * otherwise PLCTAG_STATUS_OK.
+ */
+
+LIB_EXPORT int plc_tag_register_list_callback(int32_t tag_id, void (*list_callback_func)(int32_t tag_id, uint32_t instance_id, uint16_t symbol_type, uint16_t element_length, const uint32_t *array_dims, const char *name));
+
+
+
+/*
+ * plc_tag_unregister_list_callback
+ *
+ * Remove the list callback from the tag.  Later reads of the listing fill
+ * the tag buffer again.
+ *
+ * PLCTAG_ERR_NOT_FOUND is returned if there was no list callback.
+ */
+
+LIB_EXPORT int plc_tag_unregister_list_callback(int32_t tag_id);
+
+
+
 /*
  * plc_tag_register_logger
  *
@@ -440,6 +481,42 @@ LIB_EXPORT int plc_tag_set_int_attribute(int32_t tag, const char *attrib_name, i
 
 LIB_EXPORT int plc_tag_get_size(int32_t tag);
 
+/*
+ * UDT members.
+ *
+ * Map a member path, like "Motor.Status[3]", to a byte offset in the
+ * tag's data so that a UDT can be read once and its members decoded
+ * locally.  The tag must have been read, and the UDT's template (and
+ * any nested templates) must have been read on the same connection
+ * with a "@udt/<id>" tag.  A path may start with an index, "[2].Speed",
+ * for arrays of the UDT.  Errors are returned as negative PLCTAG_ERR_xyz
+ * values.
+ *
+ * plc_tag_get_member_bit() returns the bit number within the byte at
+ * the member's offset for BOOL members, elements of BOOL arrays and
+ * bits of integer members ("Count.3").  It returns PLCTAG_ERR_UNSUPPORTED
+ * for other members.
+ */
+LIB_EXPORT int plc_tag_get_member_offset(int32_t tag, const char *member_path);
+LIB_EXPORT int plc_tag_get_member_bit(int32_t tag, const char *member_path);
+
+/*
+ * Tag listings.
+ *
+ * Search the data of a "@tags", "Program:<name>.@tags" or "@discover"
+ * tag after it has been read.  A "@discover" tag lists the controller
+ * tags and the tags of every program in one read, with program tags
+ * named "Program:<name>.<tag>".  The listings for the programs are sent
+ * at the same time on the tag's connection.
+ *
+ * Returns the byte offset in the tag data of the first entry at or after
+ * start_offset whose name matches (case-insensitive) and whose symbol
+ * type matches.  A NULL name or a negative symbol type matches any entry,
+ * so all entries of a type can be found by calling again with the last
+ * offset plus one.  Returns PLCTAG_ERR_NOT_FOUND if there is no match.
+ */
+LIB_EXPORT int plc_tag_find_list_entry(int32_t tag, const char *name, int symbol_type, int start_offset);
+
 LIB_EXPORT int plc_tag_get_bit(int32_t tag, int offset_bit);
 LIB_EXPORT int plc_tag_set_bit(int32_t tag, int offset_bit, int val);
 
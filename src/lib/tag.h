@@ -96,6 +96,19 @@ struct tag_byte_order_s {
 typedef struct tag_byte_order_s tag_byte_order_t;
 
 
+/*
+ * Byte ranges of the tag data changed since the last write, in order.
+ * Ranges closer than the merge gap are kept as one.
+ */
+#define MAX_DIRTY_RANGES (8)
+#define DIRTY_RANGE_MERGE_GAP (32)
+
+struct tag_dirty_range_t {
+    int start;
+    int end;
+};
+
+
 
 
 /*
@@ -123,10 +136,13 @@ typedef struct tag_byte_order_s tag_byte_order_t;
                         mutex_p api_mutex; \
                         tag_vtable_p vtable; \
                         void (*callback)(int32_t tag_id, int event, int status); \
+                        void (*list_callback)(int32_t tag_id, uint32_t instance_id, uint16_t symbol_type, uint16_t element_length, const uint32_t *array_dims, const char *name); \
                         int64_t read_cache_expire; \
                         int64_t read_cache_ms; \
                         int64_t auto_sync_next_read; \
-                        int64_t auto_sync_next_write
+                        int64_t auto_sync_next_write; \
+                        int dirty_count; \
+                        struct tag_dirty_range_t dirty_ranges[MAX_DIRTY_RANGES]
 
 
 
@@ -143,3 +159,6 @@ extern void lib_teardown(void);
 extern int plc_tag_abort_mapped(plc_tag_p tag);
 extern int plc_tag_destroy_mapped(plc_tag_p tag);
 extern int plc_tag_status_mapped(plc_tag_p tag);
+
+/* must be called with the tag API mutex held. */
+extern void tag_mark_dirty(plc_tag_p tag, int offset, int length);
@@ -51,6 +51,8 @@
 #include <netdb.h>
 #include <fcntl.h>
 #include <time.h>
+#include <termios.h>
+#include <sys/select.h>
 
 #include <lib/libplctag.h>
 #include <util/debug.h>
@@ -1250,6 +1252,296 @@ extern int socket_destroy(sock_p *s)
 
 
 
+/***************************************************************************
+ ****************************** Serial Port ********************************
+ **************************************************************************/
+
+
+struct serial_port_t {
+    int fd;
+    struct termios old_tio;
+};
+
+
+static speed_t baud_to_speed(int baud_rate)
+{
+    switch(baud_rate) {
+        case 110: return B110;
+        case 300: return B300;
+        case 600: return B600;
+        case 1200: return B1200;
+        case 2400: return B2400;
+        case 4800: return B4800;
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        default: return B0;
+    }
+}
+
+
+/*
+ * plc_lib_open_serial_port
+ *
+ * Open the serial device in raw, non-blocking mode.  The parity type is
+ * 0 for none, 1 for odd and 2 for even, the same as on Windows.  The old
+ * terminal settings are put back when the port is closed.
+ */
+
+serial_port_p plc_lib_open_serial_port(const char *path, int baud_rate, int data_bits, int stop_bits, int parity_type)
+{
+    serial_port_p serial_port = NULL;
+    struct termios tio;
+    speed_t speed = baud_to_speed(baud_rate);
+    tcflag_t cflag = CLOCAL | CREAD;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!path) {
+        pdebug(DEBUG_WARN, "Serial port path is NULL!");
+        return NULL;
+    }
+
+    if(speed == B0) {
+        pdebug(DEBUG_WARN, "Unsupported baud rate %d!", baud_rate);
+        return NULL;
+    }
+
+    switch(data_bits) {
+        case 5: cflag |= CS5; break;
+        case 6: cflag |= CS6; break;
+        case 7: cflag |= CS7; break;
+        case 8: cflag |= CS8; break;
+        default:
+            pdebug(DEBUG_WARN, "Unsupported number of data bits %d!", data_bits);
+            return NULL;
+    }
+
+    switch(stop_bits) {
+        case 1: break;
+        case 2: cflag |= CSTOPB; break;
+        default:
+            pdebug(DEBUG_WARN, "Unsupported number of stop bits %d!", stop_bits);
+            return NULL;
+    }
+
+    switch(parity_type) {
+        case 0: break;
+        case 1: cflag |= PARENB | PARODD; break;
+        case 2: cflag |= PARENB; break;
+        default:
+            pdebug(DEBUG_WARN, "Unsupported parity type %d!", parity_type);
+            return NULL;
+    }
+
+    serial_port = mem_alloc((int)sizeof(struct serial_port_t));
+    if(!serial_port) {
+        pdebug(DEBUG_ERROR, "Unable to allocate serial port struct!");
+        return NULL;
+    }
+
+    serial_port->fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if(serial_port->fd < 0) {
+        pdebug(DEBUG_WARN, "Error %d opening serial device %s!", errno, path);
+        mem_free(serial_port);
+        return NULL;
+    }
+
+    if(tcgetattr(serial_port->fd, &serial_port->old_tio) < 0) {
+        pdebug(DEBUG_WARN, "Error %d getting serial port configuration of %s!", errno, path);
+        close(serial_port->fd);
+        mem_free(serial_port);
+        return NULL;
+    }
+
+    /* raw mode, no flow control, reads return whatever is there. */
+    mem_set(&tio, 0, (int)sizeof(tio));
+    tio.c_cflag = cflag;
+    tio.c_iflag = (parity_type ? INPCK : IGNPAR);
+    tio.c_oflag = 0;
+    tio.c_lflag = 0;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+
+    if(tcsetattr(serial_port->fd, TCSANOW, &tio) < 0) {
+        pdebug(DEBUG_WARN, "Error %d setting serial port configuration of %s!", errno, path);
+        close(serial_port->fd);
+        mem_free(serial_port);
+        return NULL;
+    }
+
+    tcflush(serial_port->fd, TCIOFLUSH);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return serial_port;
+}
+
+
+
+
+int plc_lib_close_serial_port(serial_port_p serial_port)
+{
+    if(!serial_port) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(serial_port->fd >= 0) {
+        tcsetattr(serial_port->fd, TCSANOW, &serial_port->old_tio);
+        close(serial_port->fd);
+        serial_port->fd = -1;
+    }
+
+    mem_free(serial_port);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+/*
+ * plc_lib_serial_port_read
+ *
+ * The port is non-blocking.  Returns the number of bytes read, zero if
+ * there was nothing waiting, or an error.
+ */
+
+int plc_lib_serial_port_read(serial_port_p serial_port, uint8_t *data, int size)
+{
+    int rc;
+
+    if(!serial_port || !data) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    rc = (int)read(serial_port->fd, data, (size_t)size);
+
+    if(rc < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+
+        pdebug(DEBUG_WARN, "Serial port read error: rc=%d, errno=%d", rc, errno);
+        return PLCTAG_ERR_READ;
+    }
+
+    return rc;
+}
+
+
+int plc_lib_serial_port_write(serial_port_p serial_port, uint8_t *data, int size)
+{
+    int rc;
+
+    if(!serial_port || !data) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    rc = (int)write(serial_port->fd, data, (size_t)size);
+
+    if(rc < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+
+        pdebug(DEBUG_WARN, "Serial port write error: rc=%d, errno=%d", rc, errno);
+        return PLCTAG_ERR_WRITE;
+    }
+
+    return rc;
+}
+
+
+/*
+ * plc_lib_serial_port_wait
+ *
+ * Block until there is data to read or the timeout, in microseconds,
+ * runs out.  Returns 1 if there is data, 0 on timeout.  Serial framing
+ * like Modbus RTU depends on gaps of a few character times, so this
+ * needs finer resolution than sleep_ms().
+ */
+
+int plc_lib_serial_port_wait(serial_port_p serial_port, int timeout_us)
+{
+    fd_set read_set;
+    struct timeval tv;
+    int rc;
+
+    if(!serial_port) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(timeout_us < 0) {
+        timeout_us = 0;
+    }
+
+    FD_ZERO(&read_set);
+    FD_SET(serial_port->fd, &read_set);
+
+    tv.tv_sec = timeout_us / 1000000;
+    tv.tv_usec = timeout_us % 1000000;
+
+    rc = select(serial_port->fd + 1, &read_set, NULL, NULL, &tv);
+
+    if(rc < 0) {
+        if(errno == EINTR) {
+            return 0;
+        }
+
+        pdebug(DEBUG_WARN, "Serial port select error: errno=%d", errno);
+        return PLCTAG_ERR_READ;
+    }
+
+    return (rc > 0 ? 1 : 0);
+}
+
+
+
+
+
+
+
+
+/***************************************************************************
+ ****************************** File Handling ******************************
+ **************************************************************************/
+
+
+/*
+ * file_replace
+ *
+ * Move a file over another one.  rename() replaces the destination in
+ * one step, so readers see either the old file or the new one.
+ */
+
+int file_replace(const char *src_name, const char *dest_name)
+{
+    if(!src_name || !dest_name) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(rename(src_name, dest_name) != 0) {
+        pdebug(DEBUG_WARN, "Unable to rename %s to %s, errno=%d!", src_name, dest_name, errno);
+        return PLCTAG_ERR_WRITE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+
+
+
+
 /***************************************************************************
  ***************************** Miscellaneous *******************************
  **************************************************************************/
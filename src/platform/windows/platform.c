@@ -1322,6 +1322,11 @@ struct serial_port_t {
     HANDLE hSerialPort;
     COMMCONFIG oldDCBSerialParams;
     COMMTIMEOUTS oldTimeouts;
+    COMMTIMEOUTS readTimeouts;
+
+    /* a byte picked up while waiting, returned by the next read. */
+    int hasWaitByte;
+    uint8_t waitByte;
 };
 
 
@@ -1513,6 +1518,9 @@ serial_port_p plc_lib_open_serial_port(/*plc_lib lib,*/ const char *path, int ba
         return NULL;
     }
 
+    serial_port->hSerialPort = hSerialPort;
+    serial_port->readTimeouts = timeouts;
+
     return serial_port;
 }
 
@@ -1550,13 +1558,31 @@ int plc_lib_serial_port_read(serial_port_p serial_port, uint8_t *data, int size)
 {
     DWORD numBytesRead = 0;
     BOOL rc;
+    int waitBytes = 0;
+
+    if(size <= 0) {
+        return 0;
+    }
+
+    /* hand back the byte that plc_lib_serial_port_wait() read first. */
+    if(serial_port->hasWaitByte) {
+        *data = serial_port->waitByte;
+        serial_port->hasWaitByte = 0;
+        data++;
+        size--;
+        waitBytes = 1;
+
+        if(size == 0) {
+            return waitBytes;
+        }
+    }
 
     rc = ReadFile(serial_port->hSerialPort,(LPVOID)data,(DWORD)size,&numBytesRead,NULL);
 
     if(rc != TRUE)
-        return -1;
+        return (waitBytes ? waitBytes : -1);
 
-    return (int)numBytesRead;
+    return (int)numBytesRead + waitBytes;
 }
 
 
@@ -1571,6 +1597,98 @@ int plc_lib_serial_port_write(serial_port_p serial_port, uint8_t *data, int size
 }
 
 
+/*
+ * plc_lib_serial_port_wait
+ *
+ * Wait until there is data to read or the timeout, in microseconds, runs
+ * out.  Returns 1 if there is data, 0 on timeout.  The port is not opened
+ * for overlapped I/O, so this blocks in a one byte ReadFile() with a
+ * timeout and keeps the byte for the next read.  Comm timeouts are in
+ * milliseconds, so the wait is rounded up.
+ */
+
+int plc_lib_serial_port_wait(serial_port_p serial_port, int timeout_us)
+{
+    COMMTIMEOUTS timeouts;
+    DWORD numBytesRead = 0;
+    BOOL rc;
+
+    if(!serial_port) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(serial_port->hasWaitByte) {
+        return 1;
+    }
+
+    if(timeout_us < 0) {
+        timeout_us = 0;
+    }
+
+    /* return as soon as one byte is in, or fail after the constant. */
+    timeouts = serial_port->readTimeouts;
+    timeouts.ReadIntervalTimeout = MAXDWORD;
+    timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+    timeouts.ReadTotalTimeoutConstant = (DWORD)((timeout_us + 999) / 1000);
+
+    /* the MAXDWORD multiplier needs a constant above zero, no wait is a plain non-blocking read. */
+    if(timeouts.ReadTotalTimeoutConstant == 0) {
+        timeouts.ReadTotalTimeoutMultiplier = 0;
+    }
+
+    if(!SetCommTimeouts(serial_port->hSerialPort, &timeouts)) {
+        return PLCTAG_ERR_READ;
+    }
+
+    rc = ReadFile(serial_port->hSerialPort, (LPVOID)&(serial_port->waitByte), 1, &numBytesRead, NULL);
+
+    if(rc == TRUE && numBytesRead == 1) {
+        serial_port->hasWaitByte = 1;
+    }
+
+    /* reads after this must not block. */
+    if(!SetCommTimeouts(serial_port->hSerialPort, &(serial_port->readTimeouts)) || rc != TRUE) {
+        return PLCTAG_ERR_READ;
+    }
+
+    return serial_port->hasWaitByte;
+}
+
+
+
+
+
+
+
+
+
+
+
+/***************************************************************************
+ ****************************** File Handling ******************************
+ **************************************************************************/
+
+
+/*
+ * file_replace
+ *
+ * Move a file over another one.  rename() fails on Windows if the
+ * destination exists, so this uses MoveFileEx() to replace it.
+ */
+
+int file_replace(const char *src_name, const char *dest_name)
+{
+    if(!src_name || !dest_name) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!MoveFileExA(src_name, dest_name, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        pdebug(DEBUG_WARN, "Unable to move %s to %s, error %d!", src_name, dest_name, (int)GetLastError());
+        return PLCTAG_ERR_WRITE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
 
 
 
@@ -252,6 +252,10 @@ extern serial_port_p plc_lib_open_serial_port(const char *path, int baud_rate, i
 extern int plc_lib_close_serial_port(serial_port_p serial_port);
 extern int plc_lib_serial_port_read(serial_port_p serial_port, uint8_t *data, int size);
 extern int plc_lib_serial_port_write(serial_port_p serial_port, uint8_t *data, int size);
+extern int plc_lib_serial_port_wait(serial_port_p serial_port, int timeout_us);
+
+/* file handling */
+extern int file_replace(const char *src_name, const char *dest_name);
 
 
 /* time functions */
@@ -42,6 +42,8 @@
 void ab_teardown(void);
 int ab_init();
 plc_tag_p ab_tag_create(attr attribs);
+int ab_tag_get_member_offset(plc_tag_p tag, const char *member_path, int *bit_num);
+int ab_tag_find_list_entry(plc_tag_p tag, const char *name, int symbol_type, int start_offset);
 
 
 #endif
@@ -206,18 +206,21 @@ plc_tag_p ab_tag_create(attr attribs)
     /* set up any required settings based on the cpu type. */
     switch(tag->plc_type) {
     case AB_PLC_PLC5:
+        /* packing is off by default, not all of these PLCs support Multiple Service Packets. */
         tag->use_connected_msg = 0;
-        tag->allow_packing = 0;
+        tag->allow_packing = attr_get_int(attribs, "allow_packing", 0);
         break;
 
     case AB_PLC_SLC:
+        /* packing is off by default, not all of these PLCs support Multiple Service Packets. */
         tag->use_connected_msg = 0;
-        tag->allow_packing = 0;
+        tag->allow_packing = attr_get_int(attribs, "allow_packing", 0);
         break;
 
     case AB_PLC_MLGX:
+        /* packing is off by default, not all of these PLCs support Multiple Service Packets. */
         tag->use_connected_msg = 0;
-        tag->allow_packing = 0;
+        tag->allow_packing = attr_get_int(attribs, "allow_packing", 0);
         break;
 
     case AB_PLC_LGX_PCCC:
@@ -294,12 +297,12 @@ plc_tag_p ab_tag_create(attr attribs)
         } else {
             pdebug(DEBUG_DETAIL, "Setting up PLC/5 via DH+ bridge tag.");
             tag->use_connected_msg = 1;
+            tag->allow_packing = 0;
             tag->vtable = &eip_plc5_dhp_vtable;
         }
 
         tag->byte_order = &plc5_tag_byte_order;
 
-        tag->allow_packing = 0;
         break;
 
     case AB_PLC_SLC:
@@ -316,12 +319,12 @@ plc_tag_p ab_tag_create(attr attribs)
         } else {
             pdebug(DEBUG_DETAIL, "Setting up SLC/MicroLogix via DH+ bridge tag.");
             tag->use_connected_msg = 1;
+            tag->allow_packing = 0;
             tag->vtable = &eip_slc_dhp_vtable;
         }
 
         tag->byte_order = &slc_tag_byte_order;
 
-        tag->allow_packing = 0;
         break;
 
     case AB_PLC_LGX_PCCC:
@@ -344,7 +347,7 @@ plc_tag_p ab_tag_create(attr attribs)
             return (plc_tag_p)tag;
         }
 
-        if(!tag->tag_list) {
+        if(!tag->tag_list && !tag->udt_tag) {
             tag->byte_order = &logix_tag_byte_order;
         } else {
             tag->byte_order = &logix_tag_listing_byte_order;
@@ -353,6 +356,7 @@ plc_tag_p ab_tag_create(attr attribs)
         /* default to requiring a connection. */
         tag->use_connected_msg = attr_get_int(attribs,"use_connected_msg", 1);
         tag->allow_packing = attr_get_int(attribs, "allow_packing", 1);
+        tag->resolve_symbol = (!tag->tag_list && !tag->udt_tag && attr_get_int(attribs, "use_symbol_instance", 0));
         tag->vtable = &eip_cip_vtable;
 
         break;
@@ -444,11 +448,29 @@ plc_tag_p ab_tag_create(attr attribs)
         break;
     }
 
+    /* read only some parts of an array? */
+    if(attr_get_str(attribs, "ranges", NULL)) {
+        int rc = PLCTAG_STATUS_OK;
+
+        if(tag->plc_type != AB_PLC_LGX || !tag->use_connected_msg || tag->tag_list || tag->udt_tag) {
+            pdebug(DEBUG_WARN, "Range reads are only supported for connected Logix data tags!");
+            tag->status = PLCTAG_ERR_UNSUPPORTED;
+            return (plc_tag_p)tag;
+        }
+
+        rc = setup_read_ranges(tag, attr_get_str(attribs, "ranges", NULL));
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to set up range reads!");
+            tag->status = (int8_t)rc;
+            return (plc_tag_p)tag;
+        }
+    }
+
     /*
      * check the tag name, this is protocol specific.
      */
 
-    if(!tag->tag_list && check_tag_name(tag, attr_get_str(attribs,"name",NULL)) != PLCTAG_STATUS_OK) {
+    if(!tag->tag_list && !tag->udt_tag && check_tag_name(tag, attr_get_str(attribs,"name",NULL)) != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_INFO,"Bad tag name!");
         tag->status = PLCTAG_ERR_BAD_PARAM;
         return (plc_tag_p)tag;
@@ -639,6 +661,11 @@ int get_tag_data_type(ab_tag_p tag, attr attribs)
                         pdebug(DEBUG_WARN, "Error parsing tag listing name!");
                         return PLCTAG_ERR_BAD_PARAM;
                     }
+
+                    if(tag_listing_rc == PLCTAG_ERR_NOT_FOUND && setup_udt_tag(tag, tmp_tag_name) == PLCTAG_ERR_BAD_PARAM) {
+                        pdebug(DEBUG_WARN, "Error parsing UDT template tag name!");
+                        return PLCTAG_ERR_BAD_PARAM;
+                    }
                 }
 
                 /* if we did not set an element size yet, set one. */
@@ -745,10 +772,13 @@ int ab_tag_abort(ab_tag_p tag)
         }
 
         tag->req = rc_dec(tag->req);
-    } else {
+    } else if(!tag->frag_count && !tag->listing_count) {
         pdebug(DEBUG_DETAIL, "Called without a request in flight.");
     }
 
+    ab_tag_release_frags(tag);
+    ab_tag_release_listings(tag);
+
     tag->read_in_progress = 0;
     tag->write_in_progress = 0;
     tag->offset = 0;
@@ -760,6 +790,232 @@ int ab_tag_abort(ab_tag_p tag)
 
 
 
+/*
+ * ab_tag_release_frags
+ *
+ * Abort and release any fragment requests of a parallel read or write.
+ */
+
+void ab_tag_release_frags(ab_tag_p tag)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    for(int i=0; i < tag->frag_count; i++) {
+        if(tag->frags[i].req) {
+            spin_block(&tag->frags[i].req->lock) {
+                tag->frags[i].req->abort_request = 1;
+            }
+
+            tag->frags[i].req = rc_dec(tag->frags[i].req);
+        }
+    }
+
+    if(tag->frags) {
+        mem_free(tag->frags);
+        tag->frags = NULL;
+    }
+
+    tag->frag_count = 0;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+
+/*
+ * ab_tag_start_elem_frags
+ *
+ * Split a tag that does not fit in one PCCC packet into chunks on element
+ * boundaries and queue a request for every chunk at once.  The build
+ * function creates and queues the request for one chunk and stores it in
+ * the fragment.
+ */
+
+int ab_tag_start_elem_frags(ab_tag_p tag, int data_per_packet, ab_frag_build_func build_func)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int elem_size = tag->elem_size;
+    int elems_per_frag = 0;
+    int frag_count = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(elem_size > 0) {
+        elems_per_frag = data_per_packet / elem_size;
+    }
+
+    if(elems_per_frag <= 0 || (tag->size % elem_size) != 0) {
+        pdebug(DEBUG_WARN, "Unable to split tag of %d bytes into chunks of %d bytes on %d byte element boundaries!", tag->size, data_per_packet, elem_size);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    frag_count = ((tag->size / elem_size) + elems_per_frag - 1) / elems_per_frag;
+
+    tag->frags = mem_alloc(frag_count * (int)sizeof(struct ab_frag_t));
+    if(!tag->frags) {
+        pdebug(DEBUG_WARN, "Unable to allocate fragment array!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->frag_count = frag_count;
+
+    for(int i=0; i < frag_count && rc == PLCTAG_STATUS_OK; i++) {
+        struct ab_frag_t *frag = &tag->frags[i];
+
+        frag->plc_offset = i * elems_per_frag;
+        frag->elem_count = (tag->size / elem_size) - frag->plc_offset;
+
+        if(frag->elem_count > elems_per_frag) {
+            frag->elem_count = elems_per_frag;
+        }
+
+        frag->offset = frag->plc_offset * elem_size;
+        frag->size = frag->elem_count * elem_size;
+
+        rc = build_func(tag, frag);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to queue chunk requests, %s!", plc_tag_decode_error(rc));
+        ab_tag_release_frags(tag);
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done.  Queued %d chunks of up to %d elements.", frag_count, elems_per_frag);
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+
+/*
+ * ab_tag_check_elem_frags
+ *
+ * Hand each chunk response to the decode function as it arrives, in any
+ * order.  Returns pending until all chunks are done.  Any failure aborts
+ * the rest.
+ */
+
+int ab_tag_check_elem_frags(ab_tag_p tag, ab_frag_decode_func decode_func)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int pending = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    for(int i=0; i < tag->frag_count && rc == PLCTAG_STATUS_OK; i++) {
+        struct ab_frag_t *frag = &tag->frags[i];
+
+        if(!frag->req) {
+            continue;
+        }
+
+        /* request can be used by two threads at once. */
+        spin_block(&frag->req->lock) {
+            if(!frag->req->resp_received) {
+                rc = PLCTAG_STATUS_PENDING;
+                break;
+            }
+
+            if(frag->req->status != PLCTAG_STATUS_OK) {
+                rc = frag->req->status;
+                pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+            }
+        }
+
+        if(rc == PLCTAG_STATUS_PENDING) {
+            pending = 1;
+            rc = PLCTAG_STATUS_OK;
+            continue;
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = decode_func(tag, frag);
+        }
+
+        /* this request is done. */
+        frag->req->abort_request = 1;
+        frag->req = rc_dec(frag->req);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Chunked request failed, %s!", plc_tag_decode_error(rc));
+        ab_tag_abort(tag);
+        return rc;
+    }
+
+    if(pending) {
+        pdebug(DEBUG_SPEW, "Done.  Chunks still pending.");
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    ab_tag_release_frags(tag);
+
+    pdebug(DEBUG_DETAIL, "Done.  All chunks finished.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * ab_tag_release_read_template
+ *
+ * Let go of the reusable read request and its saved bytes.
+ */
+
+void ab_tag_release_read_template(ab_tag_p tag)
+{
+    if(tag->read_template) {
+        spin_block(&tag->read_template->lock) {
+            tag->read_template->abort_request = 1;
+        }
+
+        tag->read_template = rc_dec(tag->read_template);
+    }
+
+    if(tag->read_template_data) {
+        mem_free(tag->read_template_data);
+        tag->read_template_data = NULL;
+    }
+
+    tag->read_template_size = 0;
+}
+
+
+
+/*
+ * ab_tag_release_listings
+ *
+ * Abort and release the listing requests of a @discover tag.
+ */
+
+void ab_tag_release_listings(ab_tag_p tag)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    for(int i=0; i < tag->listing_count; i++) {
+        if(tag->listings[i].req) {
+            spin_block(&tag->listings[i].req->lock) {
+                tag->listings[i].req->abort_request = 1;
+            }
+
+            tag->listings[i].req = rc_dec(tag->listings[i].req);
+        }
+    }
+
+    if(tag->listings) {
+        mem_free(tag->listings);
+        tag->listings = NULL;
+    }
+
+    tag->listing_count = 0;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+
 
 /*
  * ab_tag_status
@@ -816,6 +1072,20 @@ void ab_tag_destroy(ab_tag_p tag)
 
     session = tag->session;
 
+    /* drop any fragment or listing requests still queued. */
+    ab_tag_release_frags(tag);
+    ab_tag_release_listings(tag);
+    ab_tag_release_read_template(tag);
+
+    if(tag->tag_index) {
+        tag->tag_index = rc_dec(tag->tag_index);
+    }
+
+    if(tag->ranges) {
+        mem_free(tag->ranges);
+        tag->ranges = NULL;
+    }
+
     /* tags should always have a session.  Release it. */
     pdebug(DEBUG_DETAIL,"Getting ready to release tag session %p",tag->session);
     if(session) {
@@ -867,6 +1137,10 @@ int ab_get_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int default_va
         res = tag->elem_size;
     } else if(str_cmp_i(attrib_name, "elem_count") == 0) {
         res = tag->elem_count;
+    } else if(str_cmp_i(attrib_name, "throttle_ms") == 0) {
+        int64_t throttle_ms = session_get_throttle_ms(tag->session);
+
+        res = (throttle_ms > INT_MAX ? INT_MAX : (int)throttle_ms);
     } else {
         pdebug(DEBUG_WARN, "Unsupported attribute name \"%s\"!", attrib_name);
         tag->status = PLCTAG_ERR_UNSUPPORTED;
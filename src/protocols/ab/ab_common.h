@@ -48,7 +48,18 @@ typedef struct ab_request_t *ab_request_p;
 #define AB_REQUEST_NULL ((ab_request_p)NULL)
 
 
+struct ab_frag_t;
+
+typedef int (*ab_frag_build_func)(ab_tag_p tag, struct ab_frag_t *frag);
+typedef int (*ab_frag_decode_func)(ab_tag_p tag, struct ab_frag_t *frag);
+
+
 extern int ab_tag_abort(ab_tag_p tag);
+extern void ab_tag_release_frags(ab_tag_p tag);
+extern int ab_tag_start_elem_frags(ab_tag_p tag, int data_per_packet, ab_frag_build_func build_func);
+extern int ab_tag_check_elem_frags(ab_tag_p tag, ab_frag_decode_func decode_func);
+extern void ab_tag_release_listings(ab_tag_p tag);
+extern void ab_tag_release_read_template(ab_tag_p tag);
 extern int ab_tag_status(ab_tag_p tag);
 
 
@@ -62,6 +62,7 @@
 #define AB_EIP_DEFAULT_TIMEOUT 2000 /* in ms */
 
 /* AB Commands */
+#define AB_EIP_LIST_IDENTITY        ((uint16_t)0x0063)
 #define AB_EIP_REGISTER_SESSION     ((uint16_t)0x0065)
 #define AB_EIP_UNREGISTER_SESSION   ((uint16_t)0x0066)
 #define AB_EIP_UNCONNECTED_SEND     ((uint16_t)0x006F)
@@ -78,7 +79,9 @@
 #define AB_EIP_CMD_FORWARD_OPEN_EX      ((uint8_t)0x5B)
 
 /* CIP embedded packet commands */
+#define AB_EIP_CMD_CIP_GET_ATTR_LIST    ((uint8_t)0x03)
 #define AB_EIP_CMD_CIP_MULTI            ((uint8_t)0x0A)
+#define AB_EIP_CMD_CIP_GET_ATTR_SINGLE  ((uint8_t)0x0E)
 #define AB_EIP_CMD_CIP_READ             ((uint8_t)0x4C)
 #define AB_EIP_CMD_CIP_WRITE            ((uint8_t)0x4D)
 #define AB_EIP_CMD_CIP_RMW              ((uint8_t)0x4E)
@@ -1071,3 +1074,20 @@ START_PACK typedef struct {
     uint16_le pccc_seq_num;          /* TNSW transaction/connection sequence number */
     //uint8_t pccc_data[ZLA_SIZE];    /* data for PCCC response. */
 } END_PACK pccc_dhp_resp;
+
+
+
+/*
+ * This is a pseudo UDT structure for each tag entry when listing all the tags
+ * in a PLC.
+ */
+
+START_PACK typedef struct {
+        uint32_le instance_id;  /* monotonically increasing but not contiguous */
+        uint16_le symbol_type;   /* type of the symbol. */
+        uint16_le element_length; /* length of one array element in bytes. */
+        uint32_le array_dims[3];  /* array dimensions. */
+        uint16_le string_len;   /* string length count. */
+        //uint8_t string_name[82]; /* MAGIC string name bytes (string_len of them, zero padded) */
+} END_PACK tag_list_entry;
+
@@ -32,6 +32,7 @@
  ***************************************************************************/
 
 #include <ctype.h>
+#include <stdlib.h>
 #include <platform.h>
 #include <lib/libplctag.h>
 #include <lib/tag.h>
@@ -42,6 +43,7 @@
 #include <ab/session.h>
 #include <ab/eip_cip.h>
 #include <ab/error_codes.h>
+#include <ab/udt.h>
 #include <util/attr.h>
 #include <util/debug.h>
 #include <util/vector.h>
@@ -112,35 +114,51 @@ CIP Tag Info command
 //
 //} END_PACK tag_list_req_DEAD;
 
-/*
- * This is a pseudo UDT structure for each tag entry when listing all the tags
- * in a PLC.
- */
-
-START_PACK typedef struct {
-        uint32_le instance_id;  /* monotonically increasing but not contiguous */
-        uint16_le symbol_type;   /* type of the symbol. */
-        uint16_le element_length; /* length of one array element in bytes. */
-        uint32_le array_dims[3];  /* array dimensions. */
-        uint16_le string_len;   /* string length count. */
-        //uint8_t string_name[82]; /* MAGIC string name bytes (string_len of them, zero padded) */
-} END_PACK tag_list_entry;
-
 
-
-static int build_read_request_connected(ab_tag_p tag, int byte_offset);
-static int build_tag_list_request_connected(ab_tag_p tag);
+static int build_read_request_connected(ab_tag_p tag, int elem_count, int byte_offset);
+static int build_tag_list_request_connected(ab_tag_p tag, uint8_t *prefix, int prefix_size, uint32_t next_id);
+static int decode_tag_list_response_connected(ab_request_p req, uint8_t **data, uint8_t **data_end, int *partial);
+static int reserve_list_buffer(ab_tag_p tag, int size);
+static int process_tag_list_entries(ab_tag_p tag, uint8_t *data, uint8_t *data_end);
+static void record_list_symbol(ab_tag_p tag, uint8_t *prefix, int prefix_size, uint8_t *name, int name_len, uint32_t instance_id, uint16_t symbol_type);
+static int start_discovery_connected(ab_tag_p tag);
+static int add_listing(ab_tag_p tag, uint8_t *program, int program_len);
+static int start_listings_connected(ab_tag_p tag);
+static int check_discover_status_connected(ab_tag_p tag);
+static int process_discover_entries(ab_tag_p tag, int listing_index, uint8_t *data, uint8_t *data_end);
+static int resolve_symbol_instance(ab_tag_p tag);
+static int get_symbol_base_size(ab_tag_p tag, int *prefix_size);
+static void restore_symbolic_name(ab_tag_p tag);
+static int retry_symbolic_name(ab_tag_p tag, int is_write);
+static int send_read_template(ab_tag_p tag);
+static void save_read_template(ab_tag_p tag, ab_request_p req);
+static void get_type_info_key(ab_tag_p tag, uint8_t **name, int *name_size);
+static void remember_type_info(ab_tag_p tag);
+static int find_type_info(ab_tag_p tag);
 static int build_read_request_unconnected(ab_tag_p tag, int byte_offset);
-static int build_write_request_connected(ab_tag_p tag, int byte_offset);
+static int build_write_request_connected(ab_tag_p tag, int byte_offset, int write_end);
 static int build_write_request_unconnected(ab_tag_p tag, int byte_offset);
 static int build_write_bit_request_connected(ab_tag_p tag);
 static int build_write_bit_request_unconnected(ab_tag_p tag);
 static int check_read_status_connected(ab_tag_p tag);
+static int decode_read_response_connected(ab_tag_p tag, ab_request_p req, uint8_t **payload, int *payload_size, int *partial);
 static int check_read_tag_list_status_connected(ab_tag_p tag);
 static int check_read_status_unconnected(ab_tag_p tag);
 static int check_write_status_connected(ab_tag_p tag);
 static int check_write_status_unconnected(ab_tag_p tag);
 static int calculate_write_data_per_packet(ab_tag_p tag);
+static int calculate_read_data_per_packet(ab_tag_p tag);
+static int start_read_frags_connected(ab_tag_p tag);
+static int start_read_ranges_connected(ab_tag_p tag);
+static int start_write_frags_connected(ab_tag_p tag);
+static int start_write_dirty_connected(ab_tag_p tag);
+static int dirty_size(ab_tag_p tag);
+static int check_read_frags_status_connected(ab_tag_p tag);
+static int check_write_frags_status_connected(ab_tag_p tag);
+static int decode_write_response_connected(ab_request_p req);
+static int build_udt_request_connected(ab_tag_p tag);
+static int check_read_udt_status_connected(ab_tag_p tag);
+static int decode_udt_attributes(ab_tag_p tag, uint8_t *data, uint8_t *data_end);
 
 static int tag_read_start(ab_tag_p tag);
 static int tag_tickler(ab_tag_p tag);
@@ -159,6 +177,26 @@ struct tag_vtable_t eip_cip_vtable = {
     ab_set_int_attrib
 };
 
+/*
+ * The data of a @udt/<id> tag starts with this header, all little-endian:
+ *
+ *   uint16 template ID
+ *   uint32 template definition size in 32-bit words
+ *   uint32 structure size in bytes
+ *   uint16 member count
+ *   uint16 structure handle
+ *
+ * The raw template data from the PLC follows.
+ */
+#define UDT_HEADER_SIZE (14)
+
+/*
+ * A @discover tag lists each program on its own, but no more than this many
+ * at a time so that a controller with many programs does not flood the
+ * session's request queue.
+ */
+#define DISCOVER_MAX_LISTINGS_IN_FLIGHT (8)
+
 /* default string types used for ControlLogix-class PLCs. */
 tag_byte_order_t logix_tag_byte_order = {
     .is_allocated = 0,
@@ -217,8 +255,14 @@ int tag_tickler(ab_tag_p tag)
 
     if (tag->read_in_progress) {
         if(tag->use_connected_msg) {
-            if(tag->tag_list) {
+            if(tag->frag_count) {
+                rc = check_read_frags_status_connected(tag);
+            } else if(tag->discover) {
+                rc = check_discover_status_connected(tag);
+            } else if(tag->tag_list) {
                 rc = check_read_tag_list_status_connected(tag);
+            } else if(tag->udt_tag) {
+                rc = check_read_udt_status_connected(tag);
             } else {
                 rc = check_read_status_connected(tag);
             }
@@ -226,6 +270,11 @@ int tag_tickler(ab_tag_p tag)
             rc = check_read_status_unconnected(tag);
         }
 
+        /* the symbol instance ID may be stale, try again with the name. */
+        if(!tag->read_in_progress && tag->symbol_resolved && (rc == PLCTAG_ERR_NOT_FOUND || rc == PLCTAG_ERR_BAD_PARAM)) {
+            rc = retry_symbolic_name(tag, 0);
+        }
+
         tag->status = (int8_t)rc;
 
         /* if the operation completed, make a note so that the callback will be called. */
@@ -240,13 +289,28 @@ int tag_tickler(ab_tag_p tag)
 
     if (tag->write_in_progress) {
         if(tag->use_connected_msg) {
-            rc = check_write_status_connected(tag);
+            if(tag->frag_count) {
+                rc = check_write_frags_status_connected(tag);
+            } else {
+                rc = check_write_status_connected(tag);
+            }
         } else {
             rc = check_write_status_unconnected(tag);
         }
 
         tag->status = (int8_t)rc;
 
+        /* the PLC may have some of the write, so send all of the data next time. */
+        if(rc_is_error(rc)) {
+            tag_mark_dirty((plc_tag_p)tag, 0, tag->size);
+        }
+
+        /* the symbol instance ID may be stale, try again with the name. */
+        if(!tag->write_in_progress && tag->symbol_resolved && (rc == PLCTAG_ERR_NOT_FOUND || rc == PLCTAG_ERR_BAD_PARAM)) {
+            rc = retry_symbolic_name(tag, 1);
+            tag->status = (int8_t)rc;
+        }
+
         /* if the operation completed, make a note so that the callback will be called. */
         if(!tag->write_in_progress) {
             tag->write_complete = 1;
@@ -289,12 +353,35 @@ int tag_read_start(ab_tag_p tag)
     /* mark the tag read in progress */
     tag->read_in_progress = 1;
 
+    if(tag->resolve_symbol) {
+        resolve_symbol_instance(tag);
+    }
+
+    /* the read replaces any changes that were not written. */
+    tag->dirty_count = 0;
+
+    /* a listing's index is rebuilt when the new listing is complete. */
+    if(tag->tag_index) {
+        tag->tag_index = rc_dec(tag->tag_index);
+    }
+
     /* i is the index of the first new request */
     if(tag->use_connected_msg) {
-        if(tag->tag_list) {
-            rc = build_tag_list_request_connected(tag);
+        if(tag->discover) {
+            rc = start_discovery_connected(tag);
+        } else if(tag->tag_list) {
+            /* the encoded name of a program listing is the program segment. */
+            rc = build_tag_list_request_connected(tag, &tag->encoded_name[1], tag->encoded_name_size - 1, tag->next_id);
+        } else if(tag->udt_tag) {
+            rc = build_udt_request_connected(tag);
+        } else if(tag->range_count) {
+            rc = start_read_ranges_connected(tag);
+        } else if(!tag->first_read && tag->offset == 0 && tag->plc_type != AB_PLC_OMRON_NJNX
+                  && tag->size > calculate_read_data_per_packet(tag)) {
+            /* we know the size, so ask for all the fragments at once. */
+            rc = start_read_frags_connected(tag);
         } else {
-            rc = build_read_request_connected(tag, tag->offset);
+            rc = build_read_request_connected(tag, tag->elem_count, tag->offset);
         }
     } else {
         rc = build_read_request_unconnected(tag, tag->offset);
@@ -338,6 +425,18 @@ int tag_write_start(ab_tag_p tag)
         return PLCTAG_ERR_UNSUPPORTED;
     }
 
+    if(tag->udt_tag) {
+        pdebug(DEBUG_WARN, "A UDT template cannot be written!");
+
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(tag->range_count) {
+        pdebug(DEBUG_WARN, "A range read tag cannot be written!");
+
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
     if(tag->read_in_progress || tag->write_in_progress) {
         pdebug(DEBUG_WARN, "Read or write operation already in flight!");
         return PLCTAG_ERR_BUSY;
@@ -346,14 +445,25 @@ int tag_write_start(ab_tag_p tag)
     /* the write is now in flight */
     tag->write_in_progress = 1;
 
+    /* another tag or a listing may already have found the type. */
+    if (tag->first_read && !tag->encoded_type_info_size && find_type_info(tag) == PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "Found cached type information.");
+    }
+
+    if(tag->resolve_symbol) {
+        resolve_symbol_instance(tag);
+    }
+
     /*
      * if the tag has not been read yet, read it.
      *
      * This gets the type data and sets up the request
-     * buffers.
+     * buffers.  If the type is already known and the size
+     * is too, the write can go straight out.  Bit writes
+     * need the size of the whole word, so they always read.
      */
 
-    if (tag->first_read) {
+    if (tag->first_read && (!tag->encoded_type_info_size || tag->size <= 0 || tag->is_bit)) {
         pdebug(DEBUG_DETAIL, "No read has completed yet, doing pre-read to get type information.");
 
         tag->pre_write_read = 1;
@@ -370,7 +480,23 @@ int tag_write_start(ab_tag_p tag)
     }
 
     if(tag->use_connected_msg) {
-        rc = build_write_request_connected(tag, tag->offset);
+        int can_fragment = (!tag->is_bit && tag->offset == 0 && tag->plc_type != AB_PLC_OMRON_NJNX
+                            && calculate_write_data_per_packet(tag) == PLCTAG_STATUS_OK);
+
+        /*
+         * odd sized writes are padded to 16 bits and the pad could land
+         * on the next element, which may not have changed.  Tags with odd
+         * sized elements always write everything.
+         */
+        if(can_fragment && tag->dirty_count > 0 && dirty_size(tag) < tag->size && !(tag->elem_size & 0x01)) {
+            /* send only the parts changed since the last write. */
+            rc = start_write_dirty_connected(tag);
+        } else if(can_fragment && tag->write_data_per_packet < tag->size) {
+            /* send all the fragments at once. */
+            rc = start_write_frags_connected(tag);
+        } else {
+            rc = build_write_request_connected(tag, tag->offset, tag->size);
+        }
     } else {
         rc = build_write_request_unconnected(tag, tag->offset);
     }
@@ -382,6 +508,9 @@ int tag_write_start(ab_tag_p tag)
         return rc;
     }
 
+    /* everything changed so far is on its way. */
+    tag->dirty_count = 0;
+
     pdebug(DEBUG_INFO, "Done.");
 
     return PLCTAG_STATUS_PENDING;
@@ -389,16 +518,25 @@ int tag_write_start(ab_tag_p tag)
 
 
 
-int build_read_request_connected(ab_tag_p tag, int byte_offset)
+int build_read_request_connected(ab_tag_p tag, int elem_count, int byte_offset)
 {
     eip_cip_co_req* cip = NULL;
     uint8_t* data = NULL;
     ab_request_p req = NULL;
     int rc = PLCTAG_STATUS_OK;
     uint8_t read_cmd = AB_EIP_CMD_CIP_READ_FRAG;
+    int whole_tag = (byte_offset == 0 && elem_count == tag->elem_count && !tag->range_count);
 
     pdebug(DEBUG_INFO, "Starting.");
 
+    /* polled tags send the same request every time. */
+    if(whole_tag && tag->read_template) {
+        rc = send_read_template(tag);
+        if(rc != PLCTAG_ERR_NOT_FOUND) {
+            return rc;
+        }
+    }
+
     /* get a request buffer */
     rc = session_create_request(tag->session, tag->tag_id, &req);
     if (rc != PLCTAG_STATUS_OK) {
@@ -438,7 +576,7 @@ int build_read_request_connected(ab_tag_p tag, int byte_offset)
     data += tag->encoded_name_size;
 
     /* add the count of elements to read. */
-    *((uint16_le*)data) = h2le16((uint16_t)(tag->elem_count));
+    *((uint16_le*)data) = h2le16((uint16_t)(elem_count));
     data += sizeof(uint16_le);
 
     if (read_cmd == AB_EIP_CMD_CIP_READ_FRAG) {
@@ -468,7 +606,24 @@ int build_read_request_connected(ab_tag_p tag, int byte_offset)
     /* set the session so that we know what session the request is aiming at */
     //req->session = tag->session;
 
-    req->allow_packing = tag->allow_packing;
+    /*
+     * a request for a whole response worth of data would only be cut
+     * short by the PLC if it were packed with others.  Small fragments,
+     * like the last one or the parts of a range read, can be packed.
+     */
+    if((elem_count * tag->elem_size) - byte_offset < calculate_read_data_per_packet(tag)) {
+        req->allow_packing = tag->allow_packing;
+    } else {
+        req->allow_packing = 0;
+    }
+
+    /* fragments that cannot be packed can still be pipelined. */
+    req->allow_pipelining = (tag->frag_count && !req->allow_packing);
+
+    /* keep a copy before the session can overwrite it with the response. */
+    if(whole_tag) {
+        save_read_template(tag, req);
+    }
 
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
@@ -488,7 +643,7 @@ int build_read_request_connected(ab_tag_p tag, int byte_offset)
 }
 
 
-int build_tag_list_request_connected(ab_tag_p tag)
+int build_tag_list_request_connected(ab_tag_p tag, uint8_t *prefix, int prefix_size, uint32_t next_id)
 {
     eip_cip_co_req* cip = NULL;
     //tag_list_req *list_req = NULL;
@@ -534,14 +689,18 @@ int build_tag_list_request_connected(ab_tag_p tag)
     *data = AB_EIP_CMD_CIP_LIST_TAGS;
     data++;
 
+    if(prefix_size < 0) {
+        prefix_size = 0;
+    }
+
     /* request path size, in 16-bit words */
-    *data = (uint8_t)(3 + ((tag->encoded_name_size-1)/2)); /* size in words of routing header + routing and instance ID. */
+    *data = (uint8_t)(3 + (prefix_size/2)); /* size in words of routing header + routing and instance ID. */
     data++;
 
-    /* add in the encoded name, but without the leading word count byte! */
-    if(tag->encoded_name_size > 1) {
-        mem_copy(data, &tag->encoded_name[1], (tag->encoded_name_size-1));
-        data += (tag->encoded_name_size-1);
+    /* add in the program segment, if any. */
+    if(prefix_size > 0) {
+        mem_copy(data, prefix, prefix_size);
+        data += prefix_size;
     }
 
     /* add in the routing header . */
@@ -554,7 +713,7 @@ int build_tag_list_request_connected(ab_tag_p tag)
     data += 4;
 
     /* now the instance ID */
-    tmp_u16 = h2le16((uint16_t)tag->next_id);
+    tmp_u16 = h2le16((uint16_t)next_id);
     mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
     data += (int)sizeof(tmp_u16);
 
@@ -817,6 +976,10 @@ int build_write_bit_request_connected(ab_tag_p tag)
     *data = (uint8_t)(tag->elem_size & 0xFF); data++;
     *data = (uint8_t)((tag->elem_size >> 8) & 0xFF); data++;
 
+    /* the session can merge other bit writes to this word into the masks. */
+    req->rmw_mask_offset = (int)(data - req->data);
+    req->rmw_mask_size = tag->elem_size;
+
     /* write the OR mask */
     for(i=0; i < tag->elem_size; i++) {
         if((tag->bit/8) == i) {
@@ -1102,7 +1265,7 @@ int build_write_bit_request_unconnected(ab_tag_p tag)
 
 
 
-int build_write_request_connected(ab_tag_p tag, int byte_offset)
+int build_write_request_connected(ab_tag_p tag, int byte_offset, int write_end)
 {
     int rc = PLCTAG_STATUS_OK;
     eip_cip_co_req* cip = NULL;
@@ -1130,7 +1293,8 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
         return rc;
     }
 
-    if(tag->write_data_per_packet < tag->size) {
+    /* writes of part of the tag need the byte offset too. */
+    if(tag->write_data_per_packet < tag->size || byte_offset > 0 || write_end < tag->size) {
         multiple_requests = 1;
     }
 
@@ -1189,7 +1353,7 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
     }
 
     /* how much data to write? */
-    write_size = tag->size - tag->offset;
+    write_size = write_end - tag->offset;
 
     if(write_size > tag->write_data_per_packet) {
         write_size = tag->write_data_per_packet;
@@ -1224,8 +1388,11 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
     /* set the size of the request */
     req->request_size = (int)(data - (req->data));
 
-    /* allow packing if the tag allows it. */
-    req->allow_packing = tag->allow_packing;
+    /* allow packing if the tag allows it, but not for fragments that fill a whole packet. */
+    req->allow_packing = (write_size < tag->write_data_per_packet ? tag->allow_packing : 0);
+
+    /* fragments that cannot be packed can still be pipelined. */
+    req->allow_pipelining = (tag->frag_count && !req->allow_packing);
 
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
@@ -1441,9 +1608,8 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
 static int check_read_status_connected(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
-    eip_cip_co_resp* cip_resp;
-    uint8_t* data;
-    uint8_t* data_end;
+    uint8_t* data = NULL;
+    int payload_size = 0;
     int partial_data = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
@@ -1498,113 +1664,17 @@ static int check_read_status_connected(ab_tag_p tag)
 
     /* the request is ours exclusively. */
 
-    /* point to the data */
-    cip_resp = (eip_cip_co_resp*)(tag->req->data);
-
-    /* point to the start of the data */
-    data = (tag->req->data) + sizeof(eip_cip_co_resp);
-
-    /* point the end of the data */
-    data_end = (tag->req->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
-
-    /* check the status */
     do {
-        ptrdiff_t payload_size = (data_end - data);
-
-        if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
-            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
-            rc = PLCTAG_ERR_BAD_DATA;
-            break;
-        }
-
-        if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
-            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
-            rc = PLCTAG_ERR_REMOTE_ERR;
-            break;
-        }
-
-        /*
-         * FIXME
-         *
-         * It probably should not be necessary to check for both as setting the type to anything other
-         * than fragmented is error-prone.
-         */
-
-        if (cip_resp->reply_service != (AB_EIP_CMD_CIP_READ_FRAG | AB_EIP_CMD_CIP_OK)
-            && cip_resp->reply_service != (AB_EIP_CMD_CIP_READ | AB_EIP_CMD_CIP_OK) ) {
-            pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
-            rc = PLCTAG_ERR_BAD_DATA;
-            break;
-        }
-
-        if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
-            pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
-            pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
-
-            rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
-
+        /* check the response and find the data after the type info. */
+        rc = decode_read_response_connected(tag, tag->req, &data, &payload_size, &partial_data);
+        if(rc != PLCTAG_STATUS_OK) {
             break;
         }
 
-        /* check to see if this is a partial response. */
-        partial_data = (cip_resp->status == AB_CIP_STATUS_FRAG);
-
-        /*
-         * check to see if there is any data to process.  If this is a packed
-         * response, there might not be.
-         */
-        payload_size = (data_end - data);
         if(payload_size > 0) {
-            /* the first byte of the response is a type byte. */
-            pdebug(DEBUG_DETAIL, "type byte = %d (%x)", (int)*data, (int)*data);
-
-            /* handle the data type part.  This can be long. */
-
-            /* check for a simple/base type */
-            if ((*data) >= AB_CIP_DATA_BIT && (*data) <= AB_CIP_DATA_STRINGI) {
-                /* copy the type info for later. */
-                if (tag->encoded_type_info_size == 0) {
-                    tag->encoded_type_info_size = 2;
-                    mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
-                }
-
-                /* skip the type byte and zero length byte */
-                data += 2;
-            } else if ((*data) == AB_CIP_DATA_ABREV_STRUCT || (*data) == AB_CIP_DATA_ABREV_ARRAY ||
-                       (*data) == AB_CIP_DATA_FULL_STRUCT || (*data) == AB_CIP_DATA_FULL_ARRAY) {
-                /* this is an aggregate type of some sort, the type info is variable length */
-                int type_length = *(data + 1) + 2;  /*
-                                                       * MAGIC
-                                                       * add 2 to get the total length including
-                                                       * the type byte and the length byte.
-                                                       */
-
-                /* check for extra long types */
-                if (type_length > MAX_TAG_TYPE_INFO) {
-                    pdebug(DEBUG_WARN, "Read data type info is too long (%d)!", type_length);
-                    rc = PLCTAG_ERR_TOO_LARGE;
-                    break;
-                }
-
-                /* copy the type info for later. */
-                if (tag->encoded_type_info_size == 0) {
-                    tag->encoded_type_info_size = type_length;
-                    mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
-                }
-
-                data += type_length;
-            } else {
-                pdebug(DEBUG_WARN, "Unsupported data type returned, type byte=%d", *data);
-                rc = PLCTAG_ERR_UNSUPPORTED;
-                break;
-            }
-
-            /* check payload size now that we have bumped past the data type info. */
-            payload_size = (data_end - data);
-
             /* copy the data into the tag and realloc if we need more space. */
             if(payload_size + tag->offset > tag->size) {
-                tag->size = (int)payload_size + tag->offset;
+                tag->size = payload_size + tag->offset;
                 tag->elem_size = tag->size / tag->elem_count;
 
                 pdebug(DEBUG_DETAIL, "Increasing tag buffer size to %d bytes.", tag->size);
@@ -1617,7 +1687,12 @@ static int check_read_status_connected(ab_tag_p tag)
                 }
             }
 
-            pdebug(DEBUG_INFO, "Got %d bytes of data", (int)payload_size);
+            pdebug(DEBUG_INFO, "Got %d bytes of data", payload_size);
+
+            /* a partial response is as full as the PLC will make it. */
+            if(partial_data && (!tag->read_data_per_packet || payload_size < tag->read_data_per_packet)) {
+                tag->read_data_per_packet = payload_size;
+            }
 
             /*
              * copy the data, but only if this is not
@@ -1626,11 +1701,11 @@ static int check_read_status_connected(ab_tag_p tag)
              * put into the tag's data buffer.
              */
             if (!tag->pre_write_read) {
-                mem_copy(tag->data + tag->offset, data, (int)(payload_size));
+                mem_copy(tag->data + tag->offset, data, payload_size);
             }
 
             /* bump the byte offset */
-            tag->offset += (int)(payload_size);
+            tag->offset += payload_size;
         } else {
             pdebug(DEBUG_DETAIL, "Response returned no data and no error.");
         }
@@ -1683,6 +1758,127 @@ static int check_read_status_connected(ab_tag_p tag)
 
 
 
+/*
+ * decode_read_response_connected
+ *
+ * Check the CIP response to a connected read and step past the type
+ * information.  The type information is saved in the tag if it does not
+ * have it yet.  On success, *payload points at the first data byte.
+ */
+
+int decode_read_response_connected(ab_tag_p tag, ab_request_p req, uint8_t **payload, int *payload_size, int *partial)
+{
+    int rc = PLCTAG_STATUS_OK;
+    eip_cip_co_resp* cip_resp = (eip_cip_co_resp*)(req->data);
+    uint8_t* data = (req->data) + sizeof(eip_cip_co_resp);
+    uint8_t* data_end = (req->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
+
+    *payload = NULL;
+    *payload_size = 0;
+    *partial = 0;
+
+    do {
+        if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
+            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
+            rc = PLCTAG_ERR_REMOTE_ERR;
+            break;
+        }
+
+        /*
+         * FIXME
+         *
+         * It probably should not be necessary to check for both as setting the type to anything other
+         * than fragmented is error-prone.
+         */
+
+        if (cip_resp->reply_service != (AB_EIP_CMD_CIP_READ_FRAG | AB_EIP_CMD_CIP_OK)
+            && cip_resp->reply_service != (AB_EIP_CMD_CIP_READ | AB_EIP_CMD_CIP_OK) ) {
+            pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
+            pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
+            pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
+
+            rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
+
+            break;
+        }
+
+        /* check to see if this is a partial response. */
+        *partial = (cip_resp->status == AB_CIP_STATUS_FRAG);
+
+        /*
+         * check to see if there is any data to process.  If this is a packed
+         * response, there might not be.
+         */
+        if((data_end - data) <= 0) {
+            break;
+        }
+
+        /* the first byte of the response is a type byte. */
+        pdebug(DEBUG_DETAIL, "type byte = %d (%x)", (int)*data, (int)*data);
+
+        /* handle the data type part.  This can be long. */
+
+        /* check for a simple/base type */
+        if ((*data) >= AB_CIP_DATA_BIT && (*data) <= AB_CIP_DATA_STRINGI) {
+            /* copy the type info for later. */
+            if (tag->encoded_type_info_size == 0) {
+                tag->encoded_type_info_size = 2;
+                mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
+                remember_type_info(tag);
+            }
+
+            /* skip the type byte and zero length byte */
+            data += 2;
+        } else if ((*data) == AB_CIP_DATA_ABREV_STRUCT || (*data) == AB_CIP_DATA_ABREV_ARRAY ||
+                   (*data) == AB_CIP_DATA_FULL_STRUCT || (*data) == AB_CIP_DATA_FULL_ARRAY) {
+            /* this is an aggregate type of some sort, the type info is variable length */
+            int type_length = *(data + 1) + 2;  /*
+                                                   * MAGIC
+                                                   * add 2 to get the total length including
+                                                   * the type byte and the length byte.
+                                                   */
+
+            /* check for extra long types */
+            if (type_length > MAX_TAG_TYPE_INFO) {
+                pdebug(DEBUG_WARN, "Read data type info is too long (%d)!", type_length);
+                rc = PLCTAG_ERR_TOO_LARGE;
+                break;
+            }
+
+            /* copy the type info for later. */
+            if (tag->encoded_type_info_size == 0) {
+                tag->encoded_type_info_size = type_length;
+                mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
+                remember_type_info(tag);
+            }
+
+            data += type_length;
+        } else {
+            pdebug(DEBUG_WARN, "Unsupported data type returned, type byte=%d", *data);
+            rc = PLCTAG_ERR_UNSUPPORTED;
+            break;
+        }
+
+        *payload = data;
+        *payload_size = (int)(data_end - data);
+    } while(0);
+
+    return rc;
+}
+
+
+
 /*
  * check_read_tag_list_status_connected
  *
@@ -1696,14 +1892,10 @@ static int check_read_status_connected(ab_tag_p tag)
 static int check_read_tag_list_status_connected(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
-    eip_cip_co_resp* cip_resp;
     uint8_t* data;
     uint8_t* data_end;
     int partial_data = 0;
 
-    static int symbol_index=0;
-
-
     pdebug(DEBUG_SPEW, "Starting.");
 
     if(!tag) {
@@ -1738,6 +1930,7 @@ static int check_read_tag_list_status_connected(ab_tag_p tag)
             tag->offset = 0;
             tag->next_id = 0;
             tag->size = tag->elem_count * tag->elem_size;
+            tag->list_entries = 0;
 
             break;
         }
@@ -1754,90 +1947,44 @@ static int check_read_tag_list_status_connected(ab_tag_p tag)
 
     /* the request is ours exclusively. */
 
-    /* point to the data */
-    cip_resp = (eip_cip_co_resp*)(tag->req->data);
-
-    /* point to the start of the data */
-    data = (tag->req->data) + sizeof(eip_cip_co_resp);
-
-    /* point the end of the data */
-    data_end = (tag->req->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
-
     /* check the status */
     do {
-        ptrdiff_t payload_size = (data_end - data);
+        ptrdiff_t payload_size = 0;
 
-        if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
-            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
-            rc = PLCTAG_ERR_BAD_DATA;
+        rc = decode_tag_list_response_connected(tag->req, &data, &data_end, &partial_data);
+        if(rc != PLCTAG_STATUS_OK) {
             break;
         }
 
-        if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
-            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
-            rc = PLCTAG_ERR_REMOTE_ERR;
-            break;
-        }
-
-        if (cip_resp->reply_service != (AB_EIP_CMD_CIP_LIST_TAGS | AB_EIP_CMD_CIP_OK) ) {
-            pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
-            rc = PLCTAG_ERR_BAD_DATA;
-            break;
-        }
-
-        if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
-            pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
-            pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
-            rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
-            break;
-        }
-
-        /* check to see if this is a partial response. */
-        partial_data = (cip_resp->status == AB_CIP_STATUS_FRAG);
+        payload_size = (data_end - data);
 
         /*
          * check to see if there is any data to process.  If this is a packed
          * response, there might not be.
          */
         if(payload_size > 0) {
-            uint8_t *current_entry_data = data;
-
-            /* copy the data into the tag and realloc if we need more space. */
-
-            if(payload_size + tag->offset > tag->size) {
-                tag->elem_count = tag->size = (int)payload_size + tag->offset;
-
-                pdebug(DEBUG_DETAIL, "Increasing tag buffer size to %d bytes.", tag->size);
-
-                tag->data = (uint8_t*)mem_realloc(tag->data, tag->size);
-                if(!tag->data) {
-                    pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
-                    rc = PLCTAG_ERR_NO_MEM;
+            /*
+             * with a list callback the entries are handed out as they come in
+             * and the tag buffer is not used.  Otherwise the buffer grows by
+             * doubling so that big listings are not copied on every fragment.
+             */
+            if(!tag->list_callback) {
+                rc = reserve_list_buffer(tag, (int)payload_size);
+                if(rc != PLCTAG_STATUS_OK) {
                     break;
                 }
-            }
-
-            /* copy the data into the tag's data buffer. */
-            mem_copy(tag->data + tag->offset, data, (int)payload_size);
-
-            tag->offset += (int)payload_size;
-
-            pdebug(DEBUG_DETAIL, "current offset %d", tag->offset);
-
-            /* scan through the data to get the next ID to use. */
-            while((data_end - current_entry_data) > 0) {
-                tag_list_entry *current_entry = (tag_list_entry*)current_entry_data;
 
-                /* first element is the symbol instance ID */
-                tag->next_id = (uint16_t)(le2h32(current_entry->instance_id) + 1);
+                /* copy the data into the tag's data buffer. */
+                mem_copy(tag->data + tag->offset, data, (int)payload_size);
 
-                pdebug(DEBUG_DETAIL, "Next ID: %d", tag->next_id);
+                tag->offset += (int)payload_size;
+                tag->elem_count = tag->size = tag->offset;
 
-                /* skip past to the next instance. */
-                current_entry_data += (sizeof(*current_entry) + le2h16(current_entry->string_len));
-
-                symbol_index++;
+                pdebug(DEBUG_DETAIL, "current offset %d", tag->offset);
             }
+
+            /* get the next ID to use, remember the symbols and call the list callback. */
+            tag->list_entries += process_tag_list_entries(tag, data, data_end);
         } else {
             pdebug(DEBUG_DETAIL, "Response returned no data and no error.");
         }
@@ -1864,9 +2011,19 @@ static int check_read_tag_list_status_connected(ab_tag_p tag)
             /* done! */
             pdebug(DEBUG_DETAIL, "Done reading tag list data!");
 
-            pdebug(DEBUG_DETAIL, "total symbols: %d", symbol_index);
+            pdebug(DEBUG_DETAIL, "total symbols: %d", tag->list_entries);
+
+            if(!tag->list_callback) {
+                tag->elem_count = tag->size = tag->offset;
+
+                if(tag->tag_index) {
+                    tag->tag_index = rc_dec(tag->tag_index);
+                }
+
+                tag->tag_index = tag_index_create(tag->data, tag->size);
+            }
 
-            tag->elem_count = tag->offset;
+            tag->list_entries = 0;
 
             tag->first_read = 0;
             tag->offset = 0;
@@ -1881,6 +2038,7 @@ static int check_read_tag_list_status_connected(ab_tag_p tag)
 
         tag->offset = 0;
         tag->next_id = 0;
+        tag->list_entries = 0;
 
         /* clean up everything. */
         ab_tag_abort(tag);
@@ -2015,6 +2173,7 @@ static int check_read_status_unconnected(ab_tag_p tag)
             if (tag->encoded_type_info_size == 0) {
                 tag->encoded_type_info_size = 2;
                 mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
+                remember_type_info(tag);
             }
 
             /* skip the type byte and zero length byte */
@@ -2040,6 +2199,7 @@ static int check_read_status_unconnected(ab_tag_p tag)
             if (tag->encoded_type_info_size == 0) {
                 tag->encoded_type_info_size = type_length;
                 mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
+                remember_type_info(tag);
             }
 
             data += type_length;
@@ -2142,7 +2302,6 @@ static int check_read_status_unconnected(ab_tag_p tag)
 
 static int check_write_status_connected(ab_tag_p tag)
 {
-    eip_cip_co_resp* cip_resp;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_SPEW, "Starting.");
@@ -2193,37 +2352,7 @@ static int check_write_status_connected(ab_tag_p tag)
 
     /* the request is ours exclusively. */
 
-    /* point to the data */
-    cip_resp = (eip_cip_co_resp*)(tag->req->data);
-
-    do {
-        if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
-            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
-            rc = PLCTAG_ERR_BAD_DATA;
-            break;
-        }
-
-        if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
-            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
-            rc = PLCTAG_ERR_REMOTE_ERR;
-            break;
-        }
-
-        if (cip_resp->reply_service != (AB_EIP_CMD_CIP_WRITE_FRAG | AB_EIP_CMD_CIP_OK)
-            && cip_resp->reply_service != (AB_EIP_CMD_CIP_WRITE | AB_EIP_CMD_CIP_OK)
-            && cip_resp->reply_service != (AB_EIP_CMD_CIP_RMW | AB_EIP_CMD_CIP_OK)) {
-            pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
-            rc = PLCTAG_ERR_BAD_DATA;
-            break;
-        }
-
-        if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
-            pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
-            pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
-            rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
-            break;
-        }
-    } while(0);
+    rc = decode_write_response_connected(tag->req);
 
     /* clean up the request. */
     tag->req->abort_request = 1;
@@ -2371,68 +2500,2084 @@ static int check_write_status_unconnected(ab_tag_p tag)
 
 
 
-int calculate_write_data_per_packet(ab_tag_p tag)
+/*
+ * decode_write_response_connected
+ *
+ * Check the CIP response to a connected write.
+ */
+
+int decode_write_response_connected(ab_request_p req)
 {
-    int overhead = 0;
-    int data_per_packet = 0;
-    int max_payload_size = 0;
+    eip_cip_co_resp* cip_resp = (eip_cip_co_resp*)(req->data);
+    int rc = PLCTAG_STATUS_OK;
 
-    pdebug(DEBUG_DETAIL, "Starting.");
+    do {
+        if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
 
-    /* if we are here, then we have all the type data etc. */
-    if(tag->use_connected_msg) {
-        pdebug(DEBUG_DETAIL,"Connected tag.");
-        max_payload_size = session_get_max_payload(tag->session);
-        overhead =  1                               /* service request, one byte */
-                    + tag->encoded_name_size        /* full encoded name */
-                    + tag->encoded_type_info_size   /* encoded type size */
-                    + 2                             /* element count, 16-bit int */
-                    + 4                             /* byte offset, 32-bit int */
-                    + 8;                            /* MAGIC fudge factor */
-    } else {
-        pdebug(DEBUG_DETAIL,"Unconnected tag.");
-        max_payload_size = session_get_max_payload(tag->session);
-        overhead =  1                               /* service request, one byte */
-                    + tag->encoded_name_size        /* full encoded name */
-                    + tag->encoded_type_info_size   /* encoded type size */
-                    + tag->session->conn_path_size + 2       /* encoded device path size plus two bytes for length and padding */
-                    + 2                             /* element count, 16-bit int */
-                    + 4                             /* byte offset, 32-bit int */
-                    + 8;                            /* MAGIC fudge factor */
+        if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
+            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
+            rc = PLCTAG_ERR_REMOTE_ERR;
+            break;
+        }
+
+        if (cip_resp->reply_service != (AB_EIP_CMD_CIP_WRITE_FRAG | AB_EIP_CMD_CIP_OK)
+            && cip_resp->reply_service != (AB_EIP_CMD_CIP_WRITE | AB_EIP_CMD_CIP_OK)
+            && cip_resp->reply_service != (AB_EIP_CMD_CIP_RMW | AB_EIP_CMD_CIP_OK)) {
+            pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
+            pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
+            pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
+            rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
+            break;
+        }
+    } while(0);
+
+    return rc;
+}
+
+
+
+
+/*
+ * start_read_frags_connected
+ *
+ * Queue one fragmented read request per chunk of the tag, all at once.
+ * The session sends them back to back instead of waiting for each
+ * response to be seen by the tickler before asking for the next chunk.
+ */
+
+int start_read_frags_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int data_per_packet = calculate_read_data_per_packet(tag);
+    int frag_count = (tag->size + data_per_packet - 1) / data_per_packet;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    tag->frags = mem_alloc(frag_count * (int)sizeof(struct ab_frag_t));
+    if(!tag->frags) {
+        pdebug(DEBUG_WARN, "Unable to allocate fragment array!");
+        return PLCTAG_ERR_NO_MEM;
     }
 
-    data_per_packet = max_payload_size - overhead;
+    tag->frag_count = frag_count;
 
-    pdebug(DEBUG_DETAIL,"Write packet maximum size is %d, write overhead is %d, and write data per packet is %d.", max_payload_size, overhead, data_per_packet);
+    for(int i=0; i < frag_count && rc == PLCTAG_STATUS_OK; i++) {
+        tag->frags[i].offset = i * data_per_packet;
+        tag->frags[i].size = tag->size - tag->frags[i].offset;
 
-    if (data_per_packet <= 0) {
-        pdebug(DEBUG_WARN,
-               "Unable to send request.  Packet overhead, %d bytes, is too large for packet, %d bytes!",
-               overhead,
-               max_payload_size);
-        return PLCTAG_ERR_TOO_LARGE;
+        if(tag->frags[i].size > data_per_packet) {
+            tag->frags[i].size = data_per_packet;
+        }
+
+        tag->frags[i].plc_offset = tag->frags[i].offset;
+        tag->frags[i].elem_count = tag->elem_count;
+
+        rc = build_read_request_connected(tag, tag->frags[i].elem_count, tag->frags[i].plc_offset);
+
+        /* the request belongs to the fragment, not the tag. */
+        tag->frags[i].req = tag->req;
+        tag->req = NULL;
     }
 
-    /* we want a multiple of 8 bytes */
-    data_per_packet &= 0xFFFFF8;
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to queue fragment read requests, %s!", plc_tag_decode_error(rc));
+        ab_tag_release_frags(tag);
+        return rc;
+    }
 
-    tag->write_data_per_packet = data_per_packet;
+    pdebug(DEBUG_INFO, "Done.  Queued %d fragment reads of up to %d bytes.", frag_count, data_per_packet);
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    return rc;
+}
 
-    return PLCTAG_STATUS_OK;
+
+
+/*
+ * start_read_ranges_connected
+ *
+ * Queue a fragmented read for each range of the array, all at once, so
+ * that the session packs them into one Multiple Service Packet.  The
+ * element count of each request ends at the end of its range so that the
+ * PLC returns no more than the range.  Ranges bigger than one response are
+ * split like a normal fragmented read.
+ */
+
+int start_read_ranges_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int data_per_packet = calculate_read_data_per_packet(tag);
+    int frag_count = 0;
+    int offset = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    for(int i=0; i < tag->range_count; i++) {
+        int range_size = tag->ranges[i].elem_count * tag->elem_size;
+
+        frag_count += (range_size + data_per_packet - 1) / data_per_packet;
+    }
+
+    tag->frags = mem_alloc(frag_count * (int)sizeof(struct ab_frag_t));
+    if(!tag->frags) {
+        pdebug(DEBUG_WARN, "Unable to allocate fragment array!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->frag_count = frag_count;
+
+    for(int i=0, frag_index=0; i < tag->range_count && rc == PLCTAG_STATUS_OK; i++) {
+        int plc_offset = tag->ranges[i].elem_offset * tag->elem_size;
+        int range_end = offset + (tag->ranges[i].elem_count * tag->elem_size);
+
+        while(offset < range_end && rc == PLCTAG_STATUS_OK) {
+            struct ab_frag_t *frag = &tag->frags[frag_index++];
+
+            frag->offset = offset;
+            frag->plc_offset = plc_offset;
+            frag->elem_count = tag->ranges[i].elem_offset + tag->ranges[i].elem_count;
+            frag->size = range_end - offset;
+
+            if(frag->size > data_per_packet) {
+                frag->size = data_per_packet;
+            }
+
+            rc = build_read_request_connected(tag, frag->elem_count, frag->plc_offset);
+
+            /* the request belongs to the fragment, not the tag. */
+            frag->req = tag->req;
+            tag->req = NULL;
+
+            offset += frag->size;
+            plc_offset += frag->size;
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to queue range read requests, %s!", plc_tag_decode_error(rc));
+        ab_tag_release_frags(tag);
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done.  Queued %d reads for %d ranges.", frag_count, tag->range_count);
+
+    return rc;
 }
 
 
 
-int setup_tag_listing(ab_tag_p tag, const char *name)
+/*
+ * start_write_frags_connected
+ *
+ * Queue all the fragmented write requests for the tag at once.
+ */
+
+int start_write_frags_connected(ab_tag_p tag)
 {
-    char **tag_parts = NULL;
+    int rc = PLCTAG_STATUS_OK;
+    int frag_count = (tag->size + tag->write_data_per_packet - 1) / tag->write_data_per_packet;
 
-    pdebug(DEBUG_DETAIL, "Starting.");
+    pdebug(DEBUG_INFO, "Starting.");
+
+    tag->frags = mem_alloc(frag_count * (int)sizeof(struct ab_frag_t));
+    if(!tag->frags) {
+        pdebug(DEBUG_WARN, "Unable to allocate fragment array!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->frag_count = frag_count;
+
+    for(int i=0; i < frag_count && rc == PLCTAG_STATUS_OK; i++) {
+        tag->frags[i].offset = i * tag->write_data_per_packet;
+
+        /* the request builder copies the data starting at tag->offset. */
+        tag->offset = tag->frags[i].offset;
+
+        rc = build_write_request_connected(tag, tag->frags[i].offset, tag->size);
+
+        tag->frags[i].size = tag->offset - tag->frags[i].offset;
+        tag->frags[i].req = tag->req;
+        tag->req = NULL;
+    }
+
+    tag->offset = 0;
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to queue fragment write requests, %s!", plc_tag_decode_error(rc));
+        ab_tag_release_frags(tag);
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done.  Queued %d fragment writes of up to %d bytes.", frag_count, tag->write_data_per_packet);
+
+    return rc;
+}
+
+
+
+/*
+ * start_write_dirty_connected
+ *
+ * Queue one fragmented write for each range of the tag data changed by
+ * the setters, rounded out to whole elements.  Small ranges are packed
+ * together by the session, so a few changes to a big array cost a few
+ * bytes each instead of the whole array.  Only used when the element size
+ * is even, so no range ends in a pad byte.
+ */
+
+int start_write_dirty_connected(ab_tag_p tag)
+{
+    struct tag_dirty_range_t ranges[MAX_DIRTY_RANGES];
+    int range_count = 0;
+    int align = (tag->elem_size > 0 ? tag->elem_size : 1);
+    int frag_count = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    for(int i=0; i < tag->dirty_count; i++) {
+        int start = (tag->dirty_ranges[i].start / align) * align;
+        int end = ((tag->dirty_ranges[i].end + align - 1) / align) * align;
+
+        if(end > tag->size) {
+            end = tag->size;
+        }
+
+        /* rounding can make ranges touch. */
+        if(range_count > 0 && start <= ranges[range_count - 1].end) {
+            if(end > ranges[range_count - 1].end) {
+                ranges[range_count - 1].end = end;
+            }
+        } else {
+            ranges[range_count].start = start;
+            ranges[range_count].end = end;
+            range_count++;
+        }
+    }
+
+    for(int i=0; i < range_count; i++) {
+        frag_count += (ranges[i].end - ranges[i].start + tag->write_data_per_packet - 1) / tag->write_data_per_packet;
+    }
+
+    tag->frags = mem_alloc(frag_count * (int)sizeof(struct ab_frag_t));
+    if(!tag->frags) {
+        pdebug(DEBUG_WARN, "Unable to allocate fragment array!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->frag_count = frag_count;
+
+    for(int i=0, frag_index=0; i < range_count && rc == PLCTAG_STATUS_OK; i++) {
+        tag->offset = ranges[i].start;
+
+        while(tag->offset < ranges[i].end && rc == PLCTAG_STATUS_OK) {
+            struct ab_frag_t *frag = &tag->frags[frag_index++];
+
+            frag->offset = tag->offset;
 
-    /* Check for a match with just "@tags" for a controller tag listing. */
-    if(str_cmp_i(name, "@tags") == 0) {
+            /* the request builder copies the data starting at tag->offset and moves it along. */
+            rc = build_write_request_connected(tag, frag->offset, ranges[i].end);
+
+            frag->size = tag->offset - frag->offset;
+            frag->req = tag->req;
+            tag->req = NULL;
+        }
+    }
+
+    tag->offset = 0;
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to queue changed range write requests, %s!", plc_tag_decode_error(rc));
+        ab_tag_release_frags(tag);
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done.  Queued %d writes for %d changed ranges.", frag_count, range_count);
+
+    return rc;
+}
+
+
+
+/* the number of bytes changed since the last write. */
+int dirty_size(ab_tag_p tag)
+{
+    int size = 0;
+
+    for(int i=0; i < tag->dirty_count; i++) {
+        size += tag->dirty_ranges[i].end - tag->dirty_ranges[i].start;
+    }
+
+    return size;
+}
+
+
+
+/*
+ * check_read_frags_status_connected
+ *
+ * Copy in the data from each fragment response as it arrives, in any
+ * order.  If the PLC sent back less than the fragment should hold, ask
+ * again for the rest of that fragment only.
+ */
+
+int check_read_frags_status_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int pending = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    for(int i=0; i < tag->frag_count && rc == PLCTAG_STATUS_OK; i++) {
+        struct ab_frag_t *frag = &tag->frags[i];
+        uint8_t *data = NULL;
+        int payload_size = 0;
+        int partial_data = 0;
+
+        if(!frag->req) {
+            continue;
+        }
+
+        /* request can be used by two threads at once. */
+        spin_block(&frag->req->lock) {
+            if(!frag->req->resp_received) {
+                rc = PLCTAG_STATUS_PENDING;
+                break;
+            }
+
+            if(frag->req->status != PLCTAG_STATUS_OK) {
+                rc = frag->req->status;
+                pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+            }
+        }
+
+        if(rc == PLCTAG_STATUS_PENDING) {
+            pending = 1;
+            rc = PLCTAG_STATUS_OK;
+            continue;
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = decode_read_response_connected(tag, frag->req, &data, &payload_size, &partial_data);
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            int copy_size = (payload_size < frag->size ? payload_size : frag->size);
+
+            mem_copy(tag->data + frag->offset, data, copy_size);
+
+            frag->offset += copy_size;
+            frag->plc_offset += copy_size;
+            frag->size -= copy_size;
+        }
+
+        /* this request is done. */
+        frag->req->abort_request = 1;
+        frag->req = rc_dec(frag->req);
+
+        if(rc == PLCTAG_STATUS_OK && frag->size > 0) {
+            if(!partial_data || payload_size == 0) {
+                pdebug(DEBUG_WARN, "PLC returned less data than the tag size!");
+                rc = PLCTAG_ERR_TOO_SMALL;
+            } else {
+                pdebug(DEBUG_DETAIL, "Short fragment, asking for the remaining %d bytes at offset %d.", frag->size, frag->plc_offset);
+
+                /* make the next read line up with what the PLC really sends. */
+                tag->read_data_per_packet = payload_size;
+
+                rc = build_read_request_connected(tag, frag->elem_count, frag->plc_offset);
+                frag->req = tag->req;
+                tag->req = NULL;
+                pending = 1;
+            }
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Fragmented read failed, %s!", plc_tag_decode_error(rc));
+        ab_tag_abort(tag);
+        return rc;
+    }
+
+    if(pending) {
+        pdebug(DEBUG_SPEW, "Done.  Fragments still pending.");
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    /* all fragments are in. */
+    ab_tag_release_frags(tag);
+    tag->read_in_progress = 0;
+    tag->offset = 0;
+
+    pdebug(DEBUG_INFO, "Done.  All fragments read.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * check_write_frags_status_connected
+ *
+ * The write is done when every fragment has been acknowledged.
+ */
+
+int check_write_frags_status_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int pending = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    for(int i=0; i < tag->frag_count && rc == PLCTAG_STATUS_OK; i++) {
+        struct ab_frag_t *frag = &tag->frags[i];
+
+        if(!frag->req) {
+            continue;
+        }
+
+        /* request can be used by two threads at once. */
+        spin_block(&frag->req->lock) {
+            if(!frag->req->resp_received) {
+                rc = PLCTAG_STATUS_PENDING;
+                break;
+            }
+
+            if(frag->req->status != PLCTAG_STATUS_OK) {
+                rc = frag->req->status;
+                pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+            }
+        }
+
+        if(rc == PLCTAG_STATUS_PENDING) {
+            pending = 1;
+            rc = PLCTAG_STATUS_OK;
+            continue;
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = decode_write_response_connected(frag->req);
+        }
+
+        frag->req->abort_request = 1;
+        frag->req = rc_dec(frag->req);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Fragmented write failed, %s!", plc_tag_decode_error(rc));
+        ab_tag_abort(tag);
+        return rc;
+    }
+
+    if(pending) {
+        pdebug(DEBUG_SPEW, "Done.  Fragments still pending.");
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    ab_tag_release_frags(tag);
+    tag->write_in_progress = 0;
+    tag->offset = 0;
+
+    pdebug(DEBUG_INFO, "Done.  All fragments written.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+int calculate_write_data_per_packet(ab_tag_p tag)
+{
+    int overhead = 0;
+    int data_per_packet = 0;
+    int max_payload_size = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    /* if we are here, then we have all the type data etc. */
+    if(tag->use_connected_msg) {
+        pdebug(DEBUG_DETAIL,"Connected tag.");
+        max_payload_size = session_get_max_payload(tag->session);
+        overhead =  1                               /* service request, one byte */
+                    + tag->encoded_name_size        /* full encoded name */
+                    + tag->encoded_type_info_size   /* encoded type size */
+                    + 2                             /* element count, 16-bit int */
+                    + 4                             /* byte offset, 32-bit int */
+                    + 8;                            /* MAGIC fudge factor */
+    } else {
+        pdebug(DEBUG_DETAIL,"Unconnected tag.");
+        max_payload_size = session_get_max_payload(tag->session);
+        overhead =  1                               /* service request, one byte */
+                    + tag->encoded_name_size        /* full encoded name */
+                    + tag->encoded_type_info_size   /* encoded type size */
+                    + tag->session->conn_path_size + 2       /* encoded device path size plus two bytes for length and padding */
+                    + 2                             /* element count, 16-bit int */
+                    + 4                             /* byte offset, 32-bit int */
+                    + 8;                            /* MAGIC fudge factor */
+    }
+
+    data_per_packet = max_payload_size - overhead;
+
+    pdebug(DEBUG_DETAIL,"Write packet maximum size is %d, write overhead is %d, and write data per packet is %d.", max_payload_size, overhead, data_per_packet);
+
+    if (data_per_packet <= 0) {
+        pdebug(DEBUG_WARN,
+               "Unable to send request.  Packet overhead, %d bytes, is too large for packet, %d bytes!",
+               overhead,
+               max_payload_size);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    /* we want a multiple of 8 bytes */
+    data_per_packet &= 0xFFFFF8;
+
+    tag->write_data_per_packet = data_per_packet;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * calculate_read_data_per_packet
+ *
+ * Estimate how much tag data fits in one connected read response.  Once
+ * the PLC has sent a partial response, its size is used instead.  If the
+ * estimate is a bit high, the PLC returns less and the remainder is asked
+ * for again.
+ */
+
+int calculate_read_data_per_packet(ab_tag_p tag)
+{
+    int overhead =  2                               /* connection sequence number */
+                    + 4                             /* reply service, reserved, status and status size */
+                    + (tag->encoded_type_info_size ? tag->encoded_type_info_size : 2) /* type info */
+                    + 8;                            /* MAGIC fudge factor */
+    int data_per_packet = session_get_max_payload(tag->session) - overhead;
+
+    /* use what the PLC actually returned if we know it. */
+    if(tag->read_data_per_packet > 0 && tag->read_data_per_packet < data_per_packet) {
+        return tag->read_data_per_packet;
+    }
+
+    /* we want a multiple of 8 bytes */
+    data_per_packet &= 0xFFFFF8;
+
+    if(data_per_packet <= 0) {
+        data_per_packet = 8;
+    }
+
+    return data_per_packet;
+}
+
+
+
+/*
+ * build_udt_request_connected
+ *
+ * Reading a template takes two steps.  First the template attributes are
+ * read to get the size of the definition.  Then the definition itself is
+ * read with the Read Template service, in as many pieces as it takes.
+ */
+
+int build_udt_request_connected(ab_tag_p tag)
+{
+    eip_cip_co_req* cip = NULL;
+    ab_request_p req = NULL;
+    int rc = PLCTAG_STATUS_OK;
+    uint8_t *data_start = NULL;
+    uint8_t *data = NULL;
+    uint16_le tmp_u16 = UINT16_LE_INIT(0);
+    uint32_le tmp_u32 = UINT32LE_INIT(0);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* get a request buffer */
+    rc = session_create_request(tag->session, tag->tag_id, &req);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
+        return rc;
+    }
+
+    /* point the request struct at the buffer */
+    cip = (eip_cip_co_req*)(req->data);
+
+    /* point to the end of the struct */
+    data_start = data = (uint8_t*)(cip + 1);
+
+    /* the service */
+    *data = (tag->udt_data_size ? AB_EIP_CMD_CIP_READ : AB_EIP_CMD_CIP_GET_ATTR_LIST);
+    data++;
+
+    /* request path size, in 16-bit words */
+    *data = 3;
+    data++;
+
+    data[0] = 0x20; /* class type */
+    data[1] = 0x6C; /* template class */
+    data[2] = 0x25; /* 16-bit instance ID type */
+    data[3] = 0x00; /* padding */
+    data += 4;
+
+    tmp_u16 = h2le16(tag->udt_id);
+    mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
+    data += (int)sizeof(tmp_u16);
+
+    if(!tag->udt_data_size) {
+        /* MAGIC, four attributes: definition size, structure size, member count, handle. */
+        uint16_t attribs[] = { 4, 0x04, 0x05, 0x02, 0x01 };
+
+        for(int i=0; i < (int)(sizeof(attribs)/sizeof(attribs[0])); i++) {
+            tmp_u16 = h2le16(attribs[i]);
+            mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
+            data += (int)sizeof(tmp_u16);
+        }
+    } else {
+        /* byte offset into the template and the number of bytes left to read. */
+        tmp_u32 = h2le32((uint32_t)tag->offset);
+        mem_copy(data, &tmp_u32, (int)sizeof(tmp_u32));
+        data += (int)sizeof(tmp_u32);
+
+        tmp_u16 = h2le16((uint16_t)(tag->udt_data_size - tag->offset));
+        mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
+        data += (int)sizeof(tmp_u16);
+    }
+
+    /* now we go back and fill in the fields of the static part */
+
+    /* encap fields */
+    cip->encap_command = h2le16(AB_EIP_CONNECTED_SEND); /* ALWAYS 0x0070 Connected Send*/
+
+    /* router timeout */
+    cip->router_timeout = h2le16(1); /* one second timeout, enough? */
+
+    /* Common Packet Format fields for unconnected send. */
+    cip->cpf_item_count = h2le16(2);                 /* ALWAYS 2 */
+    cip->cpf_cai_item_type = h2le16(AB_EIP_ITEM_CAI);/* ALWAYS 0x00A1 connected address item */
+    cip->cpf_cai_item_length = h2le16(4);            /* ALWAYS 4, size of connection ID*/
+    cip->cpf_cdi_item_type = h2le16(AB_EIP_ITEM_CDI);/* ALWAYS 0x00B1 - connected Data Item */
+    cip->cpf_cdi_item_length = h2le16((uint16_t)((int)(data - data_start) + (int)sizeof(cip->cpf_conn_seq_num)));
+
+    /* set the size of the request */
+    req->request_size = (int)((int)sizeof(*cip) + (int)(data - data_start));
+
+    req->allow_packing = tag->allow_packing;
+
+    /* add the request to the session's list. */
+    rc = session_add_request(tag->session, req);
+
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
+        tag->req = rc_dec(req);
+        return rc;
+    }
+
+    /* save the request for later */
+    tag->req = req;
+
+    pdebug(DEBUG_INFO, "Done");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * check_read_udt_status_connected
+ *
+ * Handle the responses for both steps of a template read.  When the whole
+ * definition is in, it is parsed and put in the session's template cache.
+ */
+
+int check_read_udt_status_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    eip_cip_co_resp* cip_resp;
+    uint8_t* data;
+    uint8_t* data_end;
+    int partial_data = 0;
+    int attribute_step = !tag->udt_data_size;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if (!tag->req) {
+        tag->read_in_progress = 0;
+        tag->offset = 0;
+
+        pdebug(DEBUG_WARN,"Read in progress, but no request in flight!");
+
+        return PLCTAG_ERR_READ;
+    }
+
+    /* request can be used by two threads at once. */
+    spin_block(&tag->req->lock) {
+        if(!tag->req->resp_received) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        /* check to see if it was an abort on the session side. */
+        if(tag->req->status != PLCTAG_STATUS_OK) {
+            rc = tag->req->status;
+            tag->req->abort_request = 1;
+
+            pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+
+            tag->read_in_progress = 0;
+            tag->offset = 0;
+
+            break;
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        if(rc_is_error(rc)) {
+            /* the request is dead, from session side. */
+            tag->req = rc_dec(tag->req);
+        }
+
+        return rc;
+    }
+
+    /* the request is ours exclusively. */
+    cip_resp = (eip_cip_co_resp*)(tag->req->data);
+    data = (tag->req->data) + sizeof(eip_cip_co_resp);
+    data_end = (tag->req->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
+
+    do {
+        int payload_size = (int)(data_end - data);
+
+        if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
+            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
+            rc = PLCTAG_ERR_REMOTE_ERR;
+            break;
+        }
+
+        if (cip_resp->reply_service != ((attribute_step ? AB_EIP_CMD_CIP_GET_ATTR_LIST : AB_EIP_CMD_CIP_READ) | AB_EIP_CMD_CIP_OK)) {
+            pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
+            pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
+            pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
+            rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
+            break;
+        }
+
+        if(attribute_step) {
+            rc = decode_udt_attributes(tag, data, data_end);
+
+            /* go get the definition itself. */
+            partial_data = 1;
+            break;
+        }
+
+        partial_data = (cip_resp->status == AB_CIP_STATUS_FRAG);
+
+        if(payload_size > tag->udt_data_size - tag->offset) {
+            pdebug(DEBUG_WARN, "Template data is longer than expected, ignoring the extra %d bytes.", payload_size - (tag->udt_data_size - tag->offset));
+            payload_size = tag->udt_data_size - tag->offset;
+            partial_data = 0;
+        }
+
+        mem_copy(tag->data + UDT_HEADER_SIZE + tag->offset, data, payload_size);
+        tag->offset += payload_size;
+
+        if(payload_size == 0 || tag->offset >= tag->udt_data_size) {
+            partial_data = 0;
+        }
+    } while(0);
+
+    /* clean up the request */
+    tag->req->abort_request = 1;
+    tag->req = rc_dec(tag->req);
+
+    if(rc == PLCTAG_STATUS_OK) {
+        tag->read_in_progress = 0;
+
+        if(partial_data) {
+            rc = tag_read_start(tag);
+        } else {
+            ab_udt_p udt = udt_create(tag->udt_id, tag->udt_handle, tag->udt_struct_size, tag->udt_member_count, tag->data + UDT_HEADER_SIZE, tag->offset);
+
+            if(udt) {
+                session_add_udt(tag->session, udt);
+                rc_dec(udt);
+            } else {
+                pdebug(DEBUG_WARN, "Unable to parse template %u!", (unsigned int)tag->udt_id);
+                rc = PLCTAG_ERR_BAD_REPLY;
+            }
+
+            tag->size = UDT_HEADER_SIZE + tag->offset;
+            tag->elem_count = tag->size;
+            tag->first_read = 0;
+            tag->offset = 0;
+
+            /* the next read starts over with the attributes. */
+            tag->udt_data_size = 0;
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+        pdebug(DEBUG_WARN, "Error received: %s!", plc_tag_decode_error(rc));
+
+        tag->offset = 0;
+        tag->udt_data_size = 0;
+
+        ab_tag_abort(tag);
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * decode_udt_attributes
+ *
+ * Pick the template attributes out of a Get Attribute List response and
+ * size the tag buffer for the header plus the template definition.
+ */
+
+int decode_udt_attributes(ab_tag_p tag, uint8_t *data, uint8_t *data_end)
+{
+    int count = 0;
+
+    if(data_end - data < 2) {
+        return PLCTAG_ERR_TOO_SMALL;
+    }
+
+    count = data[0] + (data[1] << 8);
+    data += 2;
+
+    for(int i=0; i < count; i++) {
+        int attr_id = 0;
+        int attr_status = 0;
+        int attr_size = 0;
+
+        if(data_end - data < 4) {
+            return PLCTAG_ERR_TOO_SMALL;
+        }
+
+        attr_id = data[0] + (data[1] << 8);
+        attr_status = data[2] + (data[3] << 8);
+        data += 4;
+
+        if(attr_status != 0) {
+            pdebug(DEBUG_WARN, "Template attribute %d returned status %d!", attr_id, attr_status);
+            return PLCTAG_ERR_REMOTE_ERR;
+        }
+
+        attr_size = ((attr_id == 4 || attr_id == 5) ? 4 : 2);
+
+        if(data_end - data < attr_size) {
+            return PLCTAG_ERR_TOO_SMALL;
+        }
+
+        switch(attr_id) {
+        case 1:
+            tag->udt_handle = (uint16_t)(data[0] + (data[1] << 8));
+            break;
+
+        case 2:
+            tag->udt_member_count = data[0] + (data[1] << 8);
+            break;
+
+        case 4:
+            tag->udt_def_size = (uint32_t)data[0] + ((uint32_t)data[1] << 8) + ((uint32_t)data[2] << 16) + ((uint32_t)data[3] << 24);
+            break;
+
+        case 5:
+            tag->udt_struct_size = (int)((uint32_t)data[0] + ((uint32_t)data[1] << 8) + ((uint32_t)data[2] << 16) + ((uint32_t)data[3] << 24));
+            break;
+
+        default:
+            break;
+        }
+
+        data += attr_size;
+    }
+
+    /* MAGIC, the definition size counts 23 bytes that Read Template does not return. */
+    tag->udt_data_size = (int)(tag->udt_def_size * 4) - 23;
+
+    if(tag->udt_data_size <= 0 || tag->udt_data_size > 0xFFFF || tag->udt_member_count <= 0) {
+        pdebug(DEBUG_WARN, "Bad template attributes, definition size %u and %d members!", (unsigned int)tag->udt_def_size, tag->udt_member_count);
+        tag->udt_data_size = 0;
+        return PLCTAG_ERR_BAD_REPLY;
+    }
+
+    tag->size = UDT_HEADER_SIZE + tag->udt_data_size;
+    tag->data = (uint8_t*)mem_realloc(tag->data, tag->size);
+    if(!tag->data) {
+        pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
+        tag->udt_data_size = 0;
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->data[0] = (uint8_t)(tag->udt_id & 0xFF);
+    tag->data[1] = (uint8_t)(tag->udt_id >> 8);
+    for(int i=0; i < 4; i++) {
+        tag->data[2 + i] = (uint8_t)(tag->udt_def_size >> (8 * i));
+        tag->data[6 + i] = (uint8_t)((uint32_t)tag->udt_struct_size >> (8 * i));
+    }
+    tag->data[10] = (uint8_t)(tag->udt_member_count & 0xFF);
+    tag->data[11] = (uint8_t)((tag->udt_member_count >> 8) & 0xFF);
+    tag->data[12] = (uint8_t)(tag->udt_handle & 0xFF);
+    tag->data[13] = (uint8_t)(tag->udt_handle >> 8);
+
+    tag->offset = 0;
+
+    pdebug(DEBUG_DETAIL, "Template %u has %d members, %d bytes of definition.", (unsigned int)tag->udt_id, tag->udt_member_count, tag->udt_data_size);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * ab_tag_get_member_offset
+ *
+ * Map a member path to a byte offset in the tag data.  For a @udt/<id>
+ * tag the template is its own and the offset is into one instance of it.
+ * For other tags it is found through the structure handle in the type
+ * information of the last read, so the tag must have been read and its
+ * template must have been read on the same session.  Offsets past the end
+ * of the data are rejected.
+ */
+
+int ab_tag_get_member_offset(plc_tag_p p_tag, const char *member_path, int *bit_num)
+{
+    ab_tag_p tag = (ab_tag_p)p_tag;
+    ab_udt_p udt = NULL;
+    int data_size = 0;
+    int offset = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(p_tag->vtable != &eip_cip_vtable) {
+        pdebug(DEBUG_WARN, "Tag type does not support UDT members.");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(tag->udt_tag) {
+        udt = session_find_udt(tag->session, tag->udt_id);
+    } else if(tag->encoded_type_info_size == 4 && tag->encoded_type_info[0] == AB_CIP_DATA_ABREV_STRUCT) {
+        udt = session_find_udt_by_handle(tag->session, (uint16_t)(tag->encoded_type_info[2] + (tag->encoded_type_info[3] << 8)));
+    } else if(tag->first_read) {
+        pdebug(DEBUG_WARN, "The tag must be read before its members can be found!");
+        return PLCTAG_ERR_NO_DATA;
+    } else {
+        pdebug(DEBUG_WARN, "Tag is not a UDT!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(!udt) {
+        pdebug(DEBUG_WARN, "The template for this tag has not been read!");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    data_size = (tag->udt_tag ? udt->struct_size : tag->size);
+
+    rc = udt_find_member(tag->session, udt, member_path, data_size, &offset, bit_num);
+
+    rc_dec(udt);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return (rc == PLCTAG_STATUS_OK ? offset : rc);
+}
+
+
+
+/*
+ * setup_udt_tag
+ *
+ * A tag named @udt/<id> reads the template with that ID.  The ID is the
+ * low 12 bits of the symbol type of a structure tag in a tag listing.
+ */
+
+int setup_udt_tag(ab_tag_p tag, const char *name)
+{
+    const char *id_str = NULL;
+    char *end = NULL;
+    long udt_id = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!name || str_cmp_i_n(name, "@udt/", 5) != 0) {
+        pdebug(DEBUG_DETAIL, "Tag is not a UDT template request.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    id_str = name + 5;
+    udt_id = strtol(id_str, &end, 10);
+
+    if(end == id_str || *end || udt_id < 0 || udt_id > AB_UDT_MEMBER_ID_MASK) {
+        pdebug(DEBUG_WARN, "Template ID in tag name %s must be a number from 0 to %d!", name, AB_UDT_MEMBER_ID_MASK);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    tag->udt_tag = 1;
+    tag->udt_id = (uint16_t)udt_id;
+    tag->elem_type = AB_TYPE_TAG_ENTRY;
+    tag->elem_count = 1;  /* place holder */
+    tag->elem_size = 1;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * process_tag_list_entries
+ *
+ * Walk the entries in one tag listing response.  This sets the instance
+ * ID to continue from, records each entry's symbol instance ID in the
+ * session and hands each entry to the list callback if there is one.
+ * The symbol key is the name encoded the way cip_encode_tag_name() would
+ * encode it, with the program segment in front for program listings.
+ *
+ * Returns the number of entries.
+ */
+
+int process_tag_list_entries(ab_tag_p tag, uint8_t *data, uint8_t *data_end)
+{
+    char name[MAX_TAG_NAME];
+    int prefix_size = 0;
+    int count = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    /* program listings have the program name segment as their encoded name. */
+    if(tag->encoded_name_size > 1) {
+        prefix_size = tag->encoded_name_size - 1;
+    }
+
+    while((data_end - data) >= (ptrdiff_t)sizeof(tag_list_entry)) {
+        tag_list_entry *entry = (tag_list_entry*)data;
+        int name_len = le2h16(entry->string_len);
+
+        if((data_end - data) < (ptrdiff_t)sizeof(*entry) + name_len) {
+            pdebug(DEBUG_WARN, "Tag listing entry runs past the end of the response!");
+            break;
+        }
+
+        data += sizeof(*entry) + (size_t)name_len;
+        count++;
+
+        /* first element is the symbol instance ID */
+        tag->next_id = (uint16_t)(le2h32(entry->instance_id) + 1);
+
+        if(name_len <= 0 || name_len >= MAX_TAG_NAME) {
+            continue;
+        }
+
+        if(tag->list_callback) {
+            uint32_t array_dims[3];
+
+            for(int i=0; i < 3; i++) {
+                array_dims[i] = le2h32(entry->array_dims[i]);
+            }
+
+            mem_copy(name, (uint8_t *)(entry + 1), name_len);
+            name[name_len] = 0;
+
+            tag->list_callback(tag->tag_id, le2h32(entry->instance_id), le2h16(entry->symbol_type), le2h16(entry->element_length), array_dims, name);
+        }
+
+        record_list_symbol(tag, &tag->encoded_name[1], prefix_size, (uint8_t *)(entry + 1), name_len, le2h32(entry->instance_id), le2h16(entry->symbol_type));
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.  Next ID: %d", tag->next_id);
+
+    return count;
+}
+
+
+
+/*
+ * record_list_symbol
+ *
+ * Remember the symbol instance ID of a listing entry in the session.  The
+ * key is the name encoded the way cip_encode_tag_name() would encode it,
+ * with the program segment, if any, in front.  For atomic types the type
+ * info is known too, so writes to the tag do not need to read it first.
+ */
+
+void record_list_symbol(ab_tag_p tag, uint8_t *prefix, int prefix_size, uint8_t *name, int name_len, uint32_t instance_id, uint16_t symbol_type)
+{
+    uint8_t symbol[MAX_TAG_NAME];
+    int symbol_size = 0;
+
+    if(name_len <= 0 || name_len > 255 || prefix_size + 2 + name_len + 1 > MAX_TAG_NAME) {
+        return;
+    }
+
+    if(prefix_size > 0) {
+        mem_copy(symbol, prefix, prefix_size);
+        symbol_size = prefix_size;
+    }
+
+    symbol[symbol_size++] = 0x91;
+    symbol[symbol_size++] = (uint8_t)name_len;
+    mem_copy(&symbol[symbol_size], name, name_len);
+    symbol_size += name_len;
+
+    if(name_len & 0x01) {
+        symbol[symbol_size++] = 0;
+    }
+
+    session_add_symbol(tag->session, symbol, symbol_size, instance_id);
+
+    /* the high bit marks a structure, otherwise the low byte is the atomic type. */
+    if(!(symbol_type & 0x8000) && (symbol_type & 0xFF) >= AB_CIP_DATA_BIT && (symbol_type & 0xFF) <= AB_CIP_DATA_STRINGI) {
+        uint8_t type_info[2] = { (uint8_t)(symbol_type & 0xFF), 0 };
+
+        session_add_type_info(tag->session, symbol, symbol_size, type_info, (int)sizeof(type_info));
+    }
+}
+
+
+
+/*
+ * decode_tag_list_response_connected
+ *
+ * Check the CIP response to a tag listing request and find the entries
+ * in it.
+ */
+
+int decode_tag_list_response_connected(ab_request_p req, uint8_t **data, uint8_t **data_end, int *partial)
+{
+    eip_cip_co_resp* cip_resp = (eip_cip_co_resp*)(req->data);
+
+    if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+        pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
+        pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
+        return PLCTAG_ERR_REMOTE_ERR;
+    }
+
+    if (cip_resp->reply_service != (AB_EIP_CMD_CIP_LIST_TAGS | AB_EIP_CMD_CIP_OK) ) {
+        pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
+        pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
+        pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
+        return decode_cip_error_code((uint8_t *)&cip_resp->status);
+    }
+
+    /* check to see if this is a partial response. */
+    *partial = (cip_resp->status == AB_CIP_STATUS_FRAG);
+
+    *data = (req->data) + sizeof(eip_cip_co_resp);
+    *data_end = (req->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * reserve_list_buffer
+ *
+ * Make room for size more bytes at tag->offset.  The buffer grows by
+ * doubling so that big listings are not copied on every response.
+ */
+
+int reserve_list_buffer(ab_tag_p tag, int size)
+{
+    int new_capacity = tag->list_capacity * 2;
+
+    if(tag->offset + size <= tag->list_capacity) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(new_capacity < tag->offset + size) {
+        new_capacity = tag->offset + size;
+    }
+
+    pdebug(DEBUG_DETAIL, "Increasing tag buffer size to %d bytes.", new_capacity);
+
+    tag->data = (uint8_t*)mem_realloc(tag->data, new_capacity);
+    if(!tag->data) {
+        pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
+        tag->list_capacity = 0;
+        tag->size = 0;
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->list_capacity = new_capacity;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * start_discovery_connected
+ *
+ * Start a @discover read with the controller scope listing.  The program
+ * listings are added as the controller's "Program:<name>" entries come in.
+ */
+
+int start_discovery_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    ab_tag_release_listings(tag);
+
+    tag->offset = 0;
+    tag->list_entries = 0;
+
+    rc = add_listing(tag, NULL, 0);
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = start_listings_connected(tag);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to start tag discovery, %s!", plc_tag_decode_error(rc));
+        ab_tag_release_listings(tag);
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * add_listing
+ *
+ * Add a listing for a program, or for the controller scope if the program
+ * name is NULL.  It is sent by start_listings_connected().
+ */
+
+int add_listing(ab_tag_p tag, uint8_t *program, int program_len)
+{
+    struct ab_listing_t *listing = NULL;
+    struct ab_listing_t *listings = NULL;
+
+    if(program && (program_len > 255 || 2 + program_len + 1 > MAX_TAG_NAME)) {
+        pdebug(DEBUG_WARN, "Program name is too long to list!");
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    listings = mem_realloc(tag->listings, (tag->listing_count + 1) * (int)sizeof(struct ab_listing_t));
+    if(!listings) {
+        pdebug(DEBUG_WARN, "Unable to allocate listing!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->listings = listings;
+    listing = &tag->listings[tag->listing_count];
+    tag->listing_count++;
+
+    mem_set(listing, 0, (int)sizeof(*listing));
+
+    /* the same symbolic segment cip_encode_tag_name() makes for "Program:<name>". */
+    if(program) {
+        listing->prefix[listing->prefix_size++] = 0x91;
+        listing->prefix[listing->prefix_size++] = (uint8_t)program_len;
+        mem_copy(&listing->prefix[listing->prefix_size], program, program_len);
+        listing->prefix_size += program_len;
+
+        if(program_len & 0x01) {
+            listing->prefix[listing->prefix_size++] = 0;
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * start_listings_connected
+ *
+ * Send the next request of each listing that is not done and has nothing
+ * in flight, up to the in flight limit.  All these requests can be packed
+ * together by the session.
+ */
+
+int start_listings_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int in_flight = 0;
+
+    for(int i=0; i < tag->listing_count; i++) {
+        if(tag->listings[i].req) {
+            in_flight++;
+        }
+    }
+
+    for(int i=0; i < tag->listing_count && in_flight < DISCOVER_MAX_LISTINGS_IN_FLIGHT && rc == PLCTAG_STATUS_OK; i++) {
+        struct ab_listing_t *listing = &tag->listings[i];
+
+        if(listing->done || listing->req) {
+            continue;
+        }
+
+        rc = build_tag_list_request_connected(tag, listing->prefix, listing->prefix_size, listing->next_id);
+
+        /* the request belongs to the listing, not the tag. */
+        listing->req = tag->req;
+        tag->req = NULL;
+
+        in_flight++;
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * check_discover_status_connected
+ *
+ * Take in the listing responses as they arrive, in any order.  When every
+ * listing is done, the merged entries are indexed and the read is done.
+ */
+
+int check_discover_status_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int pending = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    /* listings can be added while walking them, so do not keep pointers into the array. */
+    for(int i=0; i < tag->listing_count && rc == PLCTAG_STATUS_OK; i++) {
+        ab_request_p req = tag->listings[i].req;
+        uint8_t *data = NULL;
+        uint8_t *data_end = NULL;
+        int partial_data = 0;
+
+        if(!req) {
+            continue;
+        }
+
+        /* request can be used by two threads at once. */
+        spin_block(&req->lock) {
+            if(!req->resp_received) {
+                rc = PLCTAG_STATUS_PENDING;
+                break;
+            }
+
+            if(req->status != PLCTAG_STATUS_OK) {
+                rc = req->status;
+                pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+            }
+        }
+
+        if(rc == PLCTAG_STATUS_PENDING) {
+            rc = PLCTAG_STATUS_OK;
+            continue;
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = decode_tag_list_response_connected(req, &data, &data_end, &partial_data);
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = process_discover_entries(tag, i, data, data_end);
+        }
+
+        /* this request is done. */
+        req->abort_request = 1;
+        tag->listings[i].req = rc_dec(req);
+
+        /* a partial response means there is more to ask for, from the next ID. */
+        if(!partial_data) {
+            tag->listings[i].done = 1;
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = start_listings_connected(tag);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Tag discovery failed, %s!", plc_tag_decode_error(rc));
+        tag->list_entries = 0;
+        ab_tag_abort(tag);
+        return rc;
+    }
+
+    for(int i=0; i < tag->listing_count; i++) {
+        if(!tag->listings[i].done) {
+            pending = 1;
+            break;
+        }
+    }
+
+    if(pending) {
+        pdebug(DEBUG_SPEW, "Done.  Listings still pending.");
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    pdebug(DEBUG_INFO, "Discovered %d tags in %d listings.", tag->list_entries, tag->listing_count);
+
+    ab_tag_release_listings(tag);
+
+    tag->elem_count = tag->size = tag->offset;
+    tag->tag_index = tag_index_create(tag->data, tag->size);
+
+    tag->list_entries = 0;
+    tag->first_read = 0;
+    tag->read_in_progress = 0;
+    tag->offset = 0;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * process_discover_entries
+ *
+ * Copy the entries of one listing response into the tag data, in the same
+ * format as a @tags listing but with program tags named with their full
+ * "Program:<name>.<tag>" name.  A listing is added for each program found
+ * in the controller scope listing.
+ */
+
+int process_discover_entries(ab_tag_p tag, int listing_index, uint8_t *data, uint8_t *data_end)
+{
+    char full_name[MAX_TAG_NAME * 2];
+    uint8_t prefix[MAX_TAG_NAME];
+    int prefix_size = tag->listings[listing_index].prefix_size;
+    int program_len = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    /* copy the prefix, the listing array can move if a program listing is added. */
+    mem_copy(prefix, tag->listings[listing_index].prefix, prefix_size);
+
+    if(prefix_size > 0) {
+        program_len = prefix[1];
+        mem_copy(full_name, &prefix[2], program_len);
+        full_name[program_len++] = '.';
+    }
+
+    while(rc == PLCTAG_STATUS_OK && (data_end - data) >= (ptrdiff_t)sizeof(tag_list_entry)) {
+        tag_list_entry *entry = (tag_list_entry*)data;
+        uint8_t *name = (uint8_t *)(entry + 1);
+        int name_len = le2h16(entry->string_len);
+        int full_len = program_len + name_len;
+        tag_list_entry *new_entry = NULL;
+
+        if((data_end - data) < (ptrdiff_t)sizeof(*entry) + name_len) {
+            pdebug(DEBUG_WARN, "Tag listing entry runs past the end of the response!");
+            break;
+        }
+
+        data += sizeof(*entry) + (size_t)name_len;
+
+        tag->listings[listing_index].next_id = (uint16_t)(le2h32(entry->instance_id) + 1);
+
+        if(name_len <= 0 || full_len >= (int)sizeof(full_name)) {
+            continue;
+        }
+
+        mem_copy(&full_name[program_len], name, name_len);
+        full_name[full_len] = 0;
+
+        /* the entry goes in the tag data with the full name. */
+        rc = reserve_list_buffer(tag, (int)sizeof(*entry) + full_len);
+        if(rc != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        new_entry = (tag_list_entry *)(tag->data + tag->offset);
+        mem_copy(new_entry, entry, (int)sizeof(*entry));
+        new_entry->string_len = h2le16((uint16_t)full_len);
+        mem_copy((uint8_t *)(new_entry + 1), full_name, full_len);
+
+        tag->offset += (int)sizeof(*entry) + full_len;
+        tag->list_entries++;
+
+        if(tag->list_callback) {
+            uint32_t array_dims[3];
+
+            for(int i=0; i < 3; i++) {
+                array_dims[i] = le2h32(entry->array_dims[i]);
+            }
+
+            tag->list_callback(tag->tag_id, le2h32(entry->instance_id), le2h16(entry->symbol_type), le2h16(entry->element_length), array_dims, full_name);
+        }
+
+        record_list_symbol(tag, prefix, prefix_size, name, name_len, le2h32(entry->instance_id), le2h16(entry->symbol_type));
+
+        /* list each program as soon as the controller listing names it. */
+        if(prefix_size == 0 && name_len > 8 && str_cmp_i_n(full_name, "Program:", 8) == 0) {
+            pdebug(DEBUG_DETAIL, "Found program %s.", full_name);
+            rc = add_listing(tag, name, name_len);
+        }
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * ab_tag_find_list_entry
+ *
+ * Search the index of a listing tag that has finished reading.
+ */
+
+int ab_tag_find_list_entry(plc_tag_p p_tag, const char *name, int symbol_type, int start_offset)
+{
+    ab_tag_p tag = (ab_tag_p)p_tag;
+
+    if(p_tag->vtable != &eip_cip_vtable || !tag->tag_list) {
+        pdebug(DEBUG_WARN, "Tag is not a tag listing.");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(tag->read_in_progress) {
+        pdebug(DEBUG_DETAIL, "Tag listing read in progress.");
+        return PLCTAG_ERR_BUSY;
+    }
+
+    if(!tag->tag_index) {
+        pdebug(DEBUG_DETAIL, "Tag listing has not been read.");
+        return PLCTAG_ERR_NO_DATA;
+    }
+
+    return tag_index_find(tag->tag_index, tag->data, name, symbol_type, start_offset);
+}
+
+
+
+/*
+ * get_type_info_key
+ *
+ * Type info is keyed on the symbolic name, without the word count byte.
+ * Once the name is resolved to a symbol instance, the symbolic form is
+ * in the saved copy.
+ */
+
+void get_type_info_key(ab_tag_p tag, uint8_t **name, int *name_size)
+{
+    if(tag->symbol_resolved) {
+        *name = &tag->symbolic_name[1];
+        *name_size = tag->symbolic_name_size - 1;
+    } else {
+        *name = &tag->encoded_name[1];
+        *name_size = tag->encoded_name_size - 1;
+    }
+}
+
+
+
+/*
+ * remember_type_info
+ *
+ * Share the type info from a read with the other tags on the session.
+ */
+
+void remember_type_info(ab_tag_p tag)
+{
+    uint8_t *name = NULL;
+    int name_size = 0;
+
+    get_type_info_key(tag, &name, &name_size);
+
+    if(name_size > 0) {
+        session_add_type_info(tag->session, name, name_size, tag->encoded_type_info, tag->encoded_type_info_size);
+    }
+}
+
+
+
+/*
+ * find_type_info
+ *
+ * Look for the tag's type info in the session cache.  An array element
+ * has the same type info as the whole array, so if the full name is not
+ * known, try again without any trailing element segments.
+ */
+
+int find_type_info(ab_tag_p tag)
+{
+    uint8_t *name = NULL;
+    int name_size = 0;
+    int symbolic_size = 0;
+    int type_info_size = MAX_TAG_TYPE_INFO;
+    int i = 0;
+
+    get_type_info_key(tag, &name, &name_size);
+
+    if(name_size <= 0) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(session_find_type_info(tag->session, name, name_size, tag->encoded_type_info, &type_info_size) == PLCTAG_STATUS_OK) {
+        tag->encoded_type_info_size = type_info_size;
+        return PLCTAG_STATUS_OK;
+    }
+
+    while(i < name_size) {
+        switch(name[i]) {
+        case 0x91:
+            if(i + 1 >= name_size) {
+                return PLCTAG_ERR_NOT_FOUND;
+            }
+
+            i += 2 + name[i+1] + (name[i+1] & 0x01);
+            symbolic_size = i;
+            break;
+
+        case 0x28:
+            i += 2;
+            break;
+
+        case 0x29:
+            i += 4;
+            break;
+
+        case 0x2A:
+            i += 6;
+            break;
+
+        default:
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+    }
+
+    if(symbolic_size <= 0 || symbolic_size >= name_size) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    type_info_size = MAX_TAG_TYPE_INFO;
+
+    if(session_find_type_info(tag->session, name, symbolic_size, tag->encoded_type_info, &type_info_size) != PLCTAG_STATUS_OK) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    tag->encoded_type_info_size = type_info_size;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * save_read_template
+ *
+ * Keep the request and a copy of its bytes so that the next read of the
+ * whole tag can send it again without building it.  Failing to save it
+ * only costs the rebuild.
+ */
+
+void save_read_template(ab_tag_p tag, ab_request_p req)
+{
+    ab_tag_release_read_template(tag);
+
+    tag->read_template_data = mem_alloc(req->request_size);
+    if(!tag->read_template_data) {
+        pdebug(DEBUG_DETAIL, "Unable to allocate read template, will rebuild the request each time.");
+        return;
+    }
+
+    mem_copy(tag->read_template_data, req->data, req->request_size);
+    tag->read_template_size = req->request_size;
+    tag->read_template_payload = session_get_max_payload(tag->session);
+    tag->read_template = rc_inc(req);
+}
+
+
+
+/*
+ * send_read_template
+ *
+ * Put the saved read request back on the session's queue.  The session
+ * is done with a request once the response or an error is in it.  If it
+ * is not done, for instance after an abort, or the connection size
+ * changed, the template is dropped and PLCTAG_ERR_NOT_FOUND returned so
+ * that the caller builds a new request.
+ */
+
+int send_read_template(ab_tag_p tag)
+{
+    ab_request_p req = tag->read_template;
+    int rc = PLCTAG_STATUS_OK;
+    int done = 0;
+
+    spin_block(&req->lock) {
+        done = req->resp_received;
+    }
+
+    if(!done || tag->read_template_payload != session_get_max_payload(tag->session) || req->request_capacity < tag->read_template_size) {
+        pdebug(DEBUG_DETAIL, "Read template cannot be used, building a new request.");
+        ab_tag_release_read_template(tag);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    mem_copy(req->data, tag->read_template_data, tag->read_template_size);
+
+    spin_block(&req->lock) {
+        req->request_size = tag->read_template_size;
+        req->status = PLCTAG_STATUS_OK;
+        req->resp_received = 0;
+        req->abort_request = 0;
+    }
+
+    rc = session_add_request(tag->session, req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
+        ab_tag_release_read_template(tag);
+        return rc;
+    }
+
+    tag->req = rc_inc(req);
+
+    pdebug(DEBUG_DETAIL, "Done.  Sent saved read request.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * resolve_symbol_instance
+ *
+ * If a tag listing on this session has seen the tag's base symbol, replace
+ * the symbolic segment(s) for it with a class 0x6B instance segment.  Any
+ * member, array and bit parts of the name are kept.  The symbolic name is
+ * kept if the instance form would not be shorter.  An instance ID from
+ * before the session last connected is dropped and looked up again.
+ */
+
+int resolve_symbol_instance(ab_tag_p tag)
+{
+    uint8_t new_name[MAX_TAG_NAME];
+    uint32_t instance_id = 0;
+    uint32_t symbol_gen = session_get_symbol_gen(tag->session);
+    int prefix_size = 0;
+    int base_size = 0;
+    int new_size = 1;
+    int i = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(tag->symbol_resolved) {
+        if(tag->symbol_gen == symbol_gen) {
+            pdebug(DEBUG_DETAIL, "Done.  Symbol instance is current.");
+            return PLCTAG_STATUS_OK;
+        }
+
+        pdebug(DEBUG_INFO, "Session reconnected, looking up the symbol instance again.");
+        restore_symbolic_name(tag);
+    }
+
+    base_size = get_symbol_base_size(tag, &prefix_size);
+    if(base_size <= 0) {
+        tag->resolve_symbol = 0;
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(session_find_symbol(tag->session, &tag->encoded_name[1], base_size, &instance_id) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "Symbol instance not known yet.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* program segment, if any. */
+    mem_copy(&new_name[new_size], &tag->encoded_name[1], prefix_size);
+    new_size += prefix_size;
+
+    /* symbol class and instance. */
+    new_name[new_size++] = 0x20;
+    new_name[new_size++] = 0x6B;
+
+    if(instance_id <= 0xFF) {
+        new_name[new_size++] = 0x24;
+        new_name[new_size++] = (uint8_t)instance_id;
+    } else if(instance_id <= 0xFFFF) {
+        new_name[new_size++] = 0x25;
+        new_name[new_size++] = 0x00;
+        new_name[new_size++] = (uint8_t)(instance_id & 0xFF);
+        new_name[new_size++] = (uint8_t)((instance_id >> 8) & 0xFF);
+    } else {
+        new_name[new_size++] = 0x26;
+        new_name[new_size++] = 0x00;
+        new_name[new_size++] = (uint8_t)(instance_id & 0xFF);
+        new_name[new_size++] = (uint8_t)((instance_id >> 8) & 0xFF);
+        new_name[new_size++] = (uint8_t)((instance_id >> 16) & 0xFF);
+        new_name[new_size++] = (uint8_t)((instance_id >> 24) & 0xFF);
+    }
+
+    if(new_size - 1 >= base_size) {
+        /* this will not change, so stop looking. */
+        tag->resolve_symbol = 0;
+        pdebug(DEBUG_DETAIL, "Instance segment is not shorter than the symbolic name.");
+        return PLCTAG_STATUS_OK;
+    }
+
+    /* the rest of the name. */
+    i = 1 + base_size;
+    mem_copy(&new_name[new_size], &tag->encoded_name[i], tag->encoded_name_size - i);
+    new_size += tag->encoded_name_size - i;
+
+    new_name[0] = (uint8_t)((new_size - 1)/2);
+
+    /* keep the symbolic name to go back to. */
+    mem_copy(tag->symbolic_name, tag->encoded_name, tag->encoded_name_size);
+    tag->symbolic_name_size = tag->encoded_name_size;
+
+    mem_copy(tag->encoded_name, new_name, new_size);
+    tag->encoded_name_size = new_size;
+    tag->symbol_resolved = 1;
+    tag->symbol_gen = symbol_gen;
+
+    /* any saved request uses the old name. */
+    ab_tag_release_read_template(tag);
+
+    pdebug(DEBUG_INFO, "Done.  Using symbol instance %u, encoded name is now %d bytes.", (unsigned int)instance_id, new_size);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * get_symbol_base_size
+ *
+ * Find the size of the symbolic segments that name the base symbol in the
+ * tag's encoded name.  That is the first segment or, for program-scoped
+ * names, the program segment and the one after it.  Returns zero if the
+ * name does not start with a symbolic segment.
+ */
+
+int get_symbol_base_size(ab_tag_p tag, int *prefix_size)
+{
+    int first_size = 0;
+    int i = 1;
+
+    *prefix_size = 0;
+
+    if(tag->encoded_name_size < 4 || tag->encoded_name[1] != 0x91) {
+        return 0;
+    }
+
+    first_size = 2 + tag->encoded_name[2] + (tag->encoded_name[2] & 0x01);
+    i += first_size;
+
+    /* program-scoped names are looked up with the program segment. */
+    if(tag->encoded_name[2] > 8 && str_cmp_i_n((const char *)&tag->encoded_name[3], "Program:", 8) == 0
+       && i + 1 < tag->encoded_name_size && tag->encoded_name[i] == 0x91) {
+        *prefix_size = first_size;
+        return first_size + 2 + tag->encoded_name[i+1] + (tag->encoded_name[i+1] & 0x01);
+    }
+
+    return first_size;
+}
+
+
+
+/*
+ * restore_symbolic_name
+ *
+ * Go back to the symbolic name the tag was created with.
+ */
+
+void restore_symbolic_name(ab_tag_p tag)
+{
+    if(!tag->symbol_resolved) {
+        return;
+    }
+
+    mem_copy(tag->encoded_name, tag->symbolic_name, tag->symbolic_name_size);
+    tag->encoded_name_size = tag->symbolic_name_size;
+    tag->symbol_resolved = 0;
+
+    /* any saved request uses the instance ID. */
+    ab_tag_release_read_template(tag);
+}
+
+
+
+/*
+ * retry_symbolic_name
+ *
+ * The PLC rejected the path with the symbol instance ID.  The program may
+ * have been changed, so drop the ID from the session, go back to the
+ * symbolic name and start the read or write over.  A pre-write read is
+ * started over as a read and goes on to the write as usual.  A later
+ * listing can supply a new ID.
+ */
+
+int retry_symbolic_name(ab_tag_p tag, int is_write)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int prefix_size = 0;
+    int base_size = 0;
+
+    pdebug(DEBUG_INFO, "Starting.  Symbol instance rejected, retrying with the symbolic name.");
+
+    restore_symbolic_name(tag);
+
+    base_size = get_symbol_base_size(tag, &prefix_size);
+    if(base_size > 0) {
+        session_forget_symbol(tag->session, &tag->encoded_name[1], base_size);
+    }
+
+    rc = (is_write ? tag_write_start(tag) : tag_read_start(tag));
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = PLCTAG_STATUS_PENDING;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * setup_read_ranges
+ *
+ * Parse the "ranges" attribute: a comma separated list of element offsets,
+ * each with an optional element count, like "5,900:2,7321".  The tag data
+ * holds the elements of each range one after another.  The element size
+ * must be set with elem_size or elem_type because the whole array is never
+ * read to find it.
+ */
+
+int setup_read_ranges(ab_tag_p tag, const char *ranges)
+{
+    char **range_strs = NULL;
+    int range_count = 0;
+    int total_count = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(tag->elem_size <= 0) {
+        pdebug(DEBUG_WARN, "Range reads need the element size, set elem_size or elem_type!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    range_strs = str_split(ranges, ",");
+    if(!range_strs || !range_strs[0]) {
+        pdebug(DEBUG_WARN, "No ranges in \"%s\"!", ranges);
+        mem_free(range_strs);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    while(range_strs[range_count]) {
+        range_count++;
+    }
+
+    tag->ranges = mem_alloc(range_count * (int)sizeof(struct ab_range_t));
+    if(!tag->ranges) {
+        pdebug(DEBUG_WARN, "Unable to allocate range array!");
+        mem_free(range_strs);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->range_count = range_count;
+
+    for(int i=0; i < range_count && rc == PLCTAG_STATUS_OK; i++) {
+        char **parts = str_split(range_strs[i], ":");
+        int elem_offset = -1;
+        int elem_count = 1;
+
+        if(!parts || !parts[0] || str_to_int(parts[0], &elem_offset)
+           || (parts[1] && (str_to_int(parts[1], &elem_count) || parts[2]))) {
+            pdebug(DEBUG_WARN, "Unable to parse range \"%s\"!", range_strs[i]);
+            rc = PLCTAG_ERR_BAD_PARAM;
+        } else if(elem_offset < 0 || elem_count <= 0 || elem_offset + elem_count > 0xFFFF) {
+            /* the element count in the request is 16 bits. */
+            pdebug(DEBUG_WARN, "Range \"%s\" is out of bounds!", range_strs[i]);
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+        } else {
+            tag->ranges[i].elem_offset = elem_offset;
+            tag->ranges[i].elem_count = elem_count;
+            total_count += elem_count;
+        }
+
+        if(parts) {
+            mem_free(parts);
+        }
+    }
+
+    mem_free(range_strs);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    tag->elem_count = total_count;
+    tag->size = total_count * tag->elem_size;
+
+    tag->data = (uint8_t*)mem_alloc(tag->size);
+    if(!tag->data) {
+        pdebug(DEBUG_WARN, "Unable to allocate tag data!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.  %d ranges of %d elements in total.", range_count, total_count);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int setup_tag_listing(ab_tag_p tag, const char *name)
+{
+    char **tag_parts = NULL;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    /* "@discover" lists the controller tags and the tags of every program. */
+    if(str_cmp_i(name, "@discover") == 0) {
+        pdebug(DEBUG_DETAIL, "Tag is a whole controller tag discovery request.");
+
+        tag->discover = 1;
+
+        /* fall through to the last part to set up the tag. */
+    } else if(str_cmp_i(name, "@tags") == 0) {
+        /* Check for a match with just "@tags" for a controller tag listing. */
         /* controller tag listing. */
         pdebug(DEBUG_DETAIL, "Tag is a controller tag listing request.");
 
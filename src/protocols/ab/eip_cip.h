@@ -42,6 +42,10 @@ extern tag_byte_order_t logix_tag_listing_byte_order;
 
 /* tag listing helpers */
 extern int setup_tag_listing(ab_tag_p tag, const char *name);
+extern int setup_udt_tag(ab_tag_p tag, const char *name);
+
+/* sparse reads of parts of an array */
+extern int setup_read_ranges(ab_tag_p tag, const char *ranges);
 
 
 #endif
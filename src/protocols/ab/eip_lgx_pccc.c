@@ -86,6 +86,11 @@ struct tag_vtable_t lgx_pccc_vtable = {
 
 static int check_read_status(ab_tag_p tag);
 static int check_write_status(ab_tag_p tag);
+static int build_read_request(ab_tag_p tag, int elem_offset, int elem_count, ab_request_p *req_out);
+static int build_read_frag(ab_tag_p tag, struct ab_frag_t *frag);
+static int decode_read_response(ab_tag_p tag, ab_request_p req, int offset, int size);
+static int decode_read_frag(ab_tag_p tag, struct ab_frag_t *frag);
+static int finish_read(ab_tag_p tag, int rc);
 
 /*
  * tag_status
@@ -157,20 +162,15 @@ int tag_tickler(ab_tag_p tag)
 /*
  * tag_read_start
  *
- * Start a PCCC tag read (PLC5, SLC).
+ * Start a PCCC tag read (PLC5, SLC).  Tags too large for one packet are
+ * read in chunks using the packet offset of the typed read.
  */
 
 int tag_read_start(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
-    ab_request_p req;
-    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));;
     int overhead;
     int data_per_packet;
-    eip_cip_uc_req *lgx_pccc;
-    embedded_pccc *embed_pccc;
-    uint8_t *data;
-    uint8_t *embed_start;
 
     pdebug(DEBUG_INFO,"Starting");
 
@@ -210,16 +210,51 @@ int tag_read_start(ab_tag_p tag)
     }
 
     if(data_per_packet < tag->size) {
+        pdebug(DEBUG_DETAIL,"Tag size is %d and read data per packet is %d, reading in chunks.", tag->size, data_per_packet);
+
+        rc = ab_tag_start_elem_frags(tag, data_per_packet, build_read_frag);
+        if(rc != PLCTAG_STATUS_PENDING) {
+            tag->read_in_progress = 0;
+        }
+
+        return rc;
+    }
+
+    rc = build_read_request(tag, 0, tag->elem_count, &tag->req);
+    if(rc != PLCTAG_STATUS_OK) {
         tag->read_in_progress = 0;
-        pdebug(DEBUG_DETAIL,"Tag size is %d, write overhead is %d, and write data per packet is %d.", tag->size, overhead, data_per_packet);
-        return PLCTAG_ERR_TOO_LARGE;
+        return rc;
     }
 
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+
+/*
+ * build_read_request
+ *
+ * Queue a typed read of elem_count elements starting at elem_offset.
+ */
+
+int build_read_request(ab_tag_p tag, int elem_offset, int elem_count, ab_request_p *req_out)
+{
+    int rc = PLCTAG_STATUS_OK;
+    ab_request_p req;
+    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));;
+    eip_cip_uc_req *lgx_pccc;
+    embedded_pccc *embed_pccc;
+    uint8_t *data;
+    uint8_t *embed_start;
+
+    pdebug(DEBUG_DETAIL,"Starting.");
+
     /* get a request buffer */
     rc = session_create_request(tag->session, tag->tag_id, &req);
 
     if(rc != PLCTAG_STATUS_OK) {
-        tag->read_in_progress = 0;
         pdebug(DEBUG_WARN,"Unable to get new request.  rc=%d",rc);
         return rc;
     }
@@ -249,8 +284,8 @@ int tag_read_start(ab_tag_p tag)
     embed_pccc->pccc_status = 0;  /* STS 0 in request */
     embed_pccc->pccc_seq_num = h2le16(conn_seq_id); /* FIXME - get sequence ID from session? */
     embed_pccc->pccc_function = AB_EIP_PCCCLGX_TYPED_READ_FUNC;
-    embed_pccc->pccc_offset = h2le16((uint16_t)0);
-    embed_pccc->pccc_transfer_size = h2le16((uint16_t)tag->elem_count); /* This is the offset items */
+    embed_pccc->pccc_offset = h2le16((uint16_t)elem_offset); /* first element of this packet */
+    embed_pccc->pccc_transfer_size = h2le16((uint16_t)tag->elem_count); /* total elements in the transfer */
 
     /* point to the end of the struct */
     data = (uint8_t *)(embed_pccc + 1);
@@ -259,8 +294,8 @@ int tag_read_start(ab_tag_p tag)
     mem_copy(data,tag->encoded_name,tag->encoded_name_size);
     data += tag->encoded_name_size;
 
-    /* FIXME - This is the total items */
-    *((uint16_le *)data) = h2le16((uint16_t)tag->elem_count); /* elements */
+    /* elements in this packet */
+    *((uint16_le *)data) = h2le16((uint16_t)elem_count);
     data += sizeof(uint16_le);
 
     /* if this is not an multiple of 16-bit chunks, pad it out */
@@ -327,19 +362,23 @@ int tag_read_start(ab_tag_p tag)
 
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
-        tag->req = rc_dec(req);
-        tag->read_in_progress = 0;
-
+        rc_dec(req);
         return rc;
     }
 
     /* save the request for later */
-    tag->req = req;
-    req = NULL;
+    *req_out = req;
 
-    pdebug(DEBUG_INFO, "Done.");
+    pdebug(DEBUG_DETAIL, "Done.");
 
-    return PLCTAG_STATUS_PENDING;
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int build_read_frag(ab_tag_p tag, struct ab_frag_t *frag)
+{
+    return build_read_request(tag, frag->plc_offset, frag->elem_count, &frag->req);
 }
 
 
@@ -349,18 +388,26 @@ int tag_read_start(ab_tag_p tag)
 /*
  * check_read_status
  *
- * NOTE that we can have only one outstanding request because PCCC
- * does not support fragments.
+ * PCCC does not support CIP fragments, so large tags are read as several
+ * independent chunk requests.
  */
 
 
 static int check_read_status(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
-    ab_request_p req;
 
     pdebug(DEBUG_SPEW,"Starting");
 
+    if(tag->frag_count) {
+        rc = ab_tag_check_elem_frags(tag, decode_read_frag);
+        if(rc == PLCTAG_STATUS_PENDING) {
+            return rc;
+        }
+
+        return finish_read(tag, rc);
+    }
+
     /* check for request in flight. */
     if (!tag->req) {
         tag->read_in_progress = 0;
@@ -402,8 +449,56 @@ static int check_read_status(ab_tag_p tag)
     }
 
     /* the request is ours exclusively. */
+    rc = decode_read_response(tag, tag->req, 0, tag->size);
 
-    req = tag->req;
+    /* clean up the request */
+    tag->req->abort_request = 1;
+    tag->req = rc_dec(tag->req);
+
+    pdebug(DEBUG_SPEW,"Done.");
+
+    return finish_read(tag, rc);
+}
+
+
+
+/*
+ * finish_read
+ *
+ * Mark the read done and start the write if this was a pre-read.
+ */
+
+int finish_read(ab_tag_p tag, int rc)
+{
+    /* done! */
+    if(rc == PLCTAG_STATUS_OK) {
+        tag->first_read = 0;
+    }
+
+    tag->read_in_progress = 0;
+
+    /* if this is a pre-read for a write, then pass off the the write routine */
+    if (rc == PLCTAG_STATUS_OK && tag->pre_write_read) {
+        pdebug(DEBUG_DETAIL, "Restarting write call now.");
+
+        tag->pre_write_read = 0;
+        rc = tag_write_start(tag);
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * decode_read_response
+ *
+ * Check a typed read response and copy its data into the tag at offset.
+ */
+
+int decode_read_response(ab_tag_p tag, ab_request_p req, int offset, int size)
+{
+    int rc = PLCTAG_STATUS_OK;
 
     /* fake exceptions */
     do {
@@ -471,7 +566,7 @@ static int check_read_status(ab_tag_p tag)
         type_end = data;
 
         /* copy data into the tag. */
-        if((data_end - data) > tag->size) {
+        if((data_end - data) > size) {
             rc = PLCTAG_ERR_TOO_LARGE;
             break;
         }
@@ -482,40 +577,29 @@ static int check_read_status(ab_tag_p tag)
          * the user has set, possibly.
          */
         if(!tag->pre_write_read) {
-            mem_copy(tag->data, data, (int)(data_end - data));
+            mem_copy(tag->data + offset, data, (int)(data_end - data));
         }
 
-        /* copy type data into tag. */
-        tag->encoded_type_info_size = (int)(type_end - type_start);
-        mem_copy(tag->encoded_type_info, type_start, tag->encoded_type_info_size);
-
-        /* done! */
-        tag->first_read = 0;
-
-        /* have the IO thread take care of the request buffers */
-        ab_tag_abort(tag);
+        /*
+         * copy type data into tag.  A chunk only describes its own
+         * part of the tag so its type data is not kept.
+         */
+        if(offset == 0 && size == tag->size) {
+            tag->encoded_type_info_size = (int)(type_end - type_start);
+            mem_copy(tag->encoded_type_info, type_start, tag->encoded_type_info_size);
+        }
 
         rc = PLCTAG_STATUS_OK;
     } while(0);
 
-    /* clean up the request */
-    if(tag->req) {
-        tag->req = rc_dec(req);
-    }
-
-    tag->read_in_progress = 0;
-
-    /* if this is a pre-read for a write, then pass off the the write routine */
-    if (rc == PLCTAG_STATUS_OK && tag->pre_write_read) {
-        pdebug(DEBUG_DETAIL, "Restarting write call now.");
+    return rc;
+}
 
-        tag->pre_write_read = 0;
-        rc = tag_write_start(tag);
-    }
 
-    pdebug(DEBUG_SPEW,"Done.");
 
-    return rc;
+int decode_read_frag(ab_tag_p tag, struct ab_frag_t *frag)
+{
+    return decode_read_response(tag, frag->req, frag->offset, frag->size);
 }
 
 
@@ -45,6 +45,14 @@
 
 static int check_read_status(ab_tag_p tag);
 static int check_write_status(ab_tag_p tag);
+static int build_read_request(ab_tag_p tag, int offset, int size, ab_request_p *req_out);
+static int build_read_frag(ab_tag_p tag, struct ab_frag_t *frag);
+static int decode_read_response(ab_tag_p tag, ab_request_p req, int offset, int size);
+static int decode_read_frag(ab_tag_p tag, struct ab_frag_t *frag);
+static int build_write_request(ab_tag_p tag, int offset, int size, ab_request_p *req_out);
+static int build_write_frag(ab_tag_p tag, struct ab_frag_t *frag);
+static int decode_write_response(ab_request_p req);
+static int decode_write_frag(ab_tag_p tag, struct ab_frag_t *frag);
 
 
 
@@ -222,12 +230,9 @@ int tag_tickler(ab_tag_p tag)
  */
 int tag_read_start(ab_tag_p tag)
 {
-    pccc_dhp_co_req *pccc;
-    uint8_t *data = NULL;
     int data_per_packet = 0;
     int overhead = 0;
     int rc = PLCTAG_STATUS_OK;
-    ab_request_p req = NULL;
 
     pdebug(DEBUG_INFO, "Starting");
 
@@ -252,15 +257,47 @@ int tag_read_start(ab_tag_p tag)
     }
 
     if(data_per_packet < tag->size) {
+        pdebug(DEBUG_DETAIL, "Tag size is %d and read data per packet is %d, reading in chunks.", tag->size, data_per_packet);
+
+        rc = ab_tag_start_elem_frags(tag, data_per_packet, build_read_frag);
+        if(rc != PLCTAG_STATUS_PENDING) {
+            tag->read_in_progress = 0;
+        }
+
+        return rc;
+    }
+
+    rc = build_read_request(tag, 0, tag->size, &tag->req);
+    if(rc != PLCTAG_STATUS_OK) {
         tag->read_in_progress = 0;
-        pdebug(DEBUG_DETAIL, "Unable to send request: Tag size is %d, write overhead is %d, and write data per packet is %d!", tag->size, overhead, data_per_packet);
-        return PLCTAG_ERR_TOO_LARGE;
+        return rc;
     }
 
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+
+/*
+ * build_read_request
+ *
+ * Queue a word range read of size bytes starting at byte offset in the tag.
+ */
+
+int build_read_request(ab_tag_p tag, int offset, int size, ab_request_p *req_out)
+{
+    pccc_dhp_co_req *pccc;
+    uint8_t *data = NULL;
+    int rc = PLCTAG_STATUS_OK;
+    ab_request_p req = NULL;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
     /* get a request buffer */
     rc = session_create_request(tag->session, tag->tag_id, &req);
     if(rc != PLCTAG_STATUS_OK) {
-        tag->read_in_progress = 0;
         pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
         return rc;
     }
@@ -275,7 +312,7 @@ int tag_read_start(ab_tag_p tag)
     data += tag->encoded_name_size;
 
     /* amount of data to get this time */
-    *data = (uint8_t)(tag->size); /* bytes for this transfer */
+    *data = (uint8_t)(size); /* bytes for this transfer */
     data++;
 
     /* encap fields */
@@ -300,9 +337,9 @@ int tag_read_start(ab_tag_p tag)
     /* PCCC Command */
     pccc->pccc_command = AB_EIP_PCCC_TYPED_CMD;
     pccc->pccc_status = 0;  /* STS 0 in request */
-    pccc->pccc_seq_num = /*h2le16(conn_seq_id)*/ h2le16((uint16_t)(intptr_t)(tag->session));
+    pccc->pccc_seq_num = h2le16((uint16_t)session_get_new_seq_id(tag->session)); /* unique, the session matches pipelined responses by TNS */
     pccc->pccc_function = AB_EIP_PLC5_RANGE_READ_FUNC;
-    pccc->pccc_transfer_offset = h2le16((uint16_t)0);
+    pccc->pccc_transfer_offset = h2le16((uint16_t)(offset/2));  /* offset in 2-byte words */
     pccc->pccc_transfer_size = h2le16((uint16_t)((tag->size)/2));  /* size in 2-byte words */
 
     /* get ready to add the request to the queue for this session */
@@ -312,39 +349,34 @@ int tag_read_start(ab_tag_p tag)
     rc = session_add_request(tag->session, req);
 
     if(rc != PLCTAG_STATUS_OK) {
-        tag->read_in_progress = 0;
         pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
         req->abort_request = 1;
-        tag->req = rc_dec(req);
+        rc_dec(req);
         return rc;
     }
 
     /* save the request for later */
-    tag->req = req;
-//    tag->status = PLCTAG_STATUS_PENDING;
+    *req_out = req;
 
-    /* the read is now pending */
-    pdebug(DEBUG_INFO, "Done.");
+    pdebug(DEBUG_DETAIL, "Done.");
 
-    return PLCTAG_STATUS_PENDING;
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int build_read_frag(ab_tag_p tag, struct ab_frag_t *frag)
+{
+    return build_read_request(tag, frag->offset, frag->size, &frag->req);
 }
 
 
 
 int tag_write_start(ab_tag_p tag)
 {
-    pccc_dhp_co_req *pccc;
-    uint8_t *data;
-//    uint8_t element_def[16];
-//    int element_def_size;
-//    uint8_t array_def[16];
-//    int array_def_size;
-//    int pccc_data_type;
     int data_per_packet = 0;
     int overhead = 0;
-    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));;
     int rc = PLCTAG_STATUS_OK;
-    ab_request_p req;
 
     pdebug(DEBUG_INFO, "Starting");
 
@@ -376,16 +408,54 @@ int tag_write_start(ab_tag_p tag)
     }
 
     if(data_per_packet < tag->size) {
+        pdebug(DEBUG_DETAIL, "Tag size is %d and write data per packet is %d, writing in chunks.", tag->size, data_per_packet);
+
+        rc = ab_tag_start_elem_frags(tag, data_per_packet, build_write_frag);
+        if(rc != PLCTAG_STATUS_PENDING) {
+            tag->write_in_progress = 0;
+        }
+
+        return rc;
+    }
+
+    rc = build_write_request(tag, 0, tag->size, &tag->req);
+    if(rc != PLCTAG_STATUS_OK) {
         tag->write_in_progress = 0;
-        pdebug(DEBUG_WARN, "PCCC requests cannot be fragmented.  Too much data requested.");
-        return PLCTAG_ERR_TOO_LARGE;
+        return rc;
     }
 
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+
+/*
+ * build_write_request
+ *
+ * Queue a word range write of size bytes starting at byte offset in the tag.
+ */
+
+int build_write_request(ab_tag_p tag, int offset, int size, ab_request_p *req_out)
+{
+    pccc_dhp_co_req *pccc;
+    uint8_t *data;
+//    uint8_t element_def[16];
+//    int element_def_size;
+//    uint8_t array_def[16];
+//    int array_def_size;
+//    int pccc_data_type;
+    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));;
+    int rc = PLCTAG_STATUS_OK;
+    ab_request_p req;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
     /* get a request buffer */
     rc = session_create_request(tag->session, tag->tag_id, &req);
 
     if(rc != PLCTAG_STATUS_OK) {
-        tag->write_in_progress = 0;
         pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
         return rc;
     }
@@ -400,8 +470,8 @@ int tag_write_start(ab_tag_p tag)
     data += tag->encoded_name_size;
 
     /* now copy the data to write */
-    mem_copy(data, tag->data, tag->size);
-    data += tag->size;
+    mem_copy(data, tag->data + offset, size);
+    data += size;
 
     /* now fill in the rest of the structure. */
 
@@ -429,7 +499,7 @@ int tag_write_start(ab_tag_p tag)
     pccc->pccc_status = 0;  /* STS 0 in request */
     pccc->pccc_seq_num = h2le16(conn_seq_id); /* FIXME - get sequence ID from session? */
     pccc->pccc_function = AB_EIP_PLC5_RANGE_WRITE_FUNC;
-    pccc->pccc_transfer_offset = h2le16((uint16_t)0);
+    pccc->pccc_transfer_offset = h2le16((uint16_t)(offset/2));  /* offset in 2-byte words */
     pccc->pccc_transfer_size = h2le16((uint16_t)((tag->size)/2));  /* size in 2-byte words */
 
     /* get ready to add the request to the queue for this session */
@@ -439,20 +509,25 @@ int tag_write_start(ab_tag_p tag)
     rc = session_add_request(tag->session, req);
 
     if(rc != PLCTAG_STATUS_OK) {
-        tag->write_in_progress = 0;
         pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
         req->abort_request = 1;
-        tag->req = rc_dec(req);
+        rc_dec(req);
         return rc;
     }
 
     /* save the request for later */
-    tag->req = req;
-//    tag->status = PLCTAG_STATUS_PENDING;
+    *req_out = req;
 
-    pdebug(DEBUG_INFO, "Done.");
+    pdebug(DEBUG_DETAIL, "Done.");
 
-    return PLCTAG_STATUS_PENDING;
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int build_write_frag(ab_tag_p tag, struct ab_frag_t *frag)
+{
+    return build_write_request(tag, frag->offset, frag->size, &frag->req);
 }
 
 
@@ -463,13 +538,19 @@ int tag_write_start(ab_tag_p tag)
  */
 static int check_read_status(ab_tag_p tag)
 {
-    pccc_dhp_co_resp *resp;
-    uint8_t *data;
-    uint8_t *data_end;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_SPEW, "Starting");
 
+    if(tag->frag_count) {
+        rc = ab_tag_check_elem_frags(tag, decode_read_frag);
+        if(rc != PLCTAG_STATUS_PENDING) {
+            tag->read_in_progress = 0;
+        }
+
+        return rc;
+    }
+
     /* is there a request in flight? */
     if (!tag->req) {
         tag->read_in_progress = 0;
@@ -513,14 +594,41 @@ static int check_read_status(ab_tag_p tag)
     }
 
     /* the request is ours exclusively. */
+    rc = decode_read_response(tag, tag->req, 0, tag->size);
 
-    resp = (pccc_dhp_co_resp *)(tag->req->data);
+    /* clean up the request */
+    tag->req->abort_request = 1;
+    tag->req = rc_dec(tag->req);
+
+    tag->read_in_progress = 0;
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * decode_read_response
+ *
+ * Check a read response and copy its data into the tag at offset.
+ */
+
+int decode_read_response(ab_tag_p tag, ab_request_p req, int offset, int size)
+{
+    pccc_dhp_co_resp *resp;
+    uint8_t *data;
+    uint8_t *data_end;
+    int rc = PLCTAG_STATUS_OK;
+
+    resp = (pccc_dhp_co_resp *)(req->data);
 
     /* point to the start of the data */
     data = (uint8_t *)resp + sizeof(*resp);
 
     /* point to the end of the data */
-    data_end = (tag->req->data + le2h16(resp->encap_length) + sizeof(eip_encap));
+    data_end = (req->data + le2h16(resp->encap_length) + sizeof(eip_encap));
 
     /* fake exception */
     do {
@@ -543,43 +651,49 @@ static int check_read_status(ab_tag_p tag)
         }
 
         /* did we get the right amount of data? */
-        if((data_end - data) != tag->size) {
-            if((int)(data_end - data) > tag->size) {
-                pdebug(DEBUG_WARN, "Too much data received!  Expected %d bytes but got %d bytes!", tag->size, (int)(data_end - data));
+        if((data_end - data) != size) {
+            if((int)(data_end - data) > size) {
+                pdebug(DEBUG_WARN, "Too much data received!  Expected %d bytes but got %d bytes!", size, (int)(data_end - data));
                 rc = PLCTAG_ERR_TOO_LARGE;
             } else {
-                pdebug(DEBUG_WARN, "Too little data received!  Expected %d bytes but got %d bytes!", tag->size, (int)(data_end - data));
+                pdebug(DEBUG_WARN, "Too little data received!  Expected %d bytes but got %d bytes!", size, (int)(data_end - data));
                 rc = PLCTAG_ERR_TOO_SMALL;
             }
             break;
         }
 
         /* copy data into the tag. */
-        mem_copy(tag->data, data, (int)(data_end - data));
+        mem_copy(tag->data + offset, data, (int)(data_end - data));
 
         rc = PLCTAG_STATUS_OK;
     } while(0);
 
-    /* clean up the request */
-    tag->req->abort_request = 1;
-    tag->req = rc_dec(tag->req);
+    return rc;
+}
 
-    tag->read_in_progress = 0;
 
-    pdebug(DEBUG_SPEW, "Done.");
 
-    return rc;
+int decode_read_frag(ab_tag_p tag, struct ab_frag_t *frag)
+{
+    return decode_read_response(tag, frag->req, frag->offset, frag->size);
 }
 
 
 static int check_write_status(ab_tag_p tag)
 {
-    pccc_dhp_co_resp *pccc_resp;
-//    uint8_t *data = NULL;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
+    if(tag->frag_count) {
+        rc = ab_tag_check_elem_frags(tag, decode_write_frag);
+        if(rc != PLCTAG_STATUS_PENDING) {
+            tag->write_in_progress = 0;
+        }
+
+        return rc;
+    }
+
     /* is there an outstanding request? */
     if (!tag->req) {
         tag->write_in_progress = 0;
@@ -624,8 +738,33 @@ static int check_write_status(ab_tag_p tag)
     }
 
     /* the request is ours exclusively. */
+    rc = decode_write_response(tag->req);
+
+    /* clean up any outstanding requests. */
+    tag->req->abort_request = 1;
+    tag->req = rc_dec(tag->req);
+    tag->write_in_progress = 0;
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
 
-    pccc_resp = (pccc_dhp_co_resp *)(tag->req->data);
+
+/*
+ * decode_write_response
+ *
+ * Check the status of a write response.
+ */
+
+int decode_write_response(ab_request_p req)
+{
+    pccc_dhp_co_resp *pccc_resp;
+//    uint8_t *data = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    pccc_resp = (pccc_dhp_co_resp *)(req->data);
 
     /* point data just past the header */
 //    data = (uint8_t *)pccc_resp + sizeof(*pccc_resp);
@@ -655,12 +794,14 @@ static int check_write_status(ab_tag_p tag)
         rc = PLCTAG_STATUS_OK;
     } while(0);
 
-    /* clean up any outstanding requests. */
-    tag->req->abort_request = 1;
-    tag->req = rc_dec(tag->req);
-    tag->write_in_progress = 0;
+    return rc;
+}
 
-    pdebug(DEBUG_SPEW, "Done.");
 
-    return rc;
+
+int decode_write_frag(ab_tag_p tag, struct ab_frag_t *frag)
+{
+    (void)tag;
+
+    return decode_write_response(frag->req);
 }
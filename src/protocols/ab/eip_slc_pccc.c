@@ -87,6 +87,14 @@ tag_byte_order_t slc_tag_byte_order = {
 
 static int check_read_status(ab_tag_p tag);
 static int check_write_status(ab_tag_p tag);
+static int build_read_request(ab_tag_p tag, int offset, int size, ab_request_p *req_out);
+static int build_read_frag(ab_tag_p tag, struct ab_frag_t *frag);
+static int decode_read_response(ab_tag_p tag, ab_request_p req, int offset, int size);
+static int decode_read_frag(ab_tag_p tag, struct ab_frag_t *frag);
+static int build_write_request(ab_tag_p tag, int offset, int size, ab_request_p *req_out);
+static int build_write_frag(ab_tag_p tag, struct ab_frag_t *frag);
+static int decode_write_response(ab_request_p req);
+static int decode_write_frag(ab_tag_p tag, struct ab_frag_t *frag);
 
 
 
@@ -202,19 +210,15 @@ int tag_tickler(ab_tag_p tag)
 /*
  * tag_read_start
  *
- * Start a PCCC tag read (SLC).
+ * Start a PCCC tag read (SLC).  Tags too large for one packet are read
+ * in chunks, each addressed to its own first element.
  */
 
 int tag_read_start(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
-    ab_request_p req;
-    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));;
     int overhead;
     int data_per_packet;
-    pccc_req *pccc;
-    uint8_t *data;
-    uint8_t *embed_start;
 
     pdebug(DEBUG_INFO,"Starting");
 
@@ -225,9 +229,6 @@ int tag_read_start(ab_tag_p tag)
 
     tag->read_in_progress = 1;
 
-    /* how many packets will we need? How much overhead? */
-    //overhead = sizeof(pccc_resp) + 4 + tag->encoded_name_size; /* MAGIC 4 = fudge */
-
     /* calculate based on the response. */
     overhead =   1      /* PCCC CMD */
                 +1      /* PCCC status */
@@ -242,16 +243,51 @@ int tag_read_start(ab_tag_p tag)
     }
 
     if(data_per_packet < tag->size) {
-        pdebug(DEBUG_DETAIL,"Unable to send request: Tag size is %d, write overhead is %d, and write data per packet is %d!", tag->size, overhead, data_per_packet);
+        pdebug(DEBUG_DETAIL, "Tag size is %d and read data per packet is %d, reading in chunks.", tag->size, data_per_packet);
+
+        rc = ab_tag_start_elem_frags(tag, data_per_packet, build_read_frag);
+        if(rc != PLCTAG_STATUS_PENDING) {
+            tag->read_in_progress = 0;
+        }
+
+        return rc;
+    }
+
+    rc = build_read_request(tag, 0, tag->size, &tag->req);
+    if(rc != PLCTAG_STATUS_OK) {
         tag->read_in_progress = 0;
-        return PLCTAG_ERR_TOO_LARGE;
+        return rc;
     }
 
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+
+/*
+ * build_read_request
+ *
+ * Queue a typed logical read of size bytes starting at byte offset in the tag.
+ */
+
+int build_read_request(ab_tag_p tag, int offset, int size, ab_request_p *req_out)
+{
+    int rc = PLCTAG_STATUS_OK;
+    ab_request_p req = NULL;
+    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));;
+    pccc_req *pccc;
+    uint8_t *data;
+    uint8_t *embed_start;
+    int name_size = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
     /* get a request buffer */
     rc = session_create_request(tag->session, tag->tag_id, &req);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN,"Unable to get new request.  rc=%d",rc);
-        tag->read_in_progress = 0;
         return rc;
     }
 
@@ -279,14 +315,38 @@ int tag_read_start(ab_tag_p tag)
     pccc->pccc_status = 0;  /* STS 0 in request */
     pccc->pccc_seq_num = h2le16(conn_seq_id);
     pccc->pccc_function = AB_EIP_SLC_RANGE_READ_FUNC;
-    pccc->pccc_transfer_size = (uint8_t)(tag->elem_size * tag->elem_count); /* size to read/write in bytes. */
+    pccc->pccc_transfer_size = (uint8_t)(size); /* size to read/write in bytes. */
 
     /* point to the end of the struct */
     data = ((uint8_t *)pccc) + sizeof(pccc_req);
 
-    /* copy encoded tag name into the request */
-    mem_copy(data,tag->encoded_name,tag->encoded_name_size);
-    data += tag->encoded_name_size;
+    /* copy the encoded tag name, moved to the first element to read, into the request */
+    rc = slc_offset_tag_name(data, &name_size, tag->encoded_name, tag->encoded_name_size, (offset ? offset / tag->elem_size : 0));
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to address the element at byte offset %d, %s!", offset, plc_tag_decode_error(rc));
+        rc_dec(req);
+        return rc;
+    }
+
+    data += name_size;
+
+    /* whole tag reads of plain elements can be merged with reads of nearby elements of the same file. */
+    if(offset == 0 && size == tag->size && tag->elem_size > 0 && !tag->pccc_no_merge && !tag->pccc_solo_read) {
+        int sub_elem_num = 0;
+
+        if(slc_decode_tag_name(tag->encoded_name, tag->encoded_name_size, &req->pccc_file_num, &req->pccc_file_type, &req->pccc_elem, &sub_elem_num) == PLCTAG_STATUS_OK
+           && sub_elem_num == 0) {
+            req->pccc_elem_size = tag->elem_size;
+            req->pccc_read_size = size;
+            req->pccc_size_offset = (int)(&pccc->pccc_transfer_size - req->data);
+
+            /* the same limit as for chunked reads, and it has to fit in the transfer size byte. */
+            req->pccc_max_size = session_get_max_payload(tag->session) - 4;
+            if(req->pccc_max_size > UINT8_MAX) {
+                req->pccc_max_size = UINT8_MAX;
+            }
+        }
+    }
 
     /*
      * after the embedded packet, we need to tell the message router
@@ -312,48 +372,60 @@ int tag_read_start(ab_tag_p tag)
     /* mark it as ready to send */
     //req->send_request = 1;
 
+    /* several of these can share one Multiple Service Packet. */
+    req->allow_packing = tag->allow_packing;
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
         req->abort_request = 1;
-        tag->read_in_progress = 0;
-
-        tag->req = rc_dec(req);
-
+        rc_dec(req);
         return rc;
     }
 
     /* save the request for later */
-    tag->req = req;
-//    tag->status = PLCTAG_STATUS_PENDING;
+    *req_out = req;
 
-    pdebug(DEBUG_INFO, "Done.");
+    pdebug(DEBUG_DETAIL, "Done.");
 
-    return PLCTAG_STATUS_PENDING;
+    return PLCTAG_STATUS_OK;
 }
 
 
 
+int build_read_frag(ab_tag_p tag, struct ab_frag_t *frag)
+{
+    return build_read_request(tag, frag->offset, frag->size, &frag->req);
+}
+
+
 
 
 /*
  * check_read_status
  *
- * NOTE that we can have only one outstanding request because PCCC
- * does not support fragments.
+ * PCCC does not support CIP fragments, so large tags are read as several
+ * independent chunk requests.
  */
 
 
 static int check_read_status(ab_tag_p tag)
 {
-    pccc_resp *pccc;
-    uint8_t *data;
-    uint8_t *data_end;
     int rc = PLCTAG_STATUS_OK;
+    int merged = 0;
 
     pdebug(DEBUG_SPEW,"Starting");
 
+    if(tag->frag_count) {
+        rc = ab_tag_check_elem_frags(tag, decode_read_frag);
+        if(rc != PLCTAG_STATUS_PENDING) {
+            tag->read_in_progress = 0;
+        }
+
+        return rc;
+    }
+
     /* is there a request in flight? */
     if (!tag->req) {
         tag->read_in_progress = 0;
@@ -395,13 +467,63 @@ static int check_read_status(ab_tag_p tag)
     }
 
     /* the request is ours exclusively. */
+    rc = decode_read_response(tag, tag->req, 0, tag->size);
+    merged = tag->req->pccc_merged;
+
+    /* clean up the request */
+    tag->req->abort_request = 1;
+    tag->req = rc_dec(tag->req);
+
+    /* one bad address fails a whole merged read, so try this tag alone before blaming it. */
+    if(tag->pccc_solo_read) {
+        tag->pccc_solo_read = 0;
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_DETAIL, "Read failed on its own too, not merging this tag's reads any more.");
+            tag->pccc_no_merge = 1;
+        }
+    } else if(rc != PLCTAG_STATUS_OK && merged) {
+        pdebug(DEBUG_DETAIL, "Merged block read failed, %s.  Reading this tag alone.", plc_tag_decode_error(rc));
+
+        tag->pccc_solo_read = 1;
+
+        rc = build_read_request(tag, 0, tag->size, &tag->req);
+        if(rc == PLCTAG_STATUS_OK) {
+            return PLCTAG_STATUS_PENDING;
+        }
+
+        tag->pccc_solo_read = 0;
+    }
+
+    tag->read_in_progress = 0;
 
-    pccc = (pccc_resp*)(tag->req->data);
+    pdebug(DEBUG_SPEW,"Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * decode_read_response
+ *
+ * Check a read response and copy its data into the tag at offset.
+ */
+
+int decode_read_response(ab_tag_p tag, ab_request_p req, int offset, int size)
+{
+    pccc_resp *pccc;
+    uint8_t *data;
+    uint8_t *data_end;
+    int rc = PLCTAG_STATUS_OK;
+
+    pccc = (pccc_resp *)(req->data);
 
     /* point to the start of the data */
     data = (uint8_t *)pccc + sizeof(*pccc);
 
-    data_end = (tag->req->data + le2h16(pccc->encap_length) + sizeof(eip_encap));
+    /* point to the end of the data */
+    data_end = (req->data + le2h16(pccc->encap_length) + sizeof(eip_encap));
 
     /* fake exceptions */
     do {
@@ -429,50 +551,55 @@ static int check_read_status(ab_tag_p tag)
             break;
         }
 
+        /* a merged block read carries other tags' data too, ours starts resp_data_offset bytes in. */
+        if(req->pccc_merged) {
+            if((int)(data_end - data) < req->resp_data_offset + size) {
+                pdebug(DEBUG_WARN, "Too little data received for merged read!  Expected %d bytes but got %d bytes!", req->resp_data_offset + size, (int)(data_end - data));
+                rc = PLCTAG_ERR_TOO_SMALL;
+                break;
+            }
+
+            data += req->resp_data_offset;
+            data_end = data + size;
+        }
+
         /* did we get the right amount of data? */
-        if((data_end - data) != tag->size) {
-            if((int)(data_end - data) > tag->size) {
-                pdebug(DEBUG_WARN,"Too much data received!  Expected %d bytes but got %d bytes!", tag->size, (int)(data_end - data));
+        if((data_end - data) != size) {
+            if((int)(data_end - data) > size) {
+                pdebug(DEBUG_WARN, "Too much data received!  Expected %d bytes but got %d bytes!", size, (int)(data_end - data));
                 rc = PLCTAG_ERR_TOO_LARGE;
             } else {
-                pdebug(DEBUG_WARN,"Too little data received!  Expected %d bytes but got %d bytes!", tag->size, (int)(data_end - data));
+                pdebug(DEBUG_WARN, "Too little data received!  Expected %d bytes but got %d bytes!", size, (int)(data_end - data));
                 rc = PLCTAG_ERR_TOO_SMALL;
             }
             break;
         }
 
         /* copy data into the tag. */
-        mem_copy(tag->data, data, (int)(data_end - data));
+        mem_copy(tag->data + offset, data, (int)(data_end - data));
 
         rc = PLCTAG_STATUS_OK;
     } while(0);
 
-    /* clean up the request */
-    tag->req->abort_request = 1;
-    tag->req = rc_dec(tag->req);
+    return rc;
+}
 
-    tag->read_in_progress = 0;
 
-    pdebug(DEBUG_SPEW,"Done.");
 
-    return rc;
+int decode_read_frag(ab_tag_p tag, struct ab_frag_t *frag)
+{
+    return decode_read_response(tag, frag->req, frag->offset, frag->size);
 }
 
 
 
 
-
 /* FIXME  convert to unconnected messages. */
 
 int tag_write_start(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
-    pccc_req *pccc;
-    uint8_t *data;
-    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));
-    uint8_t *embed_start;
     int overhead, data_per_packet;
-    ab_request_p req = NULL;
 
     pdebug(DEBUG_INFO,"Starting.");
 
@@ -489,7 +616,8 @@ int tag_write_start(ab_tag_p tag)
                  +2  /* PCCC sequence number */
                  +1  /* PCCC function */
                  +1  /* request total transfer size in bytes. */
-                 + (tag->encoded_name_size);
+                 + (tag->encoded_name_size)
+                 +4; /* room for a longer element number in later chunks. */
 
     data_per_packet = session_get_max_payload(tag->session) - overhead;
 
@@ -500,16 +628,51 @@ int tag_write_start(ab_tag_p tag)
     }
 
     if(data_per_packet < tag->size) {
-        pdebug(DEBUG_DETAIL,"Tag size is %d, write overhead is %d, and write data per packet is %d.", session_get_max_payload(tag->session), overhead, data_per_packet);
-        tag->write_in_progress =0;
-        return PLCTAG_ERR_TOO_LARGE;
+        pdebug(DEBUG_DETAIL, "Tag size is %d and write data per packet is %d, writing in chunks.", tag->size, data_per_packet);
+
+        rc = ab_tag_start_elem_frags(tag, data_per_packet, build_write_frag);
+        if(rc != PLCTAG_STATUS_PENDING) {
+            tag->write_in_progress = 0;
+        }
+
+        return rc;
+    }
+
+    rc = build_write_request(tag, 0, tag->size, &tag->req);
+    if(rc != PLCTAG_STATUS_OK) {
+        tag->write_in_progress = 0;
+        return rc;
     }
 
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+
+/*
+ * build_write_request
+ *
+ * Queue a typed logical write of size bytes starting at byte offset in the tag.
+ */
+
+int build_write_request(ab_tag_p tag, int offset, int size, ab_request_p *req_out)
+{
+    int rc = PLCTAG_STATUS_OK;
+    pccc_req *pccc;
+    uint8_t *data;
+    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));;
+    uint8_t *embed_start;
+    ab_request_p req = NULL;
+    int name_size = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
     /* get a request buffer */
     rc = session_create_request(tag->session, tag->tag_id, &req);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN,"Unable to get new request.  rc=%d",rc);
-        tag->write_in_progress =0;
         return rc;
     }
 
@@ -521,13 +684,19 @@ int tag_write_start(ab_tag_p tag)
     /* point to the end of the struct */
     data = (req->data) + sizeof(pccc_req);
 
-    /* copy encoded tag name into the request */
-    mem_copy(data,tag->encoded_name,tag->encoded_name_size);
-    data += tag->encoded_name_size;
+    /* copy the encoded tag name, moved to the first element to write, into the request */
+    rc = slc_offset_tag_name(data, &name_size, tag->encoded_name, tag->encoded_name_size, (offset ? offset / tag->elem_size : 0));
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to address the element at byte offset %d, %s!", offset, plc_tag_decode_error(rc));
+        rc_dec(req);
+        return rc;
+    }
+
+    data += name_size;
 
     /* now copy the data to write */
-    mem_copy(data,tag->data,tag->size);
-    data += tag->size;
+    mem_copy(data, tag->data + offset, size);
+    data += size;
 
     /* now fill in the rest of the structure. */
 
@@ -562,37 +731,36 @@ int tag_write_start(ab_tag_p tag)
     pccc->pccc_status = 0;  /* STS 0 in request */
     pccc->pccc_seq_num = h2le16(conn_seq_id); /* FIXME - get sequence ID from session? */
     pccc->pccc_function = AB_EIP_SLC_RANGE_WRITE_FUNC;
-    pccc->pccc_transfer_size = (uint8_t)(tag->size);
+    pccc->pccc_transfer_size = (uint8_t)(size);
 
     /* get ready to add the request to the queue for this session */
     req->request_size = (int)(data - (req->data));
 
+    /* several of these can share one Multiple Service Packet. */
+    req->allow_packing = tag->allow_packing;
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
         req->abort_request = 1;
-        tag->write_in_progress =0;
-
-        tag->req = rc_dec(req);
-
+        rc_dec(req);
         return rc;
     }
 
-    /* the write is now pending */
-    tag->write_in_progress = 1;
-
     /* save the request for later */
-    tag->req = req;
+    *req_out = req;
 
-    /* save the request for later */
-    tag->req = req;
+    pdebug(DEBUG_DETAIL, "Done.");
 
-//    tag->status = PLCTAG_STATUS_PENDING;
+    return PLCTAG_STATUS_OK;
+}
 
-    pdebug(DEBUG_INFO, "Done.");
 
-    return PLCTAG_STATUS_PENDING;
+
+int build_write_frag(ab_tag_p tag, struct ab_frag_t *frag)
+{
+    return build_write_request(tag, frag->offset, frag->size, &frag->req);
 }
 
 
@@ -600,16 +768,23 @@ int tag_write_start(ab_tag_p tag)
 /*
  * check_write_status
  *
- * Fragments are not supported.
+ * CIP fragments are not supported, large writes are sent in chunks.
  */
 static int check_write_status(ab_tag_p tag)
 {
-    pccc_resp *pccc;
-//    uint8_t *data = NULL;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_SPEW,"Starting.");
 
+    if(tag->frag_count) {
+        rc = ab_tag_check_elem_frags(tag, decode_write_frag);
+        if(rc != PLCTAG_STATUS_PENDING) {
+            tag->write_in_progress = 0;
+        }
+
+        return rc;
+    }
+
     /* is there an outstanding request? */
     if (!tag->req) {
         tag->write_in_progress = 0;
@@ -651,11 +826,31 @@ static int check_write_status(ab_tag_p tag)
     }
 
     /* the request is ours exclusively. */
+    rc = decode_write_response(tag->req);
 
-    pccc = (pccc_resp*)(tag->req->data);
+    /* clean up the request */
+    tag->req->abort_request = 1;
+    tag->req = rc_dec(tag->req);
+    tag->write_in_progress = 0;
 
-    /* point to the start of the data */
-//    data = (uint8_t *)pccc + sizeof(*pccc);
+    pdebug(DEBUG_SPEW,"Done.");
+
+    /* Success! */
+    return rc;
+}
+
+
+
+/*
+ * decode_write_response
+ *
+ * Check the status of a write response.
+ */
+
+int decode_write_response(ab_request_p req)
+{
+    pccc_resp *pccc = (pccc_resp *)(req->data);
+    int rc = PLCTAG_STATUS_OK;
 
     /* fake exception */
     do {
@@ -687,13 +882,14 @@ static int check_write_status(ab_tag_p tag)
         rc = PLCTAG_STATUS_OK;
     } while(0);
 
-    /* clean up the request */
-    tag->req->abort_request = 1;
-    tag->req = rc_dec(tag->req);
-    tag->write_in_progress = 0;
+    return rc;
+}
 
-    pdebug(DEBUG_SPEW,"Done.");
 
-    /* Success! */
-    return rc;
+
+int decode_write_frag(ab_tag_p tag, struct ab_frag_t *frag)
+{
+    (void)tag;
+
+    return decode_write_response(frag->req);
 }
@@ -51,6 +51,7 @@ static int parse_pccc_file_num(const char **str, int *file_num);
 static int parse_pccc_elem_num(const char **str, int *elem_num);
 static int parse_pccc_subelem_num(const char **str, pccc_file_t file_type, int *subelem_num);
 static void encode_data(uint8_t *data, int *index, int val);
+static int decode_data(const uint8_t *data, int data_size, int *index, int *val);
 static int encode_file_type(pccc_file_t file_type);
 
 
@@ -282,6 +283,82 @@ int slc_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const
 
 
 
+/*
+ * Copy an encoded SLC logical address with the element number moved up
+ * by elem_offset.  This addresses the later chunks of a tag that does
+ * not fit in one packet.  A sub-element address cannot be moved because
+ * the tag elements are then smaller than the file elements.
+ */
+
+int slc_offset_tag_name(uint8_t *data, int *size, const uint8_t *encoded_name, int encoded_name_size, int elem_offset)
+{
+    int fields[4] = {0};
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!data || !size || !encoded_name) {
+        pdebug(DEBUG_WARN, "Called with null data, size or encoded name!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    rc = slc_decode_tag_name(encoded_name, encoded_name_size, &fields[0], &fields[1], &fields[2], &fields[3]);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    if(elem_offset && fields[3] != 0) {
+        pdebug(DEBUG_WARN, "Unable to offset an SLC address with a sub-element!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    fields[2] += elem_offset;
+
+    if(fields[2] > 0xFFFF) {
+        pdebug(DEBUG_WARN, "Element number %d is out of range!", fields[2]);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    *size = 0;
+
+    for(int i=0; i < 4; i++) {
+        encode_data(data, size, fields[i]);
+    }
+
+    pdebug(DEBUG_DETAIL,"Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Split an encoded SLC logical address back into its file number, file
+ * type, element and sub-element.
+ */
+
+int slc_decode_tag_name(const uint8_t *encoded_name, int encoded_name_size, int *file_num, int *file_type, int *elem_num, int *sub_elem_num)
+{
+    int *fields[4] = { file_num, file_type, elem_num, sub_elem_num };
+    int index = 0;
+
+    if(!encoded_name || !file_num || !file_type || !elem_num || !sub_elem_num) {
+        pdebug(DEBUG_WARN, "Called with null encoded name or result pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    for(int i=0; i < 4; i++) {
+        if(decode_data(encoded_name, encoded_name_size, &index, fields[i]) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Encoded SLC logical address is malformed!");
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 
 
 
@@ -1085,6 +1162,29 @@ void encode_data(uint8_t *data, int *index, int val)
 
 
 
+int decode_data(const uint8_t *data, int data_size, int *index, int *val)
+{
+    if(*index >= data_size) {
+        return PLCTAG_ERR_TOO_SMALL;
+    }
+
+    if(data[*index] != 0xff) {
+        *val = data[*index];
+        *index = *index + 1;
+    } else {
+        if(*index + 3 > data_size) {
+            return PLCTAG_ERR_TOO_SMALL;
+        }
+
+        *val = data[*index + 1] + (data[*index + 2] << 8);
+        *index = *index + 3;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 
 int encode_file_type(pccc_file_t file_type)
 {
@@ -48,6 +48,8 @@ typedef enum { PCCC_FILE_UNKNOWN, PCCC_FILE_ASCII, PCCC_FILE_BIT, PCCC_FILE_BLOC
 
 extern int plc5_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const char *name, int max_tag_name_size);
 extern int slc_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const char *name, int max_tag_name_size);
+extern int slc_offset_tag_name(uint8_t *data, int *size, const uint8_t *encoded_name, int encoded_name_size, int elem_offset);
+extern int slc_decode_tag_name(const uint8_t *encoded_name, int encoded_name_size, int *file_num, int *file_type, int *elem_num, int *sub_elem_num);
 extern uint8_t pccc_calculate_bcc(uint8_t *data,int size);
 extern uint16_t pccc_calculate_crc16(uint8_t *data, int size);
 extern const char *pccc_decode_error(uint8_t *error_ptr);
@@ -37,14 +37,22 @@
 #include <ab/defs.h>
 #include <ab/error_codes.h>
 #include <ab/session.h>
+#include <ab/tag.h>
 #include <util/debug.h>
+#include <util/hash.h>
+#include <util/hashtable.h>
+#include <ctype.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 
 #define MAX_REQUESTS (200)
 
+/* the PCCC TNS in a DH+ bridged connected packet, after the DH+ routing words and the PCCC command and status. */
+#define DHP_TNS_OFFSET ((int)sizeof(eip_cip_co_req) + 8 + 2)
+
 #define EIP_CIP_PREFIX_SIZE (44) /* bytes of encap header and CFP connected header */
 
 /* WARNING: this must fit within 9 bits! */
@@ -67,6 +75,27 @@
 
 #define SESSION_DISCONNECT_TIMEOUT (5000)
 
+/*
+ * Idle sessions send a keepalive this often.  The Forward Open asks for a
+ * connection timeout of 8x the 1s RPI, so this is well inside it.
+ */
+#define SESSION_KEEPALIVE_MS (2000)
+
+/*
+ * Adaptive bundling.  The target size is changed after this many full
+ * bundles have been timed.  The default lower bound keeps a bundle
+ * from shrinking below a handful of small requests.
+ */
+#define BUNDLE_SAMPLES (16)
+#define BUNDLE_DEFAULT_MIN_SIZE (128)
+#define BUNDLE_STEPS (8)
+
+/* longest line in a Forward Open cache file. */
+#define FO_CACHE_MAX_LINE (512)
+
+/* initial size of the session lookup index. */
+#define SESSION_INDEX_SIZE (32)
+
 
 
 static ab_session_p session_create_unsafe(const char *host, const char *path, plc_type_t plc_type, int *use_connected_msg);
@@ -74,7 +103,9 @@ static int session_init(ab_session_p session);
 //static int get_plc_type(attr attribs);
 static int add_session_unsafe(ab_session_p n);
 static int remove_session_unsafe(ab_session_p n);
-static ab_session_p find_session_by_host_unsafe(const char *gateway, const char *path);
+static ab_session_p find_session_by_host(const char *gateway, const char *path);
+static void index_session_unsafe(ab_session_p session);
+static int64_t session_key(const char *host, const char *path);
 static int session_match_valid(const char *host, const char *path, ab_session_p session);
 static int session_add_request_unsafe(ab_session_p sess, ab_request_p req);
 static int session_open_socket(ab_session_p session);
@@ -84,9 +115,19 @@ static int session_close_socket(ab_session_p session);
 static int session_unregister(ab_session_p session);
 static THREAD_FUNC(session_handler);
 static int purge_aborted_requests_unsafe(ab_session_p session);
+static int merge_bit_request_unsafe(ab_session_p session, ab_request_p req);
+static int merge_pccc_read_unsafe(ab_session_p session, ab_request_p req);
+static int riders_pending(ab_request_p req);
+static void complete_riders(ab_request_p req);
 static int process_requests(ab_session_p session);
+static int process_requests_pipelined(ab_session_p session);
 //static int check_packing(ab_session_p session, ab_request_p request);
 static int get_payload_size(ab_request_p request);
+static int get_cip_payload(uint8_t *data, uint8_t **payload, int *payload_len);
+static int get_bundle_space_unsafe(ab_session_p session);
+static void tune_bundle_size(ab_session_p session, int64_t bytes, int64_t elapsed_ms);
+static void rate_limit_refill_unsafe(ab_session_p session);
+static int rate_limit_take_unsafe(ab_session_p session, ab_request_p request);
 static int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests);
 static int prepare_request(ab_session_p session);
 static int send_eip_request(ab_session_p session, int timeout);
@@ -105,12 +146,86 @@ static int send_forward_open_request(ab_session_p session);
 static int send_old_forward_open_request(ab_session_p session);
 static int send_extended_forward_open_request(ab_session_p session);
 static int receive_forward_open_response(ab_session_p session);
+static void fo_cache_load_file(const char *file_name);
+static int fo_cache_update(const char *host, const char *path, const char *file_name, int only_use_old_forward_open, uint16_t max_payload_size, int from_file);
+static void fo_cache_apply_unsafe(ab_session_p session);
+static void fo_cache_store(ab_session_p session);
+static void fo_cache_write_file(const char *file_name);
+static int fo_cache_format_entry(hashtable_p table, int64_t key, void *data, void *context_arg);
+static int fo_cache_free_entry(hashtable_p table, int64_t key, void *data, void *context);
+static int symbol_free_entry(hashtable_p table, int64_t key, void *data, void *context);
+static int64_t symbol_key(const uint8_t *encoded_symbol, int encoded_size);
+static ab_udt_p find_udt_by_key(ab_session_p session, int64_t key);
+static int udt_release_entry(hashtable_p table, int64_t key, void *data, void *context);
+static int session_can_keepalive(ab_session_p session);
+static int send_keepalive(ab_session_p session);
 static void request_destroy(void *req_arg);
 static int session_request_increase_buffer(ab_request_p request, int new_capacity);
 
 
 static volatile mutex_p session_mutex = NULL;
 static volatile vector_p sessions = NULL;
+static volatile hashtable_p session_index = NULL;
+static lock_t session_index_lock = LOCK_INIT;
+
+/*
+ * Negotiated Forward Open results, keyed like the session index.  These
+ * outlive the sessions so that a new session to the same PLC can skip
+ * the negotiation.
+ */
+struct fo_cache_entry_t {
+    char *host;
+    char *path;
+    char *file;
+    int from_file;
+    int only_use_old_forward_open;
+    uint16_t max_payload_size;
+};
+
+/* cache files that have been read in. */
+struct fo_cache_file_t {
+    struct fo_cache_file_t *next;
+    char name[];
+};
+
+static volatile hashtable_p fo_cache = NULL;
+static struct fo_cache_file_t *fo_cache_files = NULL;
+
+/* the cache has its own locks, file I/O never happens under the session mutex. */
+static mutex_p fo_cache_mutex = NULL;
+static mutex_p fo_cache_file_mutex = NULL;
+
+static int fo_cache_match(struct fo_cache_entry_t *entry, const char *host, const char *path);
+
+#define SESSION_SYMBOL_TABLE_SIZE (256)
+#define SESSION_SYMBOL_MAX_ENTRIES (8192)
+#define SESSION_UDT_TABLE_SIZE (64)
+
+/* templates are in one table under two kinds of key. */
+#define UDT_ID_KEY(id) ((int64_t)(id) | ((int64_t)1 << 32))
+#define UDT_HANDLE_KEY(handle) ((int64_t)(handle) | ((int64_t)2 << 32))
+
+/* atomic types are 2 bytes of type info and abbreviated structures 4. */
+#define SYMBOL_TYPE_INFO_SIZE (8)
+
+/*
+ * What the session knows about a tag name: the symbol instance ID from a
+ * tag listing and the type info from a listing or a read.  The key is the
+ * CIP encoded segments of the name, including the program segment for
+ * program-scoped tags.
+ */
+struct symbol_entry_t {
+    int has_instance_id;
+    uint32_t instance_id;
+    int type_info_size;
+    uint8_t type_info[SYMBOL_TYPE_INFO_SIZE];
+    int encoded_size;
+    uint8_t encoded_symbol[];
+};
+
+static int symbol_match(struct symbol_entry_t *entry, const uint8_t *encoded_symbol, int encoded_size);
+static struct symbol_entry_t *get_symbol_entry_unsafe(ab_session_p session, const uint8_t *encoded_symbol, int encoded_size);
+static void clear_symbols(ab_session_p session);
 
 
 
@@ -129,6 +244,26 @@ int session_startup()
         return PLCTAG_ERR_NO_MEM;
     }
 
+    if((session_index = hashtable_create(SESSION_INDEX_SIZE)) == NULL) {
+        pdebug(DEBUG_ERROR, "Unable to create session index!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    if((fo_cache = hashtable_create(SESSION_INDEX_SIZE)) == NULL) {
+        pdebug(DEBUG_ERROR, "Unable to create Forward Open cache!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    if((rc = mutex_create(&fo_cache_mutex)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create Forward Open cache mutex %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    if((rc = mutex_create(&fo_cache_file_mutex)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create Forward Open cache file mutex %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
     return rc;
 }
 
@@ -147,6 +282,34 @@ void session_teardown()
         sessions = NULL;
     }
 
+    if(session_index) {
+        hashtable_destroy(session_index);
+        session_index = NULL;
+    }
+
+    if(fo_cache) {
+        hashtable_on_each(fo_cache, fo_cache_free_entry, NULL);
+        hashtable_destroy(fo_cache);
+        fo_cache = NULL;
+    }
+
+    while(fo_cache_files) {
+        struct fo_cache_file_t *file_entry = fo_cache_files;
+
+        fo_cache_files = file_entry->next;
+        mem_free(file_entry);
+    }
+
+    if(fo_cache_mutex) {
+        mutex_destroy(&fo_cache_mutex);
+        fo_cache_mutex = NULL;
+    }
+
+    if(fo_cache_file_mutex) {
+        mutex_destroy(&fo_cache_file_mutex);
+        fo_cache_file_mutex = NULL;
+    }
+
 
     if(session_mutex) {
         mutex_destroy((mutex_p *)&session_mutex);
@@ -212,6 +375,35 @@ int session_get_max_payload(ab_session_p session)
     return result;
 }
 
+/*
+ * session_get_throttle_ms
+ *
+ * Return the total time, in milliseconds, that requests on this session
+ * have been held back by the rate limits.
+ */
+
+int64_t session_get_throttle_ms(ab_session_p session)
+{
+    int64_t result = 0;
+
+    if(!session) {
+        pdebug(DEBUG_WARN, "Called with null session pointer!");
+        return 0;
+    }
+
+    critical_block(session->mutex) {
+        result = session->throttle_total_ms;
+
+        /* include the current throttling period, if any. */
+        if(session->throttle_start_ms) {
+            result += time_ms() - session->throttle_start_ms;
+        }
+    }
+
+    return result;
+}
+
+
 int session_find_or_create(ab_session_p *tag_session, attr attribs)
 {
     /*int debug = attr_get_int(attribs,"debug",0);*/
@@ -226,9 +418,45 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
     int rc = PLCTAG_STATUS_OK;
     int auto_disconnect_enabled = 0;
     int auto_disconnect_timeout_ms = INT_MAX;
+    int max_requests_per_sec = attr_get_int(attribs, "max_requests_per_sec", 0);
+    int max_bytes_per_sec = attr_get_int(attribs, "max_bytes_per_sec", 0);
+    int adaptive_bundling = attr_get_int(attribs, "adaptive_bundling", 0);
+    int bundle_min_size = attr_get_int(attribs, "bundle_min_size", BUNDLE_DEFAULT_MIN_SIZE);
+    int bundle_max_size = attr_get_int(attribs, "bundle_max_size", 0);
+    int bit_merge_ms = attr_get_int(attribs, "bit_merge_ms", 0);
+    int pccc_merge_ms = attr_get_int(attribs, "pccc_merge_ms", 0);
+    int dhp_max_in_flight = attr_get_int(attribs, "dhp_max_in_flight", 1);
+    int frag_max_in_flight = attr_get_int(attribs, "frag_max_in_flight", 1);
+    int use_symbol_instance = attr_get_int(attribs, "use_symbol_instance", 0);
+    const char *fo_cache_file = attr_get_str(attribs, "forward_open_cache", NULL);
 
     pdebug(DEBUG_DETAIL, "Starting");
 
+    if(adaptive_bundling && (bundle_min_size <= 0 || bundle_max_size < 0 || (bundle_max_size && bundle_max_size < bundle_min_size))) {
+        pdebug(DEBUG_WARN, "Bundle size bounds %d to %d are not valid!", bundle_min_size, bundle_max_size);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(max_requests_per_sec < 0 || max_bytes_per_sec < 0) {
+        pdebug(DEBUG_WARN, "Rate limits must not be negative!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(bit_merge_ms < 0 || pccc_merge_ms < 0) {
+        pdebug(DEBUG_WARN, "Merge windows must not be negative!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(dhp_max_in_flight < 1 || dhp_max_in_flight > MAX_REQUESTS) {
+        pdebug(DEBUG_WARN, "DH+ requests in flight must be between 1 and %d!", MAX_REQUESTS);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(frag_max_in_flight < 1 || frag_max_in_flight > MAX_REQUESTS) {
+        pdebug(DEBUG_WARN, "Fragment requests in flight must be between 1 and %d!", MAX_REQUESTS);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
     auto_disconnect_timeout_ms = attr_get_int(attribs, "auto_disconnect_ms", INT_MAX);
     if(auto_disconnect_timeout_ms != INT_MAX) {
         pdebug(DEBUG_DETAIL, "Setting auto-disconnect after %dms.", auto_disconnect_timeout_ms);
@@ -241,13 +469,24 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
     //     attr_set_int(attribs, "use_connected_msg", 1);
     // }
 
+    /* read the Forward Open cache file, if any, before taking the session mutex. */
+    if(fo_cache_file && str_length(fo_cache_file)) {
+        fo_cache_load_file(fo_cache_file);
+    }
+
+    /*
+     * if we are to share sessions, then look for an existing one.  The
+     * index has its own lock so this does not wait on other threads
+     * creating sessions.
+     */
+    if (shared_session) {
+        session = find_session_by_host(session_gw, session_path);
+    }
+
     critical_block(session_mutex) {
-        /* if we are to share sessions, then look for an existing one. */
-        if (shared_session) {
-            session = find_session_by_host_unsafe(session_gw, session_path);
-        } else {
-            /* no sharing, create a new one */
-            session = AB_SESSION_NULL;
+        /* another thread could have created it while we were looking. */
+        if (shared_session && session == AB_SESSION_NULL) {
+            session = find_session_by_host(session_gw, session_path);
         }
 
         if (session == AB_SESSION_NULL) {
@@ -258,8 +497,33 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
                 pdebug(DEBUG_WARN, "unable to create or find a session!");
                 rc = PLCTAG_ERR_BAD_GATEWAY;
             } else {
+                /* only shared sessions can be found again. */
+                if(shared_session) {
+                    index_session_unsafe(session);
+                }
+
                 session->auto_disconnect_enabled = auto_disconnect_enabled;
                 session->auto_disconnect_timeout_ms = auto_disconnect_timeout_ms;
+                session->max_requests_per_sec = max_requests_per_sec;
+                session->max_bytes_per_sec = max_bytes_per_sec;
+                session->bit_merge_ms = bit_merge_ms;
+                session->pccc_merge_ms = pccc_merge_ms;
+                session->dhp_max_in_flight = dhp_max_in_flight;
+                session->frag_max_in_flight = frag_max_in_flight;
+                session->use_symbol_instance = (use_symbol_instance ? 1 : 0);
+
+                if(adaptive_bundling) {
+                    session->adaptive_bundling = 1;
+                    session->bundle_min_size = bundle_min_size;
+                    session->bundle_max_size = bundle_max_size;
+                }
+
+                if(fo_cache_file && str_length(fo_cache_file)) {
+                    session->fo_cache_file = str_dup(fo_cache_file);
+                }
+
+                /* pick up any previous Forward Open negotiation with this PLC. */
+                fo_cache_apply_unsafe(session);
 
                 new_session = 1;
             }
@@ -274,6 +538,45 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
                 session->auto_disconnect_timeout_ms = auto_disconnect_timeout_ms;
             }
 
+            /* rate limits always go down, the strictest tag wins. */
+            if(max_requests_per_sec && (!session->max_requests_per_sec || session->max_requests_per_sec > max_requests_per_sec)) {
+                session->max_requests_per_sec = max_requests_per_sec;
+            }
+
+            if(max_bytes_per_sec && (!session->max_bytes_per_sec || session->max_bytes_per_sec > max_bytes_per_sec)) {
+                session->max_bytes_per_sec = max_bytes_per_sec;
+            }
+
+            /* the merge windows always go up, the tag that wants the most merging wins. */
+            if(session->bit_merge_ms < bit_merge_ms) {
+                session->bit_merge_ms = bit_merge_ms;
+            }
+
+            if(session->pccc_merge_ms < pccc_merge_ms) {
+                session->pccc_merge_ms = pccc_merge_ms;
+            }
+
+            /* the DH+ window goes down, the most careful tag wins. */
+            if(session->dhp_max_in_flight > dhp_max_in_flight) {
+                session->dhp_max_in_flight = dhp_max_in_flight;
+            }
+
+            if(session->frag_max_in_flight > frag_max_in_flight) {
+                session->frag_max_in_flight = frag_max_in_flight;
+            }
+
+            /* keep symbol instance IDs once any tag wants them. */
+            if(use_symbol_instance) {
+                session->use_symbol_instance = 1;
+            }
+
+            /* turn on adaptive bundling if we need to.  The first tag to ask sets the bounds. */
+            if(!session->adaptive_bundling && adaptive_bundling) {
+                session->bundle_min_size = bundle_min_size;
+                session->bundle_max_size = bundle_max_size;
+                session->adaptive_bundling = 1;
+            }
+
             pdebug(DEBUG_DETAIL, "Reusing existing session.");
         }
     }
@@ -315,6 +618,9 @@ int add_session_unsafe(ab_session_p session)
 
     vector_put(sessions, vector_length(sessions), session);
 
+    /* the key is also used by the Forward Open cache. */
+    session->session_key = session_key(session->host, session->path);
+
     session->on_list = 1;
 
     pdebug(DEBUG_DETAIL, "Done");
@@ -359,6 +665,13 @@ int remove_session_unsafe(ab_session_p session)
         }
     }
 
+    /* only drop the index entry if it still points at this session. */
+    spin_block(&session_index_lock) {
+        if(session_index && hashtable_get(session_index, session->session_key) == session) {
+            hashtable_remove(session_index, session->session_key);
+        }
+    }
+
     pdebug(DEBUG_DETAIL, "Done");
 
     return PLCTAG_STATUS_OK;
@@ -415,23 +728,97 @@ int session_match_valid(const char *host, const char *path, ab_session_p session
 }
 
 
-ab_session_p find_session_by_host_unsafe(const char *host, const char *path)
+/*
+ * find_session_by_host
+ *
+ * Look up a shared session by gateway and path.  This does not need the
+ * session mutex, the index has its own lock.  Sessions remove themselves
+ * from the index in their destructor, so a session found under the lock
+ * is still there to check.
+ *
+ * The index only has the newest shared session for each key.  If that
+ * one failed, or the key collides with another PLC, a new session is
+ * created and replaces it in the index.
+ */
+
+ab_session_p find_session_by_host(const char *host, const char *path)
 {
-    for(int i=0; i < vector_length(sessions); i++) {
-        ab_session_p session = vector_get(sessions, i);
+    ab_session_p session = NULL;
+    int64_t key = session_key(host, path);
 
-        /* is this session in the process of destruction? */
-        session = rc_inc(session);
-        if(session) {
-            if(session_match_valid(host, path, session)) {
-                return session;
-            }
+    spin_block(&session_index_lock) {
+        session = hashtable_get(session_index, key);
 
-            rc_dec(session);
+        if(session && session_match_valid(host, path, session)) {
+            /* this returns NULL if the session is in the process of destruction. */
+            session = rc_inc(session);
+        } else {
+            session = NULL;
+        }
+    }
+
+    return session;
+}
+
+
+
+/*
+ * index_session_unsafe
+ *
+ * Make the session the one found for its gateway and path.  Must be
+ * called with the session mutex held.
+ */
+
+void index_session_unsafe(ab_session_p session)
+{
+    spin_block(&session_index_lock) {
+        if(hashtable_get(session_index, session->session_key)) {
+            hashtable_remove(session_index, session->session_key);
         }
+
+        hashtable_put(session_index, session->session_key, session);
+    }
+}
+
+
+/*
+ * session_key
+ *
+ * Build the index key for a session from the gateway and path.  The
+ * comparison in session_match_valid() is case-insensitive, so the key
+ * is computed over the lowercased strings.
+ */
+
+int64_t session_key(const char *host, const char *path)
+{
+    char *key_str = NULL;
+    int key_len = 0;
+    uint64_t key = 0;
+
+    key_str = str_concat((host ? host : ""), "/", (path ? path : ""));
+    if(!key_str) {
+        pdebug(DEBUG_WARN, "Unable to allocate key string!");
+        return 1;
+    }
+
+    key_len = str_length(key_str);
+
+    for(int i=0; i < key_len; i++) {
+        key_str[i] = (char)tolower((unsigned char)key_str[i]);
+    }
+
+    /* two 32-bit hashes with different seeds make collisions unlikely. */
+    key = ((uint64_t)hash((uint8_t *)key_str, (size_t)key_len, 0x9E3779B9) << 32)
+          | (uint64_t)hash((uint8_t *)key_str, (size_t)key_len, 0x7F4A7C15);
+
+    mem_free(key_str);
+
+    /* zero marks an empty slot in the hashtable. */
+    if(!key) {
+        key = 1;
     }
 
-    return NULL;
+    return (int64_t)key;
 }
 
 
@@ -857,6 +1244,23 @@ void session_destroy(void *session_arg)
         session->host = NULL;
     }
 
+    if(session->fo_cache_file) {
+        mem_free(session->fo_cache_file);
+        session->fo_cache_file = NULL;
+    }
+
+    if(session->symbols) {
+        hashtable_on_each(session->symbols, symbol_free_entry, NULL);
+        hashtable_destroy(session->symbols);
+        session->symbols = NULL;
+    }
+
+    if(session->udts) {
+        hashtable_on_each(session->udts, udt_release_entry, NULL);
+        hashtable_destroy(session->udts);
+        session->udts = NULL;
+    }
+
     pdebug(DEBUG_INFO, "Done.");
 
     return;
@@ -888,6 +1292,30 @@ int session_add_request_unsafe(ab_session_p session, ab_request_p req)
         return PLCTAG_ERR_NULL_PTR;
     }
 
+    /* bit writes to a word that already has a queued RMW ride along with it. */
+    if(req->rmw_mask_size > 0) {
+        if(merge_bit_request_unsafe(session, req)) {
+            pdebug(DEBUG_DETAIL, "Done.  Merged bit write into a queued request.");
+            return rc;
+        }
+
+        if(session->bit_merge_ms > 0) {
+            req->hold_until_ms = time_ms() + session->bit_merge_ms;
+        }
+    }
+
+    /* PCCC reads of nearby elements of a file with a queued read get it in one block. */
+    if(req->pccc_elem_size > 0) {
+        if(merge_pccc_read_unsafe(session, req)) {
+            pdebug(DEBUG_DETAIL, "Done.  Merged PCCC read into a queued request.");
+            return rc;
+        }
+
+        if(session->pccc_merge_ms > 0) {
+            req->hold_until_ms = time_ms() + session->pccc_merge_ms;
+        }
+    }
+
     /* make sure the request points to the session */
 
     /* insert into the requests vector */
@@ -900,6 +1328,173 @@ int session_add_request_unsafe(ab_session_p session, ab_request_p req)
     return rc;
 }
 
+/*
+ * merge_bit_request_unsafe
+ *
+ * Look for a queued bit RMW request on the same word.  If there is one,
+ * fold this request's masks into it and hang this request off of it so
+ * that it gets the same response.  Applying the masks one after the other
+ * is the same as ANDing the AND masks and ORing in the OR masks, with the
+ * later AND mask applied to the earlier OR mask.
+ *
+ * The request must already have a reference for the session.  Returns 1 if
+ * the request was merged.  You must hold the mutex before calling this!
+ */
+int merge_bit_request_unsafe(ab_session_p session, ab_request_p req)
+{
+    int header_size = (int)sizeof(eip_cip_co_req);
+
+    for(int i=0; i < vector_length(session->requests); i++) {
+        ab_request_p carrier = vector_get(session->requests, i);
+        uint8_t *or_mask = NULL;
+        uint8_t *and_mask = NULL;
+        uint8_t *new_or_mask = NULL;
+        uint8_t *new_and_mask = NULL;
+
+        if(!carrier || carrier->abort_request || carrier->rmw_mask_size != req->rmw_mask_size || carrier->rmw_mask_offset != req->rmw_mask_offset) {
+            continue;
+        }
+
+        /* the service, tag name and mask size must match. */
+        if(mem_cmp(carrier->data + header_size, req->rmw_mask_offset - header_size, req->data + header_size, req->rmw_mask_offset - header_size)) {
+            continue;
+        }
+
+        or_mask = carrier->data + carrier->rmw_mask_offset;
+        and_mask = or_mask + carrier->rmw_mask_size;
+        new_or_mask = req->data + req->rmw_mask_offset;
+        new_and_mask = new_or_mask + req->rmw_mask_size;
+
+        for(int j=0; j < carrier->rmw_mask_size; j++) {
+            or_mask[j] = (uint8_t)((or_mask[j] & new_and_mask[j]) | new_or_mask[j]);
+            and_mask[j] = (uint8_t)(and_mask[j] & new_and_mask[j]);
+        }
+
+        /* the carrier holds the session's reference to the rider. */
+        req->rider_next = carrier->riders;
+        carrier->riders = req;
+
+        pdebug(DEBUG_DETAIL, "Merged bit write for tag %d into request for tag %d.", req->tag_id, carrier->tag_id);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * merge_pccc_read_unsafe
+ *
+ * Look for a queued PCCC read of the same data file that starts at or
+ * before this request's first element.  If the range covering both still
+ * fits in one packet, grow the queued read to cover it and hang this
+ * request off of it.  The rider gets a copy of the whole response and
+ * the offset of its own data in it.
+ *
+ * The request must already have a reference for the session.  Returns 1 if
+ * the request was merged.  You must hold the mutex before calling this!
+ */
+int merge_pccc_read_unsafe(ab_session_p session, ab_request_p req)
+{
+    for(int i=0; i < vector_length(session->requests); i++) {
+        ab_request_p carrier = vector_get(session->requests, i);
+        int data_offset = 0;
+        int new_size = 0;
+
+        if(!carrier || carrier->abort_request || carrier->pccc_elem_size != req->pccc_elem_size) {
+            continue;
+        }
+
+        if(carrier->pccc_file_num != req->pccc_file_num || carrier->pccc_file_type != req->pccc_file_type || carrier->pccc_elem > req->pccc_elem) {
+            continue;
+        }
+
+        data_offset = (req->pccc_elem - carrier->pccc_elem) * req->pccc_elem_size;
+        new_size = data_offset + req->pccc_read_size;
+
+        if(new_size < carrier->pccc_read_size) {
+            new_size = carrier->pccc_read_size;
+        }
+
+        if(new_size > carrier->pccc_max_size) {
+            continue;
+        }
+
+        carrier->data[carrier->pccc_size_offset] = (uint8_t)new_size;
+        carrier->pccc_read_size = new_size;
+        carrier->pccc_merged = 1;
+
+        req->pccc_merged = 1;
+        req->resp_data_offset = data_offset;
+
+        /* the carrier holds the session's reference to the rider. */
+        req->rider_next = carrier->riders;
+        carrier->riders = req;
+
+        pdebug(DEBUG_DETAIL, "Merged PCCC read for tag %d into request for tag %d, now %d bytes.", req->tag_id, carrier->tag_id, new_size);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * riders_pending
+ *
+ * Returns 1 if any request merged into this one still wants its response.
+ */
+int riders_pending(ab_request_p req)
+{
+    for(ab_request_p rider = req->riders; rider; rider = rider->rider_next) {
+        if(!rider->abort_request) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * complete_riders
+ *
+ * Hand the carrier's result to all the requests merged into it and
+ * release them.  Called by the session thread once the carrier is done.
+ */
+void complete_riders(ab_request_p req)
+{
+    while(req->riders) {
+        ab_request_p rider = req->riders;
+        int status = req->status;
+        int size = req->request_size;
+
+        req->riders = rider->rider_next;
+        rider->rider_next = NULL;
+
+        if(size > rider->request_capacity) {
+            pdebug(DEBUG_WARN, "Response of %d bytes does not fit merged request buffer!", size);
+            status = PLCTAG_ERR_TOO_LARGE;
+            size = 0;
+        }
+
+        if(size > 0) {
+            mem_copy(rider->data, req->data, size);
+        }
+
+        spin_block(&rider->lock) {
+            rider->status = status;
+            rider->request_size = size;
+            rider->resp_received = 1;
+        }
+
+        rc_dec(rider);
+    }
+}
+
+
 /*
  * session_add_request
  *
@@ -973,6 +1568,7 @@ THREAD_FUNC(session_handler)
     session_state_t state = SESSION_OPEN_SOCKET;
     int64_t timeout_time = 0;
     int64_t auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
+    int64_t keepalive_time = 0;
     int auto_disconnect = 0;
 
 
@@ -1003,9 +1599,13 @@ THREAD_FUNC(session_handler)
                 state = SESSION_CLOSE_SOCKET;
             } else {
                 /* set the timeout for disconnect. */
-                //if(session->auto_disconnect_enabled) {
-                auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
-                //}
+                if(session->auto_disconnect_enabled) {
+                    auto_disconnect_time = time_ms() + session->auto_disconnect_timeout_ms;
+                } else {
+                    auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
+                }
+
+                keepalive_time = time_ms() + SESSION_KEEPALIVE_MS;
 
                 state = SESSION_REGISTER;
             }
@@ -1018,6 +1618,9 @@ THREAD_FUNC(session_handler)
                 pdebug(DEBUG_WARN, "session registration failed %s!", plc_tag_decode_error(rc));
                 state = SESSION_CLOSE_SOCKET;
             } else {
+                /* the PLC program may have changed while we were not connected. */
+                clear_symbols(session);
+
                 if(session->use_connected_msg) {
                     state = SESSION_SEND_FORWARD_OPEN;
                 } else {
@@ -1072,7 +1675,13 @@ THREAD_FUNC(session_handler)
             pdebug(DEBUG_SPEW,"Critical block.");
             critical_block(session->mutex) {
                 if(vector_length(session->requests) > 0) {
-                    auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
+                    if(session->auto_disconnect_enabled) {
+                        auto_disconnect_time = time_ms() + session->auto_disconnect_timeout_ms;
+                    } else {
+                        auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
+                    }
+
+                    keepalive_time = time_ms() + SESSION_KEEPALIVE_MS;
                 }
             }
 
@@ -1086,21 +1695,40 @@ THREAD_FUNC(session_handler)
                 }
             }
 
-            /* check if we should disconnect */
-            //if(session->auto_disconnect_enabled) {
-            if(auto_disconnect_time < time_ms()) {
-                pdebug(DEBUG_DETAIL, "Disconnecting due to inactivity.");
+            /*
+             * check if we should disconnect.   Sessions stay up unless the
+             * tags asked for auto disconnect or we cannot keep the session
+             * alive on our own.
+             */
+            if(state == SESSION_IDLE && (session->auto_disconnect_enabled || !session_can_keepalive(session))) {
+                if(auto_disconnect_time < time_ms()) {
+                    pdebug(DEBUG_DETAIL, "Disconnecting due to inactivity.");
 
-                auto_disconnect = 1;
-                idle = 0;
+                    auto_disconnect = 1;
+                    idle = 0;
 
-                if(session->use_connected_msg) {
-                    state = SESSION_DISCONNECT;
-                } else {
-                    state = SESSION_UNREGISTER;
+                    if(session->use_connected_msg) {
+                        state = SESSION_DISCONNECT;
+                    } else {
+                        state = SESSION_UNREGISTER;
+                    }
+                }
+            }
+
+            /* keep the connection from timing out in the PLC. */
+            if(state == SESSION_IDLE && session_can_keepalive(session) && keepalive_time < time_ms()) {
+                keepalive_time = time_ms() + SESSION_KEEPALIVE_MS;
+
+                if((rc = send_keepalive(session)) != PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_WARN, "Keepalive failed %s!", plc_tag_decode_error(rc));
+                    idle = 0;
+                    if(session->use_connected_msg) {
+                        state = SESSION_DISCONNECT;
+                    } else {
+                        state = SESSION_UNREGISTER;
+                    }
                 }
             }
-            //}
 
             break;
 
@@ -1237,8 +1865,8 @@ int purge_aborted_requests_unsafe(ab_session_p session)
     for(int i=0; i < vector_length(session->requests); i++) {
         request = vector_get(session->requests, i);
 
-        /* filter out the aborts. */
-        if(request && request->abort_request) {
+        /* filter out the aborts.  Keep any with merged bit writes still waiting on them. */
+        if(request && request->abort_request && !riders_pending(request)) {
             purge_count++;
 
             /* remove it from the queue. */
@@ -1253,6 +1881,8 @@ int purge_aborted_requests_unsafe(ab_session_p session)
             request->request_size = 0;
             request->resp_received = 1;
 
+            complete_riders(request);
+
             /* release our hold on it. */
             request = rc_dec(request);
 
@@ -1278,6 +1908,10 @@ int process_requests(ab_session_p session)
     ab_request_p bundled_requests[MAX_REQUESTS] = {NULL};
     int num_bundled_requests = 0;
     int remaining_space = 0;
+    int bundle_was_full = 0;
+    int throttled = 0;
+    int pipeline = 0;
+    int64_t bundle_start_ms = 0;
 
     debug_set_tag_id(0);
 
@@ -1288,6 +1922,30 @@ int process_requests(ab_session_p session)
         return PLCTAG_ERR_NULL_PTR;
     }
 
+    /* bridged DH+ connections can keep several PCCC transactions going at once. */
+    if(session->use_connected_msg && session->dhp_dest && session->dhp_max_in_flight > 1) {
+        return process_requests_pipelined(session);
+    }
+
+    /* so can the fragments of large reads and writes on other connections. */
+    if(session->use_connected_msg && !session->dhp_dest && session->frag_max_in_flight > 1) {
+        critical_block(session->mutex) {
+            /* held requests are skipped, so look at the first one that is not. */
+            for(int index = 0; index < vector_length(session->requests); index++) {
+                request = vector_get(session->requests, index);
+
+                if(!request->hold_until_ms || time_ms() >= request->hold_until_ms) {
+                    pipeline = request->allow_pipelining;
+                    break;
+                }
+            }
+        }
+
+        if(pipeline) {
+            return process_requests_pipelined(session);
+        }
+    }
+
     pdebug(DEBUG_SPEW, "Checking for requests to process.");
 
     rc = PLCTAG_STATUS_OK;
@@ -1305,11 +1963,25 @@ int process_requests(ab_session_p session)
             /* if there are still requests after purging all the aborted requests, process them. */
 
             /* how much space do we have to work with. */
-            remaining_space = session->max_payload_size - (int)sizeof(cip_multi_req_header);
+            remaining_space = get_bundle_space_unsafe(session) - (int)sizeof(cip_multi_req_header);
 
             if(vector_length(session->requests)) {
-                do {
-                    request = vector_get(session->requests, 0);
+                rate_limit_refill_unsafe(session);
+
+                for(int index = 0; index < vector_length(session->requests) && remaining_space > 0 && num_bundled_requests < MAX_REQUESTS; ) {
+                    request = vector_get(session->requests, index);
+
+                    /* still collecting bit writes or reads to merge?  Leave it and look at the rest. */
+                    if(request->hold_until_ms && time_ms() < request->hold_until_ms) {
+                        index++;
+                        continue;
+                    }
+
+                    /* connected and unconnected requests cannot share a packet. */
+                    if(num_bundled_requests > 0
+                       && le2h16(((eip_encap *)(request->data))->encap_command) != le2h16(((eip_encap *)(bundled_requests[0]->data))->encap_command)) {
+                        break;
+                    }
 
                     remaining_space = remaining_space - get_payload_size(request);
 
@@ -1319,14 +1991,46 @@ int process_requests(ab_session_p session)
                      */
 
                     if(num_bundled_requests == 0 || (request->allow_packing && remaining_space > 0)) {
+                        /* over the rate limit?  Leave it queued for a later pass. */
+                        if(!rate_limit_take_unsafe(session, request)) {
+                            throttled = 1;
+                            break;
+                        }
+
                         //pdebug(DEBUG_DETAIL, "packed %d requests with remaining space %d", num_bundled_requests+1, remaining_space);
                         bundled_requests[num_bundled_requests] = request;
                         num_bundled_requests++;
 
                         /* remove it from the queue. */
-                        vector_remove(session->requests, 0);
+                        vector_remove(session->requests, index);
+                    } else if(request->allow_packing) {
+                        /*
+                         * the next request did not fit.  Only bundles cut short by
+                         * size tell us anything about the PLC.  Holds, rate limits
+                         * and mixed message types do not.
+                         */
+                        bundle_was_full = 1;
+                    }
+
+                    if(!request->allow_packing) {
+                        break;
+                    }
+                }
+
+                /* track how long the rate limit held requests back.  Merge holds do not count. */
+                if(num_bundled_requests == 0 && throttled) {
+                    if(!session->throttle_start_ms) {
+                        pdebug(DEBUG_DETAIL, "Rate limit reached, holding requests.");
+                        session->throttle_start_ms = time_ms();
                     }
-                } while(vector_length(session->requests) && remaining_space > 0 && num_bundled_requests < MAX_REQUESTS && request->allow_packing);
+                } else if(session->throttle_start_ms) {
+                    int64_t throttled_ms = time_ms() - session->throttle_start_ms;
+
+                    pdebug(DEBUG_DETAIL, "Requests were throttled for %" PRId64 "ms.", throttled_ms);
+
+                    session->throttle_total_ms += throttled_ms;
+                    session->throttle_start_ms = 0;
+                }
             } else {
                 pdebug(DEBUG_DETAIL, "All requests in queue were aborted, nothing to do.");
             }
@@ -1340,6 +2044,8 @@ int process_requests(ab_session_p session)
 
         pdebug(DEBUG_INFO, "%d requests to process.", num_bundled_requests);
 
+        bundle_start_ms = time_ms();
+
         do {
             /* copy and pack the requests into the session buffer. */
             rc = pack_requests(session, bundled_requests, num_bundled_requests);
@@ -1366,6 +2072,10 @@ int process_requests(ab_session_p session)
                 break;
             }
 
+            if(session->adaptive_bundling && bundle_was_full) {
+                tune_bundle_size(session, (int64_t)session->data_size, time_ms() - bundle_start_ms);
+            }
+
             /*
              * check the CIP status, but only if this is a bundled
              * response.   If it is a singleton, then we pass the
@@ -1405,6 +2115,8 @@ int process_requests(ab_session_p session)
                     break;
                 }
 
+                complete_riders(bundled_requests[i]);
+
                 /* release our reference */
                 bundled_requests[i] = rc_dec(bundled_requests[i]);
             }
@@ -1419,6 +2131,7 @@ int process_requests(ab_session_p session)
                     bundled_requests[i]->status = rc;
                     bundled_requests[i]->request_size = 0;
                     bundled_requests[i]->resp_received = 1;
+                    complete_riders(bundled_requests[i]);
                     bundled_requests[i] = rc_dec(bundled_requests[i]);
                 }
             }
@@ -1433,11 +2146,188 @@ int process_requests(ab_session_p session)
 }
 
 
+/*
+ * process_requests_pipelined
+ *
+ * Keep several requests outstanding on the connection.  On a bridged DH+
+ * connection up to dhp_max_in_flight PCCC requests are sent and the
+ * responses, which can come back in any order, are matched to their
+ * requests by the PCCC TNS.  On other connections up to frag_max_in_flight
+ * fragment requests are sent and matched by connection sequence number.
+ * New requests are sent as old ones complete until the queue is empty,
+ * or the next request cannot be pipelined, and all responses are in.
+ */
+
+int process_requests_pipelined(ab_session_p session)
+{
+    int rc = PLCTAG_STATUS_OK;
+    ab_request_p in_flight[MAX_REQUESTS] = {NULL};
+    uint16_t in_flight_id[MAX_REQUESTS] = {0};
+    int num_in_flight = 0;
+    int use_tns = (session->dhp_dest != 0);
+    int max_in_flight = (use_tns ? session->dhp_max_in_flight : session->frag_max_in_flight);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    do {
+        /* top up the window from the queue. */
+        while(rc == PLCTAG_STATUS_OK && num_in_flight < max_in_flight) {
+            ab_request_p request = NULL;
+
+            critical_block(session->mutex) {
+                purge_aborted_requests_unsafe(session);
+                rate_limit_refill_unsafe(session);
+
+                for(int index = 0; index < vector_length(session->requests); index++) {
+                    ab_request_p candidate = vector_get(session->requests, index);
+
+                    /* still collecting reads or bit writes to merge?  Look at the next one. */
+                    if(candidate->hold_until_ms && time_ms() < candidate->hold_until_ms) {
+                        continue;
+                    }
+
+                    if((use_tns || candidate->allow_pipelining) && rate_limit_take_unsafe(session, candidate)) {
+                        request = candidate;
+                        vector_remove(session->requests, index);
+                    }
+
+                    break;
+                }
+            }
+
+            if(!request) {
+                break;
+            }
+
+            debug_set_tag_id(request->tag_id);
+
+            /* the request is ours now, it gets cleaned up below on any error. */
+            in_flight[num_in_flight] = request;
+            num_in_flight++;
+
+            if(use_tns) {
+                if(request->request_size < DHP_TNS_OFFSET + (int)sizeof(uint16_le)) {
+                    pdebug(DEBUG_WARN, "Request is too short to be a DH+ PCCC request!");
+                    rc = PLCTAG_ERR_BAD_DATA;
+                    break;
+                }
+
+                in_flight_id[num_in_flight - 1] = (uint16_t)(request->data[DHP_TNS_OFFSET] | (request->data[DHP_TNS_OFFSET + 1] << 8));
+            }
+
+            if((rc = pack_requests(session, &request, 1)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Error while packing request, %s!", plc_tag_decode_error(rc));
+                break;
+            }
+
+            if((rc = prepare_request(session)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to prepare request, %s!", plc_tag_decode_error(rc));
+                break;
+            }
+
+            /* the connection sequence number is only known once the packet is prepared. */
+            if(!use_tns) {
+                in_flight_id[num_in_flight - 1] = session->conn_seq_num;
+            }
+
+            if((rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Error sending packet %s!", plc_tag_decode_error(rc));
+                break;
+            }
+
+            pdebug(DEBUG_DETAIL, "Sent request with %s %x, %d requests in flight.", (use_tns ? "TNS" : "sequence ID"), in_flight_id[num_in_flight - 1], num_in_flight);
+        }
+
+        debug_set_tag_id(0);
+
+        if(rc != PLCTAG_STATUS_OK || num_in_flight == 0) {
+            break;
+        }
+
+        /* wait for the next response, whichever request it is for. */
+        if((rc = recv_eip_response(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error receiving packet response %s!", plc_tag_decode_error(rc));
+            break;
+        }
+
+        if(use_tns && (int)session->data_size < DHP_TNS_OFFSET + (int)sizeof(uint16_le)) {
+            pdebug(DEBUG_WARN, "Response is too short to be a DH+ PCCC response!");
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        } else if(!use_tns && ((int)session->data_size < (int)sizeof(eip_cip_co_resp)
+                               || le2h16(((eip_encap *)(session->data))->encap_command) != AB_EIP_CONNECTED_SEND)) {
+            pdebug(DEBUG_WARN, "Response is not a connected response!");
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        } else {
+            uint16_t id = 0;
+            int index = -1;
+
+            if(use_tns) {
+                id = (uint16_t)(session->data[DHP_TNS_OFFSET] | (session->data[DHP_TNS_OFFSET + 1] << 8));
+            } else {
+                id = le2h16(((eip_cip_co_resp *)(session->data))->cpf_conn_seq_num);
+            }
+
+            for(int i=0; i < num_in_flight; i++) {
+                if(in_flight_id[i] == id) {
+                    index = i;
+                    break;
+                }
+            }
+
+            if(index < 0) {
+                pdebug(DEBUG_WARN, "Dropping response with unknown %s %x.", (use_tns ? "TNS" : "sequence ID"), id);
+                continue;
+            }
+
+            debug_set_tag_id(in_flight[index]->tag_id);
+
+            if((rc = unpack_response(session, in_flight[index], 0)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to unpack response!");
+                break;
+            }
+
+            complete_riders(in_flight[index]);
+            rc_dec(in_flight[index]);
+
+            /* fill the hole with the last one. */
+            num_in_flight--;
+            in_flight[index] = in_flight[num_in_flight];
+            in_flight_id[index] = in_flight_id[num_in_flight];
+            in_flight[num_in_flight] = NULL;
+
+            debug_set_tag_id(0);
+        }
+    } while(num_in_flight > 0);
+
+    /* problem? fail everything still waiting for a response. */
+    if(rc != PLCTAG_STATUS_OK) {
+        for(int i=0; i < num_in_flight; i++) {
+            in_flight[i]->status = rc;
+            in_flight[i]->request_size = 0;
+            in_flight[i]->resp_received = 1;
+            complete_riders(in_flight[i]);
+            in_flight[i] = rc_dec(in_flight[i]);
+        }
+    }
+
+    debug_set_tag_id(0);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
 int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
 {
     int rc = PLCTAG_STATUS_OK;
-    eip_cip_co_resp *packed_resp = (eip_cip_co_resp *)(session->data);
-    eip_cip_co_resp *unpacked_resp = NULL;
+    eip_encap *packed_resp = (eip_encap *)(session->data);
+    uint8_t *reply_start = NULL;
+    int reply_len = 0;
+    int header_size = 0;
     uint8_t *pkt_start = NULL;
     uint8_t *pkt_end = NULL;
     int new_eip_len = 0;
@@ -1447,8 +2337,13 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
     /* clear out the request data. */
     mem_set(request->data, 0, request->request_capacity);
 
+    /* the reply service is in a different place in connected and unconnected responses. */
+    if(get_cip_payload(session->data, &reply_start, &reply_len) != PLCTAG_STATUS_OK || reply_len <= 0) {
+        reply_start = NULL;
+    }
+
     /* change what we do depending on the type. */
-    if(packed_resp->reply_service != (AB_EIP_CMD_CIP_MULTI | AB_EIP_CMD_CIP_OK)) {
+    if(!reply_start || *reply_start != (AB_EIP_CMD_CIP_MULTI | AB_EIP_CMD_CIP_OK)) {
         /* copy the data back into the request buffer. */
         new_eip_len = (int)session->data_size;
         pdebug(DEBUG_INFO, "Got single response packet.  Copying %d bytes unchanged.", new_eip_len);
@@ -1477,7 +2372,7 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
 
         mem_copy(request->data, session->data, new_eip_len);
     } else {
-        cip_multi_resp_header *multi = (cip_multi_resp_header *)(&packed_resp->reply_service);
+        cip_multi_resp_header *multi = (cip_multi_resp_header *)reply_start;
         uint16_t total_responses = le2h16(multi->request_count);
         int pkt_len = 0;
 
@@ -1498,8 +2393,11 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
 
         pkt_len = (int)(pkt_end - pkt_start);
 
+        /* everything in front of the reply service is kept as is. */
+        header_size = (int)(reply_start - session->data);
+
         /* replace the request buffer if it is not big enough. */
-        new_eip_len = pkt_len + (int)sizeof(eip_cip_co_generic_response);
+        new_eip_len = pkt_len + header_size;
         if(new_eip_len > request->request_capacity) {
             int request_capacity = 0;
 
@@ -1522,22 +2420,24 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
             }
         }
 
-        /* point to the response buffer in a structured way. */
-        unpacked_resp = (eip_cip_co_resp *)(request->data);
-
         /* copy the header down */
-        mem_copy(request->data, session->data, (int)sizeof(eip_cip_co_resp));
-
-        /* size of the new packet */
-        new_eip_len = (uint16_t)(((uint8_t *)(&unpacked_resp->reply_service) + pkt_len) /* end of the packet */
-                                 - (uint8_t *)(request->data));                                      /* start of the packet */
+        mem_copy(request->data, session->data, header_size);
 
         /* now copy the packet over that. */
-        mem_copy(&unpacked_resp->reply_service, pkt_start, pkt_len);
+        mem_copy(request->data + header_size, pkt_start, pkt_len);
 
         /* stitch up the packet sizes. */
-        unpacked_resp->cpf_cdi_item_length = h2le16((uint16_t)(pkt_len + (int)sizeof(uint16_le))); /* extra for the connection sequence */
-        unpacked_resp->encap_length = h2le16((uint16_t)(new_eip_len - (uint16_t)sizeof(eip_encap)));
+        if(le2h16(packed_resp->encap_command) == AB_EIP_CONNECTED_SEND) {
+            eip_cip_co_resp *unpacked_resp = (eip_cip_co_resp *)(request->data);
+
+            unpacked_resp->cpf_cdi_item_length = h2le16((uint16_t)(pkt_len + (int)sizeof(uint16_le))); /* extra for the connection sequence */
+        } else {
+            eip_cip_uc_resp *unpacked_resp = (eip_cip_uc_resp *)(request->data);
+
+            unpacked_resp->cpf_udi_item_length = h2le16((uint16_t)pkt_len);
+        }
+
+        ((eip_encap *)(request->data))->encap_length = h2le16((uint16_t)(new_eip_len - (int)sizeof(eip_encap)));
     }
 
     pdebug(DEBUG_INFO, "Unpacked packet:");
@@ -1557,11 +2457,186 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
 
 
 
+/*
+ * get_bundle_space_unsafe
+ *
+ * Return the payload space available for a bundle.  Without adaptive
+ * bundling this is the negotiated maximum payload.
+ */
+
+int get_bundle_space_unsafe(ab_session_p session)
+{
+    int max_size = session->max_payload_size;
+
+    if(!session->adaptive_bundling) {
+        return max_size;
+    }
+
+    if(session->bundle_max_size && session->bundle_max_size < max_size) {
+        max_size = session->bundle_max_size;
+    }
+
+    /* start big, the negotiated size can also change on reconnect. */
+    if(!session->bundle_target_size || session->bundle_target_size > max_size) {
+        session->bundle_target_size = max_size;
+    }
+
+    if(session->bundle_target_size < session->bundle_min_size) {
+        session->bundle_target_size = session->bundle_min_size;
+    }
+
+    return session->bundle_target_size;
+}
+
+
+/*
+ * tune_bundle_size
+ *
+ * Record the response size and round trip time of a full bundle.  Every
+ * BUNDLE_SAMPLES bundles, compare the throughput against the previous
+ * target size and keep stepping in the direction that improved it.
+ *
+ * This is called from the session thread only.
+ */
+
+void tune_bundle_size(ab_session_p session, int64_t bytes, int64_t elapsed_ms)
+{
+    int64_t rate = 0;
+    int max_size = 0;
+    int step = 0;
+
+    critical_block(session->mutex) {
+        session->bundle_bytes += bytes;
+        session->bundle_time_ms += elapsed_ms;
+        session->bundle_samples++;
+
+        if(session->bundle_samples < BUNDLE_SAMPLES) {
+            break;
+        }
+
+        /* bytes per second.  The clock is only 1ms, so never divide by zero. */
+        rate = (session->bundle_bytes * 1000) / (session->bundle_time_ms > 0 ? session->bundle_time_ms : 1);
+
+        session->bundle_samples = 0;
+        session->bundle_bytes = 0;
+        session->bundle_time_ms = 0;
+
+        max_size = session->max_payload_size;
+        if(session->bundle_max_size && session->bundle_max_size < max_size) {
+            max_size = session->bundle_max_size;
+        }
+
+        step = (max_size - session->bundle_min_size) / BUNDLE_STEPS;
+        if(step < 1) {
+            step = 1;
+        }
+
+        /* start by shrinking, we started at the largest size. */
+        if(!session->bundle_step) {
+            session->bundle_step = -step;
+        } else if(rate < session->bundle_last_rate) {
+            /* got worse, turn around. */
+            session->bundle_step = (session->bundle_step > 0 ? -step : step);
+        } else {
+            session->bundle_step = (session->bundle_step > 0 ? step : -step);
+        }
+
+        session->bundle_last_rate = rate;
+        session->bundle_target_size += session->bundle_step;
+
+        /* bounce off the limits. */
+        if(session->bundle_target_size >= max_size) {
+            session->bundle_target_size = max_size;
+            session->bundle_step = -step;
+        } else if(session->bundle_target_size <= session->bundle_min_size) {
+            session->bundle_target_size = session->bundle_min_size;
+            session->bundle_step = step;
+        }
+
+        pdebug(DEBUG_DETAIL, "Measured %" PRId64 " bytes/sec, new bundle target size %d.", rate, session->bundle_target_size);
+    }
+}
+
+
+/*
+ * rate_limit_refill_unsafe
+ *
+ * Top up the request and byte token buckets for the time elapsed since
+ * the last refill.  Each bucket holds at most one second of budget.
+ */
+
+void rate_limit_refill_unsafe(ab_session_p session)
+{
+    int64_t now = time_ms();
+    int64_t elapsed = now - session->last_refill_ms;
+    int64_t request_cap = (int64_t)session->max_requests_per_sec * 1000;
+    int64_t byte_cap = (int64_t)session->max_bytes_per_sec * 1000;
+
+    /* first time through, start with full buckets. */
+    if(!session->last_refill_ms) {
+        elapsed = 1000;
+    }
+
+    session->last_refill_ms = now;
+
+    if(elapsed <= 0) {
+        return;
+    }
+
+    session->request_tokens += elapsed * session->max_requests_per_sec;
+    if(session->request_tokens > request_cap) {
+        session->request_tokens = request_cap;
+    }
+
+    session->byte_tokens += elapsed * session->max_bytes_per_sec;
+    if(session->byte_tokens > byte_cap) {
+        session->byte_tokens = byte_cap;
+    }
+}
+
+
+/*
+ * rate_limit_take_unsafe
+ *
+ * Returns 1 and takes the tokens if the request fits within the session
+ * rate limits.  Returns 0 and takes nothing if the request must wait.
+ *
+ * A request bigger than a full byte bucket is let through when the bucket
+ * is full and pushes the bucket negative, otherwise it would never be sent.
+ */
+
+int rate_limit_take_unsafe(ab_session_p session, ab_request_p request)
+{
+    int64_t request_cost = 1000;
+    int64_t byte_cost = (int64_t)request->request_size * 1000;
+    int64_t byte_cap = (int64_t)session->max_bytes_per_sec * 1000;
+
+    if(session->max_requests_per_sec && session->request_tokens < request_cost) {
+        return 0;
+    }
+
+    if(session->max_bytes_per_sec && session->byte_tokens < byte_cost && session->byte_tokens < byte_cap) {
+        return 0;
+    }
+
+    if(session->max_requests_per_sec) {
+        session->request_tokens -= request_cost;
+    }
+
+    if(session->max_bytes_per_sec) {
+        session->byte_tokens -= byte_cost;
+    }
+
+    return 1;
+}
+
+
 int get_payload_size(ab_request_p request)
 {
     int request_data_size = 0;
     eip_encap *header = (eip_encap *)(request->data);
     eip_cip_co_req *co_req = NULL;
+    eip_cip_uc_req *uc_req = NULL;
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
@@ -1572,6 +2647,13 @@ int get_payload_size(ab_request_p request)
                             - 2  /* for connection sequence ID */
                             + 2  /* for multipacket offset */
                             ;
+    } else if(le2h16(header->encap_command) == AB_EIP_UNCONNECTED_SEND
+              && ((eip_cip_uc_req *)(request->data))->cm_service_code == AB_EIP_CMD_PCCC_EXECUTE) {
+        /* only requests sent straight to the target can be packed, not ones routed via Unconnected Send. */
+        uc_req = (eip_cip_uc_req *)(request->data);
+        request_data_size = le2h16(uc_req->cpf_udi_item_length)
+                            + 2  /* for multipacket offset */
+                            ;
     } else {
         pdebug(DEBUG_DETAIL, "Not a supported type EIP packet type %d to get the payload size.", le2h16(header->encap_command));
         request_data_size = INT_MAX;
@@ -1584,11 +2666,43 @@ int get_payload_size(ab_request_p request)
 
 
 
+/*
+ * get_cip_payload
+ *
+ * Find the CIP service request or response inside an EIP packet.  For
+ * connected packets it starts after the connection sequence number, for
+ * unconnected packets right after the unconnected data item header.
+ */
+
+int get_cip_payload(uint8_t *data, uint8_t **payload, int *payload_len)
+{
+    eip_encap *header = (eip_encap *)data;
+
+    if(le2h16(header->encap_command) == AB_EIP_CONNECTED_SEND) {
+        eip_cip_co_req *co_req = (eip_cip_co_req *)data;
+
+        *payload = (uint8_t *)(&co_req->cpf_conn_seq_num) + sizeof(co_req->cpf_conn_seq_num);
+        *payload_len = (int)le2h16(co_req->cpf_cdi_item_length) - (int)sizeof(co_req->cpf_conn_seq_num);
+    } else if(le2h16(header->encap_command) == AB_EIP_UNCONNECTED_SEND) {
+        eip_cip_uc_req *uc_req = (eip_cip_uc_req *)data;
+
+        *payload = (uint8_t *)(&uc_req->cm_service_code);
+        *payload_len = (int)le2h16(uc_req->cpf_udi_item_length);
+    } else {
+        pdebug(DEBUG_WARN, "Unsupported EIP packet type %d!", le2h16(header->encap_command));
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 
 int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests)
 {
-    eip_cip_co_req *new_req = NULL;
-    eip_cip_co_req *packed_req = NULL;
+    int rc = PLCTAG_STATUS_OK;
+    eip_encap *packed_req = NULL;
     /* FIXME - is this the right way to check? */
     int header_size = 0;
     cip_multi_req_header *multi_header = NULL;
@@ -1622,11 +2736,15 @@ int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests
 
     pdebug(DEBUG_INFO, "header size %d", header_size);
 
-    packed_req = (eip_cip_co_req *)(session->data);
+    packed_req = (eip_encap *)(session->data);
 
     /* make room in the request packet in the session for the header. */
-    pkt_start = (uint8_t *)(&packed_req->cpf_conn_seq_num) + sizeof(packed_req->cpf_conn_seq_num);
-    pkt_len = (int)le2h16(packed_req->cpf_cdi_item_length) - (int)sizeof(packed_req->cpf_conn_seq_num);
+    rc = get_cip_payload(session->data, &pkt_start, &pkt_len);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to find the request data in packet 0!");
+        debug_set_tag_id(0);
+        return rc;
+    }
 
     pdebug(DEBUG_INFO, "packet 0 is of length %d.", pkt_len);
 
@@ -1660,14 +2778,15 @@ int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests
         /* set up the offset */
         multi_header->request_offsets[i] = h2le16((uint16_t)current_offset);
 
-        /* get a pointer to the request. */
-        new_req = (eip_cip_co_req *)(requests[i]->data);
-
         /* calculate the request start and length */
-        pkt_start = (uint8_t *)(&new_req->cpf_conn_seq_num) + sizeof(new_req->cpf_conn_seq_num);
-        pkt_len = (int)le2h16(new_req->cpf_cdi_item_length) - (int)sizeof(new_req->cpf_conn_seq_num);
-
-        pdebug(DEBUG_INFO, "packet %d is of length %d.", i, pkt_len);
+        rc = get_cip_payload(requests[i]->data, &pkt_start, &pkt_len);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to find the request data in packet %d!", i);
+            debug_set_tag_id(0);
+            return rc;
+        }
+
+        pdebug(DEBUG_INFO, "packet %d is of length %d.", i, pkt_len);
 
         /* copy the request into the session buffer. */
         mem_copy(next_pkt_data, pkt_start, pkt_len);
@@ -1678,257 +2797,1229 @@ int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests
     }
 
     /* stitch up the CPF packet length */
-    packed_req->cpf_cdi_item_length = h2le16((uint16_t)(next_pkt_data - (uint8_t *)(&packed_req->cpf_conn_seq_num)));
+    if(le2h16(packed_req->encap_command) == AB_EIP_CONNECTED_SEND) {
+        eip_cip_co_req *co_req = (eip_cip_co_req *)(session->data);
+
+        co_req->cpf_cdi_item_length = h2le16((uint16_t)(next_pkt_data - (uint8_t *)(&co_req->cpf_conn_seq_num)));
+    } else {
+        eip_cip_uc_req *uc_req = (eip_cip_uc_req *)(session->data);
+
+        uc_req->cpf_udi_item_length = h2le16((uint16_t)(next_pkt_data - (uint8_t *)(&uc_req->cm_service_code)));
+    }
 
     /* stick up the EIP packet length */
     packed_req->encap_length = h2le16((uint16_t)((size_t)(next_pkt_data - session->data) - sizeof(eip_encap)));
 
-    /* set the total data size */
-    session->data_size = (uint32_t)(next_pkt_data - session->data);
+    /* set the total data size */
+    session->data_size = (uint32_t)(next_pkt_data - session->data);
+
+    debug_set_tag_id(0);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int prepare_request(ab_session_p session)
+{
+    eip_encap *encap = NULL;
+    int payload_size = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    encap = (eip_encap *)(session->data);
+    payload_size = (int)session->data_size - (int)sizeof(eip_encap);
+
+    if(!session) {
+        pdebug(DEBUG_WARN, "Called with null session!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* fill in the fields of the request. */
+
+    encap->encap_length = h2le16((uint16_t)payload_size);
+    encap->encap_session_handle = h2le32(session->session_handle);
+    encap->encap_status = h2le32(0);
+    encap->encap_options = h2le32(0);
+
+    /* set up the session sequence ID for this transaction */
+    if(le2h16(encap->encap_command) == AB_EIP_UNCONNECTED_SEND) {
+        /* get new ID */
+        session->session_seq_id++;
+
+        //request->session_seq_id = session->session_seq_id;
+        encap->encap_sender_context = h2le64(session->session_seq_id); /* link up the request seq ID and the packet seq ID */
+
+        pdebug(DEBUG_INFO, "Preparing unconnected packet with session sequence ID %llx", session->session_seq_id);
+    } else if(le2h16(encap->encap_command) == AB_EIP_CONNECTED_SEND) {
+        eip_cip_co_req *conn_req = (eip_cip_co_req *)(session->data);
+
+        pdebug(DEBUG_DETAIL, "cpf_targ_conn_id=%x", session->targ_connection_id);
+
+        /* set up the connection information */
+        conn_req->cpf_targ_conn_id = h2le32(session->targ_connection_id);
+
+        session->conn_seq_num++;
+        conn_req->cpf_conn_seq_num = h2le16(session->conn_seq_num);
+
+        pdebug(DEBUG_INFO, "Preparing connected packet with connection ID %x and sequence ID %u(%x)", session->orig_connection_id, session->conn_seq_num, session->conn_seq_num);
+    } else {
+        pdebug(DEBUG_WARN, "Unsupported packet type %x!", le2h16(encap->encap_command));
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    /* display the data */
+    pdebug(DEBUG_INFO, "Prepared packet of size %d", session->data_size);
+    pdebug_dump_bytes(DEBUG_INFO, session->data, (int)session->data_size);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+int send_eip_request(ab_session_p session, int timeout)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int64_t timeout_time = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!session) {
+        pdebug(DEBUG_WARN, "Session pointer is null.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(timeout > 0) {
+        timeout_time = time_ms() + timeout;
+    } else {
+        timeout_time = INT64_MAX;
+    }
+
+    pdebug(DEBUG_INFO, "Sending packet of size %d", session->data_size);
+    pdebug_dump_bytes(DEBUG_INFO, session->data, (int)(session->data_size));
+
+    session->data_offset = 0;
+    session->packet_count++;
+
+    /* send the packet */
+    do {
+        rc = socket_write(session->sock, session->data + session->data_offset, (int)session->data_size - (int)session->data_offset);
+
+        if(rc >= 0) {
+            session->data_offset += (uint32_t)rc;
+        }
+
+        /* give up the CPU if we still are looping */
+        if(!session->terminating && rc >= 0 && session->data_offset < session->data_size) {
+            sleep_ms(1);
+        }
+    } while(!session->terminating && rc >= 0 && session->data_offset < session->data_size && timeout_time > time_ms());
+
+    if(session->terminating) {
+        pdebug(DEBUG_WARN, "Session is terminating.");
+        return PLCTAG_ERR_ABORT;
+    }
+
+    if(rc < 0) {
+        pdebug(DEBUG_WARN, "Error, %d, writing socket!", rc);
+        return rc;
+    }
+
+    if(timeout_time <= time_ms()) {
+        pdebug(DEBUG_WARN, "Timed out waiting to send data!");
+        return PLCTAG_ERR_TIMEOUT;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * recv_eip_response
+ *
+ * Look at the passed session and read any data we can
+ * to fill in a packet.  If we already have a full packet,
+ * punt.
+ */
+int recv_eip_response(ab_session_p session, int timeout)
+{
+    uint32_t data_needed = 0;
+    int rc = PLCTAG_STATUS_OK;
+    int64_t timeout_time = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!session) {
+        pdebug(DEBUG_WARN, "Called with null session!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+
+    if(timeout > 0) {
+        timeout_time = time_ms() + timeout;
+    } else {
+        timeout_time = INT64_MAX;
+    }
+
+    session->data_offset = 0;
+    session->data_size = 0;
+    data_needed = sizeof(eip_encap);
+
+    do {
+        rc = socket_read(session->sock, session->data + session->data_offset,
+                         (int)(data_needed - session->data_offset));
+
+        if (rc < 0) {
+            /* error! */
+            pdebug(DEBUG_WARN, "Error reading socket! rc=%d", rc);
+            return rc;
+        } else {
+            session->data_offset += (uint32_t)rc;
+
+            /*pdebug_dump_bytes(session->debug, session->data, session->data_offset);*/
+
+            /* recalculate the amount of data needed if we have just completed the read of an encap header */
+            if(session->data_offset >= sizeof(eip_encap)) {
+                data_needed = (uint32_t)(sizeof(eip_encap) + le2h16(((eip_encap *)(session->data))->encap_length));
+
+                if(data_needed > session->data_capacity) {
+                    pdebug(DEBUG_WARN, "Packet response (%d) is larger than possible buffer size (%d)!", data_needed, session->data_capacity);
+                    return PLCTAG_ERR_TOO_LARGE;
+                }
+            }
+        }
+
+        /* did we get all the data? */
+        if(!session->terminating && session->data_offset < data_needed) {
+            /* do not hog the CPU */
+            sleep_ms(1);
+        }
+    } while(!session->terminating && session->data_offset < data_needed && timeout_time > time_ms());
+
+    if(session->terminating) {
+        pdebug(DEBUG_INFO, "Session is terminating, returning...");
+        return PLCTAG_ERR_ABORT;
+    }
+
+    if(timeout_time <= time_ms()) {
+        pdebug(DEBUG_WARN, "Timed out waiting for data to read!");
+        return PLCTAG_ERR_TIMEOUT;
+    }
+
+    session->resp_seq_id = le2h64(((eip_encap *)(session->data))->encap_sender_context);
+    session->data_size = data_needed;
+
+    rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "request received all needed data (%d bytes of %d).", session->data_offset, data_needed);
+
+    pdebug_dump_bytes(DEBUG_INFO, session->data, (int)(session->data_offset));
+
+    /* check status. */
+    if(le2h32(((eip_encap *)(session->data))->encap_status) != AB_EIP_OK) {
+        rc = PLCTAG_ERR_BAD_STATUS;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+int perform_forward_close(ab_session_p session)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    do {
+        rc = send_forward_close_req(session);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Sending forward close failed, %s!", plc_tag_decode_error(rc));
+            break;
+        }
+
+        rc = recv_forward_close_resp(session);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Forward close response not received, %s!", plc_tag_decode_error(rc));
+            break;
+        }
+    } while(0);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * fo_cache_load_file
+ *
+ * Read a Forward Open cache file into the in-memory cache.  Each file is
+ * only read once.  This is called before taking the session mutex so
+ * that tag creation does not wait on the disk.  Each line is
+ * "<gateway> <path or -> <old forward open flag> <payload size>".
+ */
+
+void fo_cache_load_file(const char *file_name)
+{
+    FILE *cache_file = NULL;
+    char line[FO_CACHE_MAX_LINE];
+    char host[FO_CACHE_MAX_LINE];
+    char path[FO_CACHE_MAX_LINE];
+    struct fo_cache_file_t *file_entry = NULL;
+    int loaded = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    critical_block(fo_cache_mutex) {
+        for(file_entry = fo_cache_files; file_entry; file_entry = file_entry->next) {
+            if(str_cmp(file_entry->name, file_name) == 0) {
+                loaded = 1;
+                break;
+            }
+        }
+    }
+
+    if(loaded) {
+        pdebug(DEBUG_DETAIL, "Done.  Forward Open cache file %s already loaded.", file_name);
+        return;
+    }
+
+    /* keep out anyone rewriting the file. */
+    critical_block(fo_cache_file_mutex) {
+        cache_file = fopen(file_name, "r");
+        if(!cache_file) {
+            pdebug(DEBUG_DETAIL, "Forward Open cache file %s not found.", file_name);
+            break;
+        }
+
+        while(fgets(line, (int)sizeof(line), cache_file)) {
+            int old_fo = 0;
+            unsigned int payload = 0;
+
+            if(sscanf(line, "%511s %511s %d %u", host, path, &old_fo, &payload) != 4) {
+                continue;
+            }
+
+            if(payload == 0 || payload > MAX_CIP_MSG_SIZE_EX) {
+                pdebug(DEBUG_WARN, "Ignoring bad payload size %u in Forward Open cache file.", payload);
+                continue;
+            }
+
+            /* empty paths are written as "-" to keep the fields separated. */
+            fo_cache_update(host, (str_cmp(path, "-") == 0 ? "" : path), file_name, (old_fo ? 1 : 0), (uint16_t)payload, 1);
+        }
+
+        fclose(cache_file);
+    }
+
+    /* remember the file even if it is not there yet, it is written later. */
+    file_entry = mem_alloc((int)sizeof(*file_entry) + str_length(file_name) + 1);
+    if(!file_entry) {
+        pdebug(DEBUG_WARN, "Unable to allocate Forward Open cache file entry!");
+        return;
+    }
+
+    str_copy(file_entry->name, str_length(file_name) + 1, file_name);
+
+    critical_block(fo_cache_mutex) {
+        file_entry->next = fo_cache_files;
+        fo_cache_files = file_entry;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+/*
+ * fo_cache_update
+ *
+ * Set the cached Forward Open parameters for a gateway and path.  Values
+ * read from a file do not replace values from a Forward Open in this
+ * process.  Returns 1 if anything changed.
+ */
+
+int fo_cache_update(const char *host, const char *path, const char *file_name, int only_use_old_forward_open, uint16_t max_payload_size, int from_file)
+{
+    int64_t key = session_key(host, path);
+    struct fo_cache_entry_t *entry = NULL;
+    int changed = 0;
+
+    critical_block(fo_cache_mutex) {
+        entry = hashtable_get(fo_cache, key);
+
+        if(entry && !fo_cache_match(entry, host, path)) {
+            /* a key collision, the newer gateway and path take the slot. */
+            hashtable_remove(fo_cache, key);
+            fo_cache_free_entry(fo_cache, key, entry, NULL);
+            entry = NULL;
+        }
+
+        if(!entry) {
+            entry = mem_alloc((int)sizeof(*entry));
+            if(!entry) {
+                pdebug(DEBUG_WARN, "Unable to allocate Forward Open cache entry!");
+                break;
+            }
+
+            entry->host = str_dup(host);
+            entry->path = str_dup(path ? path : "");
+            entry->from_file = from_file;
+
+            if(!entry->host || !entry->path || hashtable_put(fo_cache, key, entry) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to insert Forward Open cache entry!");
+                fo_cache_free_entry(fo_cache, key, entry, NULL);
+                break;
+            }
+
+            changed = 1;
+        } else if(from_file && !entry->from_file) {
+            break;
+        }
+
+        if(file_name && !entry->file) {
+            entry->file = str_dup(file_name);
+            changed = 1;
+        }
+
+        if(entry->only_use_old_forward_open != only_use_old_forward_open || entry->max_payload_size != max_payload_size) {
+            changed = 1;
+        }
+
+        entry->only_use_old_forward_open = only_use_old_forward_open;
+        entry->max_payload_size = max_payload_size;
+        entry->from_file = from_file;
+    }
+
+    return changed;
+}
+
+
+/*
+ * fo_cache_match
+ *
+ * Entries are keyed on a hash, so check the gateway and path too.
+ */
+
+int fo_cache_match(struct fo_cache_entry_t *entry, const char *host, const char *path)
+{
+    return (str_cmp_i(entry->host, host) == 0 && str_cmp_i(entry->path, (path ? path : "")) == 0);
+}
+
+
+/*
+ * fo_cache_apply_unsafe
+ *
+ * Seed a new session with the Forward Open parameters from an earlier
+ * session to the same gateway and path, or from a cache file loaded by
+ * fo_cache_load_file().  Must be called with the session mutex held.
+ */
+
+void fo_cache_apply_unsafe(ab_session_p session)
+{
+    struct fo_cache_entry_t *entry = NULL;
+    int found = 0;
+    int only_use_old_forward_open = 0;
+    uint16_t max_payload_size = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    critical_block(fo_cache_mutex) {
+        entry = hashtable_get(fo_cache, session->session_key);
+        if(entry && fo_cache_match(entry, session->host, session->path)) {
+            only_use_old_forward_open = entry->only_use_old_forward_open;
+            max_payload_size = entry->max_payload_size;
+            found = 1;
+        }
+    }
+
+    if(!found) {
+        pdebug(DEBUG_DETAIL, "No cached Forward Open parameters.");
+        return;
+    }
+
+    pdebug(DEBUG_INFO, "Using cached Forward Open parameters, %s with payload size %u.", (only_use_old_forward_open ? "ForwardOpen" : "ForwardOpenEx"), (unsigned int)max_payload_size);
+
+    session->only_use_old_forward_open = only_use_old_forward_open;
+    session->max_payload_guess = max_payload_size;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+/*
+ * fo_cache_store
+ *
+ * Remember the result of a successful Forward Open.  If the values changed
+ * and the session has a cache file, the file is rewritten.  This is called
+ * from the session thread, without the session mutex.
+ */
+
+void fo_cache_store(ab_session_p session)
+{
+    int changed = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    changed = fo_cache_update(session->host, session->path, session->fo_cache_file, session->only_use_old_forward_open, session->max_payload_size, 0);
+
+    if(changed && session->fo_cache_file) {
+        fo_cache_write_file(session->fo_cache_file);
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+/*
+ * fo_cache_write_file
+ *
+ * Replace the contents of a cache file with one line for each entry that
+ * belongs to it.  The lines are put together under the cache mutex and
+ * written out after it is released, to a temporary file that then
+ * replaces the old one.  Other processes reading the file see either
+ * the old contents or the new ones.
+ */
+
+struct fo_cache_write_context_t {
+    const char *file_name;
+    char *data;
+    int size;
+    int capacity;
+};
+
+void fo_cache_write_file(const char *file_name)
+{
+    struct fo_cache_write_context_t context = { file_name, NULL, 0, 0 };
+    FILE *cache_file = NULL;
+    char *tmp_name = NULL;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    /* one writer at a time so that an older snapshot cannot win. */
+    critical_block(fo_cache_file_mutex) {
+        int rc = PLCTAG_STATUS_OK;
+
+        critical_block(fo_cache_mutex) {
+            rc = hashtable_on_each(fo_cache, fo_cache_format_entry, &context);
+        }
+
+        /* do not truncate the file if the new contents are not complete. */
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to build Forward Open cache file contents, %s!", plc_tag_decode_error(rc));
+            break;
+        }
+
+        /* write a new file and move it over the old one, so that readers never see a partial file. */
+        tmp_name = str_concat(file_name, ".tmp");
+        if(!tmp_name) {
+            pdebug(DEBUG_WARN, "Unable to allocate temporary Forward Open cache file name!");
+            break;
+        }
+
+        cache_file = fopen(tmp_name, "w");
+        if(!cache_file) {
+            pdebug(DEBUG_WARN, "Unable to open temporary Forward Open cache file %s!", tmp_name);
+            break;
+        }
+
+        if(context.size > 0 && fwrite(context.data, 1, (size_t)(unsigned int)context.size, cache_file) != (size_t)(unsigned int)context.size) {
+            rc = PLCTAG_ERR_WRITE;
+        }
+
+        if(fclose(cache_file) != 0) {
+            rc = PLCTAG_ERR_WRITE;
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = file_replace(tmp_name, file_name);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to write Forward Open cache file %s, %s!", file_name, plc_tag_decode_error(rc));
+            remove(tmp_name);
+        }
+    }
+
+    if(tmp_name) {
+        mem_free(tmp_name);
+    }
+
+    if(context.data) {
+        mem_free(context.data);
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+int fo_cache_format_entry(hashtable_p table, int64_t key, void *data, void *context_arg)
+{
+    struct fo_cache_entry_t *entry = (struct fo_cache_entry_t *)data;
+    struct fo_cache_write_context_t *context = (struct fo_cache_write_context_t *)context_arg;
+    char line[FO_CACHE_MAX_LINE];
+    int line_size = 0;
+
+    (void)table;
+    (void)key;
+
+    if(!entry->file || str_cmp(entry->file, context->file_name) != 0) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    /* empty paths are written as "-" to keep the fields separated. */
+    line_size = snprintf(line, sizeof(line), "%s %s %d %u\n", entry->host, (str_length(entry->path) ? entry->path : "-"), entry->only_use_old_forward_open, (unsigned int)entry->max_payload_size);
+    if(line_size <= 0 || line_size >= (int)sizeof(line)) {
+        pdebug(DEBUG_WARN, "Forward Open cache line for %s is too long!", entry->host);
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(context->size + line_size > context->capacity) {
+        int new_capacity = (context->capacity ? context->capacity * 2 : FO_CACHE_MAX_LINE * 4);
+        char *new_data = NULL;
+
+        while(new_capacity < context->size + line_size) {
+            new_capacity *= 2;
+        }
+
+        new_data = mem_realloc(context->data, new_capacity);
+        if(!new_data) {
+            pdebug(DEBUG_WARN, "Unable to grow Forward Open cache file buffer!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        context->data = new_data;
+        context->capacity = new_capacity;
+    }
+
+    mem_copy(context->data + context->size, line, line_size);
+    context->size += line_size;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int fo_cache_free_entry(hashtable_p table, int64_t key, void *data, void *context)
+{
+    struct fo_cache_entry_t *entry = (struct fo_cache_entry_t *)data;
+
+    (void)table;
+    (void)key;
+    (void)context;
+
+    if(entry->host) {
+        mem_free(entry->host);
+    }
+
+    if(entry->path) {
+        mem_free(entry->path);
+    }
+
+    if(entry->file) {
+        mem_free(entry->file);
+    }
+
+    mem_free(entry);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int symbol_free_entry(hashtable_p table, int64_t key, void *data, void *context)
+{
+    (void)table;
+    (void)key;
+    (void)context;
+
+    mem_free(data);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * session_add_symbol
+ *
+ * Remember the symbol instance ID for an encoded tag name.  Tag listings
+ * call this for every entry they see.  Later entries for the same name
+ * replace earlier ones.
+ */
+
+int session_add_symbol(ab_session_p session, const uint8_t *encoded_symbol, int encoded_size, uint32_t instance_id)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!session || encoded_size <= 0) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(session->mutex) {
+        struct symbol_entry_t *entry = NULL;
+
+        /* no tag on this session uses instance IDs. */
+        if(!session->use_symbol_instance) {
+            break;
+        }
+
+        entry = get_symbol_entry_unsafe(session, encoded_symbol, encoded_size);
+        if(!entry) {
+            rc = PLCTAG_ERR_NO_MEM;
+            break;
+        }
+
+        entry->instance_id = instance_id;
+        entry->has_instance_id = 1;
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * session_find_symbol
+ *
+ * Look up the symbol instance ID for an encoded tag name.  Returns
+ * PLCTAG_ERR_NOT_FOUND if no tag listing on this session has seen it.
+ */
+
+int session_find_symbol(ab_session_p session, const uint8_t *encoded_symbol, int encoded_size, uint32_t *instance_id)
+{
+    int rc = PLCTAG_ERR_NOT_FOUND;
+    int64_t key = symbol_key(encoded_symbol, encoded_size);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!session || encoded_size <= 0) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(session->mutex) {
+        struct symbol_entry_t *entry = NULL;
+
+        if(!session->symbols) {
+            break;
+        }
+
+        entry = hashtable_get(session->symbols, key);
+        if(entry && entry->has_instance_id && symbol_match(entry, encoded_symbol, encoded_size)) {
+            *instance_id = entry->instance_id;
+            rc = PLCTAG_STATUS_OK;
+        }
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * session_forget_symbol
+ *
+ * Drop the symbol instance ID for an encoded tag name, for instance after
+ * the PLC rejected it.  Any type info is kept.
+ */
+
+int session_forget_symbol(ab_session_p session, const uint8_t *encoded_symbol, int encoded_size)
+{
+    int64_t key = symbol_key(encoded_symbol, encoded_size);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!session || encoded_size <= 0) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(session->mutex) {
+        struct symbol_entry_t *entry = NULL;
+
+        if(!session->symbols) {
+            break;
+        }
+
+        entry = hashtable_get(session->symbols, key);
+        if(entry && symbol_match(entry, encoded_symbol, encoded_size)) {
+            entry->has_instance_id = 0;
+            entry->instance_id = 0;
+        }
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * session_get_symbol_gen
+ *
+ * The symbol table generation changes every time the table is cleared.
+ * A tag using an instance ID from an older generation must look it up
+ * again.
+ */
+
+uint32_t session_get_symbol_gen(ab_session_p session)
+{
+    uint32_t symbol_gen = 0;
+
+    critical_block(session->mutex) {
+        symbol_gen = session->symbol_gen;
+    }
+
+    return symbol_gen;
+}
+
+
+
+/*
+ * clear_symbols
+ *
+ * Throw away everything learned about the PLC's symbols.  Called when the
+ * session connects since a download to the PLC can change them.
+ */
+
+void clear_symbols(ab_session_p session)
+{
+    hashtable_p symbols = NULL;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    critical_block(session->mutex) {
+        symbols = session->symbols;
+        session->symbols = NULL;
+        session->symbol_gen++;
+    }
+
+    if(symbols) {
+        hashtable_on_each(symbols, symbol_free_entry, NULL);
+        hashtable_destroy(symbols);
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+
+/*
+ * session_add_type_info
+ *
+ * Remember the CIP type info for an encoded tag name so that other tags
+ * with the same name can write without reading first.  Type info that is
+ * too long to keep is ignored.
+ */
+
+int session_add_type_info(ab_session_p session, const uint8_t *encoded_symbol, int encoded_size, const uint8_t *type_info, int type_info_size)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!session || encoded_size <= 0 || !type_info) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(type_info_size <= 0 || type_info_size > SYMBOL_TYPE_INFO_SIZE) {
+        pdebug(DEBUG_SPEW, "Done.  Type info of %d bytes not cached.", type_info_size);
+        return PLCTAG_STATUS_OK;
+    }
+
+    critical_block(session->mutex) {
+        struct symbol_entry_t *entry = get_symbol_entry_unsafe(session, encoded_symbol, encoded_size);
+
+        if(!entry) {
+            rc = PLCTAG_ERR_NO_MEM;
+            break;
+        }
+
+        mem_copy(entry->type_info, (void *)type_info, type_info_size);
+        entry->type_info_size = type_info_size;
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * session_find_type_info
+ *
+ * Look up the cached type info for an encoded tag name.  On the way in
+ * type_info_size is the size of the buffer, on the way out the size of
+ * the type info.  Returns PLCTAG_ERR_NOT_FOUND if it is not known.
+ */
+
+int session_find_type_info(ab_session_p session, const uint8_t *encoded_symbol, int encoded_size, uint8_t *type_info, int *type_info_size)
+{
+    int rc = PLCTAG_ERR_NOT_FOUND;
+    int64_t key = symbol_key(encoded_symbol, encoded_size);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!session || encoded_size <= 0 || !type_info || !type_info_size) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(session->mutex) {
+        struct symbol_entry_t *entry = NULL;
 
-    debug_set_tag_id(0);
+        if(!session->symbols) {
+            break;
+        }
 
-    pdebug(DEBUG_INFO, "Done.");
+        entry = hashtable_get(session->symbols, key);
+        if(entry && entry->type_info_size > 0 && entry->type_info_size <= *type_info_size && symbol_match(entry, encoded_symbol, encoded_size)) {
+            mem_copy(type_info, entry->type_info, entry->type_info_size);
+            *type_info_size = entry->type_info_size;
+            rc = PLCTAG_STATUS_OK;
+        }
+    }
 
-    return PLCTAG_STATUS_OK;
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
 }
 
 
 
-int prepare_request(ab_session_p session)
+/*
+ * get_symbol_entry_unsafe
+ *
+ * Find the entry for an encoded tag name, creating it if needed.  On a
+ * hash collision the newest name wins.  Returns NULL if out of memory or
+ * the table is full.
+ * You must hold the mutex before calling this!
+ */
+
+struct symbol_entry_t *get_symbol_entry_unsafe(ab_session_p session, const uint8_t *encoded_symbol, int encoded_size)
 {
-    eip_encap *encap = NULL;
-    int payload_size = 0;
+    int64_t key = symbol_key(encoded_symbol, encoded_size);
+    struct symbol_entry_t *entry = NULL;
 
-    pdebug(DEBUG_INFO, "Starting.");
+    if(!session->symbols) {
+        session->symbols = hashtable_create(SESSION_SYMBOL_TABLE_SIZE);
+        if(!session->symbols) {
+            pdebug(DEBUG_WARN, "Unable to allocate symbol table!");
+            return NULL;
+        }
+    }
 
-    encap = (eip_encap *)(session->data);
-    payload_size = (int)session->data_size - (int)sizeof(eip_encap);
+    entry = hashtable_get(session->symbols, key);
+    if(entry) {
+        if(symbol_match(entry, encoded_symbol, encoded_size)) {
+            return entry;
+        }
 
-    if(!session) {
-        pdebug(DEBUG_WARN, "Called with null session!");
-        return PLCTAG_ERR_NULL_PTR;
+        /* hash collision, the newest name wins. */
+        hashtable_remove(session->symbols, key);
+        mem_free(entry);
+    } else if(hashtable_entries(session->symbols) >= SESSION_SYMBOL_MAX_ENTRIES) {
+        pdebug(DEBUG_DETAIL, "Symbol table is full.");
+        return NULL;
     }
 
-    /* fill in the fields of the request. */
+    entry = mem_alloc((int)sizeof(*entry) + encoded_size);
+    if(!entry) {
+        pdebug(DEBUG_WARN, "Unable to allocate symbol table entry!");
+        return NULL;
+    }
 
-    encap->encap_length = h2le16((uint16_t)payload_size);
-    encap->encap_session_handle = h2le32(session->session_handle);
-    encap->encap_status = h2le32(0);
-    encap->encap_options = h2le32(0);
+    entry->encoded_size = encoded_size;
+    mem_copy(entry->encoded_symbol, (void *)encoded_symbol, encoded_size);
 
-    /* set up the session sequence ID for this transaction */
-    if(le2h16(encap->encap_command) == AB_EIP_UNCONNECTED_SEND) {
-        /* get new ID */
-        session->session_seq_id++;
+    if(hashtable_put(session->symbols, key, entry) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to insert symbol table entry!");
+        mem_free(entry);
+        return NULL;
+    }
 
-        //request->session_seq_id = session->session_seq_id;
-        encap->encap_sender_context = h2le64(session->session_seq_id); /* link up the request seq ID and the packet seq ID */
+    return entry;
+}
 
-        pdebug(DEBUG_INFO, "Preparing unconnected packet with session sequence ID %llx", session->session_seq_id);
-    } else if(le2h16(encap->encap_command) == AB_EIP_CONNECTED_SEND) {
-        eip_cip_co_req *conn_req = (eip_cip_co_req *)(session->data);
 
-        pdebug(DEBUG_DETAIL, "cpf_targ_conn_id=%x", session->targ_connection_id);
 
-        /* set up the connection information */
-        conn_req->cpf_targ_conn_id = h2le32(session->targ_connection_id);
+/*
+ * symbol_key
+ *
+ * Logix tag names are not case sensitive, so hash the lowercased bytes.
+ */
 
-        session->conn_seq_num++;
-        conn_req->cpf_conn_seq_num = h2le16(session->conn_seq_num);
+int64_t symbol_key(const uint8_t *encoded_symbol, int encoded_size)
+{
+    uint8_t lower[MAX_TAG_NAME];
+    uint64_t key = 0;
 
-        pdebug(DEBUG_INFO, "Preparing connected packet with connection ID %x and sequence ID %u(%x)", session->orig_connection_id, session->conn_seq_num, session->conn_seq_num);
-    } else {
-        pdebug(DEBUG_WARN, "Unsupported packet type %x!", le2h16(encap->encap_command));
-        return PLCTAG_ERR_UNSUPPORTED;
+    if(encoded_size > MAX_TAG_NAME) {
+        encoded_size = MAX_TAG_NAME;
     }
 
-    /* display the data */
-    pdebug(DEBUG_INFO, "Prepared packet of size %d", session->data_size);
-    pdebug_dump_bytes(DEBUG_INFO, session->data, (int)session->data_size);
+    for(int i=0; i < encoded_size; i++) {
+        lower[i] = (uint8_t)tolower(encoded_symbol[i]);
+    }
 
-    pdebug(DEBUG_INFO, "Done.");
+    key = ((uint64_t)hash(lower, (size_t)encoded_size, 0x9E3779B9) << 32)
+          | (uint64_t)hash(lower, (size_t)encoded_size, 0x7F4A7C15);
 
-    return PLCTAG_STATUS_OK;
+    /* zero marks an empty slot in the hashtable. */
+    if(!key) {
+        key = 1;
+    }
+
+    return (int64_t)key;
 }
 
 
+int symbol_match(struct symbol_entry_t *entry, const uint8_t *encoded_symbol, int encoded_size)
+{
+    if(entry->encoded_size != encoded_size) {
+        return 0;
+    }
 
+    for(int i=0; i < encoded_size; i++) {
+        if(tolower(entry->encoded_symbol[i]) != tolower(encoded_symbol[i])) {
+            return 0;
+        }
+    }
 
-int send_eip_request(ab_session_p session, int timeout)
+    return 1;
+}
+
+
+/*
+ * session_add_udt
+ *
+ * Put a template in the session's cache.  The cache takes its own
+ * references.  A template read again replaces the old one, any caller
+ * still holding the old one keeps it until it lets go.
+ */
+
+int session_add_udt(ab_session_p session, ab_udt_p udt)
 {
     int rc = PLCTAG_STATUS_OK;
-    int64_t timeout_time = 0;
+    int64_t keys[2];
 
-    pdebug(DEBUG_INFO, "Starting.");
+    pdebug(DEBUG_DETAIL, "Starting.");
 
-    if(!session) {
-        pdebug(DEBUG_WARN, "Session pointer is null.");
+    if(!session || !udt) {
         return PLCTAG_ERR_NULL_PTR;
     }
 
-    if(timeout > 0) {
-        timeout_time = time_ms() + timeout;
-    } else {
-        timeout_time = INT64_MAX;
-    }
+    keys[0] = UDT_ID_KEY(udt->id);
+    keys[1] = UDT_HANDLE_KEY(udt->handle);
 
-    pdebug(DEBUG_INFO, "Sending packet of size %d", session->data_size);
-    pdebug_dump_bytes(DEBUG_INFO, session->data, (int)(session->data_size));
+    critical_block(session->mutex) {
+        if(!session->udts) {
+            session->udts = hashtable_create(SESSION_UDT_TABLE_SIZE);
+            if(!session->udts) {
+                pdebug(DEBUG_WARN, "Unable to allocate template table!");
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+        }
 
-    session->data_offset = 0;
-    session->packet_count++;
+        for(int i=0; i < 2 && rc == PLCTAG_STATUS_OK; i++) {
+            ab_udt_p old_udt = hashtable_remove(session->udts, keys[i]);
 
-    /* send the packet */
-    do {
-        rc = socket_write(session->sock, session->data + session->data_offset, (int)session->data_size - (int)session->data_offset);
+            if(old_udt) {
+                rc_dec(old_udt);
+            }
 
-        if(rc >= 0) {
-            session->data_offset += (uint32_t)rc;
+            rc = hashtable_put(session->udts, keys[i], rc_inc(udt));
+            if(rc != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to insert template in table!");
+                rc_dec(udt);
+            }
         }
+    }
 
-        /* give up the CPU if we still are looping */
-        if(!session->terminating && rc >= 0 && session->data_offset < session->data_size) {
-            sleep_ms(1);
-        }
-    } while(!session->terminating && rc >= 0 && session->data_offset < session->data_size && timeout_time > time_ms());
+    pdebug(DEBUG_DETAIL, "Done.");
 
-    if(session->terminating) {
-        pdebug(DEBUG_WARN, "Session is terminating.");
-        return PLCTAG_ERR_ABORT;
-    }
+    return rc;
+}
 
-    if(rc < 0) {
-        pdebug(DEBUG_WARN, "Error, %d, writing socket!", rc);
-        return rc;
-    }
 
-    if(timeout_time <= time_ms()) {
-        pdebug(DEBUG_WARN, "Timed out waiting to send data!");
-        return PLCTAG_ERR_TIMEOUT;
-    }
 
-    pdebug(DEBUG_INFO, "Done.");
+/*
+ * session_find_udt
+ *
+ * Get a template from the cache by its ID.  The caller must rc_dec() the
+ * returned template.  NULL if it has not been read on this session.
+ */
 
-    return PLCTAG_STATUS_OK;
+ab_udt_p session_find_udt(ab_session_p session, uint16_t udt_id)
+{
+    return find_udt_by_key(session, UDT_ID_KEY(udt_id));
 }
 
 
 
 /*
- * recv_eip_response
+ * session_find_udt_by_handle
  *
- * Look at the passed session and read any data we can
- * to fill in a packet.  If we already have a full packet,
- * punt.
+ * Same as above, but using the structure handle that the PLC puts in the
+ * type information of a tag read response.
  */
-int recv_eip_response(ab_session_p session, int timeout)
+
+ab_udt_p session_find_udt_by_handle(ab_session_p session, uint16_t handle)
 {
-    uint32_t data_needed = 0;
-    int rc = PLCTAG_STATUS_OK;
-    int64_t timeout_time = 0;
+    return find_udt_by_key(session, UDT_HANDLE_KEY(handle));
+}
 
-    pdebug(DEBUG_INFO, "Starting.");
+
+ab_udt_p find_udt_by_key(ab_session_p session, int64_t key)
+{
+    ab_udt_p udt = NULL;
 
     if(!session) {
-        pdebug(DEBUG_WARN, "Called with null session!");
-        return PLCTAG_ERR_NULL_PTR;
+        return NULL;
     }
 
-
-    if(timeout > 0) {
-        timeout_time = time_ms() + timeout;
-    } else {
-        timeout_time = INT64_MAX;
+    critical_block(session->mutex) {
+        if(session->udts) {
+            udt = rc_inc(hashtable_get(session->udts, key));
+        }
     }
 
-    session->data_offset = 0;
-    session->data_size = 0;
-    data_needed = sizeof(eip_encap);
-
-    do {
-        rc = socket_read(session->sock, session->data + session->data_offset,
-                         (int)(data_needed - session->data_offset));
+    return udt;
+}
 
-        if (rc < 0) {
-            /* error! */
-            pdebug(DEBUG_WARN, "Error reading socket! rc=%d", rc);
-            return rc;
-        } else {
-            session->data_offset += (uint32_t)rc;
 
-            /*pdebug_dump_bytes(session->debug, session->data, session->data_offset);*/
+int udt_release_entry(hashtable_p table, int64_t key, void *data, void *context)
+{
+    (void)table;
+    (void)key;
+    (void)context;
 
-            /* recalculate the amount of data needed if we have just completed the read of an encap header */
-            if(session->data_offset >= sizeof(eip_encap)) {
-                data_needed = (uint32_t)(sizeof(eip_encap) + le2h16(((eip_encap *)(session->data))->encap_length));
+    rc_dec(data);
 
-                if(data_needed > session->data_capacity) {
-                    pdebug(DEBUG_WARN, "Packet response (%d) is larger than possible buffer size (%d)!", data_needed, session->data_capacity);
-                    return PLCTAG_ERR_TOO_LARGE;
-                }
-            }
-        }
+    return PLCTAG_STATUS_OK;
+}
 
-        /* did we get all the data? */
-        if(!session->terminating && session->data_offset < data_needed) {
-            /* do not hog the CPU */
-            sleep_ms(1);
-        }
-    } while(!session->terminating && session->data_offset < data_needed && timeout_time > time_ms());
 
-    if(session->terminating) {
-        pdebug(DEBUG_INFO, "Session is terminating, returning...");
-        return PLCTAG_ERR_ABORT;
-    }
+/*
+ * session_can_keepalive
+ *
+ * DH+ bridged connections carry PCCC, not CIP, so there is no safe
+ * keepalive for them.  Those sessions disconnect when idle as before.
+ */
 
-    if(timeout_time <= time_ms()) {
-        pdebug(DEBUG_WARN, "Timed out waiting for data to read!");
-        return PLCTAG_ERR_TIMEOUT;
-    }
+int session_can_keepalive(ab_session_p session)
+{
+    return !(session->use_connected_msg && session->dhp_dest);
+}
 
-    session->resp_seq_id = le2h64(((eip_encap *)(session->data))->encap_sender_context);
-    session->data_size = data_needed;
 
-    rc = PLCTAG_STATUS_OK;
+/*
+ * send_keepalive
+ *
+ * Send a small request to keep an idle session open.  Connected sessions
+ * read the vendor ID from the Identity object over the connection, which
+ * resets the connection timer in the PLC.  Unconnected sessions only
+ * need TCP traffic, so they use a ListIdentity.
+ *
+ * Only the arrival of a response matters.  An error status in the
+ * encapsulation header, as from a PLC that does not support ListIdentity,
+ * still means the connection is alive and is not returned as an error.
+ */
 
-    pdebug(DEBUG_INFO, "request received all needed data (%d bytes of %d).", session->data_offset, data_needed);
+int send_keepalive(ab_session_p session)
+{
+    int rc = PLCTAG_STATUS_OK;
+    eip_encap *encap = (eip_encap *)(session->data);
 
-    pdebug_dump_bytes(DEBUG_INFO, session->data, (int)(session->data_offset));
+    pdebug(DEBUG_DETAIL, "Starting.");
 
-    /* check status. */
-    if(le2h32(((eip_encap *)(session->data))->encap_status) != AB_EIP_OK) {
-        rc = PLCTAG_ERR_BAD_STATUS;
-    }
+    if(session->use_connected_msg) {
+        eip_cip_co_req *cip = (eip_cip_co_req *)(session->data);
+        uint8_t *data = session->data + sizeof(eip_cip_co_req);
+
+        mem_set(session->data, 0, (int)sizeof(eip_cip_co_req));
+
+        /* Get Attribute Single, Identity class 1, instance 1, attribute 1. */
+        *data = AB_EIP_CMD_CIP_GET_ATTR_SINGLE; data++;
+        *data = 3; data++; /* path size in words */
+        *data = 0x20; data++;
+        *data = 0x01; data++;
+        *data = 0x24; data++;
+        *data = 0x01; data++;
+        *data = 0x30; data++;
+        *data = 0x01; data++;
+
+        cip->encap_command = h2le16(AB_EIP_CONNECTED_SEND);
+        cip->router_timeout = h2le16(1);
+        cip->cpf_item_count = h2le16(2);
+        cip->cpf_cai_item_type = h2le16(AB_EIP_ITEM_CAI);
+        cip->cpf_cai_item_length = h2le16(4);
+        cip->cpf_cdi_item_type = h2le16(AB_EIP_ITEM_CDI);
+        cip->cpf_cdi_item_length = h2le16((uint16_t)(data - (uint8_t *)(&cip->cpf_conn_seq_num)));
+
+        session->data_size = (uint32_t)(data - session->data);
+
+        rc = prepare_request(session);
+    } else {
+        mem_set(session->data, 0, (int)sizeof(eip_encap));
 
-    pdebug(DEBUG_INFO, "Done.");
+        encap->encap_command = h2le16(AB_EIP_LIST_IDENTITY);
+        encap->encap_length = h2le16(0);
+        encap->encap_sender_context = h2le64(++session->session_seq_id);
 
-    return rc;
-}
+        session->data_size = (uint32_t)sizeof(eip_encap);
+    }
 
+    do {
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to prepare keepalive, %s!", plc_tag_decode_error(rc));
+            break;
+        }
 
+        if((rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error sending keepalive %s!", plc_tag_decode_error(rc));
+            break;
+        }
 
-int perform_forward_close(ab_session_p session)
-{
-    int rc = PLCTAG_STATUS_OK;
+        rc = recv_eip_response(session, SESSION_DEFAULT_TIMEOUT);
 
-    pdebug(DEBUG_INFO, "Starting.");
+        /* the whole response arrived, only the PLC did not like the request. */
+        if(rc == PLCTAG_ERR_BAD_STATUS) {
+            pdebug(DEBUG_DETAIL, "Keepalive response has status %x, the session is still alive.", le2h32(encap->encap_status));
+            rc = PLCTAG_STATUS_OK;
+        }
 
-    do {
-        rc = send_forward_close_req(session);
         if(rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN, "Sending forward close failed, %s!", plc_tag_decode_error(rc));
+            pdebug(DEBUG_WARN, "Error receiving keepalive response %s!", plc_tag_decode_error(rc));
             break;
         }
 
-        rc = recv_forward_close_resp(session);
-        if(rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN, "Forward close response not received, %s!", plc_tag_decode_error(rc));
+        if(le2h16(encap->encap_command) != (session->use_connected_msg ? AB_EIP_CONNECTED_SEND : AB_EIP_LIST_IDENTITY)) {
+            pdebug(DEBUG_WARN, "Unexpected EIP packet type %x received for keepalive!", le2h16(encap->encap_command));
+            rc = PLCTAG_ERR_BAD_DATA;
             break;
         }
     } while(0);
 
-    pdebug(DEBUG_INFO, "Done.");
+    session->data_size = 0;
+    session->data_offset = 0;
+
+    pdebug(DEBUG_DETAIL, "Done.");
 
     return rc;
 }
@@ -2199,6 +4290,8 @@ int receive_forward_open_response(ab_session_p session)
 
         session->max_payload_size = session->max_payload_guess;
 
+        fo_cache_store(session);
+
         pdebug(DEBUG_INFO, "ForwardOpen succeeded with our connection ID %x and the PLC connection ID %x with packet size %u.", session->orig_connection_id, session->targ_connection_id, session->max_payload_size);
 
         rc = PLCTAG_STATUS_OK;
@@ -2377,6 +4470,11 @@ void request_destroy(void *req_arg)
 
     req->abort_request = 1;
 
+    /* anything still riding on this request will never get a response. */
+    req->status = PLCTAG_ERR_ABORT;
+    req->request_size = 0;
+    complete_riders(req);
+
     if(req->data) {
         mem_free(req->data);
         req->data = NULL;
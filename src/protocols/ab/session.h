@@ -36,6 +36,8 @@
 
 #include <ab/ab_common.h>
 #include <ab/defs.h>
+#include <ab/udt.h>
+#include <util/hashtable.h>
 #include <util/rc.h>
 #include <util/vector.h>
 
@@ -53,6 +55,7 @@ struct ab_session_t {
 //    int status;
     int failed;
     int on_list;
+    int64_t session_key;
 
     /* gateway connection related info */
     char *host;
@@ -76,6 +79,22 @@ struct ab_session_t {
     uint8_t conn_path_size;
     uint16_t dhp_dest;
 
+    /* optional file to persist the negotiated Forward Open parameters. */
+    char *fo_cache_file;
+
+    /*
+     * symbol instance IDs and type info learned from listings and reads,
+     * keyed by encoded name.  Instance IDs are only kept if a tag asked for
+     * them.  The table is cleared on every connect and the generation
+     * bumped so that tags stop using IDs from before.
+     */
+    hashtable_p symbols;
+    int use_symbol_instance;
+    uint32_t symbol_gen;
+
+    /* UDT templates that have been read, keyed by template ID and by handle. */
+    hashtable_p udts;
+
     /* registration info */
     uint32_t session_handle;
 
@@ -101,6 +120,59 @@ struct ab_session_t {
     /* disconnect handling */
     int auto_disconnect_enabled;
     int auto_disconnect_timeout_ms;
+
+    /*
+     * rate limiting.  Zero means no limit.  The buckets hold
+     * thousandths of a token so that refill can be done in integer
+     * math on a millisecond clock.
+     */
+    int max_requests_per_sec;
+    int max_bytes_per_sec;
+    int64_t request_tokens;
+    int64_t byte_tokens;
+    int64_t last_refill_ms;
+    int64_t throttle_start_ms;
+    int64_t throttle_total_ms;
+
+    /*
+     * adaptive bundling.  The target bundle size is tuned between
+     * the min and max bounds from the measured throughput.
+     */
+    int adaptive_bundling;
+    int bundle_min_size;
+    int bundle_max_size;
+    int bundle_target_size;
+    int bundle_step;
+    int bundle_samples;
+    int64_t bundle_bytes;
+    int64_t bundle_time_ms;
+    int64_t bundle_last_rate;
+
+    /*
+     * bit write merging.  Bit RMW requests are held this long in the
+     * queue so that writes to other bits of the same word can be merged in.
+     */
+    int bit_merge_ms;
+
+    /*
+     * PCCC block read merging.  Reads are held this long in the queue
+     * so that reads of nearby elements of the same data file can be
+     * merged in.
+     */
+    int pccc_merge_ms;
+
+    /*
+     * DH+ pipelining.  Up to this many PCCC transactions can be
+     * outstanding on a bridged connection, matched up by TNS.
+     */
+    int dhp_max_in_flight;
+
+    /*
+     * fragment pipelining.  Up to this many fragment requests of a large
+     * read or write can be outstanding on a connected session, matched
+     * up by connection sequence number.
+     */
+    int frag_max_in_flight;
 };
 
 struct ab_request_t {
@@ -120,9 +192,40 @@ struct ab_request_t {
     int allow_packing;
     int packing_num;
 
+    /* fragments of a large read or write can be pipelined on a connection. */
+    int allow_pipelining;
+
     /* time stamp for debugging output */
     int64_t time_sent;
 
+    /*
+     * bit Read-Modify-Write merging.  The masks are at rmw_mask_offset
+     * in the request data.  Requests merged into this one ride along
+     * on the riders list and get a copy of the response.
+     */
+    int rmw_mask_offset;
+    int rmw_mask_size;
+    int64_t hold_until_ms;
+    struct ab_request_t *riders;
+    struct ab_request_t *rider_next;
+
+    /*
+     * PCCC block read merging.  A read of pccc_read_size bytes starting
+     * at element pccc_elem of the data file.  The transfer size byte is
+     * at pccc_size_offset in the request data and can grow up to
+     * pccc_max_size.  Merged riders find their data resp_data_offset
+     * bytes into the data of the response.
+     */
+    int pccc_file_num;
+    int pccc_file_type;
+    int pccc_elem;
+    int pccc_elem_size;
+    int pccc_read_size;
+    int pccc_max_size;
+    int pccc_size_offset;
+    int pccc_merged;
+    int resp_data_offset;
+
     /* used by the background thread for incrementally getting data */
     int request_size; /* total bytes, not just data */
     int request_capacity;
@@ -139,6 +242,16 @@ extern void session_teardown();
 
 extern int session_find_or_create(ab_session_p *session, attr attribs);
 extern int session_get_max_payload(ab_session_p session);
+extern int64_t session_get_throttle_ms(ab_session_p session);
+extern int session_add_symbol(ab_session_p session, const uint8_t *encoded_symbol, int encoded_size, uint32_t instance_id);
+extern int session_find_symbol(ab_session_p session, const uint8_t *encoded_symbol, int encoded_size, uint32_t *instance_id);
+extern int session_forget_symbol(ab_session_p session, const uint8_t *encoded_symbol, int encoded_size);
+extern uint32_t session_get_symbol_gen(ab_session_p session);
+extern int session_add_type_info(ab_session_p session, const uint8_t *encoded_symbol, int encoded_size, const uint8_t *type_info, int type_info_size);
+extern int session_find_type_info(ab_session_p session, const uint8_t *encoded_symbol, int encoded_size, uint8_t *type_info, int *type_info_size);
+extern int session_add_udt(ab_session_p session, ab_udt_p udt);
+extern ab_udt_p session_find_udt(ab_session_p session, uint16_t udt_id);
+extern ab_udt_p session_find_udt_by_handle(ab_session_p session, uint16_t handle);
 extern int session_create_request(ab_session_p session, int tag_id, ab_request_p *request);
 extern int session_add_request(ab_session_p sess, ab_request_p req);
 
@@ -45,6 +45,7 @@
 #include <ab/ab_common.h>
 #include <ab/session.h>
 #include <ab/pccc.h>
+#include <ab/tag_index.h>
 
 typedef enum {
     AB_TYPE_BOOL,
@@ -64,6 +65,33 @@ typedef enum {
 } elem_type_t;
 
 
+/* one piece of a fragmented read or write that is sent in parallel. */
+struct ab_frag_t {
+    ab_request_p req;
+    int offset;         /* in the tag data. */
+    int size;
+    int plc_offset;     /* byte offset in the PLC tag, differs from offset for range reads. */
+    int elem_count;     /* element count sent with the request. */
+};
+
+
+/* one part of an array read by a sparse range read, in elements. */
+struct ab_range_t {
+    int elem_offset;
+    int elem_count;
+};
+
+
+/* one controller or program scope listing of a @discover tag. */
+struct ab_listing_t {
+    ab_request_p req;
+    uint8_t prefix[MAX_TAG_NAME];   /* encoded program name, empty for controller scope. */
+    int prefix_size;
+    uint32_t next_id;
+    int done;
+};
+
+
 struct ab_tag_t {
     /*struct plc_tag_t p_tag;*/
     TAG_BASE_STRUCT;
@@ -88,6 +116,9 @@ struct ab_tag_t {
     /* how much data can we send per packet? */
     int write_data_per_packet;
 
+    /* how much data the PLC returns per read packet, learned from partial reads. */
+    int read_data_per_packet;
+
     /* number of elements and size of each in the tag. */
     pccc_file_t file_type;
     elem_type_t elem_type;
@@ -97,6 +128,34 @@ struct ab_tag_t {
 
     int tag_list;
     uint32_t next_id;
+    int list_entries;
+    int list_capacity;
+
+    /* listings in flight for a @discover tag and the index of the finished listing. */
+    int discover;
+    struct ab_listing_t *listings;
+    int listing_count;
+    ab_tag_index_p tag_index;
+
+    /*
+     * swap the symbolic name for a symbol instance ID once one is known.
+     * The symbolic name is kept to go back to if the session reconnects
+     * or the PLC rejects the ID.
+     */
+    int resolve_symbol;
+    int symbol_resolved;
+    uint32_t symbol_gen;
+    int symbolic_name_size;
+    uint8_t symbolic_name[MAX_TAG_NAME];
+
+    /* UDT template reads, @udt/<id>.  Zero data size until the attributes are read. */
+    int udt_tag;
+    uint16_t udt_id;
+    uint16_t udt_handle;
+    uint32_t udt_def_size;
+    int udt_struct_size;
+    int udt_member_count;
+    int udt_data_size;
 
     //int is_bit;
     //uint8_t bit;
@@ -107,8 +166,26 @@ struct ab_tag_t {
     ab_request_p req;
     int offset;
 
+    /* the whole tag read request, built once and sent again as is while the connection size stays the same. */
+    ab_request_p read_template;
+    uint8_t *read_template_data;
+    int read_template_size;
+    int read_template_payload;
+
+    /* fragments in flight when a large tag is read or written in parallel. */
+    struct ab_frag_t *frags;
+    int frag_count;
+
+    /* parts of the array read into the tag data, one after another, if not the whole array. */
+    struct ab_range_t *ranges;
+    int range_count;
+
     int allow_packing;
 
+    /* PCCC block read merging.  A failed merged read is tried again alone, and never merged again if that fails too. */
+    int pccc_solo_read;
+    int pccc_no_merge;
+
     /* flags for operations */
     int read_in_progress;
     int write_in_progress;
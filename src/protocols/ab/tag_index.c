@@ -0,0 +1,342 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <ctype.h>
+#include <stdint.h>
+#include <platform.h>
+#include <ab/defs.h>
+#include <ab/tag.h>
+#include <ab/tag_index.h>
+#include <util/debug.h>
+#include <util/hash.h>
+#include <util/hashtable.h>
+#include <util/rc.h>
+
+
+/*
+ * Entry numbers are stored in the hashtables plus one so that entry zero
+ * is not mistaken for a missing key.
+ */
+struct ab_tag_index_t {
+    int count;
+    int *offsets;               /* byte offset of each entry, ascending. */
+    uint16_t *types;            /* symbol type of each entry. */
+    int *next_of_type;          /* next entry with the same symbol type, -1 at the end. */
+    hashtable_p names;          /* name key -> entry number + 1 */
+    hashtable_p first_of_type;  /* symbol type + 1 -> entry number + 1 */
+};
+
+
+static void tag_index_destroy(void *index_arg);
+static int count_entries(uint8_t *data, int size, int *offsets);
+static int64_t name_key(const uint8_t *name, int name_len);
+static int name_match(uint8_t *data, int offset, const char *name, int name_len);
+static int first_entry_at(ab_tag_index_p index, int start_offset);
+
+
+
+/*
+ * tag_index_create
+ *
+ * Walk the listing data once to find the entries, then build the name
+ * table and the per-type chains.  The chains are built back to front so
+ * that each type's first entry is the lowest one.
+ */
+
+ab_tag_index_p tag_index_create(uint8_t *data, int size)
+{
+    ab_tag_index_p index = NULL;
+    int count = count_entries(data, size, NULL);
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    index = rc_alloc((int)sizeof(struct ab_tag_index_t), tag_index_destroy);
+    if(!index) {
+        pdebug(DEBUG_WARN, "Unable to allocate tag index!");
+        return NULL;
+    }
+
+    index->count = count;
+
+    index->offsets = mem_alloc((count + 1) * (int)sizeof(int));
+    index->types = mem_alloc((count + 1) * (int)sizeof(uint16_t));
+    index->next_of_type = mem_alloc((count + 1) * (int)sizeof(int));
+    index->names = hashtable_create(count * 2 + 1);
+    index->first_of_type = hashtable_create(64);
+
+    if(!index->offsets || !index->types || !index->next_of_type || !index->names || !index->first_of_type) {
+        pdebug(DEBUG_WARN, "Unable to allocate tag index tables!");
+        return rc_dec(index);
+    }
+
+    count_entries(data, size, index->offsets);
+
+    for(int i = count - 1; i >= 0; i--) {
+        tag_list_entry *entry = (tag_list_entry *)(data + index->offsets[i]);
+        int name_len = le2h16(entry->string_len);
+        int64_t type_key = (int64_t)le2h16(entry->symbol_type) + 1;
+        int64_t key = name_key((const uint8_t *)(entry + 1), name_len);
+
+        index->types[i] = le2h16(entry->symbol_type);
+        index->next_of_type[i] = (int)(intptr_t)hashtable_remove(index->first_of_type, type_key) - 1;
+
+        if(hashtable_put(index->first_of_type, type_key, (void *)(intptr_t)(i + 1)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to add entry to the type index!");
+            return rc_dec(index);
+        }
+
+        /* names longer than any tag name cannot be looked up anyway. */
+        if(name_len <= 0 || name_len >= MAX_TAG_NAME) {
+            continue;
+        }
+
+        /* keep the first entry if a name shows up twice. */
+        hashtable_remove(index->names, key);
+
+        if(hashtable_put(index->names, key, (void *)(intptr_t)(i + 1)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to add entry to the name index!");
+            return rc_dec(index);
+        }
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.  Indexed %d entries.", count);
+
+    return index;
+}
+
+
+
+/*
+ * tag_index_find
+ *
+ * Find the first entry at or after start_offset with the given name
+ * and/or symbol type.  A NULL name or a negative type matches anything.
+ * Returns the byte offset of the entry in the listing data.
+ */
+
+int tag_index_find(ab_tag_index_p index, uint8_t *data, const char *name, int symbol_type, int start_offset)
+{
+    int entry = -1;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!index || !data) {
+        pdebug(DEBUG_WARN, "Null index or data pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(name) {
+        int name_len = str_length(name);
+
+        if(name_len <= 0 || name_len >= MAX_TAG_NAME) {
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+
+        entry = (int)(intptr_t)hashtable_get(index->names, name_key((const uint8_t *)name, name_len)) - 1;
+
+        if(entry < 0 || !name_match(data, index->offsets[entry], name, name_len)
+           || index->offsets[entry] < start_offset
+           || (symbol_type >= 0 && (int)index->types[entry] != symbol_type)) {
+            pdebug(DEBUG_DETAIL, "Tag %s not found.", name);
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+
+        return index->offsets[entry];
+    }
+
+    entry = first_entry_at(index, start_offset);
+
+    if(entry >= index->count) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(symbol_type >= 0 && (int)index->types[entry] != symbol_type) {
+        if(entry > 0 && (int)index->types[entry - 1] == symbol_type) {
+            /* walking the list from just past the last match is the common case. */
+            entry = index->next_of_type[entry - 1];
+        } else {
+            int next = (int)(intptr_t)hashtable_get(index->first_of_type, (int64_t)symbol_type + 1) - 1;
+
+            while(next >= 0 && next < entry) {
+                next = index->next_of_type[next];
+            }
+
+            entry = next;
+        }
+    }
+
+    if(entry < 0) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return index->offsets[entry];
+}
+
+
+
+
+/***********************************************************************
+ *************************** Helper Functions **************************
+ **********************************************************************/
+
+
+void tag_index_destroy(void *index_arg)
+{
+    ab_tag_index_p index = (ab_tag_index_p)index_arg;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(index->names) {
+        hashtable_destroy(index->names);
+        index->names = NULL;
+    }
+
+    if(index->first_of_type) {
+        hashtable_destroy(index->first_of_type);
+        index->first_of_type = NULL;
+    }
+
+    if(index->offsets) {
+        mem_free(index->offsets);
+        index->offsets = NULL;
+    }
+
+    if(index->types) {
+        mem_free(index->types);
+        index->types = NULL;
+    }
+
+    if(index->next_of_type) {
+        mem_free(index->next_of_type);
+        index->next_of_type = NULL;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+
+/* count the complete entries in the data, filling in their offsets if asked. */
+int count_entries(uint8_t *data, int size, int *offsets)
+{
+    int offset = 0;
+    int count = 0;
+
+    while(size - offset >= (int)sizeof(tag_list_entry)) {
+        tag_list_entry *entry = (tag_list_entry *)(data + offset);
+        int entry_size = (int)sizeof(tag_list_entry) + le2h16(entry->string_len);
+
+        if(entry_size > size - offset) {
+            break;
+        }
+
+        if(offsets) {
+            offsets[count] = offset;
+        }
+
+        offset += entry_size;
+        count++;
+    }
+
+    return count;
+}
+
+
+
+/* names match without regard to case, like the PLC does. */
+int64_t name_key(const uint8_t *name, int name_len)
+{
+    uint8_t lower[MAX_TAG_NAME];
+    uint64_t key = 0;
+
+    if(name_len > MAX_TAG_NAME) {
+        name_len = MAX_TAG_NAME;
+    }
+
+    for(int i=0; i < name_len; i++) {
+        lower[i] = (uint8_t)tolower(name[i]);
+    }
+
+    key = ((uint64_t)hash(lower, (size_t)name_len, 0x9E3779B9) << 32)
+          | (uint64_t)hash(lower, (size_t)name_len, 0x7F4A7C15);
+
+    /* zero marks an empty slot in the hashtable. */
+    if(!key) {
+        key = 1;
+    }
+
+    return (int64_t)key;
+}
+
+
+
+int name_match(uint8_t *data, int offset, const char *name, int name_len)
+{
+    tag_list_entry *entry = (tag_list_entry *)(data + offset);
+    const uint8_t *entry_name = (const uint8_t *)(entry + 1);
+
+    if(le2h16(entry->string_len) != name_len) {
+        return 0;
+    }
+
+    for(int i=0; i < name_len; i++) {
+        if(tolower(entry_name[i]) != tolower((uint8_t)name[i])) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+
+/* binary search for the first entry at or after the offset. */
+int first_entry_at(ab_tag_index_p index, int start_offset)
+{
+    int low = 0;
+    int high = index->count;
+
+    while(low < high) {
+        int mid = low + (high - low) / 2;
+
+        if(index->offsets[mid] < start_offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
@@ -0,0 +1,426 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <platform.h>
+#include <ab/defs.h>
+#include <ab/session.h>
+#include <ab/udt.h>
+#include <util/debug.h>
+#include <util/rc.h>
+
+
+static void udt_destroy(void *udt_arg);
+static int match_member_name(const char **path, ab_udt_p udt);
+static int match_index(const char **path, int *index);
+static int member_elem_size(ab_session_p session, struct ab_udt_member_t *member);
+
+
+/*
+ * udt_create
+ *
+ * Parse the raw template data from a Read Template response.  The data
+ * starts with eight bytes per member (info word, type word and byte
+ * offset), followed by the zero terminated template name and then one
+ * zero terminated name per member.
+ */
+
+ab_udt_p udt_create(uint16_t id, uint16_t handle, int struct_size, int member_count, uint8_t *data, int data_size)
+{
+    ab_udt_p udt = NULL;
+    int index = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(member_count <= 0 || data_size < member_count * 8) {
+        pdebug(DEBUG_WARN, "Template data is too short for %d members!", member_count);
+        return NULL;
+    }
+
+    udt = rc_alloc((int)sizeof(struct ab_udt_t) + (member_count * (int)sizeof(struct ab_udt_member_t)), udt_destroy);
+    if(!udt) {
+        pdebug(DEBUG_WARN, "Unable to allocate template!");
+        return NULL;
+    }
+
+    udt->id = id;
+    udt->handle = handle;
+    udt->struct_size = struct_size;
+    udt->member_count = member_count;
+
+    for(int i=0; i < member_count; i++) {
+        udt->members[i].info = (uint16_t)(data[index] + (data[index+1] << 8));
+        udt->members[i].type = (uint16_t)(data[index+2] + (data[index+3] << 8));
+        udt->members[i].offset = (int)((uint32_t)data[index+4] + ((uint32_t)data[index+5] << 8) + ((uint32_t)data[index+6] << 16) + ((uint32_t)data[index+7] << 24));
+        index += 8;
+    }
+
+    /* the template name ends at a semicolon, the rest is not useful. */
+    for(int i=-1; i < member_count; i++) {
+        int start = index;
+        char *name = NULL;
+
+        while(index < data_size && data[index]) {
+            index++;
+        }
+
+        if(index >= data_size) {
+            pdebug(DEBUG_WARN, "Template data ended in the middle of the member names!");
+            rc_dec(udt);
+            return NULL;
+        }
+
+        name = mem_alloc(index - start + 1);
+        if(!name) {
+            pdebug(DEBUG_WARN, "Unable to allocate template member name!");
+            rc_dec(udt);
+            return NULL;
+        }
+
+        mem_copy(name, &data[start], index - start);
+
+        /* step past the terminator. */
+        index++;
+
+        if(i < 0) {
+            char *semi = strchr(name, ';');
+
+            if(semi) {
+                *semi = 0;
+            }
+
+            udt->name = name;
+        } else {
+            udt->members[i].name = name;
+        }
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.  Template %u \"%s\" has %d members in %d bytes.", (unsigned int)id, udt->name, member_count, struct_size);
+
+    return udt;
+}
+
+
+
+/*
+ * udt_find_member
+ *
+ * Find the byte offset of a member in a buffer holding one or more
+ * instances of the UDT.  The path looks like the member part of a tag
+ * name, "Motor.Status[3].Running".  It may start with an index, "[2].Speed",
+ * to pick an element of an array of the UDT.  BOOL members, elements of
+ * BOOL arrays and trailing bit numbers on integer members set bit_num to
+ * the bit in the byte at the returned offset.  Otherwise bit_num is -1.
+ * Offsets at or past data_size, the size of the buffer, are out of bounds.
+ *
+ * Nested UDTs must be in the session's template cache as well.
+ */
+
+int udt_find_member(ab_session_p session, ab_udt_p udt, const char *member_path, int data_size, int *offset, int *bit_num)
+{
+    const char *path = member_path;
+    ab_udt_p current = rc_inc(udt);
+    int base = 0;
+    int index = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    *bit_num = -1;
+
+    if(!current || !path) {
+        rc_dec(current);
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* arrays of the UDT. */
+    if(*path == '[') {
+        if(match_index(&path, &index) != PLCTAG_STATUS_OK) {
+            rc_dec(current);
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+
+        if(current->struct_size <= 0 || index >= data_size / current->struct_size) {
+            pdebug(DEBUG_WARN, "Index %d is past the end of the data!", index);
+            rc_dec(current);
+            return PLCTAG_ERR_OUT_OF_BOUNDS;
+        }
+
+        base += index * current->struct_size;
+
+        if(*path == '.') {
+            path++;
+        }
+    }
+
+    while(*path && rc == PLCTAG_STATUS_OK) {
+        struct ab_udt_member_t *member = NULL;
+        uint8_t base_type = 0;
+        int member_index = match_member_name(&path, current);
+
+        if(member_index < 0) {
+            pdebug(DEBUG_WARN, "No member at \"%s\" in template %s!", path, current->name);
+            rc = PLCTAG_ERR_NOT_FOUND;
+            break;
+        }
+
+        member = &current->members[member_index];
+        base_type = (uint8_t)(member->type & 0xFF);
+        base += member->offset;
+
+        if(*path == '[') {
+            int elem_size = 0;
+
+            if(!(member->type & AB_UDT_MEMBER_ARRAY) || match_index(&path, &index) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Member %s is not an array or the index is bad!", member->name);
+                rc = PLCTAG_ERR_BAD_PARAM;
+                break;
+            }
+
+            if(!(member->type & AB_UDT_MEMBER_STRUCT) && base_type == AB_CIP_DATA_DWORD) {
+                /* BOOL arrays are packed into 32-bit words. */
+                if(index >= member->info * 32) {
+                    rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+                    break;
+                }
+
+                base += index / 8;
+                *bit_num = index % 8;
+
+                if(*path) {
+                    rc = PLCTAG_ERR_BAD_PARAM;
+                }
+
+                break;
+            }
+
+            if(index >= member->info) {
+                pdebug(DEBUG_WARN, "Index %d is past the end of member %s!", index, member->name);
+                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+                break;
+            }
+
+            elem_size = member_elem_size(session, member);
+            if(elem_size < 0) {
+                rc = elem_size;
+                break;
+            }
+
+            base += index * elem_size;
+        } else if(!(member->type & AB_UDT_MEMBER_STRUCT) && base_type == AB_CIP_DATA_BIT) {
+            *bit_num = member->info;
+
+            if(*path) {
+                rc = PLCTAG_ERR_BAD_PARAM;
+            }
+
+            break;
+        }
+
+        if(!*path) {
+            break;
+        }
+
+        if(*path != '.') {
+            rc = PLCTAG_ERR_BAD_PARAM;
+            break;
+        }
+
+        path++;
+
+        if(member->type & AB_UDT_MEMBER_STRUCT) {
+            ab_udt_p nested = session_find_udt(session, (uint16_t)(member->type & AB_UDT_MEMBER_ID_MASK));
+
+            if(!nested) {
+                pdebug(DEBUG_WARN, "Template %u for member %s has not been read!", (unsigned int)(member->type & AB_UDT_MEMBER_ID_MASK), member->name);
+                rc = PLCTAG_ERR_NOT_FOUND;
+                break;
+            }
+
+            rc_dec(current);
+            current = nested;
+        } else if(isdigit((unsigned char)*path)) {
+            /* bit number in an integer member. */
+            char *end = NULL;
+            long bit = strtol(path, &end, 10);
+
+            if(*end || bit < 0 || bit >= member_elem_size(session, member) * 8) {
+                rc = PLCTAG_ERR_BAD_PARAM;
+                break;
+            }
+
+            base += (int)(bit / 8);
+            *bit_num = (int)(bit % 8);
+            break;
+        } else {
+            pdebug(DEBUG_WARN, "Member %s is not a UDT!", member->name);
+            rc = PLCTAG_ERR_BAD_PARAM;
+        }
+    }
+
+    rc_dec(current);
+
+    if(rc == PLCTAG_STATUS_OK && base >= data_size) {
+        pdebug(DEBUG_WARN, "Member offset %d is past the end of the %d bytes of data!", base, data_size);
+        rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        *offset = base;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+void udt_destroy(void *udt_arg)
+{
+    ab_udt_p udt = (ab_udt_p)udt_arg;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(udt->name) {
+        mem_free(udt->name);
+        udt->name = NULL;
+    }
+
+    for(int i=0; i < udt->member_count; i++) {
+        if(udt->members[i].name) {
+            mem_free(udt->members[i].name);
+            udt->members[i].name = NULL;
+        }
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+/* returns the index of the member or a negative error. */
+int match_member_name(const char **path, ab_udt_p udt)
+{
+    const char *p = *path;
+    int name_len = 0;
+
+    while(isalnum((unsigned char)p[name_len]) || p[name_len] == '_' || p[name_len] == ':') {
+        name_len++;
+    }
+
+    if(!name_len) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    for(int i=0; i < udt->member_count; i++) {
+        if(udt->members[i].name && str_length(udt->members[i].name) == name_len && str_cmp_i_n(udt->members[i].name, p, name_len) == 0) {
+            *path = p + name_len;
+            return i;
+        }
+    }
+
+    return PLCTAG_ERR_NOT_FOUND;
+}
+
+
+int match_index(const char **path, int *index)
+{
+    char *end = NULL;
+    long val = 0;
+
+    if(**path != '[') {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    val = strtol(*path + 1, &end, 10);
+
+    if(end == *path + 1 || *end != ']' || val < 0 || val > INT_MAX) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    *index = (int)val;
+    *path = end + 1;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int member_elem_size(ab_session_p session, struct ab_udt_member_t *member)
+{
+    if(member->type & AB_UDT_MEMBER_STRUCT) {
+        ab_udt_p nested = session_find_udt(session, (uint16_t)(member->type & AB_UDT_MEMBER_ID_MASK));
+        int size = 0;
+
+        if(!nested) {
+            pdebug(DEBUG_WARN, "Template %u for member %s has not been read!", (unsigned int)(member->type & AB_UDT_MEMBER_ID_MASK), member->name);
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+
+        size = nested->struct_size;
+        rc_dec(nested);
+
+        return size;
+    }
+
+    switch((uint8_t)(member->type & 0xFF)) {
+        case AB_CIP_DATA_BIT:
+        case AB_CIP_DATA_SINT:
+        case AB_CIP_DATA_USINT:
+        case AB_CIP_DATA_BYTE:
+            return 1;
+
+        case AB_CIP_DATA_INT:
+        case AB_CIP_DATA_UINT:
+        case AB_CIP_DATA_WORD:
+            return 2;
+
+        case AB_CIP_DATA_DINT:
+        case AB_CIP_DATA_UDINT:
+        case AB_CIP_DATA_REAL:
+        case AB_CIP_DATA_DWORD:
+            return 4;
+
+        case AB_CIP_DATA_LINT:
+        case AB_CIP_DATA_ULINT:
+        case AB_CIP_DATA_LREAL:
+        case AB_CIP_DATA_LWORD:
+            return 8;
+
+        default:
+            pdebug(DEBUG_WARN, "Unsupported member type 0x%04x for member %s!", (unsigned int)member->type, member->name);
+            return PLCTAG_ERR_UNSUPPORTED;
+    }
+}
@@ -0,0 +1,69 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef __PLCTAG_AB_UDT_H__
+#define __PLCTAG_AB_UDT_H__ 1
+
+#include <ab/ab_common.h>
+
+/* flags in the member type word of a template. */
+#define AB_UDT_MEMBER_STRUCT    (0x8000)
+#define AB_UDT_MEMBER_ARRAY     (0x2000)
+#define AB_UDT_MEMBER_ID_MASK   (0x0FFF)
+
+struct ab_udt_member_t {
+    char *name;
+    uint16_t type;
+    uint16_t info;  /* element count for arrays, bit number for BOOL members. */
+    int offset;
+};
+
+typedef struct ab_udt_t *ab_udt_p;
+
+/*
+ * A UDT template read from the CIP Template object (class 0x6C).  These
+ * are reference counted and shared through the session's template cache.
+ */
+struct ab_udt_t {
+    uint16_t id;
+    uint16_t handle;
+    int struct_size;
+    int member_count;
+    char *name;
+    struct ab_udt_member_t members[];
+};
+
+extern ab_udt_p udt_create(uint16_t id, uint16_t handle, int struct_size, int member_count, uint8_t *data, int data_size);
+extern int udt_find_member(ab_session_p session, ab_udt_p udt, const char *member_path, int data_size, int *offset, int *bit_num);
+
+#endif
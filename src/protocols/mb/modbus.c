@@ -39,40 +39,99 @@
 #include <mb/modbus.h>
 #include <util/attr.h>
 #include <util/debug.h>
+#include <util/hash.h>
+#include <util/hashtable.h>
 #include <util/rc.h>
 
 /* data definitions */
 
 #define PLC_SOCKET_ERR_DELAY (5000)
 #define MODBUS_DEFAULT_PORT (502)
+#define MODBUS_MAX_REQUESTS_IN_FLIGHT (16)
 #define PLC_READ_DATA_LEN (300)
-#define PLC_WRITE_DATA_LEN (300)
+#define PLC_WRITE_DATA_LEN (300 * MODBUS_MAX_REQUESTS_IN_FLIGHT)
 #define MODBUS_MBAP_SIZE (6)
 #define MAX_MODBUS_REQUEST_PAYLOAD (246)
 #define MAX_MODBUS_RESPONSE_PAYLOAD (250)
 #define MAX_MODBUS_PDU_PAYLOAD (253)  /* everything after the server address */
 #define MODBUS_INACTIVITY_TIMEOUT (5000)
+#define MODBUS_REQUEST_TIMEOUT (5000)
+#define MODBUS_MAX_FRAME_SIZE (MODBUS_MBAP_SIZE + 1 + MAX_MODBUS_PDU_PAYLOAD)
+#define MODBUS_SHARED_SERVER_ID (256)  /* one connection for all unit IDs */
+#define MODBUS_RTU_CRC_SIZE (2)
+#define MODBUS_RTU_DEFAULT_BAUD (19200)
+#define MODBUS_RTU_REQUEST_TIMEOUT (1000)
+#define MODBUS_RTU_RESPONSE_WAIT_US (10000)  /* how long to block on the port at a time */
+
+/*
+ * one server/unit ID on the connection and the tags that use it.  Tags
+ * with something to do are also on the active queue, in the order they
+ * were started.  The handler only looks at those.
+ */
+struct modbus_unit_t {
+    struct modbus_unit_t *next;
+
+    uint8_t server_id;
+    struct modbus_tag_t *tags;
+    struct modbus_tag_t *active;
+    struct modbus_tag_t **active_tail;
+    int requests_in_flight;
+};
+
+typedef struct modbus_unit_t *modbus_unit_p;
+
+/* a request that has been queued or sent and is waiting for its response. */
+struct modbus_trans_t {
+    uint16_t seq_id;
+    int32_t tag_id;
+    modbus_unit_p unit;
+    int64_t timeout_ms;
+};
 
 struct modbus_plc_t {
     struct modbus_plc_t *next;
 
-    /* keep a list of tags for this PLC. */
-    struct modbus_tag_t *tags;
+    /* keep a list of units, each with its tags, for this PLC. */
+    modbus_unit_p units;
 
-    /* hostname/ip and possibly port of the server. */
+    /* hostname/ip and possibly port of the server, or the serial device for RTU. */
     char *server;
     sock_p sock;
-    uint8_t server_id;
+    int server_id;
+
+    /* Modbus RTU runs over a serial port instead of a socket. */
+    int is_rtu;
+    serial_port_p serial_port;
+    int baud_rate;
+    int data_bits;
+    int stop_bits;
+    int parity;
+    int frame_gap_us;
+    uint8_t rtu_server_id;
+    uint8_t rtu_function;
+
+    /* key into the PLC index. */
+    int64_t plc_key;
 
     /* State */
     struct {
         unsigned int terminate:1;
         unsigned int response_ready:1;
+        unsigned int response_taken:1;
         unsigned int request_ready:1;
-        unsigned int request_in_flight:1;
     } flags;
     uint16_t seq_id;
 
+    /* how many unused registers or coils a merged read may span. */
+    int coalesce_gap;
+
+    /* outstanding requests, matched to responses by transaction ID. */
+    int max_requests_in_flight;
+    int max_requests_per_unit;
+    int requests_in_flight;
+    int request_timeout_ms;
+    struct modbus_trans_t trans[MODBUS_MAX_REQUESTS_IN_FLIGHT];
+
     /* thread related state */
     thread_p handler_thread;
     mutex_p mutex;
@@ -109,12 +168,17 @@ struct modbus_tag_t {
     /* next one in the list for this PLC */
     struct modbus_tag_t *next;
 
+    /* next one on the unit's active queue, protected by the PLC mutex. */
+    struct modbus_tag_t *active_next;
+    int active;
+
     /* register type. */
     modbus_reg_type_t reg_type;
     uint16_t reg_base;
 
-    /* the PLC we are using */
+    /* the PLC and unit we are using */
     modbus_plc_p plc;
+    modbus_unit_p unit;
 
     /* actions and state */
     struct {
@@ -122,6 +186,9 @@ struct modbus_tag_t {
         unsigned int _read:1;
         unsigned int _write:1;
         unsigned int _busy:1;
+        unsigned int _merged:1;
+        unsigned int _solo:1;
+        unsigned int _no_merge:1;
     } flags;
     uint16_t request_num;
     uint16_t seq_id;
@@ -131,6 +198,14 @@ struct modbus_tag_t {
     int elem_count;
     int elem_size;
 
+    /* reads and writes can share a request with other tags. */
+    int coalesce_reads;
+    int coalesce_writes;
+    int merge_offset;
+
+    /* writes to the same registers go out in the order they were started. */
+    uint32_t write_order;
+
     /* data for outstanding requests. */
 };
 
@@ -163,7 +238,13 @@ tag_byte_order_t modbus_tag_byte_order = {
 /* Modbus module globals. */
 mutex_p mb_mutex = NULL;
 modbus_plc_p plcs = NULL;
+hashtable_p plc_index = NULL;
+lock_t plc_index_lock = LOCK_INIT;
 volatile int library_terminating = 0;
+lock_t write_order_lock = LOCK_INIT;
+uint32_t write_order = 0;
+
+#define MODBUS_PLC_INDEX_SIZE (32)
 
 
 /* helper functions */
@@ -171,6 +252,15 @@ static int create_tag_object(attr attribs, modbus_tag_p *tag);
 // static int set_tag_byte_order(attr attribs, modbus_tag_p tag);
 // static int check_byte_order_str(const char *byte_order, int length);
 static int find_or_create_plc(attr attribs, modbus_plc_p *plc);
+static int is_rtu_protocol(attr attribs);
+static int parse_parity(const char *parity_str, int *parity);
+static modbus_plc_p find_plc(const char *server, int server_id);
+static int64_t modbus_plc_key(const char *server, int server_id);
+static modbus_unit_p find_or_create_unit_unsafe(modbus_plc_p plc, uint8_t server_id);
+static void rotate_units_unsafe(modbus_plc_p plc);
+static void tag_activate_unsafe(modbus_tag_p tag);
+static void tag_activate(modbus_tag_p tag);
+static int tag_is_idle(modbus_tag_p tag);
 static int parse_register_name(attr attribs, modbus_reg_type_t *reg_type, int *reg_base);
 static void modbus_tag_destructor(void *tag_arg);
 static void modbus_plc_destructor(void *plc_arg);
@@ -178,11 +268,27 @@ static THREAD_FUNC(modbus_plc_handler);
 static int connect_plc(modbus_plc_p plc);
 static int read_packet(modbus_plc_p plc);
 static int write_packet(modbus_plc_p plc);
+static int rtu_connect_plc(modbus_plc_p plc);
+static int rtu_read_packet(modbus_plc_p plc);
+static int rtu_write_packet(modbus_plc_p plc);
+static uint16_t rtu_crc(uint8_t *data, int size);
+static int rtu_frame_gap_us(int baud_rate, int bits_per_char);
 static int process_tag(modbus_tag_p tag, modbus_plc_p plc);
+static int can_queue_request(modbus_plc_p plc, modbus_unit_p unit);
+static void add_trans(modbus_plc_p plc, modbus_tag_p tag, uint16_t seq_id);
+static int remove_trans(modbus_plc_p plc, uint16_t seq_id);
+static int find_trans(modbus_plc_p plc, uint16_t seq_id);
+static void expire_trans(modbus_plc_p plc);
 static int check_read_response(modbus_plc_p plc, modbus_tag_p tag);
 static int create_read_request(modbus_plc_p plc, modbus_tag_p tag);
+static int can_merge_read(modbus_tag_p tag);
+static int can_merge_write(modbus_tag_p tag);
+static int write_is_blocked(modbus_plc_p plc, modbus_tag_p tag);
+static int select_merged_tags(modbus_plc_p plc, modbus_tag_p tag, int for_write, int *base_register, int *register_count);
+static int copy_merged_read_data(modbus_plc_p plc, modbus_tag_p tag);
 static int check_write_response(modbus_plc_p plc, modbus_tag_p tag);
 static int create_write_request(modbus_plc_p plc, modbus_tag_p tag);
+static void copy_merged_write_data(uint8_t *payload, modbus_tag_p tag);
 static int translate_modbus_error(uint8_t err_code);
 
 static int tag_get_abort_flag(modbus_tag_p tag);
@@ -243,15 +349,27 @@ plc_tag_p mb_tag_create(attr attribs)
     /* find the PLC object. */
     rc = find_or_create_plc(attribs, &(tag->plc));
     if(rc == PLCTAG_STATUS_OK) {
-        /* put the tag on the PLC's list. */
+        uint8_t server_id = (uint8_t)(unsigned int)attr_get_int(attribs, "path", 0);
+
+        /* put the tag on the list for its unit. */
         critical_block(tag->plc->mutex) {
-            tag->next = tag->plc->tags;
-            tag->plc->tags = tag;
+            tag->unit = find_or_create_unit_unsafe(tag->plc, server_id);
+            if(tag->unit) {
+                tag->next = tag->unit->tags;
+                tag->unit->tags = tag;
+
+                /* trigger a read to get the initial value of the tag. */
+                tag->read_in_flight = 1;
+                tag->flags._read = 1;
+
+                tag_activate_unsafe(tag);
+            }
         }
 
-        /* trigger a read to get the initial value of the tag. */
-        tag->read_in_flight = 1;
-        tag->flags._read = 1;
+        if(!tag->unit) {
+            pdebug(DEBUG_WARN, "Unable to allocate Modbus unit!");
+            tag->status = (int8_t)PLCTAG_ERR_NO_MEM;
+        }
     } else {
         pdebug(DEBUG_WARN, "Unable to create new tag!  Error %s!", plc_tag_decode_error(rc));
         tag->status = (int8_t)rc;
@@ -334,6 +452,13 @@ int create_tag_object(attr attribs, modbus_tag_p *tag)
     (*tag)->elem_size = reg_size;
     (*tag)->size = data_size;
 
+    /*
+     * only tags that fit in one request can be merged.  Every byte on a
+     * serial line costs real time, so RTU tags merge unless told not to.
+     */
+    (*tag)->coalesce_reads = attr_get_int(attribs, "coalesce_reads", is_rtu_protocol(attribs));
+    (*tag)->coalesce_writes = attr_get_int(attribs, "coalesce_writes", is_rtu_protocol(attribs));
+
     /* set up the vtable */
     (*tag)->vtable = &modbus_vtable;
 
@@ -362,19 +487,42 @@ void modbus_tag_destructor(void *tag_arg)
     if(tag->plc) {
         pdebug(DEBUG_DETAIL, "Unlinking from the PLC.");
 
-        /* unlink the tag from the PLC. */
-        critical_block(tag->plc->mutex) {
-            modbus_tag_p *tag_walker = &(tag->plc->tags);
+        /* unlink the tag from its unit.  The unit stays with the PLC. */
+        if(tag->unit) {
+            critical_block(tag->plc->mutex) {
+                modbus_tag_p *tag_walker = &(tag->unit->tags);
 
-            while(*tag_walker && *tag_walker != tag) {
-                tag_walker = &((*tag_walker)->next);
-            }
+                while(*tag_walker && *tag_walker != tag) {
+                    tag_walker = &((*tag_walker)->next);
+                }
 
-            if(*tag_walker) {
-                *tag_walker = tag->next;
-            } else {
-                pdebug(DEBUG_WARN, "Tag not found on PLC list!");
+                if(*tag_walker) {
+                    *tag_walker = tag->next;
+                } else {
+                    pdebug(DEBUG_WARN, "Tag not found on PLC list!");
+                }
+
+                /* and from the active queue. */
+                if(tag->active) {
+                    tag_walker = &(tag->unit->active);
+
+                    while(*tag_walker && *tag_walker != tag) {
+                        tag_walker = &((*tag_walker)->active_next);
+                    }
+
+                    if(*tag_walker) {
+                        *tag_walker = tag->active_next;
+
+                        if(!*tag_walker) {
+                            tag->unit->active_tail = tag_walker;
+                        }
+                    }
+
+                    tag->active = 0;
+                }
             }
+
+            tag->unit = NULL;
         }
 
         pdebug(DEBUG_DETAIL, "Releasing the reference to the PLC.");
@@ -406,6 +554,15 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc)
 {
     const char *server = attr_get_str(attribs, "gateway", NULL);
     int server_id = attr_get_int(attribs, "path", -1);
+    int max_requests_in_flight = attr_get_int(attribs, "max_requests_in_flight", 1);
+    int coalesce_gap = attr_get_int(attribs, "coalesce_gap", 0);
+    int max_requests_per_unit = attr_get_int(attribs, "max_requests_per_unit", MODBUS_MAX_REQUESTS_IN_FLIGHT);
+    int share_gateway = attr_get_int(attribs, "share_gateway", 0);
+    int is_rtu = is_rtu_protocol(attribs);
+    int baud_rate = attr_get_int(attribs, "baud_rate", MODBUS_RTU_DEFAULT_BAUD);
+    int data_bits = attr_get_int(attribs, "data_bits", 8);
+    int stop_bits = attr_get_int(attribs, "stop_bits", 1);
+    int parity = 0;
     int is_new = 0;
     int rc = PLCTAG_STATUS_OK;
 
@@ -416,17 +573,56 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc)
         return PLCTAG_ERR_OUT_OF_BOUNDS;
     }
 
-    /* see if we can find a matching server. */
-    critical_block(mb_mutex) {
-        modbus_plc_p *walker = &plcs;
+    if(max_requests_in_flight < 1 || max_requests_in_flight > MODBUS_MAX_REQUESTS_IN_FLIGHT) {
+        pdebug(DEBUG_WARN, "Maximum requests in flight, %d, must be between 1 and %d!", max_requests_in_flight, MODBUS_MAX_REQUESTS_IN_FLIGHT);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
 
-        while(*walker && (*walker)->server_id == (uint8_t)(unsigned int)server_id && str_cmp_i(server, (*walker)->server) != 0) {
-            walker = &((*walker)->next);
+    if(coalesce_gap < 0) {
+        pdebug(DEBUG_WARN, "Coalesce gap, %d, must not be negative!", coalesce_gap);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    if(max_requests_per_unit < 1 || max_requests_per_unit > MODBUS_MAX_REQUESTS_IN_FLIGHT) {
+        pdebug(DEBUG_WARN, "Maximum requests per unit, %d, must be between 1 and %d!", max_requests_per_unit, MODBUS_MAX_REQUESTS_IN_FLIGHT);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    if(is_rtu) {
+        if(baud_rate <= 0 || data_bits < 5 || data_bits > 8 || stop_bits < 1 || stop_bits > 2) {
+            pdebug(DEBUG_WARN, "Serial settings %d baud, %d data bits and %d stop bits are not valid!", baud_rate, data_bits, stop_bits);
+            return PLCTAG_ERR_OUT_OF_BOUNDS;
+        }
+
+        rc = parse_parity(attr_get_str(attribs, "parity", "even"), &parity);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to parse serial parity!");
+            return rc;
+        }
+
+        /* RTU frames have no transaction ID, so only one request can be on the line. */
+        if(max_requests_in_flight > 1) {
+            pdebug(DEBUG_DETAIL, "Modbus RTU only allows one request in flight.");
+            max_requests_in_flight = 1;
+        }
+    }
+
+    /* all the unit IDs behind a shared gateway, or on a serial line, use one connection. */
+    if(share_gateway || is_rtu) {
+        server_id = MODBUS_SHARED_SERVER_ID;
+    }
+
+    /* see if we can find a matching server.  The index has its own lock. */
+    *plc = find_plc(server, server_id);
+
+    critical_block(mb_mutex) {
+        /* another thread could have created it while we were looking. */
+        if(! *plc) {
+            *plc = find_plc(server, server_id);
         }
 
         /* did we find one. */
-        if(*walker) {
-            *plc = rc_inc(*walker);
+        if(*plc) {
             is_new = 0;
         } else {
             /* nope, make a new one.  Do as little as possible in the mutex. */
@@ -441,9 +637,18 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc)
                     rc = PLCTAG_ERR_NO_MEM;
                 } else {
                     /* link up the list. */
-                    (*plc)->server_id = (uint8_t)(unsigned int)server_id;
+                    (*plc)->server_id = server_id;
                     (*plc)->next = plcs;
                     plcs = *plc;
+
+                    /* index it.  This replaces any older PLC with the same key. */
+                    (*plc)->plc_key = modbus_plc_key(server, (*plc)->server_id);
+                    spin_block(&plc_index_lock) {
+                        if(hashtable_get(plc_index, (*plc)->plc_key)) {
+                            hashtable_remove(plc_index, (*plc)->plc_key);
+                        }
+                        hashtable_put(plc_index, (*plc)->plc_key, *plc);
+                    }
                 }
             } else {
                 pdebug(DEBUG_WARN, "Unable to allocate Modbus PLC object!");
@@ -460,6 +665,25 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc)
             /* we want to stay connected initially */
             (*plc)->inactivity_timeout_ms = MODBUS_INACTIVITY_TIMEOUT + time_ms();
 
+            (*plc)->max_requests_in_flight = max_requests_in_flight;
+            (*plc)->coalesce_gap = coalesce_gap;
+            (*plc)->max_requests_per_unit = max_requests_per_unit;
+            (*plc)->request_timeout_ms = MODBUS_REQUEST_TIMEOUT;
+
+            if(is_rtu) {
+                int bits_per_char = 1 + data_bits + (parity ? 1 : 0) + stop_bits;
+
+                (*plc)->is_rtu = 1;
+                (*plc)->baud_rate = baud_rate;
+                (*plc)->data_bits = data_bits;
+                (*plc)->stop_bits = stop_bits;
+                (*plc)->parity = parity;
+                (*plc)->request_timeout_ms = MODBUS_RTU_REQUEST_TIMEOUT;
+                (*plc)->frame_gap_us = rtu_frame_gap_us(baud_rate, bits_per_char);
+
+                pdebug(DEBUG_DETAIL, "Using serial port %s at %d baud with a %dus frame gap.", server, baud_rate, (*plc)->frame_gap_us);
+            }
+
             rc = thread_create(&((*plc)->handler_thread), modbus_plc_handler, 32768, (void *)(*plc));
             if(rc != PLCTAG_STATUS_OK) {
                 pdebug(DEBUG_WARN, "Unable to create new handler thread, error %s!", plc_tag_decode_error(rc));
@@ -469,6 +693,31 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc)
                     pdebug(DEBUG_WARN, "Unable to create new mutex, error %s!", plc_tag_decode_error(rc));
                 }
             }
+        } else if(max_requests_in_flight < (*plc)->max_requests_in_flight) {
+            /* not every server can take as many requests as another tag asked for, use the smallest. */
+            pdebug(DEBUG_DETAIL, "Lowering maximum requests in flight from %d to %d.", (*plc)->max_requests_in_flight, max_requests_in_flight);
+
+            critical_block((*plc)->mutex) {
+                (*plc)->max_requests_in_flight = max_requests_in_flight;
+            }
+        }
+
+        if(!is_new && max_requests_per_unit < (*plc)->max_requests_per_unit) {
+            /* serial slaves behind a gateway might only take one request at a time. */
+            pdebug(DEBUG_DETAIL, "Lowering maximum requests per unit from %d to %d.", (*plc)->max_requests_per_unit, max_requests_per_unit);
+
+            critical_block((*plc)->mutex) {
+                (*plc)->max_requests_per_unit = max_requests_per_unit;
+            }
+        }
+
+        if(!is_new && coalesce_gap < (*plc)->coalesce_gap) {
+            /* unused registers might not exist, use the smallest gap any tag asked for. */
+            pdebug(DEBUG_DETAIL, "Lowering coalesce gap from %d to %d.", (*plc)->coalesce_gap, coalesce_gap);
+
+            critical_block((*plc)->mutex) {
+                (*plc)->coalesce_gap = coalesce_gap;
+            }
         }
     }
 
@@ -486,6 +735,180 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc)
 
 
 
+/*
+ * is_rtu_protocol
+ *
+ * Modbus RTU tags share all the tag handling with Modbus TCP, only the
+ * transport is different.
+ */
+
+int is_rtu_protocol(attr attribs)
+{
+    const char *protocol = attr_get_str(attribs, "protocol", "modbus-tcp");
+
+    return (str_cmp_i(protocol, "modbus-rtu") == 0 || str_cmp_i(protocol, "modbus_rtu") == 0);
+}
+
+
+
+/*
+ * parse_parity
+ *
+ * Turn the parity attribute into the platform's parity type: 0 for none,
+ * 1 for odd and 2 for even.
+ */
+
+int parse_parity(const char *parity_str, int *parity)
+{
+    if(str_cmp_i(parity_str, "none") == 0) {
+        *parity = 0;
+    } else if(str_cmp_i(parity_str, "odd") == 0) {
+        *parity = 1;
+    } else if(str_cmp_i(parity_str, "even") == 0) {
+        *parity = 2;
+    } else {
+        pdebug(DEBUG_WARN, "Parity \"%s\" is not one of none, odd or even!", parity_str);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * find_plc
+ *
+ * Look up an existing PLC by server and server ID.  The server ID is
+ * MODBUS_SHARED_SERVER_ID for a connection shared by all units.  This
+ * does not need mb_mutex.  PLCs leave the index in their destructor, so
+ * one found under the index lock can still be checked.  A PLC that is
+ * being destroyed or a key collision is a miss and a new PLC replaces
+ * it in the index.  Returns a new reference or NULL.
+ */
+
+modbus_plc_p find_plc(const char *server, int server_id)
+{
+    int64_t key = modbus_plc_key(server, server_id);
+    modbus_plc_p plc = NULL;
+
+    spin_block(&plc_index_lock) {
+        plc = hashtable_get(plc_index, key);
+
+        if(plc && plc->server_id == server_id && str_cmp_i(server, plc->server) == 0) {
+            /* this returns NULL if the PLC is being destroyed. */
+            plc = rc_inc(plc);
+        } else {
+            plc = NULL;
+        }
+    }
+
+    return plc;
+}
+
+
+
+/*
+ * modbus_plc_key
+ *
+ * Hash the lowercased server name and add in the server ID.
+ */
+
+int64_t modbus_plc_key(const char *server, int server_id)
+{
+    char *server_str = str_dup(server ? server : "");
+    int server_len = 0;
+    uint64_t key = 0;
+
+    if(!server_str) {
+        pdebug(DEBUG_WARN, "Unable to allocate server string!");
+        return (int64_t)server_id + 1;
+    }
+
+    server_len = str_length(server_str);
+
+    for(int i=0; i < server_len; i++) {
+        server_str[i] = (char)tolower((unsigned char)server_str[i]);
+    }
+
+    key = ((uint64_t)hash((uint8_t *)server_str, (size_t)server_len, 0x9E3779B9) << 32)
+          | ((uint64_t)(hash((uint8_t *)server_str, (size_t)server_len, 0x7F4A7C15) & 0x007FFFFF) << 9)
+          | (uint64_t)(server_id & 0x1FF);
+
+    mem_free(server_str);
+
+    /* zero is an empty hashtable slot. */
+    if(!key) {
+        key = 1;
+    }
+
+    return (int64_t)key;
+}
+
+
+
+/*
+ * find_or_create_unit_unsafe
+ *
+ * Find the unit for the server ID on the PLC, adding it if this is the
+ * first tag for it.  Must be called with the PLC mutex held.
+ */
+
+modbus_unit_p find_or_create_unit_unsafe(modbus_plc_p plc, uint8_t server_id)
+{
+    modbus_unit_p unit = NULL;
+
+    for(unit = plc->units; unit; unit = unit->next) {
+        if(unit->server_id == server_id) {
+            return unit;
+        }
+    }
+
+    unit = (modbus_unit_p)mem_alloc((int)(unsigned int)sizeof(struct modbus_unit_t));
+    if(!unit) {
+        return NULL;
+    }
+
+    pdebug(DEBUG_DETAIL, "Adding unit %u to PLC %s.", (unsigned int)server_id, plc->server);
+
+    unit->server_id = server_id;
+    unit->active_tail = &(unit->active);
+    unit->next = plc->units;
+    plc->units = unit;
+
+    return unit;
+}
+
+
+
+/*
+ * rotate_units_unsafe
+ *
+ * Move the first unit to the end of the list so that each unit gets a
+ * turn at going first for the free request slots.  Must be called with
+ * the PLC mutex held.
+ */
+
+void rotate_units_unsafe(modbus_plc_p plc)
+{
+    modbus_unit_p first = plc->units;
+    modbus_unit_p last = plc->units;
+
+    if(!first || !first->next) {
+        return;
+    }
+
+    while(last->next) {
+        last = last->next;
+    }
+
+    plc->units = first->next;
+    first->next = NULL;
+    last->next = first;
+}
+
+
+
 void modbus_plc_destructor(void *plc_arg)
 {
     modbus_plc_p plc = (modbus_plc_p)plc_arg;
@@ -512,6 +935,13 @@ void modbus_plc_destructor(void *plc_arg)
         } else {
             pdebug(DEBUG_WARN, "PLC not found in the list!");
         }
+
+        /* drop the index entry if it is still ours. */
+        spin_block(&plc_index_lock) {
+            if(plc_index && hashtable_get(plc_index, plc->plc_key) == plc) {
+                hashtable_remove(plc_index, plc->plc_key);
+            }
+        }
     }
 
     /* shut down the thread. */
@@ -532,13 +962,25 @@ void modbus_plc_destructor(void *plc_arg)
         plc->sock = NULL;
     }
 
+    if(plc->serial_port) {
+        plc_lib_close_serial_port(plc->serial_port);
+        plc->serial_port = NULL;
+    }
+
     if(plc->server) {
         mem_free(plc->server);
         plc->server = NULL;
     }
 
-    if(plc->tags) {
-        pdebug(DEBUG_WARN, "There are tags still remaining, memory leak possible!");
+    while(plc->units) {
+        modbus_unit_p unit = plc->units;
+
+        if(unit->tags) {
+            pdebug(DEBUG_WARN, "There are tags still remaining, memory leak possible!");
+        }
+
+        plc->units = unit->next;
+        mem_free(unit);
     }
 
     pdebug(DEBUG_INFO, "Done.");
@@ -565,7 +1007,16 @@ THREAD_FUNC(modbus_plc_handler)
         if(err_delay < time_ms()) {
             do {
                 /* connect if we are still active and the socket is not there. */
-                if(!plc->sock && plc->inactivity_timeout_ms > time_ms()) {
+                if(plc->is_rtu) {
+                    /* the serial port stays open, there is no server to hang up on us. */
+                    if(!plc->serial_port) {
+                        rc = rtu_connect_plc(plc);
+                        if(rc != PLCTAG_STATUS_OK) {
+                            err_delay = time_ms() + PLC_SOCKET_ERR_DELAY;
+                            break;
+                        }
+                    }
+                } else if(!plc->sock && plc->inactivity_timeout_ms > time_ms()) {
                     /* socket must not be open! */
                     rc = connect_plc(plc);
                     if(rc != PLCTAG_STATUS_OK) {
@@ -575,7 +1026,7 @@ THREAD_FUNC(modbus_plc_handler)
                 }
 
                 /* read packet */
-                rc = read_packet(plc);
+                rc = (plc->is_rtu ? rtu_read_packet(plc) : read_packet(plc));
                 if(rc != PLCTAG_STATUS_OK) {
                     /* problem, punt! */
                     err_delay = time_ms() + PLC_SOCKET_ERR_DELAY;
@@ -587,7 +1038,7 @@ THREAD_FUNC(modbus_plc_handler)
                 }
 
                 /* write packet */
-                rc = write_packet(plc);
+                rc = (plc->is_rtu ? rtu_write_packet(plc) : write_packet(plc));
                 if(rc != PLCTAG_STATUS_OK) {
                     /* oops! */
                     err_delay = time_ms() + PLC_SOCKET_ERR_DELAY;
@@ -603,21 +1054,31 @@ THREAD_FUNC(modbus_plc_handler)
                     plc->sock = NULL;
 
                     /*
-                     * if we had a request that was sent, but there was no response yet,
-                     * then we need to clean up the state.   We are never going to get that
-                     * response.
+                     * if we had requests that were sent, but there was no response yet,
+                     * then we need to clean up the state.   We are never going to get those
+                     * responses.
                      *
-                     * If there is a request ready to send, then keep it in the buffer until
-                     * we reconnect.
+                     * Anything still in the buffer goes too.  The tags see that their
+                     * transactions are gone and build new requests.
                      */
 
-                    if(plc->flags.request_in_flight && !plc->flags.request_ready) {
-                        plc->flags.request_in_flight = 0;
+                    plc->requests_in_flight = 0;
+                    plc->flags.request_ready = 0;
+                    plc->write_data_len = 0;
+                    plc->write_data_offset = 0;
+
+                    critical_block(plc->mutex) {
+                        for(modbus_unit_p unit = plc->units; unit; unit = unit->next) {
+                            unit->requests_in_flight = 0;
+                        }
                     }
 
                     /* we do not want to break here as the tags might have aborts to process. */
                 }
 
+                /* give up on requests that the server never answered. */
+                expire_trans(plc);
+
                 /* run all the tags. */
 
                 /*
@@ -631,30 +1092,51 @@ THREAD_FUNC(modbus_plc_handler)
 
                 if(rc_inc(plc)) {
                     critical_block(plc->mutex) {
-                        modbus_tag_p *tag_walker = &(plc->tags);
+                        for(modbus_unit_p unit = plc->units; unit; unit = unit->next) {
+                            modbus_tag_p *tag_walker = &(unit->active);
+
+                            while(*tag_walker) {
+                                modbus_tag_p tag = rc_inc(*tag_walker);
+                                int idle = 0;
 
-                        while(*tag_walker) {
-                            modbus_tag_p tag = rc_inc(*tag_walker);
+                                /* the tag might be in the destructor. */
+                                if(tag) {
+                                    debug_set_tag_id(tag->tag_id);
 
-                            /* the tag might be in the destructor. */
-                            if(tag) {
-                                debug_set_tag_id(tag->tag_id);
+                                    pdebug(DEBUG_SPEW, "Processing tag %d.", tag->tag_id);
 
-                                pdebug(DEBUG_SPEW, "Processing tag %d.", tag->tag_id);
+                                    rc = process_tag(tag, plc);
+                                    if(rc != PLCTAG_STATUS_OK) {
+                                        pdebug(DEBUG_WARN,  "Error, %s, processing tag %d!", plc_tag_decode_error(rc), tag->tag_id);
+                                    }
 
-                                rc = process_tag(tag, plc);
-                                if(rc != PLCTAG_STATUS_OK) {
-                                    pdebug(DEBUG_WARN,  "Error, %s, processing tag %d!", plc_tag_decode_error(rc), tag->tag_id);
+                                    debug_set_tag_id(0);
+
+                                    idle = tag_is_idle(tag);
                                 }
 
-                                debug_set_tag_id(0);
+                                /* tags with nothing left to do come off the queue until started again. */
+                                if(idle) {
+                                    *tag_walker = tag->active_next;
+                                    tag->active_next = NULL;
+                                    tag->active = 0;
+
+                                    if(!*tag_walker) {
+                                        unit->active_tail = tag_walker;
+                                    }
+                                } else {
+                                    tag_walker = &((*tag_walker)->active_next);
+                                }
 
                                 /* release reference. */
-                                tag = rc_dec(tag);
+                                if(tag) {
+                                    tag = rc_dec(tag);
+                                }
                             }
-
-                            tag_walker = &((*tag_walker)->next);
                         }
+
+                        /* a different unit gets first pick of the request slots next time. */
+                        rotate_units_unsafe(plc);
                     }
 
                     /* now drop the reference, which could cause the destructor to trigger. */
@@ -662,17 +1144,22 @@ THREAD_FUNC(modbus_plc_handler)
                 }
             } while(0);
 
+            /* a merged read response is used by several tags, so it is cleared after the pass. */
             if(plc->flags.response_ready) {
-                pdebug(DEBUG_WARN, "Response still pending after full tag pass.  Clearing buffer.");
+                if(!plc->flags.response_taken) {
+                    pdebug(DEBUG_WARN, "Response still pending after full tag pass.  Clearing buffer.");
+                }
 
                 plc->flags.response_ready = 0;
+                plc->flags.response_taken = 0;
                 plc->read_data_len = 0;
             }
         } else {
             keep_going = 0;
         }
 
-        if(!keep_going) {
+        /* an RTU read already waited on the serial port for the response. */
+        if(!keep_going && !(plc->is_rtu && plc->requests_in_flight > 0 && !plc->flags.request_ready)) {
             sleep_ms(1);
         }
     }
@@ -807,8 +1294,10 @@ int read_packet(modbus_plc_p plc)
             pdebug_dump_bytes(DEBUG_DETAIL, plc->read_data, plc->read_data_len);
             plc->flags.response_ready = 1;
 
-            /* regardless of what request this is, there is nothing in flight. */
-            plc->flags.request_in_flight = 0;
+            /* the response frees up its slot whether or not a tag still wants it. */
+            if(remove_trans(plc, (uint16_t)((uint16_t)plc->read_data[1] + (uint16_t)(plc->read_data[0] << 8))) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_DETAIL, "Response does not match any request in flight.");
+            }
         }
 
         rc = PLCTAG_STATUS_OK;
@@ -819,11 +1308,6 @@ int read_packet(modbus_plc_p plc)
         plc->inactivity_timeout_ms = MODBUS_INACTIVITY_TIMEOUT + time_ms();
     }
 
-    /* if we have some data in the buffer, keep the connection open. */
-    if(plc->read_data_len > 0) {
-        plc->inactivity_timeout_ms = MODBUS_INACTIVITY_TIMEOUT + time_ms();
-    }
-
     pdebug(DEBUG_SPEW, "Done.");
 
     return rc;
@@ -885,52 +1369,323 @@ int write_packet(modbus_plc_p plc)
     return rc;
 }
 
+
+
 /*
- * This is called in the context of the PLC thread.
- *
- * The process cannot lock the tag's API mutex.   If the tag user side is
- * blocked in plc_tag_read, plc_tag_write or any other possibly blocking
- * API call, then the API mutex will be held.
- *
- * However, we can ensure that the tag will not be deleted out from underneath
- * us because this function is called under the PLC's mutex.   plc_tag_delete()
- * will first call the destructor and try to remove the tag from the PLC's list
- * and that requires the PLC's mutex to be held.   So as long as we are
- * under the PLC's mutex, we cannot have the tag disappear out from underneath
- * us or out of the list.
+ * rtu_connect_plc
  *
- * To help ensure that, we take a reference to the tag as well.  If the tag was
- * in the process of being destroyed, the reference returned will be null.
+ * Open the serial port.  For RTU the server string is the device.
+ */
+
+int rtu_connect_plc(modbus_plc_p plc)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    plc->serial_port = plc_lib_open_serial_port(plc->server, plc->baud_rate, plc->data_bits, plc->stop_bits, plc->parity);
+    if(!plc->serial_port) {
+        pdebug(DEBUG_WARN, "Unable to open serial port \"%s\"!", plc->server);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * rtu_read_packet
  *
- * So if we are here, we are not going to have the tag disappear nor are we going to
- * have the PLC's tag list mutated.
+ * An RTU frame is the unit, the PDU and a CRC.  It has no length field;
+ * it ends when the line is quiet for 3.5 character times.  Once the CRC
+ * checks out, the frame is put in the read buffer behind a made up MBAP
+ * header with the transaction ID of the request in flight.  That way the
+ * response checks are the same as for TCP.
  */
 
-int process_tag(modbus_tag_p tag, modbus_plc_p plc)
+int rtu_read_packet(modbus_plc_p plc)
 {
     int rc = PLCTAG_STATUS_OK;
+    uint8_t *frame = plc->read_data + MODBUS_MBAP_SIZE;
+    int frame_len = 0;
+    uint16_t crc = 0;
+    uint16_t seq_id = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    if(tag_get_abort_flag(tag)) {
-        pdebug(DEBUG_DETAIL, "Aborting any in flight operations!");
+    if(!plc->serial_port || plc->flags.response_ready) {
+        return PLCTAG_STATUS_OK;
+    }
 
-        /* do this as one block to prevent half-changed state. */
-        spin_block(&tag->tag_lock) {
-            tag->flags._read = 0;
-            tag->flags._write = 0;
-            tag->flags._busy = 0;
-            tag->flags._abort = 0;
+    /* wait on the port, rather than sleeping, while a response is due. */
+    if(plc->requests_in_flight > 0 && !plc->flags.request_ready) {
+        rc = plc_lib_serial_port_wait(plc->serial_port, MODBUS_RTU_RESPONSE_WAIT_US);
+        if(rc < 0) {
+            pdebug(DEBUG_WARN, "Error, %s, waiting on serial port!", plc_tag_decode_error(rc));
+            return rc;
         }
-
-        tag->seq_id = 0;
     }
 
-    if(tag_get_write_flag(tag)) {
-        if(tag_get_busy_flag(tag)) {
-            if(plc->flags.response_ready) {
-                /* we have an outstanding write request. */
-                rc = check_write_response(plc, tag);
+    /* read until the line goes quiet. */
+    do {
+        if(frame_len >= PLC_READ_DATA_LEN - MODBUS_MBAP_SIZE) {
+            pdebug(DEBUG_WARN, "Serial frame is too long, discarding it!");
+            frame_len = 0;
+        }
+
+        rc = plc_lib_serial_port_read(plc->serial_port, frame + frame_len, PLC_READ_DATA_LEN - MODBUS_MBAP_SIZE - frame_len);
+        if(rc < 0) {
+            pdebug(DEBUG_WARN, "Error, %s, reading serial port!", plc_tag_decode_error(rc));
+            return rc;
+        }
+
+        frame_len += rc;
+
+        if(frame_len == 0) {
+            pdebug(DEBUG_SPEW, "Done.  Nothing to read.");
+            return PLCTAG_STATUS_OK;
+        }
+
+        rc = plc_lib_serial_port_wait(plc->serial_port, plc->frame_gap_us);
+        if(rc < 0) {
+            pdebug(DEBUG_WARN, "Error, %s, waiting on serial port!", plc_tag_decode_error(rc));
+            return rc;
+        }
+    } while(rc > 0);
+
+    pdebug(DEBUG_DETAIL, "Received serial frame.");
+    pdebug_dump_bytes(DEBUG_DETAIL, frame, frame_len);
+
+    if(frame_len < 2 + MODBUS_RTU_CRC_SIZE) {
+        pdebug(DEBUG_DETAIL, "Discarding %d bytes of line noise.", frame_len);
+        return PLCTAG_STATUS_OK;
+    }
+
+    crc = rtu_crc(frame, frame_len - MODBUS_RTU_CRC_SIZE);
+    if(frame[frame_len - 2] != (uint8_t)(crc & 0xFF) || frame[frame_len - 1] != (uint8_t)(crc >> 8)) {
+        pdebug(DEBUG_WARN, "Serial frame CRC does not match!");
+
+        /* the response was garbled, send the request again now instead of waiting for the timeout. */
+        if(plc->requests_in_flight > 0 && !plc->flags.request_ready) {
+            remove_trans(plc, plc->trans[0].seq_id);
+        }
+
+        return PLCTAG_STATUS_OK;
+    }
+
+    /* a late answer to a request that already timed out is not ours. */
+    if(plc->requests_in_flight == 0 || plc->flags.request_ready
+       || frame[0] != plc->rtu_server_id || (frame[1] & 0x7F) != plc->rtu_function) {
+        pdebug(DEBUG_DETAIL, "Discarding serial frame that does not answer the request in flight.");
+        return PLCTAG_STATUS_OK;
+    }
+
+    frame_len -= MODBUS_RTU_CRC_SIZE;
+    seq_id = plc->trans[0].seq_id;
+
+    plc->read_data[0] = (uint8_t)(seq_id >> 8);
+    plc->read_data[1] = (uint8_t)(seq_id & 0xFF);
+    plc->read_data[2] = 0;
+    plc->read_data[3] = 0;
+    plc->read_data[4] = (uint8_t)(frame_len >> 8);
+    plc->read_data[5] = (uint8_t)(frame_len & 0xFF);
+    plc->read_data_len = MODBUS_MBAP_SIZE + frame_len;
+
+    plc->flags.response_ready = 1;
+    remove_trans(plc, seq_id);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * rtu_write_packet
+ *
+ * The requests are built with an MBAP header as for TCP.  RTU only wants
+ * what comes after it, with a CRC on the end.
+ */
+
+int rtu_write_packet(modbus_plc_p plc)
+{
+    int rc = 1;
+    int data_left = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!plc->serial_port || !plc->flags.request_ready) {
+        pdebug(DEBUG_SPEW, "Done. Nothing to do.");
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(plc->write_data_offset == 0) {
+        uint8_t *frame = plc->write_data + MODBUS_MBAP_SIZE;
+        uint16_t crc = rtu_crc(frame, plc->write_data_len - MODBUS_MBAP_SIZE);
+        uint8_t junk[32];
+
+        /* anything still on the line belongs to an old request. */
+        do {
+            rc = plc_lib_serial_port_read(plc->serial_port, junk, (int)(unsigned int)sizeof(junk));
+        } while(rc > 0);
+
+        if(rc < 0) {
+            pdebug(DEBUG_WARN, "Error, %s, reading serial port!", plc_tag_decode_error(rc));
+            return rc;
+        }
+
+        plc->rtu_server_id = frame[0];
+        plc->rtu_function = frame[1];
+
+        plc->write_data[plc->write_data_len++] = (uint8_t)(crc & 0xFF);
+        plc->write_data[plc->write_data_len++] = (uint8_t)(crc >> 8);
+        plc->write_data_offset = MODBUS_MBAP_SIZE;
+
+        rc = 1;
+    }
+
+    data_left = plc->write_data_len - plc->write_data_offset;
+
+    while(rc > 0 && data_left > 0) {
+        rc = plc_lib_serial_port_write(plc->serial_port, plc->write_data + plc->write_data_offset, data_left);
+        if(rc >= 0) {
+            plc->write_data_offset += rc;
+            data_left = plc->write_data_len - plc->write_data_offset;
+        } else {
+            pdebug(DEBUG_WARN, "Error, %s, writing to serial port!", plc_tag_decode_error(rc));
+        }
+    }
+
+    if(rc >= 0) {
+        if(data_left == 0) {
+            pdebug(DEBUG_DETAIL, "Full serial frame written.");
+            pdebug_dump_bytes(DEBUG_DETAIL, plc->write_data + MODBUS_MBAP_SIZE, plc->write_data_len - MODBUS_MBAP_SIZE);
+
+            plc->flags.request_ready = 0;
+            plc->write_data_len = 0;
+            plc->write_data_offset = 0;
+        }
+
+        rc = PLCTAG_STATUS_OK;
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * rtu_crc
+ *
+ * The Modbus RTU CRC-16.  It goes on the wire low byte first.
+ */
+
+uint16_t rtu_crc(uint8_t *data, int size)
+{
+    uint16_t crc = 0xFFFF;
+
+    for(int i=0; i < size; i++) {
+        crc ^= data[i];
+
+        for(int bit=0; bit < 8; bit++) {
+            if(crc & 0x0001) {
+                crc = (uint16_t)((crc >> 1) ^ 0xA001);
+            } else {
+                crc = (uint16_t)(crc >> 1);
+            }
+        }
+    }
+
+    return crc;
+}
+
+
+
+/*
+ * rtu_frame_gap_us
+ *
+ * Frames end with 3.5 character times of silence.  Above 19200 baud the
+ * gap is fixed at 1750us.  Round up so that the gap is never short.
+ */
+
+int rtu_frame_gap_us(int baud_rate, int bits_per_char)
+{
+    if(baud_rate > 19200) {
+        return 1750;
+    }
+
+    return (int)(((int64_t)35 * bits_per_char * 100000 + baud_rate - 1) / baud_rate);
+}
+
+
+/*
+ * This is called in the context of the PLC thread.
+ *
+ * The process cannot lock the tag's API mutex.   If the tag user side is
+ * blocked in plc_tag_read, plc_tag_write or any other possibly blocking
+ * API call, then the API mutex will be held.
+ *
+ * However, we can ensure that the tag will not be deleted out from underneath
+ * us because this function is called under the PLC's mutex.   plc_tag_delete()
+ * will first call the destructor and try to remove the tag from the PLC's list
+ * and that requires the PLC's mutex to be held.   So as long as we are
+ * under the PLC's mutex, we cannot have the tag disappear out from underneath
+ * us or out of the list.
+ *
+ * To help ensure that, we take a reference to the tag as well.  If the tag was
+ * in the process of being destroyed, the reference returned will be null.
+ *
+ * So if we are here, we are not going to have the tag disappear nor are we going to
+ * have the PLC's tag list mutated.
+ */
+
+int process_tag(modbus_tag_p tag, modbus_plc_p plc)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(tag_get_abort_flag(tag)) {
+        pdebug(DEBUG_DETAIL, "Aborting any in flight operations!");
+
+        /* do this as one block to prevent half-changed state. */
+        spin_block(&tag->tag_lock) {
+            tag->flags._read = 0;
+            tag->flags._write = 0;
+            tag->flags._busy = 0;
+            tag->flags._abort = 0;
+            tag->flags._merged = 0;
+            tag->flags._solo = 0;
+        }
+
+        tag->seq_id = 0;
+    }
+
+    /* if the request was lost, build it again. */
+    if(tag_get_busy_flag(tag) && !plc->flags.response_ready && find_trans(plc, tag->seq_id) < 0) {
+        pdebug(DEBUG_DETAIL, "Request %u is no longer in flight, retrying.", (unsigned int)tag->seq_id);
+
+        spin_block(&tag->tag_lock) {
+            tag->flags._busy = 0;
+            tag->flags._merged = 0;
+            tag->seq_id = 0;
+
+            /* writes move on to the next chunk when the request is built. */
+            if(tag->flags._write && tag->request_num > 0) {
+                tag->request_num--;
+            }
+        }
+    }
+
+    if(tag_get_write_flag(tag)) {
+        if(tag_get_busy_flag(tag)) {
+            if(plc->flags.response_ready) {
+                /* we have an outstanding write request. */
+                rc = check_write_response(plc, tag);
                 if(rc == PLCTAG_STATUS_OK) {
                     pdebug(DEBUG_SPEW, "Either not our response or we got a response!");
                 } else {
@@ -942,11 +1697,13 @@ int process_tag(modbus_tag_p tag, modbus_plc_p plc)
                 pdebug(DEBUG_SPEW, "No response yet.");
             }
         } else {
-            /* we have a write request to do and nothing is in flight. */
-            if(! plc->flags.request_ready && !plc->flags.request_in_flight) {
+            /* we have a write request to do, is there room for another request? */
+            if(write_is_blocked(plc, tag)) {
+                pdebug(DEBUG_SPEW, "Waiting for an earlier write to the same registers.");
+            } else if(can_queue_request(plc, tag->unit)) {
                 rc = create_write_request(plc, tag);
             } else {
-                pdebug(DEBUG_SPEW, "No buffer space for a response.");
+                pdebug(DEBUG_SPEW, "Too many requests in flight.");
             }
 
             tag->status = (int8_t)rc;
@@ -970,11 +1727,11 @@ int process_tag(modbus_tag_p tag, modbus_plc_p plc)
                 pdebug(DEBUG_SPEW, "No response yet.");
             }
         } else {
-            /* we have a write request to do an nothing is in flight. */
-            if(!plc->flags.request_ready && !plc->flags.request_in_flight) {
+            /* we have a read request to do, is there room for another request? */
+            if(can_queue_request(plc, tag->unit)) {
                 rc = create_read_request(plc, tag);
             } else {
-                pdebug(DEBUG_SPEW, "No buffer space for a response.");
+                pdebug(DEBUG_SPEW, "Too many requests in flight.");
             }
 
             tag->status = (int8_t)rc;
@@ -1016,10 +1773,47 @@ int check_read_response(modbus_plc_p plc, modbus_tag_p tag)
     if(seq_id == tag->seq_id) {
         uint8_t has_error = plc->read_data[7] & (uint8_t)0x80;
 
+        /* the response might be shared with other tags, leave it in the buffer. */
+        plc->flags.response_taken = 1;
+
+        if(has_error && tag->flags._merged) {
+            /*
+             * we cannot tell which part of a merged read the server did
+             * not like.  Try again on our own.
+             */
+            pdebug(DEBUG_DETAIL, "Merged read %u failed, retrying tag alone.", (unsigned int)seq_id);
+
+            spin_block(&tag->tag_lock) {
+                tag->flags._busy = 0;
+                tag->flags._merged = 0;
+                tag->flags._solo = 1;
+                tag->seq_id = 0;
+            }
+
+            pdebug(DEBUG_DETAIL, "Done.");
+
+            return PLCTAG_STATUS_OK;
+        }
+
         if(has_error) {
             rc = translate_modbus_error(plc->read_data[8]);
 
             pdebug(DEBUG_WARN, "Got read response %ud, with error %s, of length %d.", (int)(unsigned int)seq_id, plc_tag_decode_error(rc), plc->read_data_len);
+
+            /* if this tag fails by itself after a merged read failed, it spoils merged reads. */
+            if(tag->flags._solo) {
+                pdebug(DEBUG_INFO, "Tag read fails by itself, not merging its reads any more.");
+
+                spin_block(&tag->tag_lock) {
+                    tag->flags._no_merge = 1;
+                }
+            }
+        } else if(tag->flags._merged) {
+            pdebug(DEBUG_INFO, "Got merged read response %u of length %d.", (int)(unsigned int)seq_id, plc->read_data_len);
+
+            rc = copy_merged_read_data(plc, tag);
+
+            partial_read = 0;
         } else {
             int registers_per_request = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
             int register_offset = (tag->request_num * registers_per_request);
@@ -1050,15 +1844,13 @@ int check_read_response(modbus_plc_p plc, modbus_tag_p tag)
             rc = PLCTAG_STATUS_OK;
         }
 
-        /* either way, clean up the PLC buffer. */
-        plc->read_data_len = 0;
-        plc->flags.response_ready = 0;
-
         /* clean up tag*/
         if(!partial_read) {
             spin_block(&tag->tag_lock) {
                 tag->flags._read = 0;
                 tag->flags._busy = 0;
+                tag->flags._merged = 0;
+                tag->flags._solo = 0;
                 tag->seq_id = 0;
                 tag->read_complete = 1;
                 tag->status = (int8_t)rc;
@@ -1091,13 +1883,40 @@ int check_read_response(modbus_plc_p plc, modbus_tag_p tag)
 int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
-    uint16_t seq_id = (++(plc->seq_id) ? plc->seq_id : ++(plc->seq_id)); // disallow zero
+    uint16_t seq_id = 0;
     int registers_per_request = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
     int base_register = tag->reg_base + (tag->request_num * registers_per_request);
     int register_count = tag->elem_count - (tag->request_num * registers_per_request);
+    uint8_t function_code = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
+    /* function code depends on the register type. */
+    switch(tag->reg_type) {
+        case MB_REG_COIL:
+            function_code = MB_CMD_READ_COIL_MULTI;
+            break;
+
+        case MB_REG_DISCRETE_INPUT:
+            function_code = MB_CMD_READ_DISCRETE_INPUT_MULTI;
+            break;
+
+        case MB_REG_HOLDING_REGISTER:
+            function_code = MB_CMD_READ_HOLDING_REGISTER_MULTI;
+            break;
+
+        case MB_REG_INPUT_REGISTER:
+            function_code = MB_CMD_READ_INPUT_REGISTER_MULTI;
+            break;
+
+        default:
+            pdebug(DEBUG_WARN, "Unsupported register type %d!", tag->reg_type);
+            return PLCTAG_ERR_UNSUPPORTED;
+            break;
+    }
+
+    seq_id = (++(plc->seq_id) ? plc->seq_id : ++(plc->seq_id)); // disallow zero
+
     pdebug(DEBUG_DETAIL, "seq_id=%d", seq_id);
     pdebug(DEBUG_DETAIL, "registers_per_request = %d", registers_per_request);
     pdebug(DEBUG_DETAIL, "base_register = %d", base_register);
@@ -1108,6 +1927,29 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
         register_count = registers_per_request;
     }
 
+    /* pick up other tags waiting to read nearby registers. */
+    if(can_merge_read(tag)) {
+        int merged_count = select_merged_tags(plc, tag, 0, &base_register, &register_count);
+
+        if(merged_count > 1) {
+            pdebug(DEBUG_DETAIL, "Merged %d tag reads into one request.", merged_count);
+
+            for(modbus_tag_p member = tag->unit->active; member; member = member->active_next) {
+                if(member->flags._merged && !member->flags._busy) {
+                    spin_block(&member->tag_lock) {
+                        member->flags._busy = 1;
+                        member->seq_id = seq_id;
+                        member->merge_offset = member->reg_base - base_register;
+                    }
+                }
+            }
+        } else {
+            spin_block(&tag->tag_lock) {
+                tag->flags._merged = 0;
+            }
+        }
+    }
+
     pdebug(DEBUG_INFO, "preparing read request for %d registers (of %d total) from base register %d.", register_count, tag->elem_count, base_register);
 
     /* build the read request.
@@ -1124,10 +1966,10 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
      *      9    Low byte of the first register address.
      *     10    High byte of the register count.
      *     11    Low byte of the register count.
+     *
+     * The request goes on the end of anything else waiting to be sent.
      */
 
-    plc->write_data_len = 0;
-
     /* build the request sequence ID */
     plc->write_data[plc->write_data_len] = (uint8_t)((seq_id >> 8) & 0xFF); plc->write_data_len++;
     plc->write_data[plc->write_data_len] = (uint8_t)((seq_id >> 0) & 0xFF); plc->write_data_len++;
@@ -1141,53 +1983,244 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
     plc->write_data[plc->write_data_len] = 6; plc->write_data_len++;
 
     /* device address */
-    plc->write_data[plc->write_data_len] = plc->server_id; plc->write_data_len++;
+    plc->write_data[plc->write_data_len] = tag->unit->server_id; plc->write_data_len++;
+
+    /* function code */
+    plc->write_data[plc->write_data_len] = function_code; plc->write_data_len++;
+
+    /* register base. */
+    plc->write_data[plc->write_data_len] = (uint8_t)((base_register >> 8) & 0xFF); plc->write_data_len++;
+    plc->write_data[plc->write_data_len] = (uint8_t)((base_register >> 0) & 0xFF); plc->write_data_len++;
+
+    /* number of elements to read. */
+    plc->write_data[plc->write_data_len] = (uint8_t)((register_count >> 8) & 0xFF); plc->write_data_len++;
+    plc->write_data[plc->write_data_len] = (uint8_t)((register_count >> 0) & 0xFF); plc->write_data_len++;
+
+    /* ready to go! */
+    spin_block(&tag->tag_lock) {
+        tag->flags._busy = 1;
+        tag->seq_id = seq_id;
+    }
+
+    add_trans(plc, tag, seq_id);
+
+    /* FIXME - could this ever be hoisted above the barrier above? */
+    plc->flags.request_ready = 1;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * can_merge_read
+ *
+ * A tag can share a read request if it asked for it, it fits entirely
+ * in one request and nothing is in progress for it yet.
+ */
+
+int can_merge_read(modbus_tag_p tag)
+{
+    int registers_per_request = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
+
+    return (tag->coalesce_reads
+            && tag->flags._read
+            && !tag->flags._busy
+            && !tag->flags._abort
+            && !tag->flags._solo
+            && !tag->flags._no_merge
+            && tag->request_num == 0
+            && tag->elem_count <= registers_per_request);
+}
+
+
+
+/*
+ * can_merge_write
+ *
+ * Same as for reads, but for a pending write.
+ */
+
+int can_merge_write(modbus_tag_p tag)
+{
+    int registers_per_request = (MAX_MODBUS_REQUEST_PAYLOAD * 8) / tag->elem_size;
+
+    return (tag->coalesce_writes
+            && tag->flags._write
+            && !tag->flags._busy
+            && !tag->flags._abort
+            && !tag->flags._solo
+            && !tag->flags._no_merge
+            && tag->request_num == 0
+            && tag->elem_count <= registers_per_request);
+}
+
+
+
+/*
+ * write_is_blocked
+ *
+ * A write has to wait if another tag started a write to any of the same
+ * registers of the same unit before it and that write has not been sent
+ * yet.  Requests that are sent go out in order on the connection.
+ */
+
+int write_is_blocked(modbus_plc_p plc, modbus_tag_p tag)
+{
+    int low = tag->reg_base;
+    int high = tag->reg_base + tag->elem_count;
+
+    (void)plc;
+
+    for(modbus_tag_p other = tag->unit->active; other; other = other->active_next) {
+        if(other == tag || other->reg_type != tag->reg_type) {
+            continue;
+        }
+
+        if(other->reg_base >= high || other->reg_base + other->elem_count <= low) {
+            continue;
+        }
+
+        /* the difference handles the counter wrapping. */
+        if(other->flags._write && !other->flags._busy && (int32_t)(other->write_order - tag->write_order) < 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * select_merged_tags
+ *
+ * Starting with the passed tag, grow the register range with other
+ * tags of the same unit waiting on the same operation and register type that start or
+ * end within the PLC's gap of the range.  The protocol limits of 125
+ * registers or 2000 coils per read, and 123 registers or 1968 coils per
+ * write, come from the payload sizes.  Selected tags get their merged
+ * flag set.  Returns the number of tags selected.
+ *
+ * Writes must not leave gaps or overlap, so that each register in the
+ * request gets its value from exactly one tag.
+ *
+ * Only tags on the unit's active queue can have a pending operation.
+ * This is called with the PLC mutex held, so the queue cannot change.
+ */
+
+int select_merged_tags(modbus_plc_p plc, modbus_tag_p tag, int for_write, int *base_register, int *register_count)
+{
+    int registers_per_request = ((for_write ? MAX_MODBUS_REQUEST_PAYLOAD : MAX_MODBUS_RESPONSE_PAYLOAD) * 8) / tag->elem_size;
+    int gap = (for_write ? 0 : plc->coalesce_gap);
+    int low = tag->reg_base;
+    int high = tag->reg_base + tag->elem_count;
+    int count = 1;
+    int added = 1;
+
+    spin_block(&tag->tag_lock) {
+        tag->flags._merged = 1;
+    }
+
+    /* keep going until no more tags fit, each pass can bring others in range. */
+    while(added) {
+        added = 0;
+
+        for(modbus_tag_p candidate = tag->unit->active; candidate; candidate = candidate->active_next) {
+            int candidate_low = candidate->reg_base;
+            int candidate_high = candidate->reg_base + candidate->elem_count;
+            int new_low = (candidate_low < low ? candidate_low : low);
+            int new_high = (candidate_high > high ? candidate_high : high);
+            int mergeable = 0;
+
+            if(candidate->reg_type != tag->reg_type || candidate->flags._merged) {
+                continue;
+            }
+
+            if(candidate_low > high + gap || candidate_high + gap < low) {
+                continue;
+            }
+
+            if(for_write && candidate_low < high && candidate_high > low) {
+                continue;
+            }
+
+            if(new_high - new_low > registers_per_request) {
+                continue;
+            }
+
+            if(for_write && write_is_blocked(plc, candidate)) {
+                continue;
+            }
+
+            spin_block(&candidate->tag_lock) {
+                mergeable = (for_write ? can_merge_write(candidate) : can_merge_read(candidate));
+
+                if(mergeable) {
+                    candidate->flags._merged = 1;
+                }
+            }
+
+            if(mergeable) {
+                low = new_low;
+                high = new_high;
+                count++;
+                added = 1;
+            }
+        }
+    }
+
+    *base_register = low;
+    *register_count = high - low;
+
+    return count;
+}
 
-    /* function code depends on the register type. */
-    switch(tag->reg_type) {
-        case MB_REG_COIL:
-            plc->write_data[7] = MB_CMD_READ_COIL_MULTI; plc->write_data_len++;
-            break;
 
-        case MB_REG_DISCRETE_INPUT:
-            plc->write_data[7] = MB_CMD_READ_DISCRETE_INPUT_MULTI; plc->write_data_len++;
-            break;
 
-        case MB_REG_HOLDING_REGISTER:
-            plc->write_data[7] = MB_CMD_READ_HOLDING_REGISTER_MULTI; plc->write_data_len++;
-            break;
+/*
+ * copy_merged_read_data
+ *
+ * Copy this tag's part of a merged read response into the tag.  Coils
+ * and discrete inputs are packed eight to a byte, so they need to be
+ * shifted into place.
+ */
 
-        case MB_REG_INPUT_REGISTER:
-            plc->write_data[7] = MB_CMD_READ_INPUT_REGISTER_MULTI; plc->write_data_len++;
-            break;
+int copy_merged_read_data(modbus_plc_p plc, modbus_tag_p tag)
+{
+    uint8_t payload_size = plc->read_data[8];
+    uint8_t *payload = &plc->read_data[9];
 
-        default:
-            pdebug(DEBUG_WARN, "Unsupported register type %d!", tag->reg_type);
-            return PLCTAG_ERR_UNSUPPORTED;
-            break;
-    }
+    if(tag->elem_size == 1) {
+        if(tag->merge_offset + tag->elem_count > payload_size * 8) {
+            pdebug(DEBUG_WARN, "Merged read response is too short!");
+            return PLCTAG_ERR_TOO_SMALL;
+        }
 
-    /* register base. */
-    plc->write_data[plc->write_data_len] = (uint8_t)((base_register >> 8) & 0xFF); plc->write_data_len++;
-    plc->write_data[plc->write_data_len] = (uint8_t)((base_register >> 0) & 0xFF); plc->write_data_len++;
+        mem_set(tag->data, 0, tag->size);
 
-    /* number of elements to read. */
-    plc->write_data[plc->write_data_len] = (uint8_t)((register_count >> 8) & 0xFF); plc->write_data_len++;
-    plc->write_data[plc->write_data_len] = (uint8_t)((register_count >> 0) & 0xFF); plc->write_data_len++;
+        for(int i=0; i < tag->elem_count; i++) {
+            int bit = tag->merge_offset + i;
 
-    /* ready to go! */
-    spin_block(&tag->tag_lock) {
-        tag->flags._busy = 1;
-        tag->seq_id = seq_id;
-    }
+            if(payload[bit / 8] & (1 << (bit % 8))) {
+                tag->data[i / 8] |= (uint8_t)(1 << (i % 8));
+            }
+        }
+    } else {
+        int byte_offset = (tag->merge_offset * tag->elem_size) / 8;
 
-    /* FIXME - could this ever be hoisted above the barrier above? */
-    plc->flags.request_ready = 1;
-    plc->flags.request_in_flight = 1;
+        if(byte_offset + tag->size > payload_size) {
+            pdebug(DEBUG_WARN, "Merged read response is too short!");
+            return PLCTAG_ERR_TOO_SMALL;
+        }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+        mem_copy(tag->data, payload + byte_offset, tag->size);
+    }
 
-    return rc;
+    return PLCTAG_STATUS_OK;
 }
 
 
@@ -1220,10 +2253,38 @@ int check_write_response(modbus_plc_p plc, modbus_tag_p tag)
     if(seq_id == tag->seq_id) {
         uint8_t has_error = plc->read_data[7] & (uint8_t)0x80;
 
+        /* the handler clears the PLC buffer after the pass. */
+        plc->flags.response_taken = 1;
+
+        if(has_error && tag->flags._merged) {
+            /* as with reads, we cannot tell whose registers failed.  Write them alone. */
+            pdebug(DEBUG_DETAIL, "Merged write %u failed, retrying tag alone.", (unsigned int)seq_id);
+
+            spin_block(&tag->tag_lock) {
+                tag->flags._busy = 0;
+                tag->flags._merged = 0;
+                tag->flags._solo = 1;
+                tag->seq_id = 0;
+                tag->request_num = 0;
+            }
+
+            pdebug(DEBUG_SPEW, "Done.");
+
+            return PLCTAG_STATUS_OK;
+        }
+
         if(has_error) {
             rc = translate_modbus_error(plc->read_data[8]);
 
             pdebug(DEBUG_WARN, "Got write response %ud, with error %s, of length %d.", (int)(unsigned int)seq_id, plc_tag_decode_error(rc), plc->read_data_len);
+
+            if(tag->flags._solo) {
+                pdebug(DEBUG_INFO, "Tag write fails by itself, not merging its writes any more.");
+
+                spin_block(&tag->tag_lock) {
+                    tag->flags._no_merge = 1;
+                }
+            }
         } else {
             int registers_per_request = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
             int register_offset = (tag->request_num * registers_per_request);
@@ -1248,14 +2309,13 @@ int check_write_response(modbus_plc_p plc, modbus_tag_p tag)
             rc = PLCTAG_STATUS_OK;
         }
 
-        /* either way, clean up the PLC buffer. */
-        plc->read_data_len = 0;
-        plc->flags.response_ready = 0;
         /* clean up tag*/
         if(!partial_write) {
             spin_block(&tag->tag_lock) {
                 tag->flags._write = 0;
                 tag->flags._busy = 0;
+                tag->flags._merged = 0;
+                tag->flags._solo = 0;
                 tag->seq_id = 0;
                 tag->request_num = 0;
                 tag->write_complete = 1;
@@ -1305,16 +2365,46 @@ int check_write_response(modbus_plc_p plc, modbus_tag_p tag)
 int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
-    uint16_t seq_id = (++(plc->seq_id) ? plc->seq_id : ++(plc->seq_id)); // disallow zero
+    uint16_t seq_id = 0;
     int registers_per_request = (MAX_MODBUS_REQUEST_PAYLOAD * 8) / tag->elem_size;
     int base_register = tag->reg_base + (tag->request_num * registers_per_request);
     int register_count = tag->elem_count - (tag->request_num * registers_per_request);
     int register_offset = (tag->request_num * registers_per_request);
     int byte_offset = (register_offset * tag->elem_size) / 8;
     int request_payload_size = 0;
+    int merged_count = 0;
+    uint8_t function_code = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
+    /* function code depends on the register type. */
+    switch(tag->reg_type) {
+        case MB_REG_COIL:
+            function_code = MB_CMD_WRITE_COIL_MULTI;
+            break;
+
+        case MB_REG_DISCRETE_INPUT:
+            pdebug(DEBUG_WARN, "You cannot write a discrete input!");
+            return PLCTAG_ERR_UNSUPPORTED;
+            break;
+
+        case MB_REG_HOLDING_REGISTER:
+            function_code = MB_CMD_WRITE_HOLDING_REGISTER_MULTI;
+            break;
+
+        case MB_REG_INPUT_REGISTER:
+            pdebug(DEBUG_WARN, "You cannot write an analog input!");
+            return PLCTAG_ERR_UNSUPPORTED;
+            break;
+
+        default:
+            pdebug(DEBUG_WARN, "Unsupported register type %d!", tag->reg_type);
+            return PLCTAG_ERR_UNSUPPORTED;
+            break;
+    }
+
+    seq_id = (++(plc->seq_id) ? plc->seq_id : ++(plc->seq_id)); // disallow zero
+
     pdebug(DEBUG_DETAIL, "seq_id=%d", seq_id);
     pdebug(DEBUG_DETAIL, "registers_per_request = %d", registers_per_request);
     pdebug(DEBUG_DETAIL, "base_register = %d", base_register);
@@ -1327,13 +2417,25 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
         register_count = registers_per_request;
     }
 
+    /* pick up other tags waiting to write the registers next to ours. */
+    if(can_merge_write(tag)) {
+        merged_count = select_merged_tags(plc, tag, 1, &base_register, &register_count);
+
+        if(merged_count > 1) {
+            pdebug(DEBUG_DETAIL, "Merged %d tag writes into one request.", merged_count);
+        } else {
+            spin_block(&tag->tag_lock) {
+                tag->flags._merged = 0;
+            }
+        }
+    }
+
     /* how many bytes, rounded up to the nearest byte. */
     request_payload_size = ((register_count * tag->elem_size) + 7) / 8;
 
     pdebug(DEBUG_INFO, "preparing write request for %d registers (of %d total) from base register %d of payload size %d in bytes.", register_count, tag->elem_count, base_register, request_payload_size);
 
-    /* FIXME - remove this when we figure out how to push multiple requests. */
-    plc->write_data_len = 0;
+    /* the request goes on the end of anything else waiting to be sent. */
 
     /* build the request sequence ID */
     plc->write_data[plc->write_data_len] = (uint8_t)((seq_id >> 8) & 0xFF); plc->write_data_len++;
@@ -1348,33 +2450,10 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
     plc->write_data[plc->write_data_len] = (uint8_t)(((request_payload_size + 7) >> 0) & 0xFF); plc->write_data_len++;
 
     /* device address */
-    plc->write_data[plc->write_data_len] = plc->server_id; plc->write_data_len++;
-
-    /* function code depends on the register type. */
-    switch(tag->reg_type) {
-        case MB_REG_COIL:
-            plc->write_data[7] = MB_CMD_WRITE_COIL_MULTI; plc->write_data_len++;
-            break;
-
-        case MB_REG_DISCRETE_INPUT:
-            pdebug(DEBUG_WARN, "You cannot write a discrete input!");
-            return PLCTAG_ERR_UNSUPPORTED;
-            break;
-
-        case MB_REG_HOLDING_REGISTER:
-            plc->write_data[7] = MB_CMD_WRITE_HOLDING_REGISTER_MULTI; plc->write_data_len++;
-            break;
-
-        case MB_REG_INPUT_REGISTER:
-            pdebug(DEBUG_WARN, "You cannot write an analog input!");
-            return PLCTAG_ERR_UNSUPPORTED;
-            break;
+    plc->write_data[plc->write_data_len] = tag->unit->server_id; plc->write_data_len++;
 
-        default:
-            pdebug(DEBUG_WARN, "Unsupported register type %d!", tag->reg_type);
-            return PLCTAG_ERR_UNSUPPORTED;
-            break;
-    }
+    /* function code */
+    plc->write_data[plc->write_data_len] = function_code; plc->write_data_len++;
 
     /* register base. */
     plc->write_data[plc->write_data_len] = (uint8_t)((base_register >> 8) & 0xFF); plc->write_data_len++;
@@ -1388,18 +2467,39 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
     plc->write_data[plc->write_data_len] = (uint8_t)(unsigned int)(request_payload_size); plc->write_data_len++;
 
     /* copy the tag data. */
-    mem_copy(&plc->write_data[plc->write_data_len], &tag->data[byte_offset], request_payload_size);
-    plc->write_data_len += request_payload_size;
+    if(merged_count > 1) {
+        uint8_t *payload = &plc->write_data[plc->write_data_len];
 
-    /* ready to go. */
-    spin_block(&tag->tag_lock) {
-        tag->flags._busy = 1;
-        tag->seq_id = (uint16_t)(unsigned int)seq_id;
-        tag->request_num++;
+        mem_set(payload, 0, request_payload_size);
+
+        for(modbus_tag_p member = tag->unit->active; member; member = member->active_next) {
+            if(member->flags._merged && !member->flags._busy) {
+                member->merge_offset = member->reg_base - base_register;
+
+                copy_merged_write_data(payload, member);
+
+                spin_block(&member->tag_lock) {
+                    member->flags._busy = 1;
+                    member->seq_id = seq_id;
+                    member->request_num++;
+                }
+            }
+        }
+    } else {
+        mem_copy(&plc->write_data[plc->write_data_len], &tag->data[byte_offset], request_payload_size);
+
+        spin_block(&tag->tag_lock) {
+            tag->flags._busy = 1;
+            tag->seq_id = (uint16_t)(unsigned int)seq_id;
+            tag->request_num++;
+        }
     }
 
+    plc->write_data_len += request_payload_size;
+
+    add_trans(plc, tag, seq_id);
+
     plc->flags.request_ready = 1;
-    plc->flags.request_in_flight = 1;
 
     pdebug(DEBUG_DETAIL, "Done.");
 
@@ -1408,6 +2508,157 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
 
 
 
+/*
+ * can_queue_request
+ *
+ * Modbus TCP servers can take more than one request at a time and answer
+ * them by transaction ID.  Allow up to the PLC's limit of requests sent
+ * or waiting to be sent, and up to the per unit limit for each unit.
+ */
+
+int can_queue_request(modbus_plc_p plc, modbus_unit_p unit)
+{
+    if(plc->requests_in_flight >= plc->max_requests_in_flight) {
+        return 0;
+    }
+
+    /* leave room for the other units on a shared connection. */
+    if(unit->requests_in_flight >= plc->max_requests_per_unit) {
+        return 0;
+    }
+
+    if(plc->write_data_len + MODBUS_MAX_FRAME_SIZE > PLC_WRITE_DATA_LEN) {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+
+/*
+ * add_trans
+ *
+ * Remember a new request so that the response can be matched to it.
+ */
+
+void add_trans(modbus_plc_p plc, modbus_tag_p tag, uint16_t seq_id)
+{
+    struct modbus_trans_t *trans = &plc->trans[plc->requests_in_flight];
+
+    trans->seq_id = seq_id;
+    trans->tag_id = tag->tag_id;
+    trans->unit = tag->unit;
+    trans->timeout_ms = time_ms() + plc->request_timeout_ms;
+
+    plc->requests_in_flight++;
+    tag->unit->requests_in_flight++;
+
+    pdebug(DEBUG_DETAIL, "Request %u for tag %d queued, %d requests in flight.", (unsigned int)seq_id, (int)tag->tag_id, plc->requests_in_flight);
+}
+
+
+
+/*
+ * find_trans
+ *
+ * Return the index of the request with the given transaction ID, or -1.
+ */
+
+int find_trans(modbus_plc_p plc, uint16_t seq_id)
+{
+    for(int i=0; i < plc->requests_in_flight; i++) {
+        if(plc->trans[i].seq_id == seq_id) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+
+/*
+ * remove_trans
+ *
+ * Drop a request from the table when its response arrives.
+ */
+
+int remove_trans(modbus_plc_p plc, uint16_t seq_id)
+{
+    int index = find_trans(plc, seq_id);
+
+    if(index < 0) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    pdebug(DEBUG_DETAIL, "Got response %u for tag %d.", (unsigned int)seq_id, (int)plc->trans[index].tag_id);
+
+    /* order does not matter, fill the hole with the last entry. */
+    plc->trans[index].unit->requests_in_flight--;
+    plc->requests_in_flight--;
+    plc->trans[index] = plc->trans[plc->requests_in_flight];
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * expire_trans
+ *
+ * Free the slots of requests that were sent but never answered.  Tags
+ * waiting on them will send new requests.
+ */
+
+void expire_trans(modbus_plc_p plc)
+{
+    int64_t now = time_ms();
+    int i = 0;
+
+    /* do not expire requests that are still in the buffer. */
+    if(plc->flags.request_ready) {
+        return;
+    }
+
+    while(i < plc->requests_in_flight) {
+        if(plc->trans[i].timeout_ms < now) {
+            pdebug(DEBUG_WARN, "Request %u for tag %d timed out!", (unsigned int)plc->trans[i].seq_id, (int)plc->trans[i].tag_id);
+
+            plc->trans[i].unit->requests_in_flight--;
+            plc->requests_in_flight--;
+            plc->trans[i] = plc->trans[plc->requests_in_flight];
+        } else {
+            i++;
+        }
+    }
+}
+
+
+
+/*
+ * copy_merged_write_data
+ *
+ * Put the tag's data at its place in a merged write request.
+ */
+
+void copy_merged_write_data(uint8_t *payload, modbus_tag_p tag)
+{
+    if(tag->elem_size == 1) {
+        for(int i=0; i < tag->elem_count; i++) {
+            int bit = tag->merge_offset + i;
+
+            if(tag->data[i / 8] & (1 << (i % 8))) {
+                payload[bit / 8] |= (uint8_t)(1 << (bit % 8));
+            }
+        }
+    } else {
+        mem_copy(payload + ((tag->merge_offset * tag->elem_size) / 8), tag->data, tag->size);
+    }
+}
+
+
+
 int translate_modbus_error(uint8_t err_code)
 {
     int rc = PLCTAG_STATUS_OK;
@@ -1512,6 +2763,66 @@ int parse_register_name(attr attribs, modbus_reg_type_t *reg_type, int *reg_base
 }
 
 
+/*
+ * tag_activate_unsafe
+ *
+ * Put the tag at the end of its unit's active queue if it is not there
+ * already.  Must be called with the PLC mutex held.
+ */
+
+void tag_activate_unsafe(modbus_tag_p tag)
+{
+    if(tag->active) {
+        return;
+    }
+
+    tag->active = 1;
+    tag->active_next = NULL;
+    *(tag->unit->active_tail) = tag;
+    tag->unit->active_tail = &(tag->active_next);
+}
+
+
+
+/*
+ * tag_activate
+ *
+ * Let the PLC handler know that the tag has something to do.
+ */
+
+void tag_activate(modbus_tag_p tag)
+{
+    if(!tag->plc || !tag->unit) {
+        pdebug(DEBUG_DETAIL, "Tag is not attached to a PLC.");
+        return;
+    }
+
+    critical_block(tag->plc->mutex) {
+        tag_activate_unsafe(tag);
+    }
+}
+
+
+
+/*
+ * tag_is_idle
+ *
+ * True when there is nothing pending or in flight for the tag.
+ */
+
+int tag_is_idle(modbus_tag_p tag)
+{
+    int res = 0;
+
+    spin_block(&tag->tag_lock) {
+        res = !(tag->flags._abort || tag->flags._read || tag->flags._write || tag->flags._busy);
+    }
+
+    return res;
+}
+
+
+
 int tag_get_abort_flag(modbus_tag_p tag)
 {
     int res = 0;
@@ -1626,6 +2937,8 @@ int mb_abort(plc_tag_p p_tag)
 
     tag_set_abort_flag(tag, 1);
 
+    tag_activate(tag);
+
     return PLCTAG_STATUS_OK;
 }
 
@@ -1659,6 +2972,8 @@ int mb_read_start(plc_tag_p p_tag)
     tag->status = PLCTAG_STATUS_OK;
     tag_set_read_flag(tag, 1);
 
+    tag_activate(tag);
+
     pdebug(DEBUG_DETAIL, "Done.");
 
     return PLCTAG_STATUS_PENDING;
@@ -1737,9 +3052,15 @@ int mb_write_start(plc_tag_p p_tag)
         return PLCTAG_ERR_BUSY;
     }
 
+    spin_block(&write_order_lock) {
+        tag->write_order = ++write_order;
+    }
+
     tag_set_write_flag(tag, 1);
     tag->status = PLCTAG_STATUS_OK;
 
+    tag_activate(tag);
+
     pdebug(DEBUG_DETAIL, "Done.");
 
     return PLCTAG_STATUS_PENDING;
@@ -1795,6 +3116,11 @@ void mb_teardown(void)
 
     library_terminating = 1;
 
+    if(plc_index) {
+        hashtable_destroy(plc_index);
+        plc_index = NULL;
+    }
+
     pdebug(DEBUG_DETAIL, "Destroying Modbus mutex.");
     if(mb_mutex) {
         mutex_destroy(&mb_mutex);
@@ -1821,6 +3147,15 @@ int mb_init()
         }
     }
 
+    pdebug(DEBUG_DETAIL, "Setting up PLC index.");
+    if(!plc_index) {
+        plc_index = hashtable_create(MODBUS_PLC_INDEX_SIZE);
+        if(!plc_index) {
+            pdebug(DEBUG_WARN, "Unable to create PLC index!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+    }
+
     pdebug(DEBUG_INFO, "Done.");
 
     return rc;
@@ -0,0 +1,122 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <assert.h>
+#include <string.h>
+#include "../../lib/libplctag.h"
+#include "../../lib/tag.h"
+#include "../../util/debug.h"
+
+#define TAG_SIZE (1000)
+
+
+static void check_ranges(struct plc_tag_t *tag, int count, const int *expected)
+{
+    assert(tag->dirty_count == count);
+
+    for(int i=0; i < count; i++) {
+        pdebug(DEBUG_INFO, "Range %d is %d to %d.", i, tag->dirty_ranges[i].start, tag->dirty_ranges[i].end);
+
+        assert(tag->dirty_ranges[i].start == expected[i * 2]);
+        assert(tag->dirty_ranges[i].end == expected[(i * 2) + 1]);
+    }
+}
+
+
+static void reset_tag(struct plc_tag_t *tag)
+{
+    memset(tag, 0, sizeof(*tag));
+    tag->size = TAG_SIZE;
+}
+
+
+int main(int argc, const char **argv)
+{
+    struct plc_tag_t tag;
+
+    (void)argc;
+    (void)argv;
+
+    pdebug(DEBUG_INFO,"Starting dirty range tests.");
+
+    /* ranges are clipped to the tag data and empty ones are dropped. */
+    reset_tag(&tag);
+    tag_mark_dirty(&tag, -4, 8);
+    tag_mark_dirty(&tag, TAG_SIZE - 2, 8);
+    tag_mark_dirty(&tag, 500, 0);
+    tag_mark_dirty(&tag, TAG_SIZE, 4);
+    check_ranges(&tag, 2, (const int[]){ 0, 4, TAG_SIZE - 2, TAG_SIZE });
+
+    /* far apart ranges stay separate and in order. */
+    reset_tag(&tag);
+    tag_mark_dirty(&tag, 100, 4);
+    tag_mark_dirty(&tag, 0, 4);
+    check_ranges(&tag, 2, (const int[]){ 0, 4, 100, 104 });
+
+    /* ranges within the merge gap are kept as one. */
+    reset_tag(&tag);
+    tag_mark_dirty(&tag, 0, 4);
+    tag_mark_dirty(&tag, 4 + DIRTY_RANGE_MERGE_GAP, 4);
+    check_ranges(&tag, 1, (const int[]){ 0, 8 + DIRTY_RANGE_MERGE_GAP });
+
+    reset_tag(&tag);
+    tag_mark_dirty(&tag, 0, 4);
+    tag_mark_dirty(&tag, 5 + DIRTY_RANGE_MERGE_GAP, 4);
+    check_ranges(&tag, 2, (const int[]){ 0, 4, 5 + DIRTY_RANGE_MERGE_GAP, 9 + DIRTY_RANGE_MERGE_GAP });
+
+    /* overlapping ranges, and one that bridges two others. */
+    reset_tag(&tag);
+    tag_mark_dirty(&tag, 0, 10);
+    tag_mark_dirty(&tag, 5, 10);
+    tag_mark_dirty(&tag, 200, 10);
+    tag_mark_dirty(&tag, 400, 10);
+    check_ranges(&tag, 3, (const int[]){ 0, 15, 200, 210, 400, 410 });
+
+    tag_mark_dirty(&tag, 220, 170);
+    check_ranges(&tag, 2, (const int[]){ 0, 15, 200, 410 });
+
+    /* too many ranges, the two closest are merged to make room. */
+    reset_tag(&tag);
+    for(int i=0; i < MAX_DIRTY_RANGES; i++) {
+        tag_mark_dirty(&tag, (i == 3 ? 350 : i * 100), 4);
+    }
+
+    assert(tag.dirty_count == MAX_DIRTY_RANGES);
+
+    tag_mark_dirty(&tag, 900, 4);
+    check_ranges(&tag, MAX_DIRTY_RANGES, (const int[]){ 0, 4, 100, 104, 200, 204, 350, 404, 500, 504, 600, 604, 700, 704, 900, 904 });
+
+    pdebug(DEBUG_INFO,"Done.");
+
+    return 0;
+}
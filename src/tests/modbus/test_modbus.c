@@ -0,0 +1,305 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/* the functions under test are internal to the Modbus code. */
+#include "../../protocols/mb/modbus.c"
+
+#include <assert.h>
+
+#define TAG_COUNT (6)
+
+static struct modbus_plc_t test_plc;
+static struct modbus_unit_t test_unit;
+static struct modbus_tag_t test_tags[TAG_COUNT];
+
+
+/* set up a tag with a pending read of count holding registers at base. */
+static modbus_tag_p setup_tag(int index, int base, int count)
+{
+    modbus_tag_p tag = &test_tags[index];
+
+    mem_set(tag, 0, (int)sizeof(*tag));
+
+    tag->unit = &test_unit;
+    tag->reg_type = MB_REG_HOLDING_REGISTER;
+    tag->reg_base = (uint16_t)base;
+    tag->elem_count = count;
+    tag->elem_size = 16;
+    tag->coalesce_reads = 1;
+    tag->coalesce_writes = 1;
+    tag->flags._read = 1;
+
+    return tag;
+}
+
+
+/* same as above, but for a pending write started in the passed order. */
+static modbus_tag_p setup_write_tag(int index, int base, int count, uint32_t order)
+{
+    modbus_tag_p tag = setup_tag(index, base, count);
+
+    tag->flags._read = 0;
+    tag->flags._write = 1;
+    tag->write_order = order;
+
+    return tag;
+}
+
+
+/* put the tags on the unit's active queue in the passed order. */
+static void queue_tags(const int *order, int count)
+{
+    test_unit.active = NULL;
+
+    for(int i=count - 1; i >= 0; i--) {
+        test_tags[order[i]].active_next = test_unit.active;
+        test_unit.active = &test_tags[order[i]];
+    }
+}
+
+
+static void check_merge(int index, int for_write, int expected_count, int expected_base, int expected_registers)
+{
+    int base = -1;
+    int registers = -1;
+    int count = select_merged_tags(&test_plc, &test_tags[index], for_write, &base, &registers);
+
+    pdebug(DEBUG_INFO, "Merged %d tags into %d registers at %d.", count, registers, base);
+
+    assert(count == expected_count);
+    assert(base == expected_base);
+    assert(registers == expected_registers);
+}
+
+
+static void test_merged_reads(void)
+{
+    modbus_tag_p tag = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    mem_set(&test_plc, 0, (int)sizeof(test_plc));
+
+    /* adjacent tags merge, anything past the gap, of another type or not reading does not. */
+    setup_tag(0, 10, 10);
+    setup_tag(1, 20, 5);
+    setup_tag(2, 5, 5);
+    setup_tag(3, 30, 5);
+    tag = setup_tag(4, 0, 5);
+    tag->reg_type = MB_REG_INPUT_REGISTER;
+    tag = setup_tag(5, 25, 5);
+    tag->flags._read = 0;
+    queue_tags((const int[]){ 0, 1, 2, 3, 4, 5 }, TAG_COUNT);
+
+    check_merge(0, 0, 3, 5, 20);
+    assert(test_tags[1].flags._merged && test_tags[2].flags._merged);
+    assert(!test_tags[3].flags._merged && !test_tags[4].flags._merged && !test_tags[5].flags._merged);
+
+    /* the gap lets the read span unused registers. */
+    test_plc.coalesce_gap = 5;
+    for(int i=0; i < TAG_COUNT; i++) {
+        test_tags[i].flags._merged = 0;
+    }
+
+    check_merge(0, 0, 4, 5, 30);
+    assert(test_tags[3].flags._merged);
+
+    /* later passes pick up tags that came in range. */
+    test_plc.coalesce_gap = 0;
+    setup_tag(0, 0, 10);
+    setup_tag(1, 20, 10);
+    setup_tag(2, 10, 10);
+    queue_tags((const int[]){ 0, 1, 2 }, 3);
+
+    check_merge(0, 0, 3, 0, 30);
+
+    /* tags that are busy, opted out or already requested stay out. */
+    setup_tag(0, 0, 10);
+    tag = setup_tag(1, 10, 10);
+    tag->flags._busy = 1;
+    tag = setup_tag(2, 10, 10);
+    tag->flags._no_merge = 1;
+    tag = setup_tag(3, 10, 10);
+    tag->coalesce_reads = 0;
+    tag = setup_tag(4, 10, 10);
+    tag->request_num = 3;
+    queue_tags((const int[]){ 0, 1, 2, 3, 4 }, 5);
+
+    check_merge(0, 0, 1, 0, 10);
+
+    /* a read is at most 125 registers or 2000 coils. */
+    setup_tag(0, 0, 100);
+    setup_tag(1, 100, 26);
+    setup_tag(2, 100, 25);
+    queue_tags((const int[]){ 0, 1, 2 }, 3);
+
+    check_merge(0, 0, 2, 0, 125);
+    assert(!test_tags[1].flags._merged);
+
+    tag = setup_tag(0, 0, 1990);
+    tag->reg_type = MB_REG_COIL;
+    tag->elem_size = 1;
+    tag = setup_tag(1, 1990, 10);
+    tag->reg_type = MB_REG_COIL;
+    tag->elem_size = 1;
+    tag = setup_tag(2, 2000, 1);
+    tag->reg_type = MB_REG_COIL;
+    tag->elem_size = 1;
+    queue_tags((const int[]){ 0, 1, 2 }, 3);
+
+    check_merge(0, 0, 2, 0, 2000);
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+static void test_merged_writes(void)
+{
+    modbus_tag_p tag = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    mem_set(&test_plc, 0, (int)sizeof(test_plc));
+
+    /* writes only merge without gaps, even if reads may span them. */
+    test_plc.coalesce_gap = 10;
+    setup_write_tag(0, 10, 10, 1);
+    setup_write_tag(1, 20, 5, 2);
+    setup_write_tag(2, 0, 10, 3);
+    setup_write_tag(3, 30, 5, 4);
+    setup_tag(4, 25, 5);
+    queue_tags((const int[]){ 0, 1, 2, 3, 4 }, 5);
+
+    check_merge(0, 1, 3, 0, 25);
+    assert(!test_tags[3].flags._merged && !test_tags[4].flags._merged);
+
+    /* overlapping writes would write some registers twice. */
+    test_plc.coalesce_gap = 0;
+    setup_write_tag(0, 0, 10, 1);
+    setup_write_tag(1, 5, 10, 4);
+    setup_write_tag(2, 10, 5, 3);
+    queue_tags((const int[]){ 0, 1, 2 }, 3);
+
+    check_merge(0, 1, 2, 0, 15);
+    assert(!test_tags[1].flags._merged);
+
+    /* a write waits for an earlier unsent write to the same registers. */
+    setup_write_tag(0, 0, 10, 5);
+    setup_write_tag(1, 10, 10, 6);
+    tag = setup_write_tag(2, 15, 10, 2);
+    tag->flags._solo = 1;
+    queue_tags((const int[]){ 0, 1, 2 }, 3);
+
+    check_merge(0, 1, 1, 0, 10);
+
+    /* the write order wraps around. */
+    setup_write_tag(2, 15, 10, UINT32_MAX);
+    test_tags[2].flags._solo = 1;
+    test_tags[1].write_order = 1;
+
+    check_merge(0, 1, 1, 0, 10);
+
+    /* once the earlier write is sent, it does not block. */
+    test_tags[2].flags._busy = 1;
+
+    check_merge(0, 1, 2, 0, 20);
+
+    /* a write is at most 123 registers. */
+    setup_write_tag(0, 0, 100, 1);
+    setup_write_tag(1, 100, 24, 2);
+    queue_tags((const int[]){ 0, 1 }, 2);
+
+    check_merge(0, 1, 1, 0, 100);
+
+    setup_write_tag(0, 0, 100, 1);
+    setup_write_tag(1, 100, 23, 2);
+    queue_tags((const int[]){ 0, 1 }, 2);
+
+    check_merge(0, 1, 2, 0, 123);
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+static void test_rtu(void)
+{
+    uint8_t check[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+    uint8_t frame[] = { 0x01, 0x03, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x00 };
+    uint16_t crc = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* the standard check value and a read request, whose CRC goes on the wire as C5 CD. */
+    assert(rtu_crc(check, (int)sizeof(check)) == 0x4B37);
+    assert(rtu_crc(frame, 0) == 0xFFFF);
+
+    crc = rtu_crc(frame, 6);
+    assert(crc == 0xCDC5);
+
+    /* a frame with its CRC, low byte first, checks to zero. */
+    frame[6] = (uint8_t)(crc & 0xFF);
+    frame[7] = (uint8_t)(crc >> 8);
+    assert(rtu_crc(frame, (int)sizeof(frame)) == 0);
+
+    frame[2] ^= 0x01;
+    assert(rtu_crc(frame, (int)sizeof(frame)) != 0);
+
+    /* 3.5 characters of 1 start, 8 data, optional parity and stop bits, rounded up. */
+    assert(rtu_frame_gap_us(1200, 11) == 32084);
+    assert(rtu_frame_gap_us(9600, 11) == 4011);
+    assert(rtu_frame_gap_us(19200, 11) == 2006);
+    assert(rtu_frame_gap_us(19200, 10) == 1823);
+
+    /* above 19200 baud the gap is fixed. */
+    assert(rtu_frame_gap_us(38400, 11) == 1750);
+    assert(rtu_frame_gap_us(115200, 10) == 1750);
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+int main(int argc, const char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    pdebug(DEBUG_INFO,"Starting Modbus tests.");
+
+    test_merged_reads();
+    test_merged_writes();
+    test_rtu();
+
+    pdebug(DEBUG_INFO,"Done.");
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <assert.h>
+#include <string.h>
+#include "../../lib/libplctag.h"
+#include "../../protocols/ab/pccc.h"
+#include "../../util/debug.h"
+
+#define MAX_ENCODED_NAME (32)
+
+
+/* the encoded address of name moved up by elem_offset must match the encoded address of expected. */
+static void check_offset(const char *name, int elem_offset, const char *expected)
+{
+    uint8_t encoded[MAX_ENCODED_NAME];
+    uint8_t moved[MAX_ENCODED_NAME];
+    uint8_t wanted[MAX_ENCODED_NAME];
+    int encoded_size = 0;
+    int moved_size = 0;
+    int wanted_size = 0;
+    pccc_file_t file_type = PCCC_FILE_UNKNOWN;
+
+    pdebug(DEBUG_INFO, "Moving %s by %d elements.", name, elem_offset);
+
+    assert(slc_encode_tag_name(encoded, &encoded_size, &file_type, name, MAX_ENCODED_NAME) == PLCTAG_STATUS_OK);
+    assert(slc_encode_tag_name(wanted, &wanted_size, &file_type, expected, MAX_ENCODED_NAME) == PLCTAG_STATUS_OK);
+
+    assert(slc_offset_tag_name(moved, &moved_size, encoded, encoded_size, elem_offset) == PLCTAG_STATUS_OK);
+    assert(moved_size == wanted_size);
+    assert(memcmp(moved, wanted, (size_t)wanted_size) == 0);
+}
+
+
+/* decode the encoded address of name and check the fields. */
+static void check_decode(const char *name, int file_num, int file_type, int elem_num, int sub_elem_num)
+{
+    uint8_t encoded[MAX_ENCODED_NAME];
+    int encoded_size = 0;
+    int fields[4] = { -1, -1, -1, -1 };
+    pccc_file_t pccc_file_type = PCCC_FILE_UNKNOWN;
+
+    pdebug(DEBUG_INFO, "Decoding %s.", name);
+
+    assert(slc_encode_tag_name(encoded, &encoded_size, &pccc_file_type, name, MAX_ENCODED_NAME) == PLCTAG_STATUS_OK);
+    assert(slc_decode_tag_name(encoded, encoded_size, &fields[0], &fields[1], &fields[2], &fields[3]) == PLCTAG_STATUS_OK);
+
+    assert(fields[0] == file_num);
+    assert(fields[1] == file_type);
+    assert(fields[2] == elem_num);
+    assert(fields[3] == sub_elem_num);
+}
+
+
+int main(int argc, const char **argv)
+{
+    uint8_t encoded[MAX_ENCODED_NAME];
+    uint8_t moved[MAX_ENCODED_NAME];
+    int encoded_size = 0;
+    int moved_size = 0;
+    pccc_file_t file_type = PCCC_FILE_UNKNOWN;
+    int fields[4] = { 0 };
+
+    (void)argc;
+    (void)argv;
+
+    pdebug(DEBUG_INFO,"Starting PCCC tests.");
+
+    /* the file type is the PCCC type byte, the sub-element is the word in the element. */
+    check_decode("N7:10", 7, 0x89, 10, 0);
+    check_decode("F8:300", 8, 0x8a, 300, 0);
+    check_decode("N300:2", 300, 0x89, 2, 0);
+    check_decode("T4:1.acc", 4, 0x86, 1, 2);
+
+    assert(slc_encode_tag_name(encoded, &encoded_size, &file_type, "F8:300", MAX_ENCODED_NAME) == PLCTAG_STATUS_OK);
+    assert(slc_decode_tag_name(NULL, encoded_size, &fields[0], &fields[1], &fields[2], &fields[3]) == PLCTAG_ERR_NULL_PTR);
+    assert(slc_decode_tag_name(encoded, encoded_size, &fields[0], NULL, &fields[2], &fields[3]) == PLCTAG_ERR_NULL_PTR);
+
+    /* every field must be there, including the last byte of a long one. */
+    assert(slc_decode_tag_name(encoded, encoded_size - 1, &fields[0], &fields[1], &fields[2], &fields[3]) == PLCTAG_ERR_BAD_PARAM);
+    assert(slc_decode_tag_name(encoded, 4, &fields[0], &fields[1], &fields[2], &fields[3]) == PLCTAG_ERR_BAD_PARAM);
+
+    /* element numbers past 254 take three bytes. */
+    check_offset("N7:10", 0, "N7:10");
+    check_offset("N7:10", 5, "N7:15");
+    check_offset("F8:250", 10, "F8:260");
+    check_offset("N7:300", 200, "N7:500");
+
+    /* sub-element addresses can only be copied. */
+    check_offset("T4:1.acc", 0, "T4:1.acc");
+
+    assert(slc_encode_tag_name(encoded, &encoded_size, &file_type, "T4:1.acc", MAX_ENCODED_NAME) == PLCTAG_STATUS_OK);
+    assert(slc_offset_tag_name(moved, &moved_size, encoded, encoded_size, 1) == PLCTAG_ERR_UNSUPPORTED);
+
+    /* the element number has to fit in 16 bits. */
+    assert(slc_encode_tag_name(encoded, &encoded_size, &file_type, "N7:10", MAX_ENCODED_NAME) == PLCTAG_STATUS_OK);
+    assert(slc_offset_tag_name(moved, &moved_size, encoded, encoded_size, 0xFFFF) == PLCTAG_ERR_OUT_OF_BOUNDS);
+
+    assert(slc_offset_tag_name(NULL, &moved_size, encoded, encoded_size, 1) == PLCTAG_ERR_NULL_PTR);
+    assert(slc_offset_tag_name(moved, &moved_size, encoded, encoded_size - 1, 1) == PLCTAG_ERR_BAD_PARAM);
+
+    pdebug(DEBUG_INFO,"Done.");
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <assert.h>
+#include <string.h>
+#include "../../lib/libplctag.h"
+#include "../../protocols/ab/tag_index.h"
+#include "../../util/debug.h"
+#include "../../util/rc.h"
+
+#define ENTRY_HEADER_SIZE (22)
+#define ENTRY_COUNT (6)
+
+/* add one entry in the @tags listing format, returns the offset past it. */
+static int add_entry(uint8_t *data, int offset, uint32_t instance_id, uint16_t symbol_type, const char *name)
+{
+    int name_len = (int)strlen(name);
+
+    memset(&data[offset], 0, ENTRY_HEADER_SIZE);
+
+    for(int i=0; i < 4; i++) {
+        data[offset + i] = (uint8_t)((instance_id >> (8 * i)) & 0xFF);
+    }
+
+    data[offset + 4] = (uint8_t)(symbol_type & 0xFF);
+    data[offset + 5] = (uint8_t)(symbol_type >> 8);
+    data[offset + 20] = (uint8_t)(name_len & 0xFF);
+    data[offset + 21] = (uint8_t)(name_len >> 8);
+
+    memcpy(&data[offset + ENTRY_HEADER_SIZE], name, (size_t)name_len);
+
+    return offset + ENTRY_HEADER_SIZE + name_len;
+}
+
+
+int main(int argc, const char **argv)
+{
+    const char *names[ENTRY_COUNT] = { "Foo", "Program:Main", "Program:Main.Bar", "Program:Main.baz", "Zed", "foo" };
+    const uint16_t types[ENTRY_COUNT] = { 0xC4, 0x1068, 0xC4, 0xCA, 0xC4, 0xC3 };
+    int offsets[ENTRY_COUNT];
+    uint8_t data[1024];
+    int size = 0;
+    int offset = 0;
+    ab_tag_index_p index = NULL;
+
+    (void)argc;
+    (void)argv;
+
+    pdebug(DEBUG_INFO,"Starting tag index tests.");
+
+    for(int i=0; i < ENTRY_COUNT; i++) {
+        offsets[i] = size;
+        size = add_entry(data, size, (uint32_t)(0x100 + i), types[i], names[i]);
+    }
+
+    /* a partial entry at the end is not indexed. */
+    index = tag_index_create(data, size + ENTRY_HEADER_SIZE - 2);
+    assert(index != NULL);
+
+    assert(tag_index_find(NULL, data, "Foo", -1, 0) == PLCTAG_ERR_NULL_PTR);
+    assert(tag_index_find(index, NULL, "Foo", -1, 0) == PLCTAG_ERR_NULL_PTR);
+
+    /* names do not care about case and the first of a duplicate wins. */
+    assert(tag_index_find(index, data, "program:main.BAR", -1, 0) == offsets[2]);
+    assert(tag_index_find(index, data, "FOO", -1, 0) == offsets[0]);
+    assert(tag_index_find(index, data, "Nope", -1, 0) == PLCTAG_ERR_NOT_FOUND);
+    assert(tag_index_find(index, data, "", -1, 0) == PLCTAG_ERR_NOT_FOUND);
+
+    /* the name lookup respects the type and the start offset. */
+    assert(tag_index_find(index, data, "Zed", 0xC4, 0) == offsets[4]);
+    assert(tag_index_find(index, data, "Zed", 0xCA, 0) == PLCTAG_ERR_NOT_FOUND);
+    assert(tag_index_find(index, data, "Zed", -1, offsets[4] + 1) == PLCTAG_ERR_NOT_FOUND);
+
+    /* any entry at or after an offset. */
+    assert(tag_index_find(index, data, NULL, -1, 0) == offsets[0]);
+    assert(tag_index_find(index, data, NULL, -1, offsets[1] + 1) == offsets[2]);
+    assert(tag_index_find(index, data, NULL, -1, offsets[5]) == offsets[5]);
+    assert(tag_index_find(index, data, NULL, -1, size) == PLCTAG_ERR_NOT_FOUND);
+
+    /* walk the entries of one type in order. */
+    offset = tag_index_find(index, data, NULL, 0xC4, 0);
+    assert(offset == offsets[0]);
+    offset = tag_index_find(index, data, NULL, 0xC4, offset + 1);
+    assert(offset == offsets[2]);
+    offset = tag_index_find(index, data, NULL, 0xC4, offset + 1);
+    assert(offset == offsets[4]);
+    assert(tag_index_find(index, data, NULL, 0xC4, offset + 1) == PLCTAG_ERR_NOT_FOUND);
+
+    /* starting in the middle of a run of other types. */
+    assert(tag_index_find(index, data, NULL, 0xCA, 0) == offsets[3]);
+    assert(tag_index_find(index, data, NULL, 0xC3, offsets[1]) == offsets[5]);
+    assert(tag_index_find(index, data, NULL, 0xD3, 0) == PLCTAG_ERR_NOT_FOUND);
+
+    rc_dec(index);
+
+    pdebug(DEBUG_INFO,"Done.");
+
+    return 0;
+}
@@ -0,0 +1,153 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <assert.h>
+#include <string.h>
+#include "../../lib/libplctag.h"
+#include "../../protocols/ab/defs.h"
+#include "../../protocols/ab/udt.h"
+#include "../../util/debug.h"
+#include "../../util/rc.h"
+
+#define UDT_SIZE (36)
+#define UDT_COUNT (3)
+
+/*
+ * Build the raw template data for a UDT with these members:
+ *
+ * Flag   BOOL, bit 3 of the byte at offset 0
+ * Count  DINT at offset 4
+ * Arr    DINT[5] at offset 8
+ * Bits   BOOL[64] packed in DWORD[2] at offset 28
+ */
+
+static int build_template(uint8_t *data)
+{
+    const uint16_t info[] = { 3, 0, 5, 2 };
+    const uint16_t type[] = { AB_CIP_DATA_BIT, AB_CIP_DATA_DINT, AB_UDT_MEMBER_ARRAY | AB_CIP_DATA_DINT, AB_UDT_MEMBER_ARRAY | AB_CIP_DATA_DWORD };
+    const uint32_t offset[] = { 0, 4, 8, 28 };
+    const char *names[] = { "MyUDT;n1234", "Flag", "Count", "Arr", "Bits" };
+    int size = 0;
+
+    for(int i=0; i < 4; i++) {
+        data[size++] = (uint8_t)(info[i] & 0xFF);
+        data[size++] = (uint8_t)(info[i] >> 8);
+        data[size++] = (uint8_t)(type[i] & 0xFF);
+        data[size++] = (uint8_t)(type[i] >> 8);
+
+        for(int b=0; b < 4; b++) {
+            data[size++] = (uint8_t)((offset[i] >> (8 * b)) & 0xFF);
+        }
+    }
+
+    for(int i=0; i < 5; i++) {
+        int len = (int)strlen(names[i]) + 1;
+
+        memcpy(&data[size], names[i], (size_t)len);
+        size += len;
+    }
+
+    return size;
+}
+
+
+static void check_member(ab_udt_p udt, const char *path, int data_size, int expected_rc, int expected_offset, int expected_bit)
+{
+    int offset = -1;
+    int bit_num = -2;
+    int rc = udt_find_member(NULL, udt, path, data_size, &offset, &bit_num);
+
+    pdebug(DEBUG_INFO, "Path \"%s\" got %s, offset %d and bit %d.", path, plc_tag_decode_error(rc), offset, bit_num);
+
+    assert(rc == expected_rc);
+
+    if(rc == PLCTAG_STATUS_OK) {
+        assert(offset == expected_offset);
+        assert(bit_num == expected_bit);
+    }
+}
+
+
+int main(int argc, const char **argv)
+{
+    uint8_t data[256];
+    int data_size = 0;
+    ab_udt_p udt = NULL;
+
+    (void)argc;
+    (void)argv;
+
+    pdebug(DEBUG_INFO,"Starting UDT tests.");
+
+    data_size = build_template(data);
+
+    /* short data must not parse. */
+    assert(udt_create(7, 0xABCD, UDT_SIZE, 4, data, 16) == NULL);
+    assert(udt_create(7, 0xABCD, UDT_SIZE, 4, data, data_size - 1) == NULL);
+
+    udt = udt_create(7, 0xABCD, UDT_SIZE, 4, data, data_size);
+    assert(udt != NULL);
+    assert(strcmp(udt->name, "MyUDT") == 0);
+    assert(strcmp(udt->members[3].name, "Bits") == 0);
+
+    /* plain members, names do not care about case. */
+    check_member(udt, "Flag", UDT_SIZE, PLCTAG_STATUS_OK, 0, 3);
+    check_member(udt, "count", UDT_SIZE, PLCTAG_STATUS_OK, 4, -1);
+    check_member(udt, "Nope", UDT_SIZE, PLCTAG_ERR_NOT_FOUND, 0, 0);
+
+    /* array members and BOOL arrays. */
+    check_member(udt, "Arr[2]", UDT_SIZE, PLCTAG_STATUS_OK, 16, -1);
+    check_member(udt, "Arr[5]", UDT_SIZE, PLCTAG_ERR_OUT_OF_BOUNDS, 0, 0);
+    check_member(udt, "Count[0]", UDT_SIZE, PLCTAG_ERR_BAD_PARAM, 0, 0);
+    check_member(udt, "Bits[37]", UDT_SIZE, PLCTAG_STATUS_OK, 32, 5);
+    check_member(udt, "Bits[64]", UDT_SIZE, PLCTAG_ERR_OUT_OF_BOUNDS, 0, 0);
+
+    /* bits of integer members. */
+    check_member(udt, "Count.17", UDT_SIZE, PLCTAG_STATUS_OK, 6, 1);
+    check_member(udt, "Count.32", UDT_SIZE, PLCTAG_ERR_BAD_PARAM, 0, 0);
+    check_member(udt, "Flag.1", UDT_SIZE, PLCTAG_ERR_BAD_PARAM, 0, 0);
+
+    /* members of an element of an array of the UDT. */
+    check_member(udt, "[2].Arr[1]", UDT_SIZE * UDT_COUNT, PLCTAG_STATUS_OK, (2 * UDT_SIZE) + 12, -1);
+    check_member(udt, "[3].Count", UDT_SIZE * UDT_COUNT, PLCTAG_ERR_OUT_OF_BOUNDS, 0, 0);
+
+    /* the final offset must be inside the data. */
+    check_member(udt, "[1].Count", UDT_SIZE, PLCTAG_ERR_OUT_OF_BOUNDS, 0, 0);
+    check_member(udt, "Arr[4]", 20, PLCTAG_ERR_OUT_OF_BOUNDS, 0, 0);
+
+    rc_dec(udt);
+
+    pdebug(DEBUG_INFO,"Done.");
+
+    return 0;
+}